@@ -32,6 +32,9 @@ if [ -n "$focused" ]; then
   # Get invert_color_force property of the window
   dbus-send --print-reply --dest="$service" "$object" "${interface}.win_get" "${type_win}:${focused}" string:invert_color_force
 
+  # Get several properties of the window at once, more windows can be listed
+  dbus-send --print-reply --dest="$service" "$object" "${interface}.win_get_many" "array:${type_win}:${focused}" array:string:class_general,opacity,focused_raw
+
   # Set the window to have inverted color
   dbus-send --print-reply --dest="$service" "$object" "${interface}.win_set" "${type_win}:${focused}" string:invert_color_force "${type_enum}:1"
 else
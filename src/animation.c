@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <math.h>
+
+#include <test.h>
+
+#include "animation.h"
+
+double animation_curve_apply(enum animation_curve curve, double progress) {
+	switch (curve) {
+	case ANIMATION_CURVE_EASE_IN: return progress * progress * progress;
+	case ANIMATION_CURVE_EASE_OUT: return 1 - pow(1 - progress, 3);
+	case ANIMATION_CURVE_EASE_IN_OUT:
+		if (progress < 0.5) {
+			return 4 * progress * progress * progress;
+		}
+		return 1 - pow(-2 * progress + 2, 3) / 2;
+	case ANIMATION_CURVE_LINEAR:
+	case ANIMATION_CURVE_INVALID: break;
+	}
+	return progress;
+}
+
+void animation_start(struct animation *a, double from, double to, uint64_t now,
+                     uint64_t duration, enum animation_curve curve) {
+	a->from = from;
+	a->to = to;
+	a->value = from;
+	a->start = now;
+	a->duration = duration;
+	a->curve = curve;
+}
+
+bool animation_step(struct animation *a, uint64_t now) {
+	double old = a->value;
+	if (now >= a->start + a->duration) {
+		a->value = a->to;
+	} else if (now > a->start) {
+		double progress = (double)(now - a->start) / (double)a->duration;
+		a->value = a->from +
+		           (a->to - a->from) * animation_curve_apply(a->curve, progress);
+	}
+	return a->value != old;
+}
+
+TEST_CASE(animation_step) {
+	struct animation a;
+	animation_start(&a, 0, 1, 1000, 1000, ANIMATION_CURVE_LINEAR);
+	TEST_TRUE(!animation_step(&a, 500));
+	TEST_EQUAL(a.value, 0);
+	TEST_TRUE(animation_step(&a, 1500));
+	TEST_EQUAL(a.value, 0.5);
+	TEST_TRUE(!animation_done(&a));
+	TEST_TRUE(animation_step(&a, 3000));
+	TEST_TRUE(animation_done(&a));
+	TEST_TRUE(!animation_step(&a, 4000));
+
+	animation_start(&a, 1, 0, 0, 1000, ANIMATION_CURVE_EASE_IN_OUT);
+	TEST_TRUE(animation_step(&a, 500));
+	TEST_EQUAL(a.value, 0.5);
+	TEST_TRUE(animation_step(&a, 250));
+	TEST_TRUE(a.value > 0.5);
+
+	for (int i = ANIMATION_CURVE_LINEAR; i < ANIMATION_CURVE_INVALID; i++) {
+		TEST_EQUAL(animation_curve_apply(i, 0), 0);
+		TEST_EQUAL(animation_curve_apply(i, 1), 1);
+	}
+}
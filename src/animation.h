@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "compiler.h"
+
+enum animation_curve {
+	ANIMATION_CURVE_LINEAR = 0,
+	ANIMATION_CURVE_EASE_IN,
+	ANIMATION_CURVE_EASE_OUT,
+	ANIMATION_CURVE_EASE_IN_OUT,
+	ANIMATION_CURVE_INVALID,
+};
+
+/// A value moving from one number to another over a period of time.
+///
+/// Animations don't run by themselves, they are stepped once per frame, to the time
+/// the frame is going to be shown. All times are in microseconds.
+struct animation {
+	double from, to;
+	/// Value as of the last step
+	double value;
+	uint64_t start, duration;
+	enum animation_curve curve;
+};
+
+/// Map the progress of an animation, between 0 and 1, through an easing curve
+double attr_const animation_curve_apply(enum animation_curve curve, double progress);
+
+/// Start animating from `from` to `to`, the value is `from` at `now`
+void animation_start(struct animation *a, double from, double to, uint64_t now,
+                     uint64_t duration, enum animation_curve curve);
+
+/// Advance the animation to `now`. Returns whether the value changed.
+bool animation_step(struct animation *a, uint64_t now);
+
+/// Whether the animation has reached its destination
+static inline bool animation_done(const struct animation *a) {
+	return a->value == a->to;
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <test.h>
+
+#include "arena.h"
+#include "utils.h"
+
+thread_local struct arena tls_scratch;
+
+/// Smallest buffer an arena starts with
+#define ARENA_MIN_CAPACITY 4096
+
+void *arena_alloc(struct arena *a, size_t size) {
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+	void *ret;
+	if (a->capacity - a->used >= size) {
+		ret = a->buf + a->used;
+		a->used += size;
+	} else {
+		// Doesn't fit, the buffer is grown to fit everything at the next reset
+		if (a->noverflow == a->overflow_capacity) {
+			a->overflow_capacity = a->overflow_capacity * 2 + 4;
+			a->overflow = crealloc(a->overflow, a->overflow_capacity);
+		}
+		ret = cvalloc(size);
+		a->overflow[a->noverflow++] = (struct arena_overflow){ret, size};
+		a->overflow_size += size;
+	}
+	a->peak = max2(a->peak, a->used + a->overflow_size);
+	return ret;
+}
+
+void arena_rewind(struct arena *a, struct arena_mark mark) {
+	assert(mark.used <= a->used && mark.noverflow <= a->noverflow);
+	while (a->noverflow > mark.noverflow) {
+		auto o = &a->overflow[--a->noverflow];
+		a->overflow_size -= o->size;
+		free(o->ptr);
+	}
+	a->used = mark.used;
+}
+
+void arena_reset(struct arena *a) {
+	arena_rewind(a, (struct arena_mark){0});
+	if (a->peak > a->capacity) {
+		size_t capacity = max2(a->capacity, (size_t)ARENA_MIN_CAPACITY);
+		while (capacity < a->peak) {
+			capacity *= 2;
+		}
+		free(a->buf);
+		a->buf = cvalloc(capacity);
+		a->capacity = capacity;
+	}
+	a->peak = 0;
+}
+
+void arena_deinit(struct arena *a) {
+	arena_rewind(a, (struct arena_mark){0});
+	free(a->buf);
+	free(a->overflow);
+	memset(a, 0, sizeof(*a));
+}
+
+TEST_CASE(arena) {
+	struct arena a = {0};
+	auto p1 = arena_new(&a, int, 100);
+	auto mark = arena_mark(&a);
+	auto p2 = arena_new(&a, char, 1);
+	TEST_TRUE(p1 && p2 && p1 != (int *)p2);
+	TEST_EQUAL(a.noverflow, 2);
+	arena_rewind(&a, mark);
+	TEST_EQUAL(a.noverflow, 1);
+
+	// Everything fits after a reset
+	arena_reset(&a);
+	TEST_TRUE(a.capacity >= 100 * sizeof(int));
+	p1 = arena_new(&a, int, 100);
+	mark = arena_mark(&a);
+	p2 = arena_new(&a, char, 1);
+	TEST_EQUAL(a.noverflow, 0);
+	TEST_EQUAL((uintptr_t)p2 % alignof(max_align_t), 0);
+	arena_rewind(&a, mark);
+	TEST_EQUAL(a.used, mark.used);
+	arena_deinit(&a);
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+#include <stddef.h>
+
+#include "compiler.h"
+
+struct arena_overflow {
+	void *ptr;
+	size_t size;
+};
+
+/// A bump allocator for scratch memory that doesn't outlive a frame. Memory is given
+/// back either in LIFO order with arena_rewind, or all at once with arena_reset at the
+/// end of a frame. The buffer is kept, and grown to what the busiest frame needed, so
+/// in the steady state allocating from an arena doesn't call malloc.
+struct arena {
+	char *buf;
+	size_t capacity;
+	size_t used;
+	/// Allocations that didn't fit in `buf`, they are freed when the arena is rewound
+	/// to before them
+	struct arena_overflow *overflow;
+	int noverflow, overflow_capacity;
+	size_t overflow_size;
+	/// The most memory in use at once since the last reset
+	size_t peak;
+};
+
+/// A point an arena can be rewound to
+struct arena_mark {
+	size_t used;
+	int noverflow;
+};
+
+/// Allocate `size` bytes of uninitialized memory, aligned for any type
+void *attr_malloc arena_alloc(struct arena *a, size_t size);
+
+static inline struct arena_mark arena_mark(const struct arena *a) {
+	return (struct arena_mark){.used = a->used, .noverflow = a->noverflow};
+}
+
+/// Give back everything allocated since `mark` was taken
+void arena_rewind(struct arena *a, struct arena_mark mark);
+
+/// Give back everything, and make room for as much as was used at once since the last
+/// reset
+void arena_reset(struct arena *a);
+
+void arena_deinit(struct arena *a);
+
+#define arena_new(a, type, count) ((type *)arena_alloc(a, sizeof(type) * (size_t)(count)))
+
+/// Scratch memory for temporary arrays, e.g. rectangles of regions being built. Reset
+/// after every frame.
+extern thread_local struct arena tls_scratch;
@@ -6,15 +6,33 @@
 #include "utils.h"
 #include "log.h"
 
-static inline void *atom_getter(void *ud, const char *atom_name, int *err) {
-	xcb_connection_t *c = ud;
-	xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(
-	    c, xcb_intern_atom(c, 0, to_u16_checked(strlen(atom_name)), atom_name), NULL);
+/// Remember the name of an atom in the reverse index
+static inline void atom_add_name(struct atom *a, xcb_atom_t atom, const char *name,
+                                 size_t len) {
+	if (atom != XCB_NONE && !icache_get(a->names, atom, NULL)) {
+		icache_set(a->names, atom, (uintptr_t)strndup(name, len));
+	}
+}
+
+static inline void *atom_request(void *ud, const char *atom_name) {
+	struct atom *a = ud;
+	xcb_intern_atom_cookie_t cookie =
+	    xcb_intern_atom(a->conn, 0, to_u16_checked(strlen(atom_name)), atom_name);
+	return (void *)(uintptr_t)cookie.sequence;
+}
+
+static inline void *
+atom_collect(void *ud, const char *atom_name, void *request, int *err) {
+	struct atom *a = ud;
+	xcb_intern_atom_cookie_t cookie = {.sequence = (unsigned int)(uintptr_t)request};
+	xcb_intern_atom_reply_t *reply =
+	    X_REPLY(xcb_intern_atom_reply(a->conn, cookie, NULL));
 
 	xcb_atom_t atom = XCB_NONE;
 	if (reply) {
 		log_debug("Atom %s is %d", atom_name, reply->atom);
 		atom = reply->atom;
+		atom_add_name(a, atom, atom_name, strlen(atom_name));
 		free(reply);
 	} else {
 		log_error("Failed to intern atoms");
@@ -23,12 +41,92 @@ static inline void *atom_getter(void *ud, const char *atom_name, int *err) {
 	return (void *)(intptr_t)atom;
 }
 
+static inline void *atom_getter(void *ud, const char *atom_name, int *err) {
+	return atom_collect(ud, atom_name, atom_request(ud, atom_name), err);
+}
+
+void prefetch_atoms(struct atom *a, const char *const *names, size_t n) {
+	cache_warm(a->c, names, n, atom_request, atom_collect);
+}
+
+static void *atom_name_request(void *ud, uint64_t atom) {
+	struct atom *a = ud;
+	xcb_get_atom_name_cookie_t cookie = xcb_get_atom_name(a->conn, (xcb_atom_t)atom);
+	return (void *)(uintptr_t)cookie.sequence;
+}
+
+static uint64_t
+atom_name_collect(void *ud, uint64_t atom attr_unused, void *request, int *err) {
+	struct atom *a = ud;
+	xcb_get_atom_name_cookie_t cookie = {
+	    .sequence = (unsigned int)(uintptr_t)request,
+	};
+	xcb_get_atom_name_reply_t *reply =
+	    X_REPLY(xcb_get_atom_name_reply(a->conn, cookie, NULL));
+	if (!reply) {
+		*err = 1;
+		return 0;
+	}
+	char *name = strndup(xcb_get_atom_name_name(reply),
+	                     (size_t)xcb_get_atom_name_name_length(reply));
+	free(reply);
+	return (uintptr_t)name;
+}
+
+void prefetch_atom_names(struct atom *a, const xcb_atom_t *atoms, size_t n) {
+	auto keys = ccalloc(n, uint64_t);
+	size_t nkeys = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (atoms[i] != XCB_NONE) {
+			keys[nkeys++] = atoms[i];
+		}
+	}
+	icache_warm(a->names, keys, nkeys, atom_name_request, atom_name_collect, a);
+	free(keys);
+}
+
+const char *get_atom_name(struct atom *a, xcb_atom_t atom) {
+	if (atom == XCB_NONE) {
+		return NULL;
+	}
+	uint64_t name;
+	if (!icache_get(a->names, atom, &name)) {
+		prefetch_atom_names(a, &atom, 1);
+		if (!icache_get(a->names, atom, &name)) {
+			return NULL;
+		}
+	}
+	return (const char *)(uintptr_t)name;
+}
+
+static void atom_name_free(void *ud attr_unused, uint64_t name) {
+	free((char *)(uintptr_t)name);
+}
+
+void destroy_atoms(struct atom *a) {
+	cache_free(a->c);
+	icache_free(a->names, atom_name_free, NULL);
+	free(a);
+}
+
 /**
  * Create a new atom structure and fetch all predefined atoms
  */
 struct atom *init_atoms(xcb_connection_t *c) {
 	auto atoms = ccalloc(1, struct atom);
-	atoms->c = new_cache((void *)c, atom_getter, NULL);
+	atoms->conn = c;
+	atoms->names = new_icache();
+	atoms->c = new_cache(atoms, atom_getter, NULL);
+
+	// Send all the requests before waiting for any of the replies
+#define ATOM_NAME(x) #x
+	static const char *const names[] = {
+	    LIST_APPLY(ATOM_NAME, SEP_COMMA, ATOM_LIST1),
+	    LIST_APPLY(ATOM_NAME, SEP_COMMA, ATOM_LIST2),
+	};
+#undef ATOM_NAME
+	prefetch_atoms(atoms, names, ARR_SIZE(names));
+
 #define ATOM_GET(x) atoms->a##x = (xcb_atom_t)(intptr_t)cache_get(atoms->c, #x, NULL)
 	LIST_APPLY(ATOM_GET, SEP_COLON, ATOM_LIST1);
 	LIST_APPLY(ATOM_GET, SEP_COLON, ATOM_LIST2);
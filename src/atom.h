@@ -44,24 +44,37 @@
 	_NET_WM_STATE_FULLSCREEN, \
 	_NET_WM_BYPASS_COMPOSITOR, \
 	UTF8_STRING, \
-	C_STRING
+	C_STRING, \
+	_XROOTPMAP_ID, \
+	_XSETROOT_ID
 // clang-format on
 
 #define ATOM_DEF(x) xcb_atom_t a##x
 
 struct atom {
+	xcb_connection_t *conn;
 	struct cache *c;
+	/// Reverse index, from atoms to their names
+	struct icache *names;
 	LIST_APPLY(ATOM_DEF, SEP_COLON, ATOM_LIST1);
 	LIST_APPLY(ATOM_DEF, SEP_COLON, ATOM_LIST2);
 };
 
 struct atom *init_atoms(xcb_connection_t *);
 
+/// Intern many atoms at once, so they only cost one round-trip. Following `get_atom`
+/// calls for these names won't talk to the X server.
+void prefetch_atoms(struct atom *a, const char *const *names, size_t n);
+
 static inline xcb_atom_t get_atom(struct atom *a, const char *key) {
 	return (xcb_atom_t)(intptr_t)cache_get(a->c, key, NULL);
 }
 
-static inline void destroy_atoms(struct atom *a) {
-	cache_free(a->c);
-	free(a);
-}
+/// Get the name of an atom, NULL if it can't be fetched. The name is owned by `a`.
+const char *get_atom_name(struct atom *a, xcb_atom_t atom);
+
+/// Fetch the names of many atoms at once, so following `get_atom_name` calls for them
+/// won't talk to the X server.
+void prefetch_atom_names(struct atom *a, const xcb_atom_t *atoms, size_t n);
+
+void destroy_atoms(struct atom *a);
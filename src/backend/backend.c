@@ -17,6 +17,9 @@ extern struct backend_operations xrender_ops, dummy_ops;
 #ifdef CONFIG_OPENGL
 extern struct backend_operations glx_ops;
 #endif
+#ifdef CONFIG_EGL
+extern struct backend_operations egl_ops;
+#endif
 
 struct backend_operations *backend_list[NUM_BKEND] = {
     [BKEND_XRENDER] = &xrender_ops,
@@ -24,6 +27,9 @@ struct backend_operations *backend_list[NUM_BKEND] = {
 #ifdef CONFIG_OPENGL
     [BKEND_GLX] = &glx_ops,
 #endif
+#ifdef CONFIG_EGL
+    [BKEND_EGL] = &egl_ops,
+#endif
 };
 
 /**
@@ -53,16 +59,370 @@ region_t get_damage(session_t *ps, bool all_damage) {
 	return region;
 }
 
+/// Compose the shadow of a window whose shadow image is a copy of the shadow template,
+/// piece by piece, see shadow_template_slice
+static void compose_shadow_from_template(session_t *ps, struct managed_win *w,
+                                         const region_t *reg_shadow,
+                                         const region_t *reg_visible) {
+	int band = ps->gaussian_map->w - 1;
+	int x = w->g.x + w->shadow_dx, y = w->g.y + w->shadow_dy;
+	int nx = shadow_template_slice_count(w->widthb, band),
+	    ny = shadow_template_slice_count(w->heightb, band);
+	region_t reg_slice;
+	pixman_region32_init(&reg_slice);
+	for (int i = 0; i < nx; i++) {
+		auto sx = shadow_template_slice(w->widthb, band, i);
+		for (int j = 0; j < ny; j++) {
+			auto sy = shadow_template_slice(w->heightb, band, j);
+			pixman_region32_intersect_rect(&reg_slice, (region_t *)reg_shadow,
+			                               x + sx.start, y + sy.start,
+			                               (uint)(sx.end - sx.start),
+			                               (uint)(sy.end - sy.start));
+			if (!pixman_region32_not_empty(&reg_slice)) {
+				continue;
+			}
+			ps->backend_data->ops->compose(ps->backend_data, w->shadow_image,
+			                               x + sx.offset, y + sy.offset,
+			                               &reg_slice, reg_visible);
+		}
+	}
+	pixman_region32_fini(&reg_slice);
+}
+
+/// Let the backend know the content of the window image has changed since the last
+/// paint, so it can drop what it derived from the old content.
+static void win_image_content_changed(session_t *ps, struct managed_win *w) {
+	if (!w->content_changed) {
+		return;
+	}
+	w->content_changed = false;
+	if (!w->win_image) {
+		return;
+	}
+	// The damage of the window is clipped to what's visible, and dropped while it's
+	// hidden, so it can't tell where the content changed
+	region_t reg_changed;
+	pixman_region32_init_rect(&reg_changed, 0, 0, (uint)w->widthb, (uint)w->heightb);
+	ps->backend_data->ops->image_op(ps->backend_data, IMAGE_OP_CONTENT_CHANGED,
+	                                w->win_image, &reg_changed, &reg_changed, NULL);
+	pixman_region32_fini(&reg_changed);
+}
+
+/// Drop the parts of the blurred backgrounds kept for the windows, that might have been
+/// changed by the damage since the last paint, and tell the backend which window images
+/// have changed. Then start tracking the damage anew.
+static void invalidate_blur_caches(session_t *ps) {
+	bool use_cache = ps->o.blur_method != BLUR_METHOD_NONE &&
+	                 ps->backend_data->ops->copy_area &&
+	                 ps->backend_data->ops->get_blur_size;
+	int blur_width = 0, blur_height = 0;
+	if (use_cache) {
+		ps->backend_data->ops->get_blur_size(ps->backend_blur_context,
+		                                     &blur_width, &blur_height);
+	}
+
+	// What might have changed behind the current window
+	region_t reg_changed;
+	pixman_region32_init(&reg_changed);
+	pixman_region32_copy(&reg_changed, &ps->background_damage);
+	pixman_region32_clear(&ps->background_damage);
+
+	// We don't know where windows that are not painted are in the paint order, so
+	// assume they are behind everything
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		if (!w->to_paint) {
+			win_image_content_changed(ps, w);
+			pixman_region32_union(&reg_changed, &reg_changed,
+			                      &w->content_damage);
+			pixman_region32_clear(&w->content_damage);
+			win_release_blur_cache(ps->backend_data, w);
+		}
+	}
+
+	for (int i = 0; i < ps->npaint_list; i++) {
+		auto e = &ps->paint_list[i];
+		auto w = e->w;
+		auto cache = &w->blur_cache;
+		if (!cache->image) {
+			// Nothing to invalidate
+		} else if (!use_cache || !e->blur_background || cache->x != e->x ||
+		           cache->y != e->y || cache->width != e->widthb ||
+		           cache->height != e->heightb) {
+			win_release_blur_cache(ps->backend_data, w);
+		} else {
+			// Blurred pixels depend on what's within the blur size
+			region_t reg_stale =
+			    resize_region(&reg_changed, blur_width, blur_height);
+			pixman_region32_subtract(&cache->valid, &cache->valid,
+			                         &reg_stale);
+			pixman_region32_fini(&reg_stale);
+		}
+
+		// Content of this window is behind the windows above it
+		win_image_content_changed(ps, w);
+		pixman_region32_union(&reg_changed, &reg_changed, &w->content_damage);
+		pixman_region32_clear(&w->content_damage);
+	}
+	pixman_region32_fini(&reg_changed);
+}
+
+/// Blur the background of a window. Where the blurred background kept from earlier
+/// frames is still valid, it's reused instead. Newly blurred parts are copied into
+/// the cache.
+static void
+blur_window_background(session_t *ps, struct managed_win *w, double opacity,
+                       const region_t *reg_blur, const region_t *reg_visible) {
+	auto backend = ps->backend_data;
+	if (!backend->ops->copy_area) {
+		backend->ops->blur(backend, opacity, ps->backend_blur_context, reg_blur,
+		                   reg_visible);
+		return;
+	}
+
+	auto cache = &w->blur_cache;
+	region_t reg_reuse, reg_fresh;
+	pixman_region32_init(&reg_reuse);
+	pixman_region32_init(&reg_fresh);
+	pixman_region32_intersect(&reg_reuse, &cache->valid, (region_t *)reg_blur);
+	pixman_region32_subtract(&reg_fresh, (region_t *)reg_blur, &reg_reuse);
+
+	// The blur reads from around the blurred region, so blur first, before the
+	// reused part is composed on top of what's behind the window
+	if (pixman_region32_not_empty(&reg_fresh)) {
+		bool blurred = backend->ops->blur(
+		    backend, opacity, ps->backend_blur_context, &reg_fresh, reg_visible);
+		// Pixels blurred with opacity are blended with what's behind, they can't
+		// be reused. And only the visible part is guaranteed to be blurred.
+		if (blurred && opacity == 1) {
+			pixman_region32_intersect(&reg_fresh, &reg_fresh,
+			                          (region_t *)reg_visible);
+			void *image =
+			    backend->ops->copy_area(backend, cache->image, w->g.x, w->g.y,
+			                            w->widthb, w->heightb, &reg_fresh);
+			if (image) {
+				cache->image = image;
+				cache->x = w->g.x;
+				cache->y = w->g.y;
+				cache->width = w->widthb;
+				cache->height = w->heightb;
+				pixman_region32_union(&cache->valid, &cache->valid,
+				                      &reg_fresh);
+			} else {
+				win_release_blur_cache(backend, w);
+			}
+		}
+	}
+
+	if (pixman_region32_not_empty(&reg_reuse)) {
+		backend->ops->set_image_property(backend, IMAGE_PROPERTY_OPACITY,
+		                                 cache->image, &opacity);
+		backend->ops->compose(backend, cache->image, cache->x, cache->y,
+		                      &reg_reuse, reg_visible);
+	}
+	pixman_region32_fini(&reg_reuse);
+	pixman_region32_fini(&reg_fresh);
+}
+
+/// Paint the wallpaper. A wallpaper that has to be tiled or scaled to cover the screen is
+/// copied into a screen sized image as it's painted, and painted from there where the
+/// copy is valid, so it's not tiled again every frame.
+static void
+paint_root_image(session_t *ps, const region_t *reg_paint, const region_t *reg_visible) {
+	auto backend = ps->backend_data;
+	if (!ps->root_image_tiled || !backend->ops->copy_area) {
+		backend->ops->compose(backend, ps->root_image, 0, 0, reg_paint, reg_visible);
+		return;
+	}
+
+	region_t reg_reuse, reg_fresh;
+	pixman_region32_init(&reg_reuse);
+	pixman_region32_init(&reg_fresh);
+	pixman_region32_intersect(&reg_reuse, &ps->root_cache_valid, (region_t *)reg_paint);
+	pixman_region32_subtract(&reg_fresh, (region_t *)reg_paint, &reg_reuse);
+
+	if (pixman_region32_not_empty(&reg_fresh)) {
+		backend->ops->compose(backend, ps->root_image, 0, 0, &reg_fresh, reg_visible);
+		// Nothing else has been painted yet, what's visible of the wallpaper can be
+		// copied as is
+		pixman_region32_intersect(&reg_fresh, &reg_fresh, (region_t *)reg_visible);
+		void *image = backend->ops->copy_area(backend, ps->root_cache, 0, 0,
+		                                      ps->root_width, ps->root_height,
+		                                      &reg_fresh);
+		if (image) {
+			ps->root_cache = image;
+			pixman_region32_union(&ps->root_cache_valid, &ps->root_cache_valid,
+			                      &reg_fresh);
+		}
+	}
+
+	if (pixman_region32_not_empty(&reg_reuse)) {
+		backend->ops->compose(backend, ps->root_cache, 0, 0, &reg_reuse, reg_visible);
+	}
+	pixman_region32_fini(&reg_reuse);
+	pixman_region32_fini(&reg_fresh);
+}
+
+/// Expand the damage to include everything that changes because of blur. And
+/// calculate the region that needs to be painted, which includes what the blur reads
+/// from.
+///
+/// @param reg_damage the damage, it will be expanded in place
+/// @param reg_paint returns the region to paint, must not be initialized
+static void
+expand_damage_for_blur(session_t *ps, region_t *reg_damage, region_t *reg_paint) {
+	int blur_width, blur_height;
+	ps->backend_data->ops->get_blur_size(ps->backend_blur_context, &blur_width,
+	                                     &blur_height);
+
+	int nblurred = 0;
+	for (int i = 0; i < ps->npaint_list; i++) {
+		nblurred += ps->paint_list[i].blur_background;
+	}
+	auto mark = arena_mark(&tls_scratch);
+	auto blur_regions = arena_new(&tls_scratch, region_t, nblurred);
+
+	// The region of screen a given window influences will be smeared out by blur,
+	// once for every blurred window on top of it that the influenced region touches.
+	// So we go from bottom to top, and grow the damage by the blur size, inside the
+	// windows whose background is blurred and is near the damage.
+	region_t reg_expanded = resize_region(reg_damage, blur_width, blur_height);
+	int i = 0;
+	for (int j = 0; j < ps->npaint_list; j++) {
+		if (!ps->paint_list[j].blur_background) {
+			continue;
+		}
+		region_t *reg_blur = &blur_regions[i++];
+		*reg_blur = win_get_bounding_shape_global_by_val(ps->paint_list[j].w);
+
+		region_t reg_tmp;
+		pixman_region32_init(&reg_tmp);
+		pixman_region32_intersect(&reg_tmp, &reg_expanded, reg_blur);
+		pixman_region32_subtract(&reg_tmp, &reg_tmp, reg_damage);
+		if (pixman_region32_not_empty(&reg_tmp)) {
+			pixman_region32_union(reg_damage, reg_damage, &reg_tmp);
+			pixman_region32_fini(&reg_expanded);
+			reg_expanded = resize_region(reg_damage, blur_width, blur_height);
+		}
+		pixman_region32_fini(&reg_tmp);
+	}
+	pixman_region32_fini(&reg_expanded);
+
+	// Blurring requires data slightly outside the area being blurred, that has to
+	// be painted too, with the windows below. So we go from top to bottom, and grow
+	// the paint region by what each blurred window reads from, which in turn might
+	// need more data for the blur of the windows below.
+	pixman_region32_init(reg_paint);
+	pixman_region32_copy(reg_paint, reg_damage);
+	for (i = nblurred - 1; i >= 0; i--) {
+		region_t reg_tmp;
+		pixman_region32_init(&reg_tmp);
+		pixman_region32_intersect(&reg_tmp, &blur_regions[i], reg_paint);
+		if (pixman_region32_not_empty(&reg_tmp)) {
+			resize_region_in_place(&reg_tmp, blur_width, blur_height);
+			pixman_region32_union(reg_paint, reg_paint, &reg_tmp);
+		}
+		pixman_region32_fini(&reg_tmp);
+		pixman_region32_fini(&blur_regions[i]);
+	}
+	arena_rewind(&tls_scratch, mark);
+
+	pixman_region32_intersect(reg_paint, reg_paint, &ps->screen_reg);
+	pixman_region32_intersect(reg_damage, reg_damage, &ps->screen_reg);
+}
+
+/// Simplify the damage of each monitor separately. Merging rectangles of different
+/// monitors could only ever give us bounding boxes spanning the gaps between them, so
+/// the rectangle limit applies per monitor instead.
+///
+/// @return number of pixels added to the damage
+static long simplify_damage(session_t *ps, region_t *damage) {
+	if (ps->nmonitors <= 1) {
+		return region_simplify(damage, ps->o.max_damage_rects,
+		                       ps->o.damage_merge_waste);
+	}
+
+	long extra_pixels = 0;
+	region_t result, part;
+	pixman_region32_init(&result);
+	pixman_region32_init(&part);
+	for (int i = 0; i < ps->nmonitors; i++) {
+		const rect_t *r = &ps->monitors[i].rect;
+		uint width = (uint)(r->x2 - r->x1), height = (uint)(r->y2 - r->y1);
+		pixman_region32_intersect_rect(&part, damage, r->x1, r->y1, width,
+		                               height);
+		if (!pixman_region32_not_empty(&part)) {
+			continue;
+		}
+		// Take the part out, so overlapping (e.g. mirrored) monitors don't get
+		// the same damage twice
+		pixman_region32_subtract(damage, damage, &part);
+		extra_pixels += region_simplify(&part, ps->o.max_damage_rects,
+		                                ps->o.damage_merge_waste);
+		pixman_region32_union(&result, &result, &part);
+	}
+	// Whatever is left is not on any monitor, but it's still part of the screen
+	extra_pixels +=
+	    region_simplify(damage, ps->o.max_damage_rects, ps->o.damage_merge_waste);
+	pixman_region32_union(damage, damage, &result);
+	pixman_region32_fini(&part);
+	pixman_region32_fini(&result);
+	return extra_pixels;
+}
+
+/// Find the window to present directly instead of compositing the frame, which is
+/// possible if it is the only thing visible and it is shown without any changes.
+static struct win_paint_entry *direct_present_candidate(session_t *ps) {
+	if (!ps->backend_data->ops->present_image || !ps->npaint_list ||
+	    ps->o.monitor_repaint || ps->o.force_win_blend) {
+		return NULL;
+	}
+
+	// The paint list is sorted from bottom to top
+	auto e = &ps->paint_list[ps->npaint_list - 1];
+	auto w = e->w;
+	if (e->mode != WMODE_SOLID || e->opacity != 1 || e->shadow ||
+	    e->blur_background) {
+		return NULL;
+	}
+	if (w->state != WSTATE_MAPPED || w->bounding_shaped || w->corner_radius > 0 ||
+	    w->dim_level > 0 || w->invert_color || w->frame_opacity != 1) {
+		return NULL;
+	}
+	if (e->x != 0 || e->y != 0 || e->widthb != ps->root_width ||
+	    e->heightb != ps->root_height) {
+		return NULL;
+	}
+	return e;
+}
+
+/// Move the head of the damage ring, called once a frame has been presented
+static void advance_damage_ring(session_t *ps) {
+	ps->damage = ps->damage - 1;
+	if (ps->damage < ps->damage_ring) {
+		ps->damage = ps->damage_ring + ps->ndamage - 1;
+	}
+	pixman_region32_clear(ps->damage);
+}
+
 /// paint all windows
-void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
-	if (ps->o.xrender_sync_fence) {
-		if (ps->xsync_exists && !x_fence_sync(ps->c, ps->sync_fence)) {
-			log_error("x_fence_sync failed, xrender-sync-fence will be "
-			          "disabled from now on.");
-			xcb_sync_destroy_fence(ps->c, ps->sync_fence);
-			ps->sync_fence = XCB_NONE;
-			ps->o.xrender_sync_fence = false;
-			ps->xsync_exists = false;
+void paint_all_new(session_t *ps, bool ignore_damage) {
+	auto ft = ps->frame_timing;
+	auto timing_start = frame_timing_now(ft);
+	if (ps->o.xrender_sync_fence && ps->xsync_exists) {
+		// Make sure the X rendering requested so far, e.g. by the clients into
+		// their windows, is done before it's used. No round trips, errors are
+		// handled by ev_xcb_error.
+		auto fence = x_fence_ring_trigger(ps->c, &ps->sync_fences);
+		// The GPU may wait on the fence, the server has to be told to trigger
+		// it first
+		xcb_flush(ps->c);
+		auto ops = ps->backend_data->ops;
+		if (!ops->wait_x_fence) {
+			x_fence_ring_await(ps->c, &ps->sync_fences);
+		} else if (!ops->wait_x_fence(ps->backend_data, fence)) {
+			// The backend doesn't render through X, so the CPU has to wait
+			x_fence_ring_await(ps->c, &ps->sync_fences);
+			x_sync(ps->c);
 		}
 	}
 	// All painting will be limited to the damage, if _some_ of
@@ -75,12 +435,50 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 		pixman_region32_init(&reg_damage);
 		pixman_region32_copy(&reg_damage, &ps->screen_reg);
 	}
+	invalidate_blur_caches(ps);
 
 	if (!pixman_region32_not_empty(&reg_damage)) {
 		pixman_region32_fini(&reg_damage);
 		return;
 	}
 
+	// A single opaque window covering the whole screen doesn't need to be
+	// composited, saving a full screen copy per frame
+	auto direct = direct_present_candidate(ps);
+	if (direct) {
+		// The properties could be left over from an earlier frame
+		double dim_opacity = 0.0;
+		ps->backend_data->ops->set_image_property(
+		    ps->backend_data, IMAGE_PROPERTY_MAX_BRIGHTNESS, direct->win_image,
+		    &ps->o.max_brightness);
+		ps->backend_data->ops->set_image_property(
+		    ps->backend_data, IMAGE_PROPERTY_INVERTED, direct->win_image,
+		    &direct->w->invert_color);
+		ps->backend_data->ops->set_image_property(
+		    ps->backend_data, IMAGE_PROPERTY_DIM_LEVEL, direct->win_image,
+		    &dim_opacity);
+		ps->backend_data->ops->set_image_property(
+		    ps->backend_data, IMAGE_PROPERTY_OPACITY, direct->win_image,
+		    &direct->opacity);
+		auto present_start = trace_now(ps->trace);
+		if (ps->backend_data->ops->present_image(ps->backend_data,
+		                                         direct->win_image)) {
+			log_trace("Presented window %#010x directly", direct->w->base.id);
+			trace_span(ps->trace, "present", present_start,
+			           direct->w->base.id);
+			frame_timing_lap(ft, FRAME_TIMING_PRESENT, &timing_start);
+			advance_damage_ring(ps);
+			pixman_region32_fini(&reg_damage);
+			return;
+		}
+	}
+
+	// Fewer, bigger rectangles are cheaper to paint than many tiny ones
+	int nrects_before = pixman_region32_n_rects(&reg_damage);
+	long extra_pixels = simplify_damage(ps, &reg_damage);
+	log_trace("Damage simplified from %d to %d rectangles, %ld pixels added",
+	          nrects_before, pixman_region32_n_rects(&reg_damage), extra_pixels);
+
 #ifdef DEBUG_REPAINT
 	static struct timespec last_paint = {0};
 #endif
@@ -98,32 +496,7 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	region_t reg_paint;
 	assert(ps->o.blur_method != BLUR_METHOD_INVALID);
 	if (ps->o.blur_method != BLUR_METHOD_NONE && ps->backend_data->ops->get_blur_size) {
-		int blur_width, blur_height;
-		ps->backend_data->ops->get_blur_size(ps->backend_blur_context,
-		                                     &blur_width, &blur_height);
-
-		// The region of screen a given window influences will be smeared
-		// out by blur. With more windows on top of the given window, the
-		// influences region will be smeared out more.
-		//
-		// Also, blurring requires data slightly outside the area that needs
-		// to be blurred. The more semi-transparent windows are stacked on top
-		// of each other, the larger the area will be.
-		//
-		// Instead of accurately calculate how much bigger the damage
-		// region will be because of blur, we assume the worst case here.
-		// That is, the damaged window is at the bottom of the stack, and
-		// all other windows have semi-transparent background
-		int resize_factor = 1;
-		if (t) {
-			resize_factor = t->stacking_rank;
-		}
-		resize_region_in_place(&reg_damage, blur_width * resize_factor,
-		                       blur_height * resize_factor);
-		reg_paint = resize_region(&reg_damage, blur_width * resize_factor,
-		                          blur_height * resize_factor);
-		pixman_region32_intersect(&reg_paint, &reg_paint, &ps->screen_reg);
-		pixman_region32_intersect(&reg_damage, &reg_damage, &ps->screen_reg);
+		expand_damage_for_blur(ps, &reg_damage, &reg_paint);
 	} else {
 		pixman_region32_init(&reg_paint);
 		pixman_region32_copy(&reg_paint, &reg_damage);
@@ -134,14 +507,15 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	region_t reg_visible;
 	pixman_region32_init(&reg_visible);
 	pixman_region32_copy(&reg_visible, &ps->screen_reg);
-	if (t && !ps->o.transparent_clipping) {
+	if (ps->npaint_list && !ps->o.transparent_clipping) {
 		// Calculate the region upon which the root window (wallpaper) is to be
 		// painted based on the ignore region of the lowest window, if available
 		//
 		// NOTE If transparent_clipping is enabled, transparent windows are
 		// included in the reg_ignore, but we still want to have the wallpaper
 		// beneath them, so we don't use reg_ignore for wallpaper in that case.
-		pixman_region32_subtract(&reg_visible, &reg_visible, t->reg_ignore);
+		pixman_region32_subtract(&reg_visible, &reg_visible,
+		                         ps->paint_list[0].reg_ignore);
 	}
 
 	// Region on screen we don't want any shadows on
@@ -153,20 +527,22 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	}
 
 	if (ps->root_image) {
-		ps->backend_data->ops->compose(ps->backend_data, ps->root_image, 0, 0,
-		                               &reg_paint, &reg_visible);
+		paint_root_image(ps, &reg_paint, &reg_visible);
 	} else {
 		ps->backend_data->ops->fill(ps->backend_data, (struct color){0, 0, 0, 1},
 		                            &reg_paint);
 	}
+	frame_timing_lap(ft, FRAME_TIMING_ROOT, &timing_start);
 
 	// Windows are sorted from bottom to top
 	// Each window has a reg_ignore, which is the region obscured by all the windows
 	// on top of that window. This is used to reduce the number of pixels painted.
 	//
 	// Whether this is beneficial is to be determined XXX
-	for (auto w = t; w; w = w->prev_trans) {
-		pixman_region32_subtract(&reg_visible, &ps->screen_reg, w->reg_ignore);
+	for (int i = 0; i < ps->npaint_list; i++) {
+		auto e = &ps->paint_list[i];
+		auto w = e->w;
+		pixman_region32_subtract(&reg_visible, &ps->screen_reg, e->reg_ignore);
 		assert(!(w->flags & WIN_FLAGS_IMAGE_ERROR));
 		assert(!(w->flags & WIN_FLAGS_PIXMAP_STALE));
 		assert(!(w->flags & WIN_FLAGS_PIXMAP_NONE));
@@ -193,46 +569,41 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 		}
 
 		// Blur window background
-		/* TODO(yshui) since the backend might change the content of the window
-		 * (e.g. with shaders), we should consult the backend whether the window
-		 * is transparent or not. for now we will just rely on the force_win_blend
-		 * option */
-		auto real_win_mode = w->mode;
-
-		if (w->blur_background &&
-		    (ps->o.force_win_blend || real_win_mode == WMODE_TRANS ||
-		     (ps->o.blur_background_frame && real_win_mode == WMODE_FRAME_TRANS))) {
+		auto real_win_mode = e->mode;
+
+		if (e->blur_background) {
 			// Minimize the region we try to blur, if the window
 			// itself is not opaque, only the frame is.
 
+			auto blur_start = trace_now(ps->trace);
 			double blur_opacity = 1;
-			if (w->opacity < (1.0 / MAX_ALPHA)) {
+			if (e->opacity < (1.0 / MAX_ALPHA)) {
 				// Hide blur for fully transparent windows.
 				blur_opacity = 0;
 			} else if (w->state == WSTATE_MAPPING) {
 				// Gradually increase the blur intensity during
 				// fading in.
-				assert(w->opacity <= w->opacity_target);
-				blur_opacity = w->opacity / w->opacity_target;
+				assert(e->opacity <= w->opacity_target);
+				blur_opacity = e->opacity / w->opacity_target;
 			} else if (w->state == WSTATE_UNMAPPING ||
 			           w->state == WSTATE_DESTROYING) {
 				// Gradually decrease the blur intensity during
 				// fading out.
-				assert(w->opacity <= w->opacity_target_old);
-				blur_opacity = w->opacity / w->opacity_target_old;
+				assert(e->opacity <= w->opacity_target_old);
+				blur_opacity = e->opacity / w->opacity_target_old;
 			} else if (w->state == WSTATE_FADING) {
-				if (w->opacity < w->opacity_target &&
+				if (e->opacity < w->opacity_target &&
 				    w->opacity_target_old < (1.0 / MAX_ALPHA)) {
 					// Gradually increase the blur intensity during
 					// fading in.
-					assert(w->opacity <= w->opacity_target);
-					blur_opacity = w->opacity / w->opacity_target;
-				} else if (w->opacity > w->opacity_target &&
+					assert(e->opacity <= w->opacity_target);
+					blur_opacity = e->opacity / w->opacity_target;
+				} else if (e->opacity > w->opacity_target &&
 				           w->opacity_target < (1.0 / MAX_ALPHA)) {
 					// Gradually decrease the blur intensity during
 					// fading out.
-					assert(w->opacity <= w->opacity_target_old);
-					blur_opacity = w->opacity / w->opacity_target_old;
+					assert(e->opacity <= w->opacity_target_old);
+					blur_opacity = e->opacity / w->opacity_target_old;
 				}
 			}
 			assert(blur_opacity >= 0 && blur_opacity <= 1);
@@ -240,9 +611,8 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 			if (real_win_mode == WMODE_TRANS || ps->o.force_win_blend) {
 				// We need to blur the bounding shape of the window
 				// (reg_paint_in_bound = reg_bound \cap reg_paint)
-				ps->backend_data->ops->blur(
-				    ps->backend_data, blur_opacity, ps->backend_blur_context,
-				    &reg_paint_in_bound, &reg_visible);
+				blur_window_background(ps, w, blur_opacity,
+				                       &reg_paint_in_bound, &reg_visible);
 			} else {
 				// Window itself is solid, we only need to blur the frame
 				// region
@@ -252,7 +622,7 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 				assert(real_win_mode == WMODE_FRAME_TRANS);
 
 				auto reg_blur = win_get_region_frame_local_by_val(w);
-				pixman_region32_translate(&reg_blur, w->g.x, w->g.y);
+				pixman_region32_translate(&reg_blur, e->x, e->y);
 				// make sure reg_blur \in reg_paint
 				pixman_region32_intersect(&reg_blur, &reg_blur, &reg_paint);
 				if (ps->o.transparent_clipping) {
@@ -260,15 +630,16 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 					pixman_region32_intersect(&reg_blur, &reg_blur,
 					                          &reg_visible);
 				}
-				ps->backend_data->ops->blur(ps->backend_data, blur_opacity,
-				                            ps->backend_blur_context,
-				                            &reg_blur, &reg_visible);
+				blur_window_background(ps, w, blur_opacity, &reg_blur,
+				                       &reg_visible);
 				pixman_region32_fini(&reg_blur);
 			}
+			trace_span(ps->trace, "blur", blur_start, w->base.id);
+			frame_timing_lap(ft, FRAME_TIMING_BLUR, &timing_start);
 		}
 
 		// Draw shadow on target
-		if (w->shadow) {
+		if (e->shadow) {
 			assert(!(w->flags & WIN_FLAGS_SHADOW_NONE));
 			// Clip region for the shadow
 			// reg_shadow \in reg_paint
@@ -308,40 +679,48 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 				                          &reg_visible);
 			}
 
-			assert(w->shadow_image);
+			assert(e->shadow_image);
 			ps->backend_data->ops->set_image_property(
-			    ps->backend_data, IMAGE_PROPERTY_OPACITY, w->shadow_image,
-			    &w->opacity);
-			ps->backend_data->ops->compose(
-			    ps->backend_data, w->shadow_image, w->g.x + w->shadow_dx,
-			    w->g.y + w->shadow_dy, &reg_shadow, &reg_visible);
+			    ps->backend_data, IMAGE_PROPERTY_OPACITY, e->shadow_image,
+			    &e->opacity);
+			if (w->shadow_from_template) {
+				compose_shadow_from_template(ps, w, &reg_shadow,
+				                             &reg_visible);
+			} else {
+				ps->backend_data->ops->compose(
+				    ps->backend_data, e->shadow_image,
+				    e->x + w->shadow_dx, e->y + w->shadow_dy,
+				    &reg_shadow, &reg_visible);
+			}
 			pixman_region32_fini(&reg_shadow);
+			frame_timing_lap(ft, FRAME_TIMING_SHADOW, &timing_start);
 		}
 
 		// Update image properties
 		{
 			double dim_opacity = 0.0;
-			if (w->dim) {
-				dim_opacity = ps->o.inactive_dim;
+			if (w->dim_level > 0) {
+				dim_opacity = w->dim_level;
 				if (!ps->o.inactive_dim_fixed) {
-					dim_opacity *= w->opacity;
+					dim_opacity *= e->opacity;
 				}
 			}
 
 			ps->backend_data->ops->set_image_property(
-			    ps->backend_data, IMAGE_PROPERTY_MAX_BRIGHTNESS, w->win_image,
+			    ps->backend_data, IMAGE_PROPERTY_MAX_BRIGHTNESS, e->win_image,
 			    &ps->o.max_brightness);
 			ps->backend_data->ops->set_image_property(
-			    ps->backend_data, IMAGE_PROPERTY_INVERTED, w->win_image,
+			    ps->backend_data, IMAGE_PROPERTY_INVERTED, e->win_image,
 			    &w->invert_color);
 			ps->backend_data->ops->set_image_property(
-			    ps->backend_data, IMAGE_PROPERTY_DIM_LEVEL, w->win_image,
+			    ps->backend_data, IMAGE_PROPERTY_DIM_LEVEL, e->win_image,
 			    &dim_opacity);
 			ps->backend_data->ops->set_image_property(
-			    ps->backend_data, IMAGE_PROPERTY_OPACITY, w->win_image, &w->opacity);
+			    ps->backend_data, IMAGE_PROPERTY_OPACITY, e->win_image,
+			    &e->opacity);
 		}
 
-		if (w->opacity * MAX_ALPHA < 1) {
+		if (e->opacity * MAX_ALPHA < 1) {
 			// We don't need to paint the window body itself if it's
 			// completely transparent.
 			goto skip;
@@ -357,8 +736,8 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 
 		// Draw window on target
 		if (w->frame_opacity == 1) {
-			ps->backend_data->ops->compose(ps->backend_data, w->win_image,
-			                               w->g.x, w->g.y,
+			ps->backend_data->ops->compose(ps->backend_data, e->win_image,
+			                               e->x, e->y,
 			                               &reg_paint_in_bound, &reg_visible);
 		} else {
 			// For window image processing, we don't have to limit the process
@@ -375,13 +754,13 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 				region_t reg_bound_local;
 				pixman_region32_init(&reg_bound_local);
 				pixman_region32_copy(&reg_bound_local, &reg_bound);
-				pixman_region32_translate(&reg_bound_local, -w->g.x, -w->g.y);
+				pixman_region32_translate(&reg_bound_local, -e->x, -e->y);
 
 				pixman_region32_init(&reg_visible_local);
 				pixman_region32_intersect(&reg_visible_local,
 				                          &reg_visible, &reg_paint);
-				pixman_region32_translate(&reg_visible_local, -w->g.x,
-				                          -w->g.y);
+				pixman_region32_translate(&reg_visible_local, -e->x,
+				                          -e->y);
 				// Data outside of the bounding shape won't be visible,
 				// but it is not necessary to limit the image operations
 				// to the bounding shape yet. So pass that as the visible
@@ -392,14 +771,14 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 			}
 
 			auto new_img = ps->backend_data->ops->clone_image(
-			    ps->backend_data, w->win_image, &reg_visible_local);
+			    ps->backend_data, e->win_image, &reg_visible_local);
 			auto reg_frame = win_get_region_frame_local_by_val(w);
 			ps->backend_data->ops->image_op(
 			    ps->backend_data, IMAGE_OP_APPLY_ALPHA, new_img, &reg_frame,
 			    &reg_visible_local, (double[]){w->frame_opacity});
 			pixman_region32_fini(&reg_frame);
-			ps->backend_data->ops->compose(ps->backend_data, new_img, w->g.x,
-			                               w->g.y, &reg_paint_in_bound,
+			ps->backend_data->ops->compose(ps->backend_data, new_img, e->x,
+			                               e->y, &reg_paint_in_bound,
 			                               &reg_visible);
 			ps->backend_data->ops->release_image(ps->backend_data, new_img);
 			pixman_region32_fini(&reg_visible_local);
@@ -407,6 +786,7 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	skip:
 		pixman_region32_fini(&reg_bound);
 		pixman_region32_fini(&reg_paint_in_bound);
+		frame_timing_lap(ft, FRAME_TIMING_COMPOSE, &timing_start);
 	}
 	pixman_region32_fini(&reg_paint);
 	pixman_region32_fini(&reg_shadow_clip);
@@ -418,18 +798,17 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 		pixman_region32_fini(&reg_damage_debug);
 	}
 
-	// Move the head of the damage ring
-	ps->damage = ps->damage - 1;
-	if (ps->damage < ps->damage_ring) {
-		ps->damage = ps->damage_ring + ps->ndamage - 1;
-	}
-	pixman_region32_clear(ps->damage);
+	advance_damage_ring(ps);
+	frame_timing_lap(ft, FRAME_TIMING_COMPOSE, &timing_start);
 
 	if (ps->backend_data->ops->present) {
 		// Present the rendered scene
 		// Vsync is done here
+		auto present_start = trace_now(ps->trace);
 		ps->backend_data->ops->present(ps->backend_data, &reg_damage);
+		trace_span(ps->trace, "present", present_start, 0);
 	}
+	frame_timing_lap(ft, FRAME_TIMING_PRESENT, &timing_start);
 
 	pixman_region32_fini(&reg_damage);
 
@@ -440,8 +819,9 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	log_trace("[ %5ld:%09ld ] ", diff.tv_sec, diff.tv_nsec);
 	last_paint = now;
 	log_trace("paint:");
-	for (win *w = t; w; w = w->prev_trans)
-		log_trace(" %#010lx", w->id);
+	for (int i = 0; i < ps->npaint_list; i++) {
+		log_trace(" %#010x", ps->paint_list[i].w->base.id);
+	}
 #endif
 }
 
@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "compiler.h"
 #include "config.h"
@@ -25,11 +27,29 @@ typedef struct backend_base {
 	xcb_window_t root;
 	struct ev_loop *loop;
 
-	/// Whether the backend can accept new render request at the moment
+	/// Whether the backend can accept new render request at the moment. If the
+	/// backend sets this, it must call the ready callback once it is ready again.
 	bool busy;
+	/// Estimated memory taken by the images currently alive, in bytes. Backends keep
+	/// it up to date with backend_image_created and backend_image_released.
+	size_t image_bytes;
 	// ...
 } backend_t;
 
+/// Images are assumed to take 4 bytes per pixel, whatever their format is
+static inline size_t backend_image_size(int width, int height) {
+	return (size_t)width * (size_t)height * 4;
+}
+
+static inline void backend_image_created(backend_t *base, int width, int height) {
+	base->image_bytes += backend_image_size(width, height);
+}
+
+static inline void backend_image_released(backend_t *base, int width, int height) {
+	assert(base->image_bytes >= backend_image_size(width, height));
+	base->image_bytes -= backend_image_size(width, height);
+}
+
 typedef void (*backend_ready_callback_t)(void *);
 
 // When image properties are actually applied to the image, they are applied in a
@@ -59,15 +79,23 @@ enum image_properties {
 enum image_operations {
 	// Multiply the alpha channel by the argument
 	IMAGE_OP_APPLY_ALPHA,
+	// The content of the image has changed in reg_op, e.g. the window drew into
+	// its pixmap. Anything the backend derived from the content has to be
+	// computed again. The argument is unused.
+	IMAGE_OP_CONTENT_CHANGED,
 };
 
 struct gaussian_blur_args {
 	int size;
 	double deviation;
+	/// Blur at 1/downscale of the resolution, 1 for full resolution
+	int downscale;
 };
 
 struct box_blur_args {
 	int size;
+	/// Blur at 1/downscale of the resolution, 1 for full resolution
+	int downscale;
 };
 
 struct kernel_blur_args {
@@ -152,6 +180,24 @@ struct backend_operations {
 	             const region_t *reg_blur, const region_t *reg_visible)
 	    attr_nonnull(1, 3, 4, 5);
 
+	/**
+	 * Copy part of the rendering buffer into an opaque image, which can be
+	 * `compose`d later. This is used to keep the blurred background of windows.
+	 *
+	 * Optional
+	 *
+	 * @param backend_data the backend data
+	 * @param image_data   an image returned by a previous call to copy into, or NULL
+	 *                     to create a new `width` x `height` image
+	 * @param x, y         the top left corner of the image in the target
+	 * @param reg_copy     the region to copy, in target coordinates
+	 * @return the image copied into, NULL on failure, in which case `image_data` is
+	 *         left untouched
+	 */
+	void *(*copy_area)(backend_t *backend_data, void *image_data, int x, int y,
+	                   int width, int height, const region_t *reg_copy)
+	    attr_nonnull(1, 7);
+
 	/// Update part of the back buffer with the rendering buffer, then present the
 	/// back buffer onto the target window (if not back buffered, update part of the
 	/// target window directly).
@@ -161,6 +207,20 @@ struct backend_operations {
 	/// @param region part of the target that should be updated
 	void (*present)(backend_t *backend_data, const region_t *region) attr_nonnull(1, 2);
 
+	/// Present an image onto the target window as it is, instead of what has been
+	/// rendered into the back buffer. Used when a single window covers the whole
+	/// screen and nothing needs to be composited with it, so the X server can flip
+	/// to it, or at least copy it only once. After this, the content of the back
+	/// buffers is unknown.
+	///
+	/// Optional
+	///
+	/// @param image_data an image the size of the target, returned by `bind_pixmap`
+	/// @return whether the image has been presented, if not, the frame should be
+	///         rendered as usual
+	bool (*present_image)(backend_t *backend_data, void *image_data)
+	    attr_nonnull(1, 2);
+
 	/**
 	 * Bind a X pixmap to the backend's internal image data structure.
 	 *
@@ -269,20 +329,40 @@ struct backend_operations {
 	void (*get_blur_size)(void *blur_context, int *width, int *height);
 
 	// ===========         Hooks        ============
-	/// Let the backend hook into the event handling queue
-	/// Not implemented yet
-	void (*set_ready_callback)(backend_t *, backend_ready_callback_t cb);
+	/// Set the callback to call when the backend is no longer busy, `data` is passed
+	/// to the callback.
+	/// Optional, only needed if the backend can be busy.
+	void (*set_ready_callback)(backend_t *, backend_ready_callback_t cb, void *data);
 	/// Called right after the core has handled its events.
-	/// Not implemented yet
+	/// Optional.
 	void (*handle_events)(backend_t *);
 	// ===========         Misc         ============
 	/// Return the driver that is been used by the backend
 	enum driver (*detect_driver)(backend_t *backend_data);
 
 	void (*diagnostics)(backend_t *backend_data);
+
+	/// Start or stop measuring how long the GPU takes to render the frames.
+	/// Optional.
+	void (*set_gpu_timing)(backend_t *backend_data, bool enable);
+	/// Get how long the GPU took to render one of the previous frames, in
+	/// nanoseconds, without waiting for the GPU. Optional, only needed if
+	/// `set_gpu_timing` is implemented.
+	///
+	/// @return whether a new measurement is available
+	bool (*gpu_frame_time)(backend_t *backend_data, uint64_t *time);
+
+	/// Make the rendering that follows wait for an X Sync fence to be triggered,
+	/// without blocking the CPU. Optional, backends rendering with X requests
+	/// don't need it, the X server is asked to hold them until the fence is
+	/// triggered.
+	///
+	/// @return false if the backend can't wait for the fence, the caller then has
+	///         to wait on the CPU
+	bool (*wait_x_fence)(backend_t *backend_data, xcb_sync_fence_t fence);
 };
 
 extern struct backend_operations *backend_list[];
 
-void paint_all_new(session_t *ps, struct managed_win *const t, bool ignore_damage)
-    attr_nonnull(1);
+/// Paint the windows paint_preprocess put in `ps->paint_list`
+void paint_all_new(session_t *ps, bool ignore_damage) attr_nonnull(1);
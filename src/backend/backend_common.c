@@ -12,6 +12,7 @@
 #include "config.h"
 #include "kernel.h"
 #include "log.h"
+#include "microbench.h"
 #include "utils.h"
 #include "win.h"
 #include "x.h"
@@ -57,8 +58,58 @@ xcb_render_picture_t solid_picture(xcb_connection_t *c, xcb_drawable_t d, bool a
 	return picture;
 }
 
-xcb_image_t *
-make_shadow(xcb_connection_t *c, const conv *kernel, double opacity, int width, int height) {
+/// Build a fixed-point summed-area table of `kernel`, scaled by `scale`.
+///
+/// isum[y * (d + 1) + x] is the sum of the kernel from (0, 0) to (x - 1, y - 1),
+/// inclusive, in 16.16 fixed point. The extra zero row and column spare us the bound
+/// checks sum_kernel has to do.
+static int32_t *shadow_sum_table(const conv *kernel, double scale) {
+	const double *shadow_sum = kernel->rsum;
+	int d = kernel->w;
+	auto isum = ccalloc((d + 1) * (d + 1), int32_t);
+	for (int y = 0; y < d; y++) {
+		for (int x = 0; x < d; x++) {
+			isum[(y + 1) * (d + 1) + x + 1] =
+			    (int32_t)lround(shadow_sum[y * d + x] * scale * 65536.0);
+		}
+	}
+	return isum;
+}
+
+/// Alpha of a shadow pixel, whose kernel overlaps with the window in
+/// [x0, x1) x [y0, y1) of the kernel.
+static inline uint8_t
+shadow_alpha(const int32_t *isum, int d, int x0, int x1, int y0, int y1) {
+	const int32_t *top = &isum[y0 * (d + 1)], *bottom = &isum[y1 * (d + 1)];
+	int32_t sum = bottom[x1] - bottom[x0] - top[x1] + top[x0];
+	if (sum <= 0) {
+		return 0;
+	}
+	return (uint8_t)min2(sum >> 16, 255);
+}
+
+/// Fill one row of the shadow, whose kernel overlaps with the window in [y0, y1) of the
+/// kernel vertically.
+static void
+shadow_fill_row(uint8_t *row, const int32_t *isum, int d, int width, int y0, int y1) {
+	int swidth = width + d - 1;
+	// Columns [d - 1, width) have the whole kernel width over the window, so they
+	// are all the same. The rest is symmetric.
+	int edge = min2(d - 1, (swidth + 1) / 2);
+	for (int x = 0; x < edge; x++) {
+		int x0 = max2(d - x - 1, 0), x1 = min2(d - x - 1 + width, d);
+		row[x] = row[swidth - x - 1] = shadow_alpha(isum, d, x0, x1, y0, y1);
+	}
+	if (width > d - 1) {
+		memset(row + d - 1, shadow_alpha(isum, d, 0, d, y0, y1),
+		       (size_t)(width - d + 1));
+	}
+}
+
+/// Render the alpha values of a shadow for a `width` x `height` window into `data`,
+/// which has (width + d - 1) x (height + d - 1) pixels, `stride` bytes per row.
+static void shadow_fill(uint8_t *data, long stride, const conv *kernel, double opacity,
+                        int width, int height) {
 	/*
 	 * We classify shadows into 4 kinds of regions
 	 *    r = shadow radius
@@ -71,10 +122,40 @@ make_shadow(xcb_connection_t *c, const conv *kernel, double opacity, int width,
 	 * height-r +-----+---------+-----+
 	 *          |  1  |    2    |  1  |
 	 * height+r +-----+---------+-----+
+	 *
+	 * Rows in the middle are all the same, and the bottom rows mirror the top ones,
+	 * so we only calculate the distinct rows, and copy them around.
 	 */
+	int d = kernel->w;
+	int swidth = width + d - 1, sheight = height + d - 1;
+
+	// Shadows of windows smaller than the kernel are not scaled by opacity
+	double scale = (width < d - 1 || height < d - 1) ? 255.0 : 255.0 * opacity;
+	int32_t *isum = shadow_sum_table(kernel, scale);
+
+	int edge = min2(d - 1, (sheight + 1) / 2);
+	for (int y = 0; y < edge; y++) {
+		int y0 = max2(d - y - 1, 0), y1 = min2(d - y - 1 + height, d);
+		uint8_t *row = data + y * stride;
+		shadow_fill_row(row, isum, d, width, y0, y1);
+		if (sheight - y - 1 != y) {
+			memcpy(data + (sheight - y - 1) * stride, row, (size_t)swidth);
+		}
+	}
+	if (height > d - 1) {
+		uint8_t *row = data + (d - 1) * stride;
+		shadow_fill_row(row, isum, d, width, 0, d);
+		for (int y = d; y < height; y++) {
+			memcpy(data + y * stride, row, (size_t)swidth);
+		}
+	}
+	free(isum);
+}
+
+xcb_image_t *
+make_shadow_image(xcb_connection_t *c, const conv *kernel, int width, int height) {
 	xcb_image_t *ximage;
-	const double *shadow_sum = kernel->rsum;
-	assert(shadow_sum);
+	assert(kernel->rsum);
 	// We only support square kernels for shadow
 	assert(kernel->w == kernel->h);
 	int d = kernel->w;
@@ -90,104 +171,97 @@ make_shadow(xcb_connection_t *c, const conv *kernel, double opacity, int width,
 		log_error("failed to create an X image");
 		return 0;
 	}
+	return ximage;
+}
 
-	unsigned char *data = ximage->data;
-	long sstride = ximage->stride;
+void fill_shadow_image(xcb_image_t *ximage, const conv *kernel, double opacity,
+                       int width, int height) {
+	shadow_fill(ximage->data, ximage->stride, kernel, opacity, width, height);
+}
 
-	// If the window body is smaller than the kernel, we do convolution directly
-	if (width < r * 2 && height < r * 2) {
-		for (int y = 0; y < sheight; y++) {
-			for (int x = 0; x < swidth; x++) {
-				double sum = sum_kernel_normalized(
-				    kernel, d - x - 1, d - y - 1, width, height);
-				data[y * sstride + x] = (uint8_t)(sum * 255.0);
-			}
-		}
-		return ximage;
+xcb_image_t *
+make_shadow(xcb_connection_t *c, const conv *kernel, double opacity, int width, int height) {
+	auto ximage = make_shadow_image(c, kernel, width, height);
+	if (ximage) {
+		fill_shadow_image(ximage, kernel, opacity, width, height);
 	}
+	return ximage;
+}
 
-	if (height < r * 2) {
-		// Implies width >= r * 2
-		// If the window height is smaller than the kernel, we divide
-		// the window like this:
-		// -r     r         width-r  width+r
-		// +------+-------------+------+
-		// |      |             |      |
-		// +------+-------------+------+
-		for (int y = 0; y < sheight; y++) {
-			for (int x = 0; x < r * 2; x++) {
-				double sum = sum_kernel_normalized(kernel, d - x - 1,
-				                                   d - y - 1, d, height) *
-				             255.0;
-				data[y * sstride + x] = (uint8_t)sum;
-				data[y * sstride + swidth - x - 1] = (uint8_t)sum;
-			}
-		}
-		for (int y = 0; y < sheight; y++) {
-			double sum =
-			    sum_kernel_normalized(kernel, 0, d - y - 1, d, height) * 255.0;
-			memset(&data[y * sstride + r * 2], (uint8_t)sum,
-			       (size_t)(width - 2 * r));
-		}
-		return ximage;
+/// Render a shadow the straightforward way, one sum_kernel per pixel
+static void attr_unused shadow_fill_reference(uint8_t *data, long stride,
+                                              const conv *kernel, double opacity,
+                                              int width, int height) {
+	int d = kernel->w;
+	if (width < d - 1 || height < d - 1) {
+		opacity = 1;
 	}
-	if (width < r * 2) {
-		// Similarly, for width smaller than kernel
-		for (int y = 0; y < r * 2; y++) {
-			for (int x = 0; x < swidth; x++) {
-				double sum = sum_kernel_normalized(kernel, d - x - 1,
-				                                   d - y - 1, width, d) *
-				             255.0;
-				data[y * sstride + x] = (uint8_t)sum;
-				data[(sheight - y - 1) * sstride + x] = (uint8_t)sum;
-			}
-		}
-		for (int x = 0; x < swidth; x++) {
-			double sum =
-			    sum_kernel_normalized(kernel, d - x - 1, 0, width, d) * 255.0;
-			for (int y = r * 2; y < height; y++) {
-				data[y * sstride + x] = (uint8_t)sum;
-			}
+	for (int y = 0; y < height + d - 1; y++) {
+		for (int x = 0; x < width + d - 1; x++) {
+			double sum = sum_kernel_normalized(kernel, d - x - 1, d - y - 1,
+			                                   width, height);
+			data[y * stride + x] = (uint8_t)(sum * opacity * 255.0);
 		}
-		return ximage;
-	}
-
-	// Implies: width >= r * 2 && height >= r * 2
-
-	// Fill part 3
-	for (int y = r; y < height + r; y++) {
-		memset(data + sstride * y + r, (uint8_t)(255 * opacity), (size_t)width);
 	}
+}
 
-	// Part 1
-	for (int y = 0; y < r * 2; y++) {
-		for (int x = 0; x < r * 2; x++) {
-			double tmpsum = shadow_sum[y * d + x] * opacity * 255.0;
-			data[y * sstride + x] = (uint8_t)tmpsum;
-			data[(sheight - y - 1) * sstride + x] = (uint8_t)tmpsum;
-			data[(sheight - y - 1) * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
-			data[y * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
+TEST_CASE(make_shadow_fill) {
+	static const int radii[] = {3, 12, 24, 48};
+	static const struct {
+		int width, height;
+	} sizes[] = {{1, 1}, {20, 7}, {7, 20}, {100, 100}, {800, 600}};
+
+	for (size_t i = 0; i < ARR_SIZE(radii); i++) {
+		conv *kernel = gaussian_kernel_autodetect_deviation(radii[i]);
+		sum_kernel_preprocess(kernel);
+		int d = kernel->w;
+		for (size_t j = 0; j < ARR_SIZE(sizes); j++) {
+			int width = sizes[j].width, height = sizes[j].height;
+			int swidth = width + d - 1, sheight = height + d - 1;
+			auto expected = ccalloc(swidth * sheight, uint8_t);
+			auto got = ccalloc(swidth * sheight, uint8_t);
+			shadow_fill_reference(expected, swidth, kernel, 0.75, width,
+			                      height);
+			shadow_fill(got, swidth, kernel, 0.75, width, height);
+
+			// Rounding of the fixed point sums can be off by one
+			int max_error = 0;
+			for (int k = 0; k < swidth * sheight; k++) {
+				max_error = max2(max_error, abs(expected[k] - got[k]));
+			}
+			TEST_TRUE(max_error <= 1);
+			free(expected);
+			free(got);
 		}
+		free_conv(kernel);
 	}
+}
 
-	// Part 2, top/bottom
-	for (int y = 0; y < r * 2; y++) {
-		double tmpsum = shadow_sum[d * y + d - 1] * opacity * 255.0;
-		memset(&data[y * sstride + r * 2], (uint8_t)tmpsum, (size_t)(width - r * 2));
-		memset(&data[(sheight - y - 1) * sstride + r * 2], (uint8_t)tmpsum,
-		       (size_t)(width - r * 2));
+/// make_shadow without creating the X image, which needs a connection
+static void
+bench_shadow_fill(struct microbench *bench, int radius, int width, int height) {
+	conv *kernel = gaussian_kernel_autodetect_deviation(radius);
+	sum_kernel_preprocess(kernel);
+	int swidth = width + kernel->w - 1, sheight = height + kernel->h - 1;
+	auto data = ccalloc(swidth * sheight, uint8_t);
+	MICROBENCH_LOOP() {
+		shadow_fill(data, swidth, kernel, 0.75, width, height);
+		microbench_keep(data);
 	}
+	free(data);
+	free_conv(kernel);
+}
 
-	// Part 2, left/right
-	for (int x = 0; x < r * 2; x++) {
-		double tmpsum = shadow_sum[d * (d - 1) + x] * opacity * 255.0;
-		for (int y = r * 2; y < height; y++) {
-			data[y * sstride + x] = (uint8_t)tmpsum;
-			data[y * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
-		}
-	}
+MICROBENCH(make_shadow_small) {
+	bench_shadow_fill(bench, 12, 100, 100);
+}
 
-	return ximage;
+MICROBENCH(make_shadow_large) {
+	bench_shadow_fill(bench, 12, 1920, 1080);
+}
+
+MICROBENCH(make_shadow_large_radius) {
+	bench_shadow_fill(bench, 48, 1920, 1080);
 }
 
 /**
@@ -227,33 +301,12 @@ bool build_shadow(xcb_connection_t *c, xcb_drawable_t d, double opacity, const i
 	gc = x_new_id(c);
 	xcb_create_gc(c, gc, shadow_pixmap, 0, NULL);
 
-	// We need to make room for protocol metadata in the request. The metadata should
-	// be 24 bytes plus padding, let's be generous and give it 1kb
-	auto maximum_image_size = xcb_get_maximum_request_length(c) * 4 - 1024;
-	auto maximum_row =
-	    to_u16_checked(clamp(maximum_image_size / shadow_image->stride, 0, UINT16_MAX));
-	if (maximum_row <= 0) {
-		// TODO(yshui) Upload image with XShm
-		log_error("X server request size limit is too restrictive, or the shadow "
-		          "image is too wide for us to send a single row of the shadow "
-		          "image. Shadow size: %dx%d",
-		          width, height);
+	if (!x_put_image(c, shadow_pixmap, gc, shadow_image, 0, 0)) {
+		log_error("Failed to upload the shadow image, shadow size: %dx%d", width,
+		          height);
 		goto shadow_picture_err;
 	}
 
-	for (uint32_t row = 0; row < shadow_image->height; row += maximum_row) {
-		auto batch_height = maximum_row;
-		if (batch_height > shadow_image->height - row) {
-			batch_height = to_u16_checked(shadow_image->height - row);
-		}
-
-		uint32_t offset = row * shadow_image->stride / sizeof(*shadow_image->data);
-		xcb_put_image(c, (uint8_t)shadow_image->format, shadow_pixmap, gc,
-		              shadow_image->width, batch_height, 0, to_i16_checked(row),
-		              0, shadow_image->depth, shadow_image->stride * batch_height,
-		              shadow_image->data + offset);
-	}
-
 	xcb_render_composite(c, XCB_RENDER_PICT_OP_SRC, shadow_pixel, shadow_picture,
 	                     shadow_picture_argb, 0, 0, 0, 0, 0, 0, shadow_image->width,
 	                     shadow_image->height);
@@ -311,8 +364,13 @@ default_backend_render_shadow(backend_t *backend_data, int width, int height,
 	return ret;
 }
 
+/// Scale a blur size down to use it at 1/downscale of the resolution
+static int downscale_blur_size(int size, int downscale) {
+	return (size + downscale / 2) / max2(downscale, 1);
+}
+
 static struct conv **generate_box_blur_kernel(struct box_blur_args *args, int *kernel_count) {
-	int r = args->size * 2 + 1;
+	int r = downscale_blur_size(args->size, args->downscale) * 2 + 1;
 	assert(r > 0);
 	auto ret = ccalloc(2, struct conv *);
 	ret[0] = cvalloc(sizeof(struct conv) + sizeof(double) * (size_t)r);
@@ -331,7 +389,9 @@ static struct conv **generate_box_blur_kernel(struct box_blur_args *args, int *k
 
 static struct conv **
 generate_gaussian_blur_kernel(struct gaussian_blur_args *args, int *kernel_count) {
-	int r = args->size * 2 + 1;
+	int size = downscale_blur_size(args->size, args->downscale);
+	double deviation = args->deviation / max2(args->downscale, 1);
+	int r = size * 2 + 1;
 	assert(r > 0);
 	auto ret = ccalloc(2, struct conv *);
 	ret[0] = cvalloc(sizeof(struct conv) + sizeof(double) * (size_t)r);
@@ -340,19 +400,29 @@ generate_gaussian_blur_kernel(struct gaussian_blur_args *args, int *kernel_count
 	ret[0]->h = 1;
 	ret[1]->w = 1;
 	ret[1]->h = r;
-	for (int i = 0; i <= args->size; i++) {
+	for (int i = 0; i <= size; i++) {
 		ret[0]->data[i] = ret[0]->data[r - i - 1] =
-		    1.0 / (sqrt(2.0 * M_PI) * args->deviation) *
-		    exp(-(args->size - i) * (args->size - i) /
-		        (2 * args->deviation * args->deviation));
+		    1.0 / (sqrt(2.0 * M_PI) * deviation) *
+		    exp(-(size - i) * (size - i) / (2 * deviation * deviation));
 		ret[1]->data[i] = ret[1]->data[r - i - 1] = ret[0]->data[i];
 	}
 	*kernel_count = 2;
 	return ret;
 }
 
+/// Get how many times the image should be scaled down by before being blurred.
+int blur_downscale(enum blur_method method, void *args) {
+	switch (method) {
+	case BLUR_METHOD_BOX: return max2(((struct box_blur_args *)args)->downscale, 1);
+	case BLUR_METHOD_GAUSSIAN:
+		return max2(((struct gaussian_blur_args *)args)->downscale, 1);
+	default: return 1;
+	}
+}
+
 /// Generate blur kernels for gaussian and box blur methods. Generated kernel is not
-/// normalized, and the center element will always be 1.
+/// normalized, and the center element will always be 1. If the blur is downscaled,
+/// the kernels are for the downscaled image.
 struct conv **generate_blur_kernel(enum blur_method method, void *args, int *kernel_count) {
 	switch (method) {
 	case BLUR_METHOD_BOX: return generate_box_blur_kernel(args, kernel_count);
@@ -51,6 +51,13 @@ xcb_render_picture_t solid_picture(xcb_connection_t *, xcb_drawable_t, bool argb
 
 xcb_image_t *
 make_shadow(xcb_connection_t *c, const conv *kernel, double opacity, int width, int height);
+/// Create an empty X image, big enough for the shadow of a `width` x `height` window
+xcb_image_t *
+make_shadow_image(xcb_connection_t *c, const conv *kernel, int width, int height);
+/// Render the shadow into an image created by make_shadow_image. This doesn't use X or
+/// the log, so it can run on a worker thread.
+void fill_shadow_image(xcb_image_t *, const conv *kernel, double opacity, int width,
+                       int height);
 
 /// The default implementation of `is_win_transparent`, it simply looks at win::mode. So
 /// this is not suitable for backends that alter the content of windows
@@ -66,6 +73,7 @@ default_backend_render_shadow(backend_t *backend_data, int width, int height,
 
 void init_backend_base(struct backend_base *base, session_t *ps);
 
+int blur_downscale(enum blur_method method, void *args);
 struct conv **generate_blur_kernel(enum blur_method method, void *args, int *kernel_count);
 struct dual_kawase_params *generate_dual_kawase_params(void *args);
 
@@ -26,13 +26,13 @@ enum driver detect_driver(xcb_connection_t *c, backend_t *backend_data, xcb_wind
 	// First we try doing backend agnostic detection using RANDR
 	// There's no way to query the X server about what driver is loaded, so RANDR is
 	// our best shot.
-	auto randr_version = xcb_randr_query_version_reply(
+	auto randr_version = X_REPLY(xcb_randr_query_version_reply(
 	    c, xcb_randr_query_version(c, XCB_RANDR_MAJOR_VERSION, XCB_RANDR_MINOR_VERSION),
-	    NULL);
+	    NULL));
 	if (randr_version &&
 	    (randr_version->major_version > 1 || randr_version->minor_version >= 4)) {
-		auto r = xcb_randr_get_providers_reply(
-		    c, xcb_randr_get_providers(c, window), NULL);
+		auto r = X_REPLY(xcb_randr_get_providers_reply(
+		    c, xcb_randr_get_providers(c, window), NULL));
 		if (r == NULL) {
 			log_warn("Failed to get RANDR providers");
 			free(randr_version);
@@ -41,8 +41,9 @@ enum driver detect_driver(xcb_connection_t *c, backend_t *backend_data, xcb_wind
 
 		auto providers = xcb_randr_get_providers_providers(r);
 		for (auto i = 0; i < xcb_randr_get_providers_providers_length(r); i++) {
-			auto r2 = xcb_randr_get_provider_info_reply(
-			    c, xcb_randr_get_provider_info(c, providers[i], r->timestamp), NULL);
+			auto r2 = X_REPLY(xcb_randr_get_provider_info_reply(
+			    c, xcb_randr_get_provider_info(c, providers[i], r->timestamp),
+			    NULL));
 			if (r2 == NULL) {
 				continue;
 			}
@@ -0,0 +1,645 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <X11/Xlib-xcb.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xcb/dri3.h>
+#include <xcb/xcb.h>
+
+#include "backend/backend.h"
+#include "backend/backend_common.h"
+#include "backend/gl/egl.h"
+#include "backend/gl/gl_common.h"
+#include "common.h"
+#include "compiler.h"
+#include "config.h"
+#include "log.h"
+#include "picom.h"
+#include "region.h"
+#include "utils.h"
+#include "x.h"
+
+/// Build a DRM fourcc code, same as fourcc_code from drm_fourcc.h
+#define DRM_FOURCC(a, b, c, d)                                                           \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) |                  \
+	 ((uint32_t)(d) << 24))
+#define DRM_FORMAT_MOD_INVALID 0x00ffffffffffffffULL
+#define DRM_FORMAT_MOD_LINEAR 0ULL
+/// Maximum number of planes a dma-buf can have
+#define EGL_MAX_PLANES 4
+
+struct egl_pixmap {
+	EGLImage image;
+	xcb_pixmap_t pixmap;
+	bool owned;
+};
+
+struct egl_data {
+	struct gl_data gl;
+	EGLDisplay display;
+	EGLSurface target_win;
+	EGLContext ctx;
+	/// Whether pixmaps are imported as dma-bufs with DRI3, instead of going through
+	/// EGL_KHR_image_pixmap
+	bool dri3;
+	/// Whether the dma-buf format modifiers reported by DRI3 can be passed to EGL
+	bool dri3_modifiers;
+	/// Whether fences can be used to wait for frames to be done, instead of glFinish
+	bool has_fence;
+};
+
+/**
+ * Free a gl_texture_t.
+ */
+static void egl_release_image(backend_t *base, struct gl_texture *tex) {
+	struct egl_data *gd = (void *)base;
+	struct egl_pixmap *p = tex->user_data;
+	// Release binding
+	if (p->image != EGL_NO_IMAGE_KHR) {
+		eglDestroyImageProc(gd->display, p->image);
+		p->image = EGL_NO_IMAGE_KHR;
+	}
+
+	if (p->owned) {
+		xcb_free_pixmap(base->c, p->pixmap);
+		p->pixmap = XCB_NONE;
+	}
+
+	free(p);
+	tex->user_data = NULL;
+}
+
+/**
+ * Destroy EGL related resources.
+ */
+static void egl_deinit(backend_t *base) {
+	struct egl_data *gd = (void *)base;
+
+	gl_deinit(&gd->gl);
+
+	// Destroy EGL context
+	if (gd->ctx != EGL_NO_CONTEXT) {
+		eglMakeCurrent(gd->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(gd->display, gd->ctx);
+		gd->ctx = EGL_NO_CONTEXT;
+	}
+
+	if (gd->target_win != EGL_NO_SURFACE) {
+		eglDestroySurface(gd->display, gd->target_win);
+		gd->target_win = EGL_NO_SURFACE;
+	}
+
+	if (gd->display != EGL_NO_DISPLAY) {
+		eglTerminate(gd->display);
+		gd->display = EGL_NO_DISPLAY;
+	}
+
+	free(gd);
+}
+
+static void *egl_decouple_user_data(backend_t *base attr_unused, void *ud attr_unused) {
+	auto ret = cmalloc(struct egl_pixmap);
+	ret->owned = false;
+	ret->image = EGL_NO_IMAGE_KHR;
+	ret->pixmap = 0;
+	return ret;
+}
+
+/// Check if the X server can export pixmaps as dma-bufs with all their planes and
+/// modifiers, which needs DRI3 1.2
+static bool egl_has_dri3(xcb_connection_t *c) {
+	auto ext = xcb_get_extension_data(c, &xcb_dri3_id);
+	if (!ext || !ext->present) {
+		return false;
+	}
+	auto r = X_REPLY(
+	    xcb_dri3_query_version_reply(c, xcb_dri3_query_version(c, 1, 2), NULL));
+	if (!r) {
+		return false;
+	}
+	bool ret = r->major_version > 1 || (r->major_version == 1 && r->minor_version >= 2);
+	free(r);
+	return ret;
+}
+
+static backend_t *egl_init(session_t *ps) {
+	bool success = false;
+	auto gd = ccalloc(1, struct egl_data);
+	init_backend_base(&gd->gl.base, ps);
+	gd->display = EGL_NO_DISPLAY;
+	gd->target_win = EGL_NO_SURFACE;
+	gd->ctx = EGL_NO_CONTEXT;
+
+	// EGL_EXT_platform_x11 is a client extension, it is queried without a display
+	const char *client_exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (!client_exts || !strstr(client_exts, "EGL_EXT_platform_x11")) {
+		log_error("EGL_EXT_platform_x11 is not supported by your driver");
+		goto end;
+	}
+	eglGetPlatformDisplayProc =
+	    (void *)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	eglCreatePlatformWindowSurfaceProc =
+	    (void *)eglGetProcAddress("eglCreatePlatformWindowSurfaceEXT");
+	if (!eglGetPlatformDisplayProc || !eglCreatePlatformWindowSurfaceProc) {
+		log_error("Failed to get EGL platform functions");
+		goto end;
+	}
+
+	gd->display = eglGetPlatformDisplayProc(
+	    EGL_PLATFORM_X11_EXT, ps->dpy,
+	    (EGLint[]){EGL_PLATFORM_X11_SCREEN_EXT, ps->scr, EGL_NONE});
+	if (gd->display == EGL_NO_DISPLAY) {
+		log_error("Failed to get EGL display.");
+		goto end;
+	}
+
+	EGLint major, minor;
+	if (!eglInitialize(gd->display, &major, &minor)) {
+		log_error("Failed to initialize EGL.");
+		goto end;
+	}
+	if (major < 1 || (major == 1 && minor < 5)) {
+		log_error("EGL version too old, need at least 1.5.");
+		goto end;
+	}
+
+	eglext_init(gd->display);
+	if (!eglext.has_EGL_KHR_image_pixmap && !eglext.has_EGL_EXT_image_dma_buf_import) {
+		log_error("Neither EGL_KHR_image_pixmap nor EGL_EXT_image_dma_buf_import is "
+		          "supported by your driver");
+		goto end;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		log_error("Failed to bind OpenGL API.");
+		goto end;
+	}
+
+	// Find a config with the visual of the target window, so we can be sure the
+	// config is compatible with it.
+	EGLint ncfgs = 0;
+	EGLint cfg_attrs[] = {
+	    EGL_SURFACE_TYPE,    EGL_WINDOW_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	    EGL_RED_SIZE,        1,              EGL_GREEN_SIZE,      1,
+	    EGL_BLUE_SIZE,       1,              EGL_STENCIL_SIZE,    1,
+	    EGL_NONE,
+	};
+	if (!eglChooseConfig(gd->display, cfg_attrs, NULL, 0, &ncfgs) || ncfgs <= 0) {
+		log_error("Failed to get EGL configs.");
+		goto end;
+	}
+	auto cfgs = ccalloc(ncfgs, EGLConfig);
+	eglChooseConfig(gd->display, cfg_attrs, cfgs, ncfgs, &ncfgs);
+	EGLConfig config = NULL;
+	for (int i = 0; i < ncfgs; i++) {
+		EGLint visual_id = 0;
+		if (eglGetConfigAttrib(gd->display, cfgs[i], EGL_NATIVE_VISUAL_ID,
+		                       &visual_id) &&
+		    (xcb_visualid_t)visual_id == ps->vis) {
+			config = cfgs[i];
+			break;
+		}
+	}
+	free(cfgs);
+	if (!config) {
+		log_error("Couldn't find a suitable config for the target window");
+		goto end;
+	}
+
+	Window target = session_get_target_window(ps);
+	gd->target_win =
+	    eglCreatePlatformWindowSurfaceProc(gd->display, config, &target, NULL);
+	if (gd->target_win == EGL_NO_SURFACE) {
+		log_error("Failed to create EGL surface.");
+		goto end;
+	}
+
+	gd->ctx = eglCreateContext(gd->display, config, EGL_NO_CONTEXT,
+	                           (EGLint[]){
+	                               EGL_CONTEXT_MAJOR_VERSION,
+	                               3,
+	                               EGL_CONTEXT_MINOR_VERSION,
+	                               3,
+	                               EGL_CONTEXT_OPENGL_PROFILE_MASK,
+	                               EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+	                               EGL_NONE,
+	                           });
+	if (gd->ctx == EGL_NO_CONTEXT) {
+		log_error("Failed to get EGL context.");
+		goto end;
+	}
+
+	// Attach EGL context
+	if (!eglMakeCurrent(gd->display, gd->target_win, gd->target_win, gd->ctx)) {
+		log_error("Failed to attach EGL context.");
+		goto end;
+	}
+
+	if (!gl_init(&gd->gl, ps)) {
+		log_error("Failed to setup OpenGL");
+		goto end;
+	}
+
+	if (!gl_has_extension("GL_EXT_EGL_image_storage")) {
+		log_error("GL_EXT_EGL_image_storage is not supported by your driver");
+		goto end;
+	}
+	glEGLImageTargetTexStorage =
+	    (void *)eglGetProcAddress("glEGLImageTargetTexStorageEXT");
+	if (!glEGLImageTargetTexStorage) {
+		log_error("Failed to get glEGLImageTargetTexStorageEXT");
+		goto end;
+	}
+
+	// Import pixmaps as dma-bufs when we can, the driver samples them directly
+	// instead of possibly copying them into a texture.
+	gd->dri3 = eglext.has_EGL_EXT_image_dma_buf_import && egl_has_dri3(ps->c);
+	gd->dri3_modifiers = eglext.has_EGL_EXT_image_dma_buf_import_modifiers;
+	if (!gd->dri3 && !eglext.has_EGL_KHR_image_pixmap) {
+		log_error("DRI3 is not available, and EGL_KHR_image_pixmap is not "
+		          "supported by your driver");
+		goto end;
+	}
+	log_info("Importing window pixmaps %s", gd->dri3 ? "as dma-bufs with DRI3"
+	                                                 : "with EGL_KHR_image_pixmap");
+
+	// Fences are in the core of EGL 1.5, but the client API has to support them too,
+	// we find that out the first time we create one
+	gd->has_fence = true;
+	gd->gl.decouple_texture_user_data = egl_decouple_user_data;
+	gd->gl.release_user_data = egl_release_image;
+
+	if (!eglSwapInterval(gd->display, ps->o.vsync ? 1 : 0) && ps->o.vsync) {
+		log_error("Failed to enable vsync.");
+	}
+
+	success = true;
+
+end:
+	if (!success) {
+		egl_deinit(&gd->gl.base);
+		return NULL;
+	}
+
+	return &gd->gl.base;
+}
+
+/// DRM format of pixmaps with the given depth and bits per pixel, 0 if unknown
+static uint32_t egl_drm_format(int depth, int bpp) {
+	if (bpp == 32) {
+		switch (depth) {
+		case 24: return DRM_FOURCC('X', 'R', '2', '4');
+		case 30: return DRM_FOURCC('X', 'R', '3', '0');
+		case 32: return DRM_FOURCC('A', 'R', '2', '4');
+		}
+	} else if (bpp == 16 && depth == 16) {
+		return DRM_FOURCC('R', 'G', '1', '6');
+	}
+	return 0;
+}
+
+/// Import a pixmap as an EGLImage through the dma-bufs backing it. Returns
+/// EGL_NO_IMAGE_KHR if the pixmap can't be exported or imported this way.
+static EGLImage egl_import_dri3(struct egl_data *gd, xcb_pixmap_t pixmap) {
+	static const EGLint plane_attrs[EGL_MAX_PLANES][5] = {
+	    {EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+	     EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+	     EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT},
+	    {EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+	     EGL_DMA_BUF_PLANE1_PITCH_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+	     EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT},
+	    {EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+	     EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+	     EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT},
+	    {EGL_DMA_BUF_PLANE3_FD_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+	     EGL_DMA_BUF_PLANE3_PITCH_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+	     EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT},
+	};
+	xcb_connection_t *c = gd->gl.base.c;
+	auto r = X_REPLY(xcb_dri3_buffers_from_pixmap_reply(
+	    c, xcb_dri3_buffers_from_pixmap(c, pixmap), NULL));
+	if (!r) {
+		return EGL_NO_IMAGE_KHR;
+	}
+
+	int *fds = xcb_dri3_buffers_from_pixmap_reply_fds(c, r);
+	const uint32_t *strides = xcb_dri3_buffers_from_pixmap_strides(r);
+	const uint32_t *offsets = xcb_dri3_buffers_from_pixmap_offsets(r);
+	uint32_t format = egl_drm_format(r->depth, r->bpp);
+	bool has_modifier = gd->dri3_modifiers && r->modifier != DRM_FORMAT_MOD_INVALID;
+	// Without EGL_EXT_image_dma_buf_import_modifiers, only buffers with an implicit
+	// or linear layout can be described to EGL
+	bool layout_known = has_modifier || r->modifier == DRM_FORMAT_MOD_INVALID ||
+	                    r->modifier == DRM_FORMAT_MOD_LINEAR;
+
+	EGLImage image = EGL_NO_IMAGE_KHR;
+	if (format && layout_known && r->nfd > 0 && r->nfd <= EGL_MAX_PLANES) {
+		EGLint attrs[6 + EGL_MAX_PLANES * 10 + 1];
+		int n = 0;
+		attrs[n++] = EGL_WIDTH;
+		attrs[n++] = r->width;
+		attrs[n++] = EGL_HEIGHT;
+		attrs[n++] = r->height;
+		attrs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+		attrs[n++] = (EGLint)format;
+		for (int i = 0; i < r->nfd; i++) {
+			attrs[n++] = plane_attrs[i][0];
+			attrs[n++] = fds[i];
+			attrs[n++] = plane_attrs[i][1];
+			attrs[n++] = (EGLint)offsets[i];
+			attrs[n++] = plane_attrs[i][2];
+			attrs[n++] = (EGLint)strides[i];
+			if (has_modifier) {
+				attrs[n++] = plane_attrs[i][3];
+				attrs[n++] = (EGLint)(r->modifier & 0xffffffff);
+				attrs[n++] = plane_attrs[i][4];
+				attrs[n++] = (EGLint)(r->modifier >> 32);
+			}
+		}
+		attrs[n++] = EGL_NONE;
+		image = eglCreateImageProc(gd->display, EGL_NO_CONTEXT,
+		                           EGL_LINUX_DMA_BUF_EXT, NULL, attrs);
+	}
+
+	// EGL has its own references to the buffers
+	for (int i = 0; i < r->nfd; i++) {
+		close(fds[i]);
+	}
+	free(r);
+	return image;
+}
+
+static void *
+egl_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, bool owned) {
+	struct egl_data *gd = (void *)base;
+	struct egl_pixmap *eglpixmap = NULL;
+
+	auto r = X_REPLY(
+	    xcb_get_geometry_reply(base->c, xcb_get_geometry(base->c, pixmap), NULL));
+	if (!r) {
+		log_error("Invalid pixmap %#010x", pixmap);
+		return NULL;
+	}
+
+	log_trace("Binding pixmap %#010x", pixmap);
+	auto wd = ccalloc(1, struct backend_image);
+	wd->max_brightness = 1;
+	auto inner = ccalloc(1, struct gl_texture);
+	inner->width = wd->ewidth = r->width;
+	inner->height = wd->eheight = r->height;
+	wd->inner = (struct backend_image_inner_base *)inner;
+	free(r);
+
+	eglpixmap = cmalloc(struct egl_pixmap);
+	eglpixmap->pixmap = pixmap;
+	eglpixmap->owned = owned;
+	eglpixmap->image = EGL_NO_IMAGE_KHR;
+	if (gd->dri3) {
+		eglpixmap->image = egl_import_dri3(gd, pixmap);
+		if (eglpixmap->image == EGL_NO_IMAGE_KHR) {
+			log_debug("Failed to import pixmap %#010x as dma-buf, falling back "
+			          "to EGL_KHR_image_pixmap",
+			          pixmap);
+		}
+	}
+	if (eglpixmap->image == EGL_NO_IMAGE_KHR && eglext.has_EGL_KHR_image_pixmap) {
+		eglpixmap->image = eglCreateImageProc(
+		    gd->display, EGL_NO_CONTEXT, EGL_NATIVE_PIXMAP_KHR,
+		    (EGLClientBuffer)(uintptr_t)pixmap, NULL);
+	}
+	if (eglpixmap->image == EGL_NO_IMAGE_KHR) {
+		log_error("Failed to create eglpixmap for pixmap %#010x", pixmap);
+		goto err;
+	}
+
+	log_trace("EGLImage %p", eglpixmap->image);
+
+	// Create texture
+	inner->user_data = eglpixmap;
+	inner->texture = gl_new_texture(GL_TEXTURE_2D);
+	inner->has_alpha = fmt.alpha_size != 0;
+	// EGLImages have their origin at the top left
+	inner->y_inverted = true;
+	wd->opacity = 1;
+	wd->color_inverted = false;
+	wd->dim = 0;
+	wd->inner->refcount = 1;
+	glBindTexture(GL_TEXTURE_2D, inner->texture);
+	glEGLImageTargetTexStorage(GL_TEXTURE_2D, eglpixmap->image, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	backend_image_created(base, inner->width, inner->height);
+
+	gl_check_err();
+	return wd;
+err:
+	free(eglpixmap);
+
+	if (owned) {
+		xcb_free_pixmap(base->c, pixmap);
+	}
+	free(inner);
+	free(wd);
+	return NULL;
+}
+
+/// Convert a region to the rectangles EGL takes, which have their origin at the bottom
+/// left. The returned array is allocated from `tls_scratch`.
+static EGLint *egl_region_to_rects(struct egl_data *gd, const region_t *region, int *n) {
+	const rect_t *rects = pixman_region32_rectangles((region_t *)region, n);
+	auto ret = arena_new(&tls_scratch, EGLint, *n * 4);
+	for (int i = 0; i < *n; i++) {
+		ret[i * 4] = rects[i].x1;
+		ret[i * 4 + 1] = gd->gl.height - rects[i].y2;
+		ret[i * 4 + 2] = rects[i].x2 - rects[i].x1;
+		ret[i * 4 + 3] = rects[i].y2 - rects[i].y1;
+	}
+	return ret;
+}
+
+static void egl_present(backend_t *base, const region_t *region) {
+	struct egl_data *gd = (void *)base;
+	auto mark = arena_mark(&tls_scratch);
+	int nrects;
+	EGLint *rects = egl_region_to_rects(gd, region, &nrects);
+
+	// Only the damaged part of the back buffer is drawn to, tell the driver so it
+	// doesn't have to preserve the rest. The buffer age has been queried for this
+	// frame by now, which EGL_KHR_partial_update requires.
+	if (eglext.has_EGL_KHR_partial_update) {
+		eglSetDamageRegionProc(gd->display, gd->target_win, rects, nrects);
+	}
+	gl_present(base, region);
+
+	// And only push the damaged part to the display
+	if (eglSwapBuffersWithDamageProc) {
+		eglSwapBuffersWithDamageProc(gd->display, gd->target_win, rects, nrects);
+	} else {
+		eglSwapBuffers(gd->display, gd->target_win);
+	}
+	arena_rewind(&tls_scratch, mark);
+
+	if (gd->gl.is_nvidia) {
+		return;
+	}
+	// Wait for the frame to be done. A fence only waits for the commands of this
+	// frame, instead of draining the whole pipeline like glFinish.
+	EGLSync fence = EGL_NO_SYNC;
+	if (gd->has_fence) {
+		fence = eglCreateSync(gd->display, EGL_SYNC_FENCE, NULL);
+		if (fence == EGL_NO_SYNC) {
+			log_info("EGL fences are not supported, using glFinish");
+			gd->has_fence = false;
+		}
+	}
+	if (fence != EGL_NO_SYNC) {
+		eglClientWaitSync(gd->display, fence, EGL_SYNC_FLUSH_COMMANDS_BIT,
+		                  EGL_FOREVER);
+		eglDestroySync(gd->display, fence);
+	} else {
+		glFinish();
+	}
+}
+
+static int egl_buffer_age(backend_t *base) {
+	if (!eglext.has_EGL_EXT_buffer_age) {
+		return -1;
+	}
+
+	struct egl_data *gd = (void *)base;
+	EGLint val;
+	eglQuerySurface(gd->display, gd->target_win, EGL_BUFFER_AGE_EXT, &val);
+	return (int)val ?: -1;
+}
+
+static void egl_diagnostics(backend_t *base) {
+	struct egl_data *gd = (void *)base;
+	printf("* Driver vendors:\n");
+	printf(" * EGL: %s\n", eglQueryString(gd->display, EGL_VENDOR));
+	if (eglext.has_EGL_MESA_query_driver) {
+		auto get_display_driver_name =
+		    (PFNEGLGETDISPLAYDRIVERNAMEPROC)eglGetProcAddress(
+		        "eglGetDisplayDriverName");
+		if (get_display_driver_name) {
+			printf(" * EGL driver: %s\n", get_display_driver_name(gd->display));
+		}
+	}
+	printf(" * GL: %s\n", glGetString(GL_VENDOR));
+	printf("* GL renderer: %s\n", glGetString(GL_RENDERER));
+	printf("* Pixmap import: %s\n", gd->dri3 ? "DRI3 dma-buf" : "EGL_KHR_image_pixmap");
+	printf("* Partial update: %s\n", eglext.has_EGL_KHR_partial_update ? "Yes" : "No");
+	printf("* Swap with damage: %s\n", eglSwapBuffersWithDamageProc ? "Yes" : "No");
+}
+
+struct backend_operations egl_ops = {
+    .init = egl_init,
+    .deinit = egl_deinit,
+    .bind_pixmap = egl_bind_pixmap,
+    .release_image = gl_release_image,
+    .compose = gl_compose,
+    .image_op = gl_image_op,
+    .set_image_property = default_set_image_property,
+    .read_pixel = gl_read_pixel,
+    .clone_image = default_clone_image,
+    .blur = gl_blur,
+    .copy_area = gl_copy_area,
+    .is_image_transparent = default_is_image_transparent,
+    .prepare = gl_prepare,
+    .present = egl_present,
+    .buffer_age = egl_buffer_age,
+    .render_shadow = gl_render_shadow,
+    .fill = gl_fill,
+    .create_blur_context = gl_create_blur_context,
+    .destroy_blur_context = gl_destroy_blur_context,
+    .get_blur_size = gl_get_blur_size,
+    .diagnostics = egl_diagnostics,
+    .set_gpu_timing = gl_set_gpu_timing,
+    .gpu_frame_time = gl_gpu_frame_time,
+    .wait_x_fence = gl_wait_x_fence,
+    .max_buffer_age = 5,        // Why?
+};
+
+/**
+ * Check if an EGL extension exists.
+ */
+static inline bool egl_has_extension(EGLDisplay dpy, const char *ext) {
+	const char *egl_exts = eglQueryString(dpy, EGL_EXTENSIONS);
+	if (!egl_exts) {
+		log_error("Failed get EGL extension list.");
+		return false;
+	}
+
+	auto inlen = strlen(ext);
+	const char *curr = egl_exts;
+	bool match = false;
+	while (curr && !match) {
+		const char *end = strchr(curr, ' ');
+		if (!end) {
+			// Last extension string
+			match = strcmp(ext, curr) == 0;
+		} else if (curr + inlen == end) {
+			// Length match, do match string
+			match = strncmp(ext, curr, (unsigned long)(end - curr)) == 0;
+		}
+		curr = end ? end + 1 : NULL;
+	}
+
+	if (!match) {
+		log_info("Missing EGL extension %s.", ext);
+	} else {
+		log_info("Found EGL extension %s.", ext);
+	}
+
+	return match;
+}
+
+struct eglext_info eglext = {0};
+PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayProc;
+PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC eglCreatePlatformWindowSurfaceProc;
+PFNEGLCREATEIMAGEKHRPROC eglCreateImageProc;
+PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageProc;
+PFNGLEGLIMAGETARGETTEXSTORAGEEXTPROC glEGLImageTargetTexStorage;
+PFNEGLSETDAMAGEREGIONKHRPROC eglSetDamageRegionProc;
+PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC eglSwapBuffersWithDamageProc;
+
+void eglext_init(EGLDisplay dpy) {
+	if (eglext.initialized) {
+		return;
+	}
+	eglext.initialized = true;
+#define check_ext(name) eglext.has_##name = egl_has_extension(dpy, #name)
+	check_ext(EGL_MESA_query_driver);
+	check_ext(EGL_KHR_image_pixmap);
+	check_ext(EGL_EXT_image_dma_buf_import);
+	check_ext(EGL_EXT_image_dma_buf_import_modifiers);
+	check_ext(EGL_EXT_buffer_age);
+	check_ext(EGL_KHR_partial_update);
+	check_ext(EGL_KHR_swap_buffers_with_damage);
+	check_ext(EGL_EXT_swap_buffers_with_damage);
+#undef check_ext
+
+#define lookup(name) (name##Proc = (__typeof__(name##Proc))eglGetProcAddress(#name "KHR"))
+	if (!lookup(eglCreateImage) || !lookup(eglDestroyImage)) {
+		eglext.has_EGL_KHR_image_pixmap = false;
+		eglext.has_EGL_EXT_image_dma_buf_import = false;
+	}
+	if (!lookup(eglSetDamageRegion)) {
+		eglext.has_EGL_KHR_partial_update = false;
+	}
+#undef lookup
+
+	// Both versions of swap buffers with damage take the same arguments
+	eglSwapBuffersWithDamageProc = NULL;
+	if (eglext.has_EGL_KHR_swap_buffers_with_damage) {
+		eglSwapBuffersWithDamageProc =
+		    (void *)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	}
+	if (!eglSwapBuffersWithDamageProc &&
+	    eglext.has_EGL_EXT_swap_buffers_with_damage) {
+		eglSwapBuffersWithDamageProc =
+		    (void *)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+	}
+}
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+#include <stdbool.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+
+#include "compiler.h"
+#include "log.h"
+#include "utils.h"
+#include "x.h"
+
+struct eglext_info {
+	bool initialized;
+	bool has_EGL_MESA_query_driver;
+	bool has_EGL_KHR_image_pixmap;
+	bool has_EGL_EXT_image_dma_buf_import;
+	bool has_EGL_EXT_image_dma_buf_import_modifiers;
+	bool has_EGL_EXT_buffer_age;
+	bool has_EGL_KHR_partial_update;
+	bool has_EGL_KHR_swap_buffers_with_damage;
+	bool has_EGL_EXT_swap_buffers_with_damage;
+};
+
+extern struct eglext_info eglext;
+
+extern PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayProc;
+extern PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC eglCreatePlatformWindowSurfaceProc;
+extern PFNEGLCREATEIMAGEKHRPROC eglCreateImageProc;
+extern PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageProc;
+extern PFNGLEGLIMAGETARGETTEXSTORAGEEXTPROC glEGLImageTargetTexStorage;
+extern PFNEGLSETDAMAGEREGIONKHRPROC eglSetDamageRegionProc;
+/// eglSwapBuffersWithDamageKHR or eglSwapBuffersWithDamageEXT, NULL if neither is
+/// supported
+extern PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC eglSwapBuffersWithDamageProc;
+
+void eglext_init(EGLDisplay);
@@ -21,10 +21,17 @@
 
 #include "backend/backend_common.h"
 #include "backend/gl/gl_common.h"
+#include "backend/gl/program_cache.h"
 
 #define GLSL(version, ...) "#version " #version "\n" #__VA_ARGS__
 #define QUOTE(...) #__VA_ARGS__
 
+/// Number of pixels each workgroup of the compute shader blur works on
+#define COMPUTE_BLUR_TILE 128
+/// Largest kernel the compute shader blur is used for, so the tile and the pixels
+/// around it fit in the minimum amount of shared memory required by OpenGL
+#define COMPUTE_BLUR_MAX_KERNEL 1024
+
 static const GLuint vert_coord_loc = 0;
 static const GLuint vert_in_texcoord_loc = 1;
 
@@ -32,20 +39,12 @@ struct gl_blur_context {
 	enum blur_method method;
 	gl_blur_shader_t *blur_shader;
 
-	/// Temporary textures used for blurring
-	GLuint *blur_textures;
-	int blur_texture_count;
-	/// Temporary fbos used for blurring
-	GLuint *blur_fbos;
-	int blur_fbo_count;
-
-	/// Cached dimensions of each blur_texture. They are the same size as the target,
-	/// so they are always big enough without resizing.
+	/// Temporary textures used for blurring, and the fbos attached to them. They are
+	/// taken from the texture pool whenever the size of the target changes, so they
+	/// are always big enough without resizing.
 	/// Turns out calling glTexImage to resize is expensive, so we avoid that.
-	struct texture_size {
-		int width;
-		int height;
-	} * texture_sizes;
+	struct gl_pooled_texture **blur_textures;
+	int blur_texture_count;
 
 	/// Cached dimensions of the offscreen framebuffer. It's the same size as the
 	/// target but is expanded in either direction by resize_width / resize_height.
@@ -54,6 +53,21 @@ struct gl_blur_context {
 	/// How much do we need to resize the damaged region for blurring.
 	int resize_width, resize_height;
 
+	/// Dual-kawase only: how far away the samples are taken, in pixels of the
+	/// texture being sampled, rounded up.
+	int sample_distance;
+
+	/// Compute shader passes. If there are any, they do all the blurring, and the
+	/// only pass in `blur_shader` copies the result into the back buffer.
+	gl_blur_compute_shader_t *compute_shader;
+	int ncompute_passes;
+
+	/// How many times smaller the image is blurred at, 1 for full resolution
+	int downscale;
+	/// If downscale > 1, passes that scale the back buffer down into a blur
+	/// texture, and scale the result back up into the back buffer
+	gl_blur_shader_t scale_shader[2];
+
 	int npasses;
 };
 
@@ -114,6 +128,9 @@ GLuint gl_create_program(const GLuint *const shaders, int nshaders) {
 		log_error("Failed to create program.");
 		goto end;
 	}
+	if (gl_program_cache_enabled()) {
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
 
 	for (int i = 0; i < nshaders; ++i)
 		glAttachShader(program, shaders[i]);
@@ -151,12 +168,24 @@ end:
 
 /**
  * @brief Create a program from vertex and fragment shader strings.
+ *
+ * The program is loaded from the program cache if it's there, and put into the cache
+ * after it's been compiled otherwise.
  */
 GLuint gl_create_program_from_str(const char *vert_shader_str, const char *frag_shader_str) {
 	GLuint vert_shader = 0;
 	GLuint frag_shader = 0;
 	GLuint prog = 0;
 
+	uint64_t cache_key = 0;
+	if (gl_program_cache_enabled()) {
+		cache_key = gl_program_cache_key(vert_shader_str, frag_shader_str);
+		prog = gl_program_cache_load(cache_key);
+		if (prog) {
+			return prog;
+		}
+	}
+
 	if (vert_shader_str)
 		vert_shader = gl_create_shader(GL_VERTEX_SHADER, vert_shader_str);
 	if (frag_shader_str)
@@ -181,6 +210,9 @@ GLuint gl_create_program_from_str(const char *vert_shader_str, const char *frag_
 	if (frag_shader)
 		glDeleteShader(frag_shader);
 
+	if (prog && gl_program_cache_enabled()) {
+		gl_program_cache_store(cache_key, prog);
+	}
 	return prog;
 }
 
@@ -193,6 +225,172 @@ static void gl_free_prog_main(gl_win_shader_t *pprogram) {
 	}
 }
 
+static void gl_ring_buffer_init(struct gl_ring_buffer *ring, GLenum target, size_t size,
+                                bool persistent) {
+	*ring = (struct gl_ring_buffer){.target = target, .size = size};
+	glGenBuffers(1, &ring->bo);
+	glBindBuffer(target, ring->bo);
+	if (persistent) {
+		const GLbitfield flags =
+		    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, (GLsizeiptr)size, NULL, flags);
+		ring->map = glMapBufferRange(target, 0, (GLsizeiptr)size, flags);
+		if (ring->map) {
+			return;
+		}
+
+		// The storage is immutable, so we need a new buffer to fall back
+		log_warn("Failed to map the vertex buffer, falling back to "
+		         "glBufferSubData.");
+		glDeleteBuffers(1, &ring->bo);
+		glGenBuffers(1, &ring->bo);
+		glBindBuffer(target, ring->bo);
+	}
+	glBufferData(target, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+}
+
+static void gl_ring_buffer_deinit(struct gl_ring_buffer *ring) {
+	if (ring->map) {
+		glBindBuffer(ring->target, ring->bo);
+		glUnmapBuffer(ring->target);
+	}
+	for (int i = 0; i < GL_RING_BUFFER_SECTIONS; i++) {
+		if (ring->fences[i]) {
+			glDeleteSync(ring->fences[i]);
+		}
+	}
+	glBindBuffer(ring->target, 0);
+	glDeleteBuffers(1, &ring->bo);
+	*ring = (struct gl_ring_buffer){0};
+}
+
+/// Point the vertex arrays to the ring buffers
+static void gl_setup_vertex_arrays(struct gl_data *gd) {
+	glBindVertexArray(gd->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, gd->vertex_ring.bo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->index_ring.bo);
+	glEnableVertexAttribArray(vert_coord_loc);
+	glEnableVertexAttribArray(vert_in_texcoord_loc);
+	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4,
+	                      NULL);
+	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
+	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
+
+	glBindVertexArray(gd->fill_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, gd->vertex_ring.bo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->index_ring.bo);
+	glEnableVertexAttribArray(vert_coord_loc);
+	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 2,
+	                      NULL);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/// Wait until the GPU is done with a section of the ring buffer
+static void gl_ring_buffer_wait(struct gl_ring_buffer *ring, int section) {
+	GLsync fence = ring->fences[section];
+	if (!fence) {
+		return;
+	}
+
+	GLenum ret;
+	do {
+		// 100ms
+		ret = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+	} while (ret == GL_TIMEOUT_EXPIRED);
+	if (ret == GL_WAIT_FAILED) {
+		log_error("Failed to wait for the vertex buffer fence.");
+	}
+	glDeleteSync(fence);
+	ring->fences[section] = NULL;
+}
+
+/**
+ * Copy data into a ring buffer, the ring buffer is left bound to its target.
+ *
+ * The section of the buffer the data lands in is only fenced when a later upload moves
+ * past it. So all the data used by a draw has to be uploaded before the draw, and all
+ * the draws using the data have to be issued before anything else is uploaded to the
+ * same ring buffer.
+ *
+ * @return offset of the data in the buffer, in bytes
+ */
+static size_t gl_ring_buffer_upload(struct gl_data *gd, struct gl_ring_buffer *ring,
+                                    const void *data, size_t size) {
+	// Keep the offsets aligned, so they can be converted to vertex indices
+	size_t aligned_size = (size + 15) & ~(size_t)15;
+	if (aligned_size > ring->size / GL_RING_BUFFER_SECTIONS) {
+		size_t new_size = ring->size;
+		while (aligned_size > new_size / GL_RING_BUFFER_SECTIONS) {
+			new_size *= 2;
+		}
+		log_debug("Growing vertex buffer to %zu bytes", new_size);
+
+		// Buffers still used by the GPU are kept alive by the driver, so we
+		// don't have to wait
+		GLenum target = ring->target;
+		bool persistent = ring->map != NULL;
+		gl_ring_buffer_deinit(ring);
+		gl_ring_buffer_init(ring, target, new_size, persistent);
+		gl_setup_vertex_arrays(gd);
+	}
+
+	size_t section_size = ring->size / GL_RING_BUFFER_SECTIONS;
+	glBindBuffer(ring->target, ring->bo);
+	if (ring->head + aligned_size > (size_t)(ring->section + 1) * section_size) {
+		// Not enough space left in this section, move on to the next one
+		int next = (ring->section + 1) % GL_RING_BUFFER_SECTIONS;
+		if (ring->map) {
+			ring->fences[ring->section] =
+			    glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			gl_ring_buffer_wait(ring, next);
+		} else if (next == 0) {
+			// Orphan the storage when wrapping around, so the driver
+			// doesn't have to wait for the GPU
+			glBufferData(ring->target, (GLsizeiptr)ring->size, NULL,
+			             GL_STREAM_DRAW);
+		}
+		ring->section = next;
+		ring->head = (size_t)next * section_size;
+	}
+
+	size_t offset = ring->head;
+	if (ring->map) {
+		memcpy(ring->map + offset, data, size);
+	} else {
+		glBufferSubData(ring->target, (GLintptr)offset, (GLsizeiptr)size, data);
+	}
+	ring->head += aligned_size;
+	gd->frame_stats.buffer_uploads++;
+	return offset;
+}
+
+/// Upload the vertices and indices of a draw
+///
+/// @param stride size of a vertex, in bytes
+static struct gl_vertex_range
+gl_upload_vertices(struct gl_data *gd, const GLint *coord, int ncoords, size_t stride,
+                   const GLuint *indices, int nindices) {
+	size_t vertex_offset = gl_ring_buffer_upload(
+	    gd, &gd->vertex_ring, coord, sizeof(GLint) * (size_t)ncoords);
+	size_t index_offset = gl_ring_buffer_upload(gd, &gd->index_ring, indices,
+	                                            sizeof(GLuint) * (size_t)nindices);
+	return (struct gl_vertex_range){
+	    .index_offset = index_offset,
+	    .base_vertex = (GLint)(vertex_offset / stride),
+	    .nelems = nindices,
+	};
+}
+
+/// Draw the vertices in `range`, with the currently bound vertex array
+static void
+gl_draw_vertex_range(struct gl_data *gd, const struct gl_vertex_range *range) {
+	glDrawElementsBaseVertex(GL_TRIANGLES, range->nelems, GL_UNSIGNED_INT,
+	                         (void *)range->index_offset, range->base_vertex);
+	gd->frame_stats.draw_calls++;
+}
+
 /*
  * @brief Implements recursive part of gl_average_texture_color.
  *
@@ -209,7 +407,9 @@ static void gl_free_prog_main(gl_win_shader_t *pprogram) {
  */
 static GLuint
 _gl_average_texture_color(backend_t *base, GLuint source_texture, GLuint destination_texture,
-                          GLuint auxiliary_texture, GLuint fbo, int width, int height) {
+                          GLuint auxiliary_texture, GLuint fbo, int width, int height,
+                          int texture_width, int texture_height) {
+	auto gd = (struct gl_data *)base;
 	const int max_width = 1;
 	const int max_height = 1;
 	const int from_width = next_power_of_two(width);
@@ -235,19 +435,23 @@ _gl_average_texture_color(backend_t *base, GLuint source_texture, GLuint destina
 	    0, to_height,        // vertex coord
 	    0, height,           // texture coord
 	};
-	glBufferSubData(GL_ARRAY_BUFFER, 0, (long)sizeof(*coord) * 16, coord);
+	GLuint indices[] = {0, 1, 2, 2, 3, 0};
+	auto range = gl_upload_vertices(gd, coord, 16, sizeof(GLint) * 4, indices, 6);
 
 	// Prepare framebuffer for new render iteration
 	glBindTexture(GL_TEXTURE_2D, destination_texture);
 	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
 	                       destination_texture, 0);
-	gl_check_fb_complete(GL_FRAMEBUFFER);
+	if (!gl_check_fb_complete(GL_FRAMEBUFFER)) {
+		return 0;
+	}
 
 	// Bind source texture as downscaling shader uniform input
 	glBindTexture(GL_TEXTURE_2D, source_texture);
 
 	// Render into framebuffer
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+	glBindVertexArray(gd->vao);
+	gl_draw_vertex_range(gd, &range);
 
 	// Have we downscaled enough?
 	GLuint result;
@@ -255,9 +459,13 @@ _gl_average_texture_color(backend_t *base, GLuint source_texture, GLuint destina
 		GLuint new_source_texture = destination_texture;
 		GLuint new_destination_texture =
 		    auxiliary_texture != 0 ? auxiliary_texture : source_texture;
-		result = _gl_average_texture_color(base, new_source_texture,
-		                                   new_destination_texture, 0, fbo,
-		                                   to_width, to_height);
+		// From now on we only sample from the auxiliary textures
+		glUniform2f(glGetUniformLocationChecked(gd->brightness_shader.prog,
+		                                        "texsize"),
+		            (GLfloat)texture_width, (GLfloat)texture_height);
+		result = _gl_average_texture_color(
+		    base, new_source_texture, new_destination_texture, 0, fbo, to_width,
+		    to_height, texture_width, texture_height);
 	} else {
 		result = destination_texture;
 	}
@@ -271,29 +479,49 @@ _gl_average_texture_color(backend_t *base, GLuint source_texture, GLuint destina
  * width and half height).
  * Returned texture must not be deleted, since it's owned by the gl_image. It will be
  * deleted when the gl_image is released.
+ *
+ * The result is cached until the content of the image changes, see
+ * IMAGE_OP_CONTENT_CHANGED.
  */
 static GLuint gl_average_texture_color(backend_t *base, struct backend_image *img) {
 	auto gd = (struct gl_data *)base;
 	auto inner = (struct gl_texture *)img->inner;
+	if (inner->average_color) {
+		return inner->average_color;
+	}
 
 	// Prepare textures which will be used for destination and source of rendering
 	// during downscaling.
 	const int texture_count = ARR_SIZE(inner->auxiliary_texture);
 	if (!inner->auxiliary_texture[0]) {
 		assert(!inner->auxiliary_texture[1]);
-		glGenTextures(texture_count, inner->auxiliary_texture);
 		glActiveTexture(GL_TEXTURE0);
 		for (int i = 0; i < texture_count; i++) {
-			glBindTexture(GL_TEXTURE_2D, inner->auxiliary_texture[i]);
+			inner->auxiliary_texture[i] = gl_texture_pool_acquire(
+			    gd, GL_RGB8, inner->width, inner->height);
+			auto aux = inner->auxiliary_texture[i];
+			if (!aux) {
+				for (int j = 0; j < i; j++) {
+					gl_texture_pool_release(
+					    gd, inner->auxiliary_texture[j]);
+					inner->auxiliary_texture[j] = NULL;
+				}
+				return 0;
+			}
+			glBindTexture(GL_TEXTURE_2D, aux->texture);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 			glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR,
 			                 (GLint[]){0, 0, 0, 0});
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, inner->width,
-			             inner->height, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
 		}
 	}
+	// Textures from the pool can be bigger than the image, texture coordinates have
+	// to be normalized by their real sizes
+	auto aux = inner->auxiliary_texture;
+	const int tex_width = inner->pooled ? inner->pooled->width : inner->width,
+	          tex_height = inner->pooled ? inner->pooled->height : inner->height;
 
 	// Prepare framebuffer used for rendering and bind it
 	GLuint fbo;
@@ -304,42 +532,15 @@ static GLuint gl_average_texture_color(backend_t *base, struct backend_image *im
 	// Enable shaders
 	glUseProgram(gd->brightness_shader.prog);
 	glUniform2f(glGetUniformLocationChecked(gd->brightness_shader.prog, "texsize"),
-	            (GLfloat)inner->width, (GLfloat)inner->height);
-
-	// Prepare vertex attributes
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	GLuint bo[2];
-	glGenBuffers(2, bo);
-	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[1]);
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
-	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
-
-	// Allocate buffers for render input
-	GLint coord[16] = {0};
-	GLuint indices[] = {0, 1, 2, 2, 3, 0};
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * 16, coord, GL_DYNAMIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * 6, indices,
-	             GL_STATIC_DRAW);
+	            (GLfloat)tex_width, (GLfloat)tex_height);
 
 	// Do actual recursive render to 1x1 texture
 	GLuint result_texture = _gl_average_texture_color(
-	    base, inner->texture, inner->auxiliary_texture[0],
-	    inner->auxiliary_texture[1], fbo, inner->width, inner->height);
+	    base, inner->texture, aux[0]->texture, aux[1]->texture, fbo, inner->width,
+	    inner->height, aux[0]->width, aux[0]->height);
 
 	// Cleanup vertex attributes
-	glDisableVertexAttribArray(vert_coord_loc);
-	glDisableVertexAttribArray(vert_in_texcoord_loc);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glDeleteBuffers(2, bo);
 	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &vao);
 
 	// Cleanup shaders
 	glUseProgram(0);
@@ -354,102 +555,94 @@ static GLuint gl_average_texture_color(backend_t *base, struct backend_image *im
 
 	gl_check_err();
 
+	inner->average_color = result_texture;
 	return result_texture;
 }
 
-/**
- * Render a region with texture data.
- *
- * @param ptex the texture
- * @param target the framebuffer to render into
- * @param dst_x,dst_y the top left corner of region where this texture
- *                    should go. In OpenGL coordinate system (important!).
- * @param reg_tgt     the clip region, in Xorg coordinate system
- * @param reg_visible ignored
- */
-static void _gl_compose(backend_t *base, struct backend_image *img, GLuint target,
-                        GLint *coord, GLuint *indices, int nrects) {
-	auto gd = (struct gl_data *)base;
-	auto inner = (struct gl_texture *)img->inner;
-	if (!img || !inner->texture) {
-		log_error("Missing texture.");
-		return;
-	}
-
-	GLuint brightness = 0;
-	if (img->max_brightness < 1.0) {
-		brightness = gl_average_texture_color(base, img);
-	}
+static const gl_win_shader_t *gl_win_shader_get(struct gl_data *gd, unsigned features);
 
-	assert(gd->win_shader.prog);
-	glUseProgram(gd->win_shader.prog);
-	if (gd->win_shader.unifm_opacity >= 0) {
-		glUniform1f(gd->win_shader.unifm_opacity, (float)img->opacity);
-	}
-	if (gd->win_shader.unifm_invert_color >= 0) {
-		glUniform1i(gd->win_shader.unifm_invert_color, img->color_inverted);
-	}
-	if (gd->win_shader.unifm_tex >= 0) {
-		glUniform1i(gd->win_shader.unifm_tex, 0);
-	}
-	if (gd->win_shader.unifm_dim >= 0) {
-		glUniform1f(gd->win_shader.unifm_dim, (float)img->dim);
-	}
-	if (gd->win_shader.unifm_brightness >= 0) {
-		glUniform1i(gd->win_shader.unifm_brightness, 1);
-	}
-	if (gd->win_shader.unifm_max_brightness >= 0) {
-		glUniform1f(gd->win_shader.unifm_max_brightness, (float)img->max_brightness);
+void gl_compose_flush(struct gl_data *gd) {
+	auto batch = &gd->compose_batch;
+	if (!batch->ncmds) {
+		return;
 	}
 
-	// log_trace("Draw: %d, %d, %d, %d -> %d, %d (%d, %d) z %d\n",
-	//          x, y, width, height, dx, dy, ptex->width, ptex->height, z);
-
-	// Bind texture
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, brightness);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, inner->texture);
+	// Upload the vertices of all the queued draws at once
+	auto range = gl_upload_vertices(gd, batch->coord, batch->nrects * 16,
+	                                sizeof(GLint) * 4, batch->indices,
+	                                batch->nrects * 6);
+	glBindVertexArray(gd->vao);
 
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gd->back_fbo);
+	const gl_win_shader_t *shader = NULL;
+	for (int i = 0; i < batch->ncmds; i++) {
+		const struct gl_compose_cmd *cmd = &batch->cmds[i];
+		// Use the program with just the features this draw needs
+		unsigned features = 0;
+		if (cmd->opacity < 1) {
+			features |= GL_WIN_SHADER_OPACITY;
+		}
+		if (cmd->color_inverted) {
+			features |= GL_WIN_SHADER_INVERT;
+		}
+		if (cmd->dim > 0) {
+			features |= GL_WIN_SHADER_DIM;
+		}
+		if (cmd->brightness) {
+			features |= GL_WIN_SHADER_MAX_BRIGHTNESS;
+		}
+		auto next_shader = gl_win_shader_get(gd, features);
+		if (!next_shader) {
+			continue;
+		}
+		if (next_shader != shader) {
+			shader = next_shader;
+			glUseProgram(shader->prog);
+			if (shader->unifm_tex >= 0) {
+				glUniform1i(shader->unifm_tex, 0);
+			}
+			if (shader->unifm_brightness >= 0) {
+				glUniform1i(shader->unifm_brightness, 1);
+			}
+		}
 
-	GLuint bo[2];
-	glGenBuffers(2, bo);
-	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[1]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * nrects * 16, coord, GL_STATIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * nrects * 6,
-	             indices, GL_STATIC_DRAW);
+		if (shader->unifm_opacity >= 0) {
+			glUniform1f(shader->unifm_opacity, cmd->opacity);
+		}
+		if (shader->unifm_dim >= 0) {
+			glUniform1f(shader->unifm_dim, cmd->dim);
+		}
+		if (shader->unifm_max_brightness >= 0) {
+			glUniform1f(shader->unifm_max_brightness, cmd->max_brightness);
+		}
 
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
-	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
-	glDrawElements(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, cmd->brightness);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, cmd->texture);
 
-	glDisableVertexAttribArray(vert_coord_loc);
-	glDisableVertexAttribArray(vert_in_texcoord_loc);
-	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &vao);
+		gl_draw_vertex_range(
+		    gd, &(struct gl_vertex_range){
+		            .index_offset = range.index_offset +
+		                            sizeof(GLuint) * (size_t)cmd->first_index,
+		            .base_vertex = range.base_vertex,
+		            .nelems = cmd->nindices,
+		        });
+	}
+	batch->ncmds = 0;
+	batch->nrects = 0;
 
 	// Cleanup
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 	glDrawBuffer(GL_BACK);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glDeleteBuffers(2, bo);
-
 	glUseProgram(0);
 
 	gl_check_err();
-
-	return;
 }
 
 /// Convert rectangles in X coordinates to OpenGL vertex and texture coordinates
@@ -531,28 +724,74 @@ void gl_compose(backend_t *base, void *image_data, int dst_x, int dst_y,
 		return;
 	}
 
+	if (!inner->texture) {
+		log_error("Missing texture.");
+		return;
+	}
+
+	GLuint brightness = 0;
+	if (img->max_brightness < 1.0) {
+		brightness = gl_average_texture_color(base, img);
+	}
+
+	// Queue the draw, it will be done together with the other queued ones when
+	// something else needs to be drawn
+	auto batch = &gd->compose_batch;
+	if (batch->nrects + nrects > batch->rects_capacity) {
+		batch->rects_capacity =
+		    max2(batch->rects_capacity * 2, batch->nrects + nrects);
+		batch->coord = crealloc(batch->coord, batch->rects_capacity * 16);
+		batch->indices = crealloc(batch->indices, batch->rects_capacity * 6);
+	}
+
 	// Until we start to use glClipControl, reg_tgt, dst_x and dst_y and
 	// in a different coordinate system than the one OpenGL uses.
 	// OpenGL window coordinate (or NDC) has the origin at the lower left of the
 	// screen, with y axis pointing up; Xorg has the origin at the upper left of the
 	// screen, with y axis pointing down. We have to do some coordinate conversion in
 	// this function
-
-	auto coord = ccalloc(nrects * 16, GLint);
-	auto indices = ccalloc(nrects * 6, GLuint);
+	GLuint *indices = &batch->indices[batch->nrects * 6];
 	x_rect_to_coords(nrects, rects, dst_x, dst_y, inner->height, gd->height,
-	                 inner->y_inverted, coord, indices);
-	_gl_compose(base, img, gd->back_fbo, coord, indices, nrects);
-
-	free(indices);
-	free(coord);
+	                 inner->y_inverted, &batch->coord[batch->nrects * 16], indices);
+	for (int i = 0; i < nrects * 6; i++) {
+		indices[i] += (GLuint)batch->nrects * 4;
+	}
+
+	struct gl_compose_cmd cmd = {
+	    .texture = inner->texture,
+	    .brightness = brightness,
+	    .opacity = (float)img->opacity,
+	    .dim = (float)img->dim,
+	    .max_brightness = (float)img->max_brightness,
+	    .color_inverted = img->color_inverted,
+	    .first_index = batch->nrects * 6,
+	    .nindices = nrects * 6,
+	};
+	batch->nrects += nrects;
+
+	// Merge with the last draw if nothing but the geometry differs
+	if (batch->ncmds) {
+		auto last = &batch->cmds[batch->ncmds - 1];
+		if (last->texture == cmd.texture && last->brightness == cmd.brightness &&
+		    last->opacity == cmd.opacity && last->dim == cmd.dim &&
+		    last->max_brightness == cmd.max_brightness &&
+		    last->color_inverted == cmd.color_inverted) {
+			last->nindices += cmd.nindices;
+			return;
+		}
+	}
+	if (batch->ncmds == batch->cmds_capacity) {
+		batch->cmds_capacity = batch->cmds_capacity * 2 + 16;
+		batch->cmds = crealloc(batch->cmds, batch->cmds_capacity);
+	}
+	batch->cmds[batch->ncmds++] = cmd;
 }
 
 /**
  * Blur contents in a particular region.
  */
 bool gl_kernel_blur(backend_t *base, double opacity, void *ctx, const rect_t *extent,
-                    const GLuint vao[2], const int vao_nelems[2]) {
+                    const struct gl_vertex_range ranges[2]) {
 	auto bctx = (struct gl_blur_context *)ctx;
 	auto gd = (struct gl_data *)base;
 
@@ -580,10 +819,9 @@ bool gl_kernel_blur(backend_t *base, double opacity, void *ctx, const rect_t *ex
 		} else {
 			texorig_x = extent->x1 + bctx->resize_width;
 			texorig_y = dst_y_fb_coord - bctx->resize_height;
-			src_texture = bctx->blur_textures[curr];
-			auto src_size = bctx->texture_sizes[curr];
-			tex_width = src_size.width;
-			tex_height = src_size.height;
+			src_texture = bctx->blur_textures[curr]->texture;
+			tex_width = bctx->blur_textures[curr]->width;
+			tex_height = bctx->blur_textures[curr]->height;
 		}
 
 		glBindTexture(GL_TEXTURE_2D, src_texture);
@@ -591,24 +829,17 @@ bool gl_kernel_blur(backend_t *base, double opacity, void *ctx, const rect_t *ex
 		glUniform2f(p->unifm_pixel_norm, 1.0f / (GLfloat)tex_width,
 		            1.0f / (GLfloat)tex_height);
 
-		// The number of indices in the selected vertex array
-		GLsizei nelems;
+		// The vertices to draw
+		const struct gl_vertex_range *range;
 
 		if (i < bctx->npasses - 1) {
-			assert(bctx->blur_fbos[0]);
 			assert(bctx->blur_textures[!curr]);
 
 			// not last pass, draw into framebuffer, with resized regions
-			glBindVertexArray(vao[1]);
-			nelems = vao_nelems[1];
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[0]);
-
-			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			                       GL_TEXTURE_2D, bctx->blur_textures[!curr], 0);
+			range = &ranges[1];
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER,
+			                  bctx->blur_textures[!curr]->fbo);
 			glDrawBuffer(GL_COLOR_ATTACHMENT0);
-			if (!gl_check_fb_complete(GL_FRAMEBUFFER)) {
-				return false;
-			}
 
 			glUniform1f(p->unifm_opacity, 1.0);
 			glUniform2f(p->orig_loc, (GLfloat)bctx->resize_width,
@@ -616,8 +847,7 @@ bool gl_kernel_blur(backend_t *base, double opacity, void *ctx, const rect_t *ex
 		} else {
 			// last pass, draw directly into the back buffer, with origin
 			// regions
-			glBindVertexArray(vao[0]);
-			nelems = vao_nelems[0];
+			range = &ranges[0];
 			glBindFramebuffer(GL_FRAMEBUFFER, gd->back_fbo);
 
 			glUniform1f(p->unifm_opacity, (float)opacity);
@@ -625,7 +855,7 @@ bool gl_kernel_blur(backend_t *base, double opacity, void *ctx, const rect_t *ex
 		}
 
 		glUniform2f(p->texorig_loc, (GLfloat)texorig_x, (GLfloat)texorig_y);
-		glDrawElements(GL_TRIANGLES, nelems, GL_UNSIGNED_INT, NULL);
+		gl_draw_vertex_range(gd, range);
 
 		// XXX use multiple draw calls is probably going to be slow than
 		//     just simply blur the whole area.
@@ -636,8 +866,186 @@ bool gl_kernel_blur(backend_t *base, double opacity, void *ctx, const rect_t *ex
 	return true;
 }
 
-bool gl_dual_kawase_blur(backend_t *base, double opacity, void *ctx, const rect_t *extent,
-                         const GLuint vao[2], const int vao_nelems[2]) {
+/// Blur at a reduced resolution: the back buffer is scaled down into a blur texture,
+/// the kernel passes run on that, then the result is scaled back up into the back
+/// buffer with bilinear filtering. Takes the same arguments as `gl_kernel_blur`.
+static bool gl_downscaled_blur(backend_t *base, double opacity, void *ctx,
+                               const rect_t *extent,
+                               const struct gl_vertex_range ranges[2]) {
+	auto bctx = (struct gl_blur_context *)ctx;
+	auto gd = (struct gl_data *)base;
+	auto scale = (GLfloat)bctx->downscale;
+
+	// The origin to use when sampling from the blur textures
+	auto texorig_x = (GLfloat)(extent->x1 + bctx->resize_width);
+	auto texorig_y = (GLfloat)(bctx->fb_height - extent->y2 - bctx->resize_height);
+
+	// Scale down the back buffer into the first blur texture
+	const gl_blur_shader_t *p = &bctx->scale_shader[0];
+	assert(p->prog);
+	glUseProgram(p->prog);
+	glBindTexture(GL_TEXTURE_2D, gd->back_texture);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_textures[0]->fbo);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glUniform2f(p->orig_loc, (GLfloat)bctx->resize_width,
+	            -(GLfloat)bctx->resize_height);
+	glUniform2f(p->texorig_loc, (GLfloat)extent->x1,
+	            (GLfloat)(gd->height - extent->y2));
+	gl_draw_vertex_range(gd, &ranges[1]);
+
+	int curr = 0;
+	for (int i = 0; i < bctx->npasses; i++) {
+		p = &bctx->blur_shader[i];
+		assert(p->prog);
+		auto src = bctx->blur_textures[curr];
+		glUseProgram(p->prog);
+		glBindTexture(GL_TEXTURE_2D, src->texture);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_textures[!curr]->fbo);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		glUniform2f(p->unifm_pixel_norm, 1.0f / (GLfloat)src->width,
+		            1.0f / (GLfloat)src->height);
+		glUniform1f(p->unifm_opacity, 1.0);
+		glUniform1f(p->scale_loc, scale);
+		glUniform2f(p->orig_loc, (GLfloat)bctx->resize_width,
+		            -(GLfloat)bctx->resize_height);
+		glUniform2f(p->texorig_loc, texorig_x, texorig_y);
+		gl_draw_vertex_range(gd, &ranges[1]);
+		curr = !curr;
+	}
+
+	// Scale the result back up into the back buffer, with the original region
+	p = &bctx->scale_shader[1];
+	assert(p->prog);
+	auto result = bctx->blur_textures[curr];
+	glUseProgram(p->prog);
+	glBindTexture(GL_TEXTURE_2D, result->texture);
+	glBindFramebuffer(GL_FRAMEBUFFER, gd->back_fbo);
+	glUniform2f(p->unifm_pixel_norm, 1.0f / (GLfloat)result->width,
+	            1.0f / (GLfloat)result->height);
+	glUniform1f(p->unifm_opacity, (float)opacity);
+	glUniform2f(p->orig_loc, 0, 0);
+	glUniform2f(p->texorig_loc, texorig_x, texorig_y);
+	gl_draw_vertex_range(gd, &ranges[0]);
+
+	return true;
+}
+
+/// Blur with compute shader passes, then copy the result into the back buffer. Takes
+/// the same arguments as `gl_kernel_blur`.
+static bool gl_compute_blur(backend_t *base, double opacity, void *ctx,
+                            const rect_t *extent,
+                            const struct gl_vertex_range ranges[2]) {
+	auto bctx = (struct gl_blur_context *)ctx;
+	auto gd = (struct gl_data *)base;
+
+	// The area to blur, in the coordinates of the blur textures
+	int x = extent->x1 + bctx->resize_width,
+	    y = bctx->fb_height - extent->y2 - bctx->resize_height;
+	int width = extent->x2 - extent->x1, height = extent->y2 - extent->y1;
+
+	int curr = 0;
+	for (int i = 0; i < bctx->ncompute_passes; i++) {
+		const gl_blur_compute_shader_t *p = &bctx->compute_shader[i];
+		assert(p->prog);
+		assert(bctx->blur_textures[curr]);
+
+		glUseProgram(p->prog);
+		if (i == 0) {
+			// The back buffer is not expanded by the resize width/height
+			glBindTexture(GL_TEXTURE_2D, gd->back_texture);
+			glUniform2i(p->src_offset_loc, -bctx->resize_width,
+			            -bctx->resize_height);
+			glUniform4i(p->src_bounds_loc, 0, 0, gd->width, gd->height);
+		} else {
+			glBindTexture(GL_TEXTURE_2D, bctx->blur_textures[!curr]->texture);
+			glUniform2i(p->src_offset_loc, 0, 0);
+			glUniform4i(p->src_bounds_loc, x, y, x + width, y + height);
+		}
+		glBindImageTexture(0, bctx->blur_textures[curr]->texture, 0, GL_FALSE, 0,
+		                   GL_WRITE_ONLY, GL_RGBA8);
+		glUniform2i(p->origin_loc, x, y);
+		glUniform2i(p->size_loc, width, height);
+		int ntiles = ((p->vertical ? height : width) + COMPUTE_BLUR_TILE - 1) /
+		             COMPUTE_BLUR_TILE;
+		if (p->vertical) {
+			glDispatchCompute((GLuint)width, (GLuint)ntiles, 1);
+		} else {
+			glDispatchCompute((GLuint)ntiles, (GLuint)height, 1);
+		}
+		// Make the writes visible to the next pass, and to whoever renders into
+		// the texture next
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+		                GL_FRAMEBUFFER_BARRIER_BIT);
+		curr = !curr;
+	}
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+	// Draw the blurred pixels into the back buffer, with the original region
+	const gl_blur_shader_t *p = &bctx->blur_shader[0];
+	assert(p->prog);
+	glUseProgram(p->prog);
+	glBindTexture(GL_TEXTURE_2D, bctx->blur_textures[!curr]->texture);
+	glBindFramebuffer(GL_FRAMEBUFFER, gd->back_fbo);
+	glUniform1f(p->unifm_opacity, (float)opacity);
+	glUniform2f(p->orig_loc, 0, 0);
+	glUniform2f(p->texorig_loc, (GLfloat)x, (GLfloat)y);
+	gl_draw_vertex_range(gd, &ranges[0]);
+
+	return true;
+}
+
+/// Upload the vertices of multiple regions used in blur passes, in one go. `regions[0]`
+/// is drawn into the back buffer, the rest are drawn into the blur textures. Texture
+/// coordinates are all relative to `extent_resized`.
+static void gl_upload_blur_regions(struct gl_data *gd, const struct gl_blur_context *bctx,
+                                   const rect_t *extent_resized, region_t *regions,
+                                   int nregions, struct gl_vertex_range *ranges) {
+	int total = 0;
+	for (int i = 0; i < nregions; i++) {
+		total += pixman_region32_n_rects(&regions[i]);
+	}
+
+	auto mark = arena_mark(&tls_scratch);
+	auto coord = arena_new(&tls_scratch, GLint, total * 16);
+	auto indices = arena_new(&tls_scratch, GLuint, total * 6);
+	int offset = 0;
+	for (int i = 0; i < nregions; i++) {
+		int nrects;
+		const rect_t *rects = pixman_region32_rectangles(&regions[i], &nrects);
+		x_rect_to_coords(nrects, rects, extent_resized->x1, extent_resized->y2,
+		                 bctx->fb_height, i == 0 ? gd->height : bctx->fb_height,
+		                 false, &coord[offset * 16], &indices[offset * 6]);
+		for (int j = offset * 6; j < (offset + nrects) * 6; j++) {
+			indices[j] += (GLuint)offset * 4;
+		}
+		ranges[i].index_offset = sizeof(GLuint) * (size_t)offset * 6;
+		ranges[i].nelems = nrects * 6;
+		offset += nrects;
+	}
+
+	auto range = gl_upload_vertices(gd, coord, total * 16, sizeof(GLint) * 4, indices,
+	                                total * 6);
+	for (int i = 0; i < nregions; i++) {
+		ranges[i].index_offset += range.index_offset;
+		ranges[i].base_vertex = range.base_vertex;
+	}
+	arena_rewind(&tls_scratch, mark);
+}
+
+/// Limit drawing to the extent of `reg`. `reg` is in X coordinates, it is offset by
+/// `x_offset`, Y-flipped against `y_flip`, then scaled down by `scale`, to get the
+/// coordinates in the target framebuffer.
+static void gl_blur_scissor(const region_t *reg, int x_offset, int y_flip, int scale) {
+	auto extent = pixman_region32_extents((region_t *)reg);
+	int left = (int)floor((extent->x1 + x_offset) / (double)scale),
+	    right = (int)ceil((extent->x2 + x_offset) / (double)scale),
+	    bottom = (int)floor((y_flip - extent->y2) / (double)scale),
+	    top = (int)ceil((y_flip - extent->y1) / (double)scale);
+	glScissor(left, bottom, max2(right - left, 0), max2(top - bottom, 0));
+}
+
+bool gl_dual_kawase_blur(backend_t *base, double opacity, void *ctx,
+                         const region_t *reg_blur, const rect_t *extent) {
 	auto bctx = (struct gl_blur_context *)ctx;
 	auto gd = (struct gl_data *)base;
 
@@ -645,7 +1053,51 @@ bool gl_dual_kawase_blur(backend_t *base, double opacity, void *ctx, const rect_
 	    dst_y_fb_coord = bctx->fb_height - extent->y2;
 
 	int iterations = bctx->blur_texture_count;
+
+	// Work out which part of each texture is actually read by the next pass,
+	// the passes only draw that. In screen pixels, an upsample pass reading a
+	// texture of scale `s` reaches `(offset + 1) * s` pixels away, for the sample
+	// offset and the interpolation; a downsample pass reading a texture of scale
+	// `s` reaches `(offset / 2 + 1) * s` pixels away. None of them need more than
+	// what the whole chain was expanded by.
+	//
+	// regions[0]: region drawn by the last pass, into the back buffer
+	// regions[1 + i]: region the downsample pass draws into texture i
+	// regions[iterations + i]: region the upsample pass draws into texture i - 1
+	auto mark = arena_mark(&tls_scratch);
+	auto regions = arena_new(&tls_scratch, region_t, iterations * 2);
+	// Not all of them are used, but all of them are freed
+	memset(regions, 0, sizeof(region_t) * (size_t)iterations * 2);
+	auto up_expand = arena_new(&tls_scratch, int, iterations);
+	int expand = 0;
+	for (int i = 0; i < iterations; i++) {
+		expand += (bctx->sample_distance + 1) << (i + 1);
+		up_expand[i] = expand;
+	}
+	pixman_region32_init(&regions[0]);
+	pixman_region32_copy(&regions[0], (region_t *)reg_blur);
+	for (int i = iterations - 1; i >= 0; i--) {
+		if (i < iterations - 1) {
+			int down_expand = (bctx->sample_distance / 2 + 1) << (i + 1);
+			expand = max2(up_expand[i], expand + down_expand);
+		}
+		regions[1 + i] = resize_region(reg_blur, min2(expand, bctx->resize_width),
+		                               min2(expand, bctx->resize_height));
+		if (i > 0) {
+			int prev = up_expand[i - 1];
+			regions[iterations + i] =
+			    resize_region(reg_blur, min2(prev, bctx->resize_width),
+			                  min2(prev, bctx->resize_height));
+		}
+	}
+
+	auto ranges = arena_new(&tls_scratch, struct gl_vertex_range, iterations * 2);
+	gl_upload_blur_regions(gd, bctx, extent, regions, iterations * 2, ranges);
+	glBindVertexArray(gd->vao);
+	glEnable(GL_SCISSOR_TEST);
+
 	int scale_factor = 1;
+	int fb_y_flip = bctx->fb_height - bctx->resize_height;
 
 	// Kawase downsample pass
 	const gl_blur_shader_t *down_pass = &bctx->blur_shader[0];
@@ -674,23 +1126,22 @@ bool gl_dual_kawase_blur(backend_t *base, double opacity, void *ctx, const rect_
 			texorig_y = dst_y_screen_coord;
 		} else {
 			// copy from previous pass
-			src_texture = bctx->blur_textures[i - 1];
-			auto src_size = bctx->texture_sizes[i - 1];
-			tex_width = src_size.width;
-			tex_height = src_size.height;
+			src_texture = bctx->blur_textures[i - 1]->texture;
+			tex_width = bctx->blur_textures[i - 1]->width;
+			tex_height = bctx->blur_textures[i - 1]->height;
 
 			texorig_x = extent->x1 + bctx->resize_width;
 			texorig_y = dst_y_fb_coord - bctx->resize_height;
 		}
 
 		assert(src_texture);
-		assert(bctx->blur_fbos[i]);
+		assert(bctx->blur_textures[i]);
 
 		glBindTexture(GL_TEXTURE_2D, src_texture);
-		glBindVertexArray(vao[1]);
-		auto nelems = vao_nelems[1];
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[i]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_textures[i]->fbo);
 		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		gl_blur_scissor(&regions[1 + i], bctx->resize_width, fb_y_flip,
+		                scale_factor);
 
 		glUniform2f(down_pass->texorig_loc, (GLfloat)texorig_x, (GLfloat)texorig_y);
 		glUniform1f(down_pass->scale_loc, (GLfloat)scale_factor);
@@ -698,7 +1149,7 @@ bool gl_dual_kawase_blur(backend_t *base, double opacity, void *ctx, const rect_
 		glUniform2f(down_pass->unifm_pixel_norm, 1.0f / (GLfloat)tex_width,
 		            1.0f / (GLfloat)tex_height);
 
-		glDrawElements(GL_TRIANGLES, nelems, GL_UNSIGNED_INT, NULL);
+		gl_draw_vertex_range(gd, &ranges[1 + i]);
 	}
 
 	// Kawase upsample pass
@@ -714,35 +1165,36 @@ bool gl_dual_kawase_blur(backend_t *base, double opacity, void *ctx, const rect_
 		// Scale output width / height back by two in each iteration
 		scale_factor >>= 1;
 
-		const GLuint src_texture = bctx->blur_textures[i];
-		assert(src_texture);
+		assert(bctx->blur_textures[i]);
+		const GLuint src_texture = bctx->blur_textures[i]->texture;
 
 		// Calculate normalized half-width/-height of a src pixel
-		auto src_size = bctx->texture_sizes[i];
-		int tex_width = src_size.width;
-		int tex_height = src_size.height;
+		int tex_width = bctx->blur_textures[i]->width;
+		int tex_height = bctx->blur_textures[i]->height;
 
-		// The number of indices in the selected vertex array
-		GLsizei nelems;
+		// The vertices to draw
+		const struct gl_vertex_range *range;
 
 		glBindTexture(GL_TEXTURE_2D, src_texture);
 		if (i > 0) {
-			assert(bctx->blur_fbos[i - 1]);
+			assert(bctx->blur_textures[i - 1]);
 
 			// not last pass, draw into next framebuffer
-			glBindVertexArray(vao[1]);
-			nelems = vao_nelems[1];
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[i - 1]);
+			range = &ranges[iterations + i];
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER,
+			                  bctx->blur_textures[i - 1]->fbo);
 			glDrawBuffer(GL_COLOR_ATTACHMENT0);
+			gl_blur_scissor(&regions[iterations + i], bctx->resize_width,
+			                fb_y_flip, scale_factor);
 
 			glUniform2f(up_pass->orig_loc, (GLfloat)bctx->resize_width,
 			            -(GLfloat)bctx->resize_height);
 			glUniform1f(up_pass->unifm_opacity, (GLfloat)1);
 		} else {
 			// last pass, draw directly into the back buffer
-			glBindVertexArray(vao[0]);
-			nelems = vao_nelems[0];
+			range = &ranges[0];
 			glBindFramebuffer(GL_FRAMEBUFFER, gd->back_fbo);
+			gl_blur_scissor(&regions[0], 0, gd->height, 1);
 
 			glUniform2f(up_pass->orig_loc, (GLfloat)0, (GLfloat)0);
 			glUniform1f(up_pass->unifm_opacity, (GLfloat)opacity);
@@ -752,9 +1204,14 @@ bool gl_dual_kawase_blur(backend_t *base, double opacity, void *ctx, const rect_
 		glUniform2f(up_pass->unifm_pixel_norm, 1.0f / (GLfloat)tex_width,
 		            1.0f / (GLfloat)tex_height);
 
-		glDrawElements(GL_TRIANGLES, nelems, GL_UNSIGNED_INT, NULL);
+		gl_draw_vertex_range(gd, range);
 	}
 
+	glDisable(GL_SCISSOR_TEST);
+	for (int i = 0; i < iterations * 2; i++) {
+		pixman_region32_fini(&regions[i]);
+	}
+	arena_rewind(&tls_scratch, mark);
 	return true;
 }
 
@@ -762,6 +1219,7 @@ bool gl_blur(backend_t *base, double opacity, void *ctx, const region_t *reg_blu
              const region_t *reg_visible attr_unused) {
 	auto bctx = (struct gl_blur_context *)ctx;
 	auto gd = (struct gl_data *)base;
+	gl_compose_flush(gd);
 
 	bool ret = false;
 
@@ -772,35 +1230,38 @@ bool gl_blur(backend_t *base, double opacity, void *ctx, const region_t *reg_blu
 		bctx->fb_width = gd->width + bctx->resize_width * 2;
 		bctx->fb_height = gd->height + bctx->resize_height * 2;
 
+		// Give back all the old textures first, so they can be reused for the
+		// new size if it is in the same size class
+		for (int i = 0; i < bctx->blur_texture_count; ++i) {
+			if (bctx->blur_textures[i]) {
+				gl_texture_pool_release(gd, bctx->blur_textures[i]);
+				bctx->blur_textures[i] = NULL;
+			}
+		}
 		for (int i = 0; i < bctx->blur_texture_count; ++i) {
-			auto tex_size = bctx->texture_sizes + i;
+			int tex_width = bctx->fb_width, tex_height = bctx->fb_height;
 			if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
 				// Use smaller textures for each iteration (quarter of the
 				// previous texture)
-				tex_size->width = 1 + ((bctx->fb_width - 1) >> (i + 1));
-				tex_size->height = 1 + ((bctx->fb_height - 1) >> (i + 1));
-			} else {
-				tex_size->width = bctx->fb_width;
-				tex_size->height = bctx->fb_height;
+				tex_width = 1 + ((bctx->fb_width - 1) >> (i + 1));
+				tex_height = 1 + ((bctx->fb_height - 1) >> (i + 1));
 			}
 
-			glBindTexture(GL_TEXTURE_2D, bctx->blur_textures[i]);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_size->width,
-			             tex_size->height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
-
-			if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
-				// Attach texture to FBO target
-				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[i]);
-				glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER,
-				                       GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-				                       bctx->blur_textures[i], 0);
-				if (!gl_check_fb_complete(GL_FRAMEBUFFER)) {
-					glBindFramebuffer(GL_FRAMEBUFFER, 0);
-					return false;
-				}
+			bctx->blur_textures[i] =
+			    gl_texture_pool_acquire(gd, GL_RGBA8, tex_width, tex_height);
+			if (!bctx->blur_textures[i]) {
+				// Try again on the next blur
+				bctx->fb_width = bctx->fb_height = 0;
+				return false;
 			}
+			glBindTexture(GL_TEXTURE_2D, bctx->blur_textures[i]->texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+			                GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+			                GL_CLAMP_TO_EDGE);
 		}
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 	}
 
 	// Remainder: regions are in Xorg coordinates
@@ -810,82 +1271,43 @@ bool gl_blur(backend_t *base, double opacity, void *ctx, const region_t *reg_blu
 	             *extent_resized = pixman_region32_extents(&reg_blur_resized);
 	int width = extent->x2 - extent->x1, height = extent->y2 - extent->y1;
 	if (width == 0 || height == 0) {
+		pixman_region32_fini(&reg_blur_resized);
 		return true;
 	}
 
-	int nrects, nrects_resized;
-	const rect_t *rects = pixman_region32_rectangles((region_t *)reg_blur, &nrects),
-	             *rects_resized =
-	                 pixman_region32_rectangles(&reg_blur_resized, &nrects_resized);
-	if (!nrects || !nrects_resized) {
-		return true;
-	}
-
-	auto coord = ccalloc(nrects * 16, GLint);
-	auto indices = ccalloc(nrects * 6, GLuint);
-	x_rect_to_coords(nrects, rects, extent_resized->x1, extent_resized->y2,
-	                 bctx->fb_height, gd->height, false, coord, indices);
-
-	auto coord_resized = ccalloc(nrects_resized * 16, GLint);
-	auto indices_resized = ccalloc(nrects_resized * 6, GLuint);
-	x_rect_to_coords(nrects_resized, rects_resized, extent_resized->x1,
-	                 extent_resized->y2, bctx->fb_height, bctx->fb_height, false,
-	                 coord_resized, indices_resized);
-	pixman_region32_fini(&reg_blur_resized);
-
-	GLuint vao[2];
-	glGenVertexArrays(2, vao);
-	GLuint bo[4];
-	glGenBuffers(4, bo);
-
-	glBindVertexArray(vao[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[1]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * nrects * 16, coord, GL_STATIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * nrects * 6,
-	             indices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
-	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
-
-	glBindVertexArray(vao[1]);
-	glBindBuffer(GL_ARRAY_BUFFER, bo[2]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[3]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord_resized) * nrects_resized * 16,
-	             coord_resized, GL_STATIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	             (long)sizeof(*indices_resized) * nrects_resized * 6, indices_resized,
-	             GL_STATIC_DRAW);
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
-	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
-
-	int vao_nelems[2] = {nrects * 6, nrects_resized * 6};
-
 	if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
-		ret = gl_dual_kawase_blur(base, opacity, ctx, extent_resized, vao, vao_nelems);
+		// Dual-kawase draws a different region in each pass
+		ret = gl_dual_kawase_blur(base, opacity, ctx, reg_blur, extent_resized);
 	} else {
-		ret = gl_kernel_blur(base, opacity, ctx, extent_resized, vao, vao_nelems);
+		// The last pass draws the original region, the other passes draw the
+		// resized one
+		region_t regions[2];
+		pixman_region32_init(&regions[0]);
+		pixman_region32_init(&regions[1]);
+		pixman_region32_copy(&regions[0], (region_t *)reg_blur);
+		pixman_region32_copy(&regions[1], &reg_blur_resized);
+
+		struct gl_vertex_range ranges[2];
+		gl_upload_blur_regions(gd, bctx, extent_resized, regions, 2, ranges);
+		glBindVertexArray(gd->vao);
+		if (bctx->ncompute_passes) {
+			ret = gl_compute_blur(base, opacity, ctx, extent_resized, ranges);
+		} else if (bctx->downscale > 1) {
+			ret = gl_downscaled_blur(base, opacity, ctx, extent_resized,
+			                         ranges);
+		} else {
+			ret = gl_kernel_blur(base, opacity, ctx, extent_resized, ranges);
+		}
+		pixman_region32_fini(&regions[0]);
+		pixman_region32_fini(&regions[1]);
 	}
+	pixman_region32_fini(&reg_blur_resized);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glDeleteBuffers(4, bo);
 	glBindVertexArray(0);
-	glDeleteVertexArrays(2, vao);
 	glUseProgram(0);
 
-	free(indices);
-	free(coord);
-	free(indices_resized);
-	free(coord_resized);
-
 	gl_check_err();
 	return ret;
 }
@@ -940,6 +1362,7 @@ static int gl_win_shader_from_string(const char *vshader_str, const char *fshade
  * Callback to run on root window size change.
  */
 void gl_resize(struct gl_data *gd, int width, int height) {
+	gl_compose_flush(gd);
 	GLint viewport_dimensions[2];
 	glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewport_dimensions);
 
@@ -972,6 +1395,31 @@ static const char fill_frag[] = GLSL(330,
 	}
 );
 
+// Computes the alpha of the shadow from a summed area table of the convolution kernel,
+// the same way make_shadow does
+static const char shadow_frag[] = GLSL(330,
+	uniform sampler2D kernel_sum;
+	uniform int kernel_size;
+	// Size of the window casting the shadow
+	uniform ivec2 size;
+	uniform vec4 color;
+	float sum_at(ivec2 p) {
+		if (p.x < 0 || p.y < 0)
+			return 0.0;
+		return texelFetch(kernel_sum, p, 0).r;
+	}
+	void main() {
+		// The part of the kernel overlapping with the window, see sum_kernel
+		ivec2 start = ivec2(kernel_size - 1) - ivec2(gl_FragCoord.xy);
+		ivec2 end = clamp(start + size, 0, kernel_size);
+		start = clamp(start, 0, kernel_size);
+		float sum = sum_at(end - 1) - sum_at(ivec2(start.x, end.y) - 1) -
+		            sum_at(ivec2(end.x, start.y) - 1) + sum_at(start - 1);
+		float alpha = clamp(sum, 0.0, 1.0) * color.a;
+		gl_FragColor = vec4(color.rgb * alpha, alpha);
+	}
+);
+
 static const char fill_vert[] = GLSL(330,
 	layout(location = 0) in vec2 in_coord;
 	uniform mat4 projection;
@@ -1005,26 +1453,17 @@ static const char interpolating_vert[] = GLSL(330,
 /// @param[in] y_inverted whether the y coordinates in `clip` should be inverted
 static void _gl_fill(backend_t *base, struct color c, const region_t *clip, GLuint target,
                      int height, bool y_inverted) {
-	static const GLuint fill_vert_in_coord_loc = 0;
 	int nrects;
 	const rect_t *rect = pixman_region32_rectangles((region_t *)clip, &nrects);
 	auto gd = (struct gl_data *)base;
 
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	GLuint bo[2];
-	glGenBuffers(2, bo);
 	glUseProgram(gd->fill_shader.prog);
 	glUniform4f(gd->fill_shader.color_loc, (GLfloat)c.red, (GLfloat)c.green,
 	            (GLfloat)c.blue, (GLfloat)c.alpha);
-	glEnableVertexAttribArray(fill_vert_in_coord_loc);
-	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[1]);
 
-	auto coord = ccalloc(nrects * 8, GLint);
-	auto indices = ccalloc(nrects * 6, GLuint);
+	auto mark = arena_mark(&tls_scratch);
+	auto coord = arena_new(&tls_scratch, GLint, nrects * 8);
+	auto indices = arena_new(&tls_scratch, GLuint, nrects * 6);
 	for (int i = 0; i < nrects; i++) {
 		GLint y1 = y_inverted ? height - rect[i].y2 : rect[i].y1,
 		      y2 = y_inverted ? height - rect[i].y1 : rect[i].y2;
@@ -1042,46 +1481,185 @@ static void _gl_fill(backend_t *base, struct color c, const region_t *clip, GLui
 		indices[i * 6 + 4] = (GLuint)i * 4 + 3;
 		indices[i * 6 + 5] = (GLuint)i * 4 + 0;
 	}
-	glBufferData(GL_ARRAY_BUFFER, nrects * 8 * (long)sizeof(*coord), coord, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, nrects * 6 * (long)sizeof(*indices),
-	             indices, GL_STREAM_DRAW);
+	auto range = gl_upload_vertices(gd, coord, nrects * 8, sizeof(GLint) * 2, indices,
+	                                nrects * 6);
 
-	glVertexAttribPointer(fill_vert_in_coord_loc, 2, GL_INT, GL_FALSE,
-	                      sizeof(*coord) * 2, (void *)0);
+	glBindVertexArray(gd->fill_vao);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
-	glDrawElements(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL);
+	gl_draw_vertex_range(gd, &range);
 
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glDisableVertexAttribArray(fill_vert_in_coord_loc);
 	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &vao);
 
-	glDeleteBuffers(2, bo);
-	free(indices);
-	free(coord);
+	arena_rewind(&tls_scratch, mark);
 
 	gl_check_err();
 }
 
 void gl_fill(backend_t *base, struct color c, const region_t *clip) {
 	auto gd = (struct gl_data *)base;
+	gl_compose_flush(gd);
 	return _gl_fill(base, c, clip, gd->back_fbo, gd->height, true);
 }
 
+void *gl_render_shadow(backend_t *base, int width, int height, const conv *kernel,
+                       double r, double g, double b, double a) {
+	auto gd = (struct gl_data *)base;
+	// We only support square kernels for shadow
+	assert(kernel->rsum);
+	assert(kernel->w == kernel->h);
+	int d = kernel->w;
+	int swidth = width + (d / 2) * 2, sheight = height + (d / 2) * 2;
+
+	// Upload the summed area table of the kernel
+	auto rsum = ccalloc(d * d, GLfloat);
+	for (int i = 0; i < d * d; i++) {
+		rsum[i] = (GLfloat)kernel->rsum[i];
+	}
+	GLuint kernel_texture = gl_new_texture(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, kernel_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, d, d, 0, GL_RED, GL_FLOAT, rsum);
+	free(rsum);
+
+	auto new_tex = ccalloc(1, struct gl_texture);
+	new_tex->texture = gl_new_texture(GL_TEXTURE_2D);
+	new_tex->y_inverted = true;
+	new_tex->has_alpha = true;
+	new_tex->width = swidth;
+	new_tex->height = sheight;
+	new_tex->refcount = 1;
+	glBindTexture(GL_TEXTURE_2D, new_tex->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, swidth, sheight, 0, GL_BGRA,
+	             GL_UNSIGNED_BYTE, NULL);
+
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       new_tex->texture, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	if (!gl_check_fb_complete(GL_DRAW_FRAMEBUFFER)) {
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &kernel_texture);
+		glDeleteTextures(1, &new_tex->texture);
+		free(new_tex);
+		return NULL;
+	}
+	new_tex->user_data = gd->decouple_texture_user_data(base, NULL);
+
+	GLint coord[] = {0, 0, swidth, 0, swidth, sheight, 0, sheight};
+	GLuint indices[] = {0, 1, 2, 2, 3, 0};
+	auto range = gl_upload_vertices(gd, coord, 8, sizeof(GLint) * 2, indices, 6);
+
+	glUseProgram(gd->shadow_shader.prog);
+	glUniform4f(gd->shadow_shader.color_loc, (GLfloat)r, (GLfloat)g, (GLfloat)b,
+	            (GLfloat)a);
+	glUniform2i(gd->shadow_shader.size_loc, width, height);
+	glUniform1i(gd->shadow_shader.kernel_size_loc, d);
+	glBindTexture(GL_TEXTURE_2D, kernel_texture);
+
+	// The content of the new texture is undefined, so overwrite it instead of
+	// blending
+	glDisable(GL_BLEND);
+	glBindVertexArray(gd->fill_vao);
+	gl_draw_vertex_range(gd, &range);
+	glEnable(GL_BLEND);
+
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &kernel_texture);
+	glUseProgram(0);
+
+	gl_check_err();
+
+	backend_image_created(base, swidth, sheight);
+	auto img = default_new_backend_image(swidth, sheight);
+	img->inner = (struct backend_image_inner_base *)new_tex;
+	return img;
+}
+
+void *gl_copy_area(backend_t *base, void *image_data, int x, int y, int width, int height,
+                   const region_t *reg_copy) {
+	auto gd = (struct gl_data *)base;
+	gl_compose_flush(gd);
+
+	struct backend_image *img = image_data;
+	if (!img) {
+		auto new_tex = ccalloc(1, struct gl_texture);
+		new_tex->pooled = gl_texture_pool_acquire(gd, GL_RGBA8, width, height);
+		if (!new_tex->pooled) {
+			free(new_tex);
+			return NULL;
+		}
+		new_tex->texture = new_tex->pooled->texture;
+		// Rows are stored top to bottom, like the other textures we render into
+		new_tex->y_inverted = true;
+		new_tex->has_alpha = false;
+		new_tex->width = width;
+		new_tex->height = height;
+		new_tex->refcount = 1;
+		new_tex->user_data = gd->decouple_texture_user_data(base, NULL);
+
+		glBindTexture(GL_TEXTURE_2D, new_tex->texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		backend_image_created(base, width, height);
+		img = default_new_backend_image(width, height);
+		img->inner = (struct backend_image_inner_base *)new_tex;
+	}
+	auto inner = (struct gl_texture *)img->inner;
+	assert(inner->pooled && inner->refcount == 1);
+
+	int nrects;
+	const rect_t *rects = pixman_region32_rectangles((region_t *)reg_copy, &nrects);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gd->back_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, inner->pooled->fbo);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	for (int i = 0; i < nrects; i++) {
+		// The back buffer has its origin at the lower left, the image at the
+		// upper left, so the rows are flipped while copying
+		auto r = rects[i];
+		glBlitFramebuffer(r.x1, gd->height - r.y2, r.x2, gd->height - r.y1,
+		                  r.x1 - x, r.y2 - y, r.x2 - x, r.y1 - y,
+		                  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+	gl_check_err();
+	return img;
+}
+
 static void gl_release_image_inner(backend_t *base, struct gl_texture *inner) {
 	auto gd = (struct gl_data *)base;
+	backend_image_released(base, inner->width, inner->height);
 	gd->release_user_data(base, inner);
 	assert(inner->user_data == NULL);
 
-	glDeleteTextures(1, &inner->texture);
-	glDeleteTextures(2, inner->auxiliary_texture);
+	if (inner->pooled) {
+		gl_texture_pool_release(gd, inner->pooled);
+	} else {
+		glDeleteTextures(1, &inner->texture);
+	}
+	for (size_t i = 0; i < ARR_SIZE(inner->auxiliary_texture); i++) {
+		if (inner->auxiliary_texture[i]) {
+			gl_texture_pool_release(gd, inner->auxiliary_texture[i]);
+		}
+	}
 	free(inner);
 	gl_check_err();
 }
 
 void gl_release_image(backend_t *base, void *image_data) {
+	gl_compose_flush((struct gl_data *)base);
 	struct backend_image *wd = image_data;
 	auto inner = (struct gl_texture *)wd->inner;
 	inner->refcount--;
@@ -1100,39 +1678,245 @@ static inline void gl_free_blur_shader(gl_blur_shader_t *shader) {
 	shader->prog = 0;
 }
 
-void gl_destroy_blur_context(backend_t *base attr_unused, void *ctx) {
+static void gl_free_compute_blur_passes(struct gl_blur_context *ctx) {
+	for (int i = 0; i < ctx->ncompute_passes; i++) {
+		if (ctx->compute_shader[i].prog) {
+			glDeleteProgram(ctx->compute_shader[i].prog);
+		}
+	}
+	free(ctx->compute_shader);
+	ctx->compute_shader = NULL;
+	ctx->ncompute_passes = 0;
+}
+
+void gl_destroy_blur_context(backend_t *base, void *ctx) {
 	auto bctx = (struct gl_blur_context *)ctx;
+	auto gd = (struct gl_data *)base;
 	// Free GLSL shaders/programs
 	for (int i = 0; i < bctx->npasses; ++i) {
 		gl_free_blur_shader(&bctx->blur_shader[i]);
 	}
 	free(bctx->blur_shader);
+	gl_free_compute_blur_passes(bctx);
+	gl_free_blur_shader(&bctx->scale_shader[0]);
+	gl_free_blur_shader(&bctx->scale_shader[1]);
 
 	if (bctx->blur_texture_count && bctx->blur_textures) {
-		glDeleteTextures(bctx->blur_texture_count, bctx->blur_textures);
+		for (int i = 0; i < bctx->blur_texture_count; i++) {
+			if (bctx->blur_textures[i]) {
+				gl_texture_pool_release(gd, bctx->blur_textures[i]);
+			}
+		}
 		free(bctx->blur_textures);
 	}
-	if (bctx->blur_texture_count && bctx->texture_sizes) {
-		free(bctx->texture_sizes);
-	}
-	if (bctx->blur_fbo_count && bctx->blur_fbos) {
-		glDeleteFramebuffers(bctx->blur_fbo_count, bctx->blur_fbos);
-		free(bctx->blur_fbos);
-	}
 
 	bctx->blur_texture_count = 0;
-	bctx->blur_fbo_count = 0;
 
 	free(bctx);
 
 	gl_check_err();
 }
 
+/// Create compute shader passes for a blur made of 1-dimensional kernels. Each
+/// workgroup loads a tile of pixels, plus the pixels around it the kernel reaches, into
+/// shared memory once, then every pixel in the tile is computed from there. So unlike
+/// the fragment shader passes, the number of texture fetches doesn't grow with the
+/// kernel size.
+static bool
+gl_create_compute_blur_passes(struct gl_blur_context *ctx, GLfloat *projection,
+                              struct conv **kernels, int nkernels) {
+	// clang-format off
+	static const char *COMPUTE_SHADER_BLUR = GLSL(430,
+		layout(local_size_x = %d, local_size_y = %d) in;
+		uniform sampler2D tex_src;
+		layout(rgba8, binding = 0) writeonly uniform image2D img_dst;
+		// The area to blur, in the destination image
+		uniform ivec2 origin;
+		uniform ivec2 size;
+		// Added to coordinates in the destination to get those in the source
+		uniform ivec2 src_offset;
+		// The part of the source with valid content, x1, y1, x2, y2
+		uniform ivec4 src_bounds;
+		const int width = %d;
+		const int tile = %d;
+		const ivec2 dir = ivec2(%d, %d);
+		const float weights[width] = float[](%s);
+		shared vec4 pixels[tile + width - 1];
+		void main() {
+			ivec2 id = ivec2(gl_GlobalInvocationID.xy);
+			ivec2 local_id = ivec2(gl_LocalInvocationID.xy);
+			int local = local_id.x * dir.x + local_id.y * dir.y;
+			ivec2 first =
+			    origin + id + src_offset - dir * (local + width / 2);
+			for (int i = local; i < tile + width - 1; i += tile) {
+				ivec2 src = clamp(first + dir * i, src_bounds.xy,
+				                  src_bounds.zw - 1);
+				pixels[i] = texelFetch(tex_src, src, 0);
+			}
+			barrier();
+			if (any(greaterThanEqual(id, size))) {
+				return;
+			}
+			vec4 sum = vec4(0.0, 0.0, 0.0, 0.0);
+			for (int i = 0; i < width; i++) {
+				sum += weights[i] * pixels[local + i];
+			}
+			imageStore(img_dst, origin + id, sum / float(%.7g));
+		}
+	);
+	static const char *FRAG_SHADER_COPY = GLSL(330,
+		uniform sampler2D tex_src;
+		uniform float opacity;
+		in vec2 texcoord;
+		out vec4 out_color;
+		void main() {
+			out_color = texelFetch(tex_src, ivec2(texcoord.xy), 0) * opacity;
+		}
+	);
+	// clang-format on
+
+	ctx->compute_shader = ccalloc(nkernels, gl_blur_compute_shader_t);
+	ctx->ncompute_passes = nkernels;
+	for (int i = 0; i < nkernels; i++) {
+		auto kern = kernels[i];
+		auto pass = &ctx->compute_shader[i];
+		pass->vertical = kern->w == 1 && kern->h > 1;
+		int width = pass->vertical ? kern->h : kern->w;
+
+		// '%.7g' is at most 14 characters, plus a comma
+		size_t weights_len = 15 * (size_t)width + 1;
+		char *weights = ccalloc(weights_len, char);
+		char *pc = weights;
+		double sum = 0;
+		for (int j = 0; j < width; j++) {
+			pc += snprintf(pc, weights_len - (size_t)(pc - weights), "%s%.7g",
+			               j ? "," : "", kern->data[j]);
+			sum += kern->data[j];
+		}
+
+		size_t shader_len = strlen(COMPUTE_SHADER_BLUR) + strlen(weights) +
+		                    4 * 10 /* sizes */ + 2 * 2 /* direction */ +
+		                    14 /* sum */ + 1 /* null terminator */;
+		char *shader_str = ccalloc(shader_len, char);
+		auto real_shader_len = snprintf(
+		    shader_str, shader_len, COMPUTE_SHADER_BLUR,
+		    pass->vertical ? 1 : COMPUTE_BLUR_TILE,
+		    pass->vertical ? COMPUTE_BLUR_TILE : 1, width, COMPUTE_BLUR_TILE,
+		    !pass->vertical, pass->vertical, weights, sum);
+		CHECK(real_shader_len >= 0);
+		CHECK((size_t)real_shader_len < shader_len);
+		free(weights);
+
+		GLuint shader = gl_create_shader(GL_COMPUTE_SHADER, shader_str);
+		free(shader_str);
+		if (!shader) {
+			return false;
+		}
+		pass->prog = gl_create_program(&shader, 1);
+		glDeleteShader(shader);
+		if (!pass->prog) {
+			return false;
+		}
+		pass->origin_loc = glGetUniformLocationChecked(pass->prog, "origin");
+		pass->size_loc = glGetUniformLocationChecked(pass->prog, "size");
+		pass->src_offset_loc =
+		    glGetUniformLocationChecked(pass->prog, "src_offset");
+		pass->src_bounds_loc =
+		    glGetUniformLocationChecked(pass->prog, "src_bounds");
+	}
+
+	auto pass = &ctx->blur_shader[0];
+	pass->prog = gl_create_program_from_str(vertex_shader, FRAG_SHADER_COPY);
+	if (!pass->prog) {
+		return false;
+	}
+	glBindFragDataLocation(pass->prog, 0, "out_color");
+	pass->unifm_pixel_norm = -1;
+	pass->unifm_opacity = glGetUniformLocationChecked(pass->prog, "opacity");
+	pass->orig_loc = glGetUniformLocationChecked(pass->prog, "orig");
+	pass->texorig_loc = glGetUniformLocationChecked(pass->prog, "texorig");
+
+	glUseProgram(pass->prog);
+	int pml = glGetUniformLocationChecked(pass->prog, "projection");
+	glUniformMatrix4fv(pml, 1, false, projection);
+	glUseProgram(0);
+
+	ctx->npasses = 1;
+	return true;
+}
+
+/// Create the passes scaling the image down and up for a downscaled blur.
+static bool
+gl_create_blur_scale_passes(struct gl_blur_context *ctx, GLfloat *projection) {
+	// clang-format off
+	static const char *FRAG_SHADER_DOWN = GLSL(330,
+		uniform sampler2D tex_src;
+		uniform float scale;
+		in vec2 texcoord;
+		out vec4 out_color;
+		void main() {
+			// Average the scale x scale block of pixels this pixel covers
+			ivec2 size = textureSize(tex_src, 0);
+			vec2 corner = texcoord - 0.5 * scale + 0.5;
+			int n = int(scale);
+			vec4 sum = vec4(0.0, 0.0, 0.0, 0.0);
+			for (int i = 0; i < n; i++) {
+				for (int j = 0; j < n; j++) {
+					ivec2 pos = ivec2(floor(corner + vec2(i, j)));
+					pos = clamp(pos, ivec2(0, 0), size - 1);
+					sum += texelFetch(tex_src, pos, 0);
+				}
+			}
+			out_color = sum / float(n * n);
+		}
+	);
+	static const char *FRAG_SHADER_UP = GLSL(330,
+		uniform sampler2D tex_src;
+		uniform vec2 pixel_norm;
+		uniform float downscale;
+		uniform float opacity;
+		in vec2 texcoord;
+		out vec4 out_color;
+		void main() {
+			vec2 uv = texcoord / downscale * pixel_norm;
+			out_color = texture2D(tex_src, uv) * opacity;
+		}
+	);
+	// clang-format on
+
+	const char *shaders[] = {FRAG_SHADER_DOWN, FRAG_SHADER_UP};
+	for (int i = 0; i < 2; i++) {
+		auto pass = &ctx->scale_shader[i];
+		pass->prog = gl_create_program_from_str(vertex_shader, shaders[i]);
+		if (!pass->prog) {
+			return false;
+		}
+		glBindFragDataLocation(pass->prog, 0, "out_color");
+		pass->unifm_pixel_norm =
+		    glGetUniformLocationChecked(pass->prog, "pixel_norm");
+		pass->unifm_opacity = glGetUniformLocationChecked(pass->prog, "opacity");
+		pass->orig_loc = glGetUniformLocationChecked(pass->prog, "orig");
+		pass->texorig_loc = glGetUniformLocationChecked(pass->prog, "texorig");
+		// The upscale pass draws at full resolution, only its texture
+		// coordinates are scaled
+		pass->scale_loc = glGetUniformLocationChecked(
+		    pass->prog, i == 0 ? "scale" : "downscale");
+
+		glUseProgram(pass->prog);
+		int pml = glGetUniformLocationChecked(pass->prog, "projection");
+		glUniformMatrix4fv(pml, 1, false, projection);
+		glUniform1f(pass->scale_loc, (GLfloat)ctx->downscale);
+		glUseProgram(0);
+	}
+	return true;
+}
+
 /**
  * Initialize GL blur filters.
  */
 bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
-                                   enum blur_method method, void *args) {
+                                   enum blur_method method, void *args,
+                                   bool use_compute) {
 	bool success = false;
 	auto ctx = (struct gl_blur_context *)blur_context;
 
@@ -1152,9 +1936,8 @@ bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
 		return true;
 	}
 
-	// Specify required textures and FBOs
+	// Specify required textures
 	ctx->blur_texture_count = 2;
-	ctx->blur_fbo_count = 1;
 
 	ctx->blur_shader = ccalloc(max2(2, nkernels), gl_blur_shader_t);
 
@@ -1169,10 +1952,11 @@ bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
 		uniform sampler2D tex_src;
 		uniform vec2 pixel_norm;
 		uniform float opacity;
+		uniform float scale = 1.0;
 		in vec2 texcoord;
 		out vec4 out_color;
 		void main() {
-			vec2 uv = texcoord * pixel_norm;
+			vec2 uv = texcoord / scale * pixel_norm;
 			vec4 sum = vec4(0.0, 0.0, 0.0, 0.0);
 			%s //body of the convolution
 			out_color = sum / float(%.7g) * opacity;
@@ -1186,6 +1970,30 @@ bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
 	const char *shader_add = FRAG_SHADER_BLUR_ADD;
 	char *extension = strdup("");
 
+	// Blurs made of 1-dimensional kernels, e.g. the gaussian blur, can be done with
+	// compute shaders
+	ctx->downscale = blur_downscale(method, args);
+	use_compute = use_compute && ctx->downscale == 1;
+	for (int i = 0; use_compute && i < nkernels; i++) {
+		auto kern = kernels[i];
+		use_compute = (kern->w == 1 || kern->h == 1) &&
+		              max2(kern->w, kern->h) <= COMPUTE_BLUR_MAX_KERNEL;
+	}
+	if (use_compute) {
+		if (gl_create_compute_blur_passes(ctx, projection, kernels, nkernels)) {
+			for (int i = 0; i < nkernels; i++) {
+				ctx->resize_width += kernels[i]->w / 2;
+				ctx->resize_height += kernels[i]->h / 2;
+			}
+			success = true;
+			goto out;
+		}
+		log_warn("Failed to create the compute shaders for blur, falling back to "
+		         "fragment shaders.");
+		gl_free_compute_blur_passes(ctx);
+		gl_free_blur_shader(&ctx->blur_shader[0]);
+	}
+
 	for (int i = 0; i < nkernels; i++) {
 		auto kern = kernels[i];
 		// Build shader
@@ -1281,6 +2089,7 @@ bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
 		pass->unifm_opacity = glGetUniformLocationChecked(pass->prog, "opacity");
 		pass->orig_loc = glGetUniformLocationChecked(pass->prog, "orig");
 		pass->texorig_loc = glGetUniformLocationChecked(pass->prog, "texorig");
+		pass->scale_loc = glGetUniformLocationChecked(pass->prog, "scale");
 
 		// Setup projection matrix
 		glUseProgram(pass->prog);
@@ -1292,7 +2101,18 @@ bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
 		ctx->resize_height += kern->h / 2;
 	}
 
-	if (nkernels == 1) {
+	if (ctx->downscale > 1) {
+		if (!gl_create_blur_scale_passes(ctx, projection)) {
+			log_error("Failed to create GLSL program.");
+			success = false;
+			goto out;
+		}
+		// The kernels are for the downscaled image, plus we need the pixels the
+		// scaling passes reach
+		ctx->resize_width = ctx->resize_width * ctx->downscale + ctx->downscale;
+		ctx->resize_height = ctx->resize_height * ctx->downscale + ctx->downscale;
+		ctx->npasses = nkernels;
+	} else if (nkernels == 1) {
 		// Generate an extra null pass so we don't need special code path for
 		// the single pass case
 		auto pass = &ctx->blur_shader[1];
@@ -1340,12 +2160,12 @@ bool gl_create_dual_kawase_blur_context(void *blur_context, GLfloat *projection,
 
 	auto blur_params = generate_dual_kawase_params(args);
 
-	// Specify required textures and FBOs
+	// Specify required textures
 	ctx->blur_texture_count = blur_params->iterations;
-	ctx->blur_fbo_count = blur_params->iterations;
 
 	ctx->resize_width += blur_params->expand;
 	ctx->resize_height += blur_params->expand;
+	ctx->sample_distance = (int)ceil(blur_params->offset);
 
 	ctx->npasses = 2;
 	ctx->blur_shader = ccalloc(ctx->npasses, gl_blur_shader_t);
@@ -1517,37 +2337,16 @@ void *gl_create_blur_context(backend_t *base, enum blur_method method, void *arg
 		success = gl_create_dual_kawase_blur_context(ctx, projection_matrix[0],
 		                                             method, args);
 	} else {
-		success =
-		    gl_create_kernel_blur_context(ctx, projection_matrix[0], method, args);
+		success = gl_create_kernel_blur_context(ctx, projection_matrix[0], method,
+		                                        args, gd->has_compute_shader);
 	}
 	if (!success || ctx->method == BLUR_METHOD_NONE) {
 		goto out;
 	}
 
-	// Texture size will be defined by gl_blur
-	ctx->blur_textures = ccalloc(ctx->blur_texture_count, GLuint);
-	ctx->texture_sizes = ccalloc(ctx->blur_texture_count, struct texture_size);
-	glGenTextures(ctx->blur_texture_count, ctx->blur_textures);
-
-	for (int i = 0; i < ctx->blur_texture_count; ++i) {
-		glBindTexture(GL_TEXTURE_2D, ctx->blur_textures[i]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	}
-
-	// Generate FBO and textures when needed
-	ctx->blur_fbos = ccalloc(ctx->blur_fbo_count, GLuint);
-	glGenFramebuffers(ctx->blur_fbo_count, ctx->blur_fbos);
-
-	for (int i = 0; i < ctx->blur_fbo_count; ++i) {
-		if (!ctx->blur_fbos[i]) {
-			log_error("Failed to generate framebuffer objects for blur");
-			success = false;
-			goto out;
-		}
-	}
+	// Textures are taken from the texture pool by gl_blur, when it knows the size
+	ctx->blur_textures =
+	    ccalloc(ctx->blur_texture_count, struct gl_pooled_texture *);
 
 out:
 	if (!success) {
@@ -1566,10 +2365,11 @@ void gl_get_blur_size(void *blur_context, int *width, int *height) {
 }
 
 // clang-format off
-const char *win_shader_glsl = GLSL(330,
+/// The window shader, without the version line. Each HAS_* macro is defined to true or
+/// false depending on the features wanted, the disabled ones are compiled out.
+static const char win_shader_glsl[] = QUOTE(
 	uniform float opacity;
 	uniform float dim;
-	uniform bool invert_color;
 	in vec2 texcoord;
 	uniform sampler2D tex;
 	uniform sampler2D brightness;
@@ -1577,18 +2377,25 @@ const char *win_shader_glsl = GLSL(330,
 
 	void main() {
 		vec4 c = texelFetch(tex, ivec2(texcoord), 0);
-		if (invert_color) {
+		if (HAS_INVERT) {
 			c = vec4(c.aaa - c.rgb, c.a);
 		}
-		c = vec4(c.rgb * (1.0 - dim), c.a) * opacity;
+		if (HAS_DIM) {
+			c = vec4(c.rgb * (1.0 - dim), c.a);
+		}
+		if (HAS_OPACITY) {
+			c *= opacity;
+		}
 
-		vec3 rgb_brightness = texelFetch(brightness, ivec2(0, 0), 0).rgb;
-		// Ref: https://en.wikipedia.org/wiki/Relative_luminance
-		float brightness = rgb_brightness.r * 0.21 +
-		                   rgb_brightness.g * 0.72 +
-		                   rgb_brightness.b * 0.07;
-		if (brightness > max_brightness)
-			c.rgb = c.rgb * (max_brightness / brightness);
+		if (HAS_MAX_BRIGHTNESS) {
+			vec3 rgb_brightness = texelFetch(brightness, ivec2(0, 0), 0).rgb;
+			// Ref: https://en.wikipedia.org/wiki/Relative_luminance
+			float brightness = rgb_brightness.r * 0.21 +
+			                   rgb_brightness.g * 0.72 +
+			                   rgb_brightness.b * 0.07;
+			if (brightness > max_brightness)
+				c.rgb = c.rgb * (max_brightness / brightness);
+		}
 
 		gl_FragColor = c;
 	}
@@ -1605,6 +2412,125 @@ const char *present_vertex_shader = GLSL(330,
 );
 // clang-format on
 
+/// Get the window shader with the given features, compiling it if this is the first time
+/// it is used.
+///
+/// @param features a combination of `enum gl_win_shader_feature`
+/// @return the shader, NULL if it could not be compiled
+static const gl_win_shader_t *gl_win_shader_get(struct gl_data *gd, unsigned features) {
+	assert(features < GL_WIN_SHADER_NPERMUTATIONS);
+	auto shader = &gd->win_shaders[features];
+	if (shader->prog) {
+		return shader;
+	}
+
+	static const char *const FEATURE_MACROS[] = {
+	    "HAS_OPACITY",
+	    "HAS_INVERT",
+	    "HAS_DIM",
+	    "HAS_MAX_BRIGHTNESS",
+	};
+	static_assert(1 << ARR_SIZE(FEATURE_MACROS) == GL_WIN_SHADER_NPERMUTATIONS,
+	              "Missing window shader feature macros");
+	char source[sizeof(win_shader_glsl) + 256];
+	int len = snprintf(source, sizeof(source), "#version 330\n");
+	for (size_t i = 0; i < ARR_SIZE(FEATURE_MACROS); i++) {
+		len += snprintf(source + len, sizeof(source) - (size_t)len,
+		                "#define %s %s\n", FEATURE_MACROS[i],
+		                (features & (1U << i)) ? "true" : "false");
+	}
+	snprintf(source + len, sizeof(source) - (size_t)len, "%s", win_shader_glsl);
+
+	log_debug("Compiling window shader with features %#x", features);
+	if (gl_win_shader_from_string(vertex_shader, source, shader) < 0) {
+		shader->prog = 0;
+		return NULL;
+	}
+	int pml = glGetUniformLocationChecked(shader->prog, "projection");
+	glUniformMatrix4fv(pml, 1, false, gd->projection[0]);
+	return shader;
+}
+
+/// Round a texture dimension up to its size class. The classes are at most 1/8 of the
+/// size apart, so not too much memory is wasted.
+static int gl_texture_pool_size_class(int size) {
+	int granularity = max2(next_power_of_two(size) / 8, 16);
+	return (size + granularity - 1) / granularity * granularity;
+}
+
+static inline size_t gl_pooled_texture_bytes(const struct gl_pooled_texture *tex) {
+	// Assume 4 bytes per pixel, drivers usually pad 3 channel formats anyway
+	return (size_t)tex->width * (size_t)tex->height * 4;
+}
+
+static void gl_pooled_texture_free(struct gl_pooled_texture *tex) {
+	glDeleteFramebuffers(1, &tex->fbo);
+	glDeleteTextures(1, &tex->texture);
+	free(tex);
+}
+
+struct gl_pooled_texture *
+gl_texture_pool_acquire(struct gl_data *gd, GLenum format, int width, int height) {
+	auto pool = &gd->texture_pool;
+	width = gl_texture_pool_size_class(width);
+	height = gl_texture_pool_size_class(height);
+	list_foreach(struct gl_pooled_texture, i, &pool->free, free_node) {
+		if (i->format == format && i->width == width && i->height == height) {
+			list_remove(&i->free_node);
+			pool->free_bytes -= gl_pooled_texture_bytes(i);
+			return i;
+		}
+	}
+
+	auto tex = ccalloc(1, struct gl_pooled_texture);
+	tex->format = format;
+	tex->width = width;
+	tex->height = height;
+	tex->texture = gl_new_texture(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, tex->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, (GLint)format, width, height, 0, GL_BGRA,
+	             GL_UNSIGNED_BYTE, NULL);
+
+	glGenFramebuffers(1, &tex->fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, tex->fbo);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       tex->texture, 0);
+	if (!gl_check_fb_complete(GL_DRAW_FRAMEBUFFER)) {
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		gl_pooled_texture_free(tex);
+		return NULL;
+	}
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+	gd->frame_stats.texture_allocations++;
+	gl_check_err();
+	return tex;
+}
+
+void gl_texture_pool_release(struct gl_data *gd, struct gl_pooled_texture *tex) {
+	auto pool = &gd->texture_pool;
+	list_insert_after(&pool->free, &tex->free_node);
+	pool->free_bytes += gl_pooled_texture_bytes(tex);
+
+	// Evict the least recently released textures
+	while (pool->free_bytes > pool->budget) {
+		auto lru =
+		    list_entry(pool->free.prev, struct gl_pooled_texture, free_node);
+		list_remove(&lru->free_node);
+		pool->free_bytes -= gl_pooled_texture_bytes(lru);
+		gl_pooled_texture_free(lru);
+	}
+}
+
+static void gl_texture_pool_deinit(struct gl_data *gd) {
+	auto pool = &gd->texture_pool;
+	list_foreach_safe(struct gl_pooled_texture, i, &pool->free, free_node) {
+		list_remove(&i->free_node);
+		gl_pooled_texture_free(i);
+	}
+	pool->free_bytes = 0;
+}
+
 bool gl_init(struct gl_data *gd, session_t *ps) {
 	// Initialize GLX data structure
 	glDisable(GL_DEPTH_TEST);
@@ -1653,21 +2579,41 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	                                   {0, 2.0f / (GLfloat)viewport_dimensions[1], 0, 0},
 	                                   {0, 0, 0, 0},
 	                                   {-1, -1, 0, 1}};
+	memcpy(gd->projection, projection_matrix, sizeof(projection_matrix));
+	gl_program_cache_init();
 
-	// Initialize shaders
-	gl_win_shader_from_string(vertex_shader, win_shader_glsl, &gd->win_shader);
-	int pml = glGetUniformLocationChecked(gd->win_shader.prog, "projection");
-	glUseProgram(gd->win_shader.prog);
-	glUniformMatrix4fv(pml, 1, false, projection_matrix[0]);
+	// Initialize shaders. Most windows are drawn as they are, so the plain window
+	// shader is compiled right away, the others when they are first needed.
+	if (!gl_win_shader_get(gd, 0)) {
+		log_error("Failed to create the window shader");
+		return false;
+	}
 	glUseProgram(0);
 
 	gd->fill_shader.prog = gl_create_program_from_str(fill_vert, fill_frag);
 	gd->fill_shader.color_loc = glGetUniformLocation(gd->fill_shader.prog, "color");
-	pml = glGetUniformLocationChecked(gd->fill_shader.prog, "projection");
+	int pml = glGetUniformLocationChecked(gd->fill_shader.prog, "projection");
 	glUseProgram(gd->fill_shader.prog);
 	glUniformMatrix4fv(pml, 1, false, projection_matrix[0]);
 	glUseProgram(0);
 
+	gd->shadow_shader.prog = gl_create_program_from_str(fill_vert, shadow_frag);
+	if (!gd->shadow_shader.prog) {
+		log_error("Failed to create the shadow shader");
+		return false;
+	}
+	gd->shadow_shader.color_loc =
+	    glGetUniformLocationChecked(gd->shadow_shader.prog, "color");
+	gd->shadow_shader.size_loc =
+	    glGetUniformLocationChecked(gd->shadow_shader.prog, "size");
+	gd->shadow_shader.kernel_size_loc =
+	    glGetUniformLocationChecked(gd->shadow_shader.prog, "kernel_size");
+	pml = glGetUniformLocationChecked(gd->shadow_shader.prog, "projection");
+	glUseProgram(gd->shadow_shader.prog);
+	glUniform1i(glGetUniformLocationChecked(gd->shadow_shader.prog, "kernel_sum"), 0);
+	glUniformMatrix4fv(pml, 1, false, projection_matrix[0]);
+	glUseProgram(0);
+
 	gd->present_prog = gl_create_program_from_str(present_vertex_shader, dummy_frag);
 	if (!gd->present_prog) {
 		log_error("Failed to create the present shader");
@@ -1691,6 +2637,25 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	glUniformMatrix4fv(pml, 1, false, projection_matrix[0]);
 	glUseProgram(0);
 
+	// Set up the buffers all the vertices are streamed into
+	gd->has_buffer_storage = gl_has_extension("GL_ARB_buffer_storage");
+
+	GLint gl_major = 0, gl_minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &gl_major);
+	glGetIntegerv(GL_MINOR_VERSION, &gl_minor);
+	gd->has_compute_shader = gl_major > 4 || (gl_major == 4 && gl_minor >= 3);
+	glGenVertexArrays(1, &gd->vao);
+	glGenVertexArrays(1, &gd->fill_vao);
+	glBindVertexArray(gd->vao);
+	gl_ring_buffer_init(&gd->vertex_ring, GL_ARRAY_BUFFER, 1024 * 1024,
+	                    gd->has_buffer_storage);
+	gl_ring_buffer_init(&gd->index_ring, GL_ELEMENT_ARRAY_BUFFER, 256 * 1024,
+	                    gd->has_buffer_storage);
+	gl_setup_vertex_arrays(gd);
+
+	list_init_head(&gd->texture_pool.free);
+	gd->texture_pool.budget = (size_t)ps->o.glx_texture_pool_size * 1024 * 1024;
+
 	// Set up the size of the back texture
 	gl_resize(gd, ps->root_width, ps->root_height);
 
@@ -1721,7 +2686,27 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 }
 
 void gl_deinit(struct gl_data *gd) {
-	gl_free_prog_main(&gd->win_shader);
+	for (int i = 0; i < GL_WIN_SHADER_NPERMUTATIONS; i++) {
+		gl_free_prog_main(&gd->win_shaders[i]);
+	}
+	gl_program_cache_deinit();
+	gl_set_gpu_timing(&gd->base, false);
+	if (gd->shadow_shader.prog) {
+		glDeleteProgram(gd->shadow_shader.prog);
+		gd->shadow_shader.prog = 0;
+	}
+
+	glDeleteVertexArrays(1, &gd->vao);
+	glDeleteVertexArrays(1, &gd->fill_vao);
+	gl_texture_pool_deinit(gd);
+	gl_ring_buffer_deinit(&gd->vertex_ring);
+	gl_ring_buffer_deinit(&gd->index_ring);
+
+	auto batch = &gd->compose_batch;
+	free(batch->coord);
+	free(batch->indices);
+	free(batch->cmds);
+	*batch = (struct gl_compose_batch){0};
 
 	if (gd->logger) {
 		log_remove_target_tls(gd->logger);
@@ -1749,38 +2734,43 @@ GLuint gl_new_texture(GLenum target) {
 	return texture;
 }
 
-/// Actually duplicate a texture into a new one, if this texture is shared
-static inline void gl_image_decouple(backend_t *base, struct backend_image *img) {
+/// Actually duplicate a texture into a new one, if this texture is shared. Returns
+/// false if the new texture can't be created.
+static inline bool gl_image_decouple(backend_t *base, struct backend_image *img) {
 	if (img->inner->refcount == 1) {
-		return;
+		return true;
 	}
 	auto gd = (struct gl_data *)base;
 	auto inner = (struct gl_texture *)img->inner;
 	auto new_tex = ccalloc(1, struct gl_texture);
 
-	new_tex->texture = gl_new_texture(GL_TEXTURE_2D);
+	new_tex->pooled =
+	    gl_texture_pool_acquire(gd, GL_RGBA8, inner->width, inner->height);
+	if (!new_tex->pooled) {
+		free(new_tex);
+		return false;
+	}
+	new_tex->texture = new_tex->pooled->texture;
 	new_tex->y_inverted = true;
 	new_tex->height = inner->height;
 	new_tex->width = inner->width;
 	new_tex->refcount = 1;
 	new_tex->user_data = gd->decouple_texture_user_data(base, inner->user_data);
+	backend_image_created(base, new_tex->width, new_tex->height);
 
+	// Reset the parameters, the texture could have been used for something else
 	glBindTexture(GL_TEXTURE_2D, new_tex->texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, new_tex->width, new_tex->height, 0,
-	             GL_BGRA, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
 	assert(gd->present_prog);
 	glUseProgram(gd->present_prog);
 	glBindTexture(GL_TEXTURE_2D, inner->texture);
 
-	GLuint fbo;
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
-	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-	                       new_tex->texture, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, new_tex->pooled->fbo);
 	glDrawBuffer(GL_COLOR_ATTACHMENT0);
-	gl_check_fb_complete(GL_DRAW_FRAMEBUFFER);
 
 	glClearColor(0, 0, 0, 0);
 	glClear(GL_COLOR_BUFFER_BIT);
@@ -1805,38 +2795,13 @@ static inline void gl_image_decouple(backend_t *base, struct backend_image *img)
 	};
 	// clang-format on
 	GLuint indices[] = {0, 1, 2, 2, 3, 0};
+	auto range = gl_upload_vertices(gd, coord, 16, sizeof(GLint) * 4, indices, 6);
 
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	GLuint bo[2];
-	glGenBuffers(2, bo);
-	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[1]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * 16, coord, GL_STATIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * 6, indices,
-	             GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
-	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
-
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
-
-	glDisableVertexAttribArray(vert_coord_loc);
-	glDisableVertexAttribArray(vert_in_texcoord_loc);
+	glBindVertexArray(gd->vao);
+	gl_draw_vertex_range(gd, &range);
 	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glDeleteBuffers(2, bo);
 
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glDeleteFramebuffers(1, &fbo);
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glUseProgram(0);
@@ -1845,6 +2810,7 @@ static inline void gl_image_decouple(backend_t *base, struct backend_image *img)
 
 	img->inner = (struct backend_image_inner_base *)new_tex;
 	inner->refcount--;
+	return true;
 }
 
 static void gl_image_apply_alpha(backend_t *base, struct backend_image *img,
@@ -1865,13 +2831,80 @@ static void gl_image_apply_alpha(backend_t *base, struct backend_image *img,
 	glDeleteFramebuffers(1, &fbo);
 }
 
+void gl_prepare(backend_t *base, const region_t *reg_damage attr_unused) {
+	auto gd = (struct gl_data *)base;
+	auto timer = &gd->frame_timer;
+	// If the GPU is way behind, this frame isn't measured
+	if (timer->enabled && timer->npending < GL_TIME_QUERIES) {
+		int next = (timer->head + timer->npending) % GL_TIME_QUERIES;
+		glBeginQuery(GL_TIME_ELAPSED, timer->queries[next]);
+		timer->active = true;
+	}
+}
+
+void gl_set_gpu_timing(backend_t *base, bool enable) {
+	auto gd = (struct gl_data *)base;
+	auto timer = &gd->frame_timer;
+	if (timer->enabled == enable) {
+		return;
+	}
+	assert(!timer->active);
+	if (!enable) {
+		// Results still pending are discarded
+		glDeleteQueries(GL_TIME_QUERIES, timer->queries);
+	}
+	*timer = (struct gl_frame_timer){.enabled = enable};
+	if (enable) {
+		glGenQueries(GL_TIME_QUERIES, timer->queries);
+	}
+}
+
+bool gl_wait_x_fence(backend_t *base, xcb_sync_fence_t fence) {
+	auto gd = (struct gl_data *)base;
+	if (!gd->import_sync) {
+		return false;
+	}
+	GLsync sync = gd->import_sync(GL_SYNC_X11_FENCE_EXT, (GLintptr)fence, 0);
+	if (!sync) {
+		return false;
+	}
+	// The GPU waits for the fence before running the commands that follow. The sync
+	// object is only actually deleted once the wait is over.
+	glWaitSync(sync, 0, GL_TIMEOUT_IGNORED);
+	glDeleteSync(sync);
+	gl_check_err();
+	return true;
+}
+
+bool gl_gpu_frame_time(backend_t *base, uint64_t *time) {
+	auto gd = (struct gl_data *)base;
+	auto timer = &gd->frame_timer;
+	if (!timer->npending) {
+		return false;
+	}
+	GLuint query = timer->queries[timer->head];
+	GLint available = GL_FALSE;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) {
+		return false;
+	}
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+	timer->head = (timer->head + 1) % GL_TIME_QUERIES;
+	timer->npending--;
+	*time = elapsed;
+	return true;
+}
+
 void gl_present(backend_t *base, const region_t *region) {
 	auto gd = (struct gl_data *)base;
+	gl_compose_flush(gd);
 
 	int nrects;
 	const rect_t *rect = pixman_region32_rectangles((region_t *)region, &nrects);
-	auto coord = ccalloc(nrects * 8, GLint);
-	auto indices = ccalloc(nrects * 6, GLuint);
+	auto mark = arena_mark(&tls_scratch);
+	auto coord = arena_new(&tls_scratch, GLint, nrects * 8);
+	auto indices = arena_new(&tls_scratch, GLuint, nrects * 6);
 	for (int i = 0; i < nrects; i++) {
 		// clang-format off
 		memcpy(&coord[i * 8],
@@ -1891,30 +2924,25 @@ void gl_present(backend_t *base, const region_t *region) {
 	glUseProgram(gd->present_prog);
 	glBindTexture(GL_TEXTURE_2D, gd->back_texture);
 
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	GLuint bo[2];
-	glGenBuffers(2, bo);
-	glEnableVertexAttribArray(vert_coord_loc);
-	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[1]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(GLint) * nrects * 8, coord, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(GLuint) * nrects * 6, indices,
-	             GL_STREAM_DRAW);
+	auto range = gl_upload_vertices(gd, coord, nrects * 8, sizeof(GLint) * 2, indices,
+	                                nrects * 6);
+	glBindVertexArray(gd->fill_vao);
+	gl_draw_vertex_range(gd, &range);
+	glBindVertexArray(0);
 
-	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 2, NULL);
-	glDrawElements(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL);
+	arena_rewind(&tls_scratch, mark);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	glDeleteBuffers(2, bo);
-	glDeleteVertexArrays(1, &vao);
+	log_trace("Frame done with %u draw calls, %u buffer uploads, %u texture "
+	          "allocations",
+	          gd->frame_stats.draw_calls, gd->frame_stats.buffer_uploads,
+	          gd->frame_stats.texture_allocations);
+	gd->frame_stats = (struct gl_frame_stats){0};
 
-	free(coord);
-	free(indices);
+	if (gd->frame_timer.active) {
+		glEndQuery(GL_TIME_ELAPSED);
+		gd->frame_timer.active = false;
+		gd->frame_timer.npending++;
+	}
 }
 
 bool gl_image_op(backend_t *base, enum image_operations op, void *image_data,
@@ -1922,22 +2950,41 @@ bool gl_image_op(backend_t *base, enum image_operations op, void *image_data,
 	struct backend_image *tex = image_data;
 	switch (op) {
 	case IMAGE_OP_APPLY_ALPHA:
-		gl_image_decouple(base, tex);
+		gl_compose_flush((struct gl_data *)base);
+		if (!gl_image_decouple(base, tex)) {
+			return false;
+		}
 		assert(tex->inner->refcount == 1);
 		gl_image_apply_alpha(base, tex, reg_op, *(double *)arg);
 		break;
+	case IMAGE_OP_CONTENT_CHANGED:
+		// The texture is shared by all clones of the image, so is the cached
+		// average color
+		((struct gl_texture *)tex->inner)->average_color = 0;
+		break;
 	}
 
 	return true;
 }
 
-bool gl_read_pixel(backend_t *base attr_unused, void *image_data, int x, int y,
+bool gl_read_pixel(backend_t *base, void *image_data, int x, int y,
                    struct color *output) {
+	gl_compose_flush((struct gl_data *)base);
 	struct backend_image *tex = image_data;
 	auto inner = (struct gl_texture *)tex->inner;
 	GLfloat color[4];
-	glReadPixels(x, inner->y_inverted ? inner->height - y : y, 1, 1, GL_RGBA,
+
+	// Read from the texture of the image, not whatever framebuffer is bound
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       inner->texture, 0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(x, inner->y_inverted ? y : inner->height - 1 - y, 1, 1, GL_RGBA,
 	             GL_FLOAT, color);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
 	output->alpha = color[3];
 	output->red = color[0];
 	output->green = color[1];
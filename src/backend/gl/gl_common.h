@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include "backend/backend.h"
+#include "list.h"
 #include "log.h"
 #include "region.h"
 
@@ -24,6 +25,17 @@ typedef struct {
 	GLint unifm_max_brightness;
 } gl_win_shader_t;
 
+/// Features of the window shader. Each combination of them that is used gets its own
+/// program, so a window only pays for what it uses.
+enum gl_win_shader_feature {
+	GL_WIN_SHADER_OPACITY = 1,
+	GL_WIN_SHADER_INVERT = 2,
+	GL_WIN_SHADER_DIM = 4,
+	GL_WIN_SHADER_MAX_BRIGHTNESS = 8,
+	/// Number of possible combinations
+	GL_WIN_SHADER_NPERMUTATIONS = 16,
+};
+
 // Program and uniforms for brightness shader
 typedef struct {
 	GLuint prog;
@@ -39,11 +51,51 @@ typedef struct {
 	GLint scale_loc;
 } gl_blur_shader_t;
 
+// Program and uniforms for compute shader blur passes
+typedef struct {
+	GLuint prog;
+	GLint origin_loc;
+	GLint size_loc;
+	GLint src_offset_loc;
+	GLint src_bounds_loc;
+	/// Whether the kernel of this pass is vertical
+	bool vertical;
+} gl_blur_compute_shader_t;
+
 typedef struct {
 	GLuint prog;
 	GLint color_loc;
 } gl_fill_shader_t;
 
+// Program and uniforms for shadow shader
+typedef struct {
+	GLuint prog;
+	GLint color_loc;
+	GLint size_loc;
+	GLint kernel_size_loc;
+} gl_shadow_shader_t;
+
+/// A texture taken from the texture pool, and a framebuffer it's attached to
+struct gl_pooled_texture {
+	GLuint texture, fbo;
+	GLenum format;
+	/// Size of the texture, which is the requested size rounded up to its size class
+	int width, height;
+	/// Node in the list of free textures of the pool, when it's not in use
+	struct list_node free_node;
+};
+
+/// Textures no longer in use, kept around to be reused instead of allocating new
+/// ones. When they take up more memory than the budget, the least recently released
+/// ones are deleted.
+struct gl_texture_pool {
+	/// The most recently released texture comes first
+	struct list_node free;
+	/// Memory used by the free textures, and how much they are allowed to use, in
+	/// bytes
+	size_t free_bytes, budget;
+};
+
 /// @brief Wrapper of a binded GLX texture.
 struct gl_texture {
 	int refcount;
@@ -51,24 +103,135 @@ struct gl_texture {
 	GLuint texture;
 	int width, height;
 	bool y_inverted;
+	/// Where `texture` comes from, if it is taken from the texture pool
+	struct gl_pooled_texture *pooled;
 
 	// Textures for auxiliary uses.
-	GLuint auxiliary_texture[2];
+	struct gl_pooled_texture *auxiliary_texture[2];
+	/// 1x1 texture holding the average color of `texture`, one of the auxiliary
+	/// textures. 0 if it hasn't been computed, or the content has changed since.
+	GLuint average_color;
 	void *user_data;
 };
 
+/// A texture draw queued in the compose batch
+struct gl_compose_cmd {
+	GLuint texture;
+	/// Texture holding the average brightness of `texture`, 0 if not needed
+	GLuint brightness;
+	float opacity;
+	float dim;
+	float max_brightness;
+	bool color_inverted;
+	/// Range of this draw in the batch's index buffer
+	int first_index;
+	int nindices;
+};
+
+/// Compose operations queued up, to be uploaded and drawn together. Anything else
+/// that touches the GL state or the textures flushes the batch first, so the order of
+/// operations is unchanged.
+struct gl_compose_batch {
+	GLint *coord;
+	GLuint *indices;
+	/// Number of rectangles queued, and allocated in coord/indices
+	int nrects, rects_capacity;
+	struct gl_compose_cmd *cmds;
+	int ncmds, cmds_capacity;
+};
+
+#ifndef GL_SYNC_X11_FENCE_EXT
+// From GL_EXT_x11_sync_object, older glext.h might not have it
+#define GL_SYNC_X11_FENCE_EXT 0x90E1
+#endif
+
+#define GL_RING_BUFFER_SECTIONS 4
+
+/// A buffer object vertex data is streamed into. Uploads are appended, and wrap around
+/// to the start when the end is reached, so the storage is never reallocated. With
+/// ARB_buffer_storage the buffer is mapped persistently, and a fence is placed on each
+/// section of the buffer when we move past it, so it is not overwritten before the
+/// GPU is done with it.
+struct gl_ring_buffer {
+	GLuint bo;
+	GLenum target;
+	/// Persistently mapped storage of `bo`, NULL if glBufferSubData is used instead
+	char *map;
+	/// Size of the buffer, and where the next upload goes
+	size_t size, head;
+	/// The section of the buffer `head` is in
+	int section;
+	GLsync fences[GL_RING_BUFFER_SECTIONS];
+};
+
+/// Vertices and indices of a draw, uploaded to the ring buffers
+struct gl_vertex_range {
+	/// Offset of the first index in the index buffer, in bytes
+	size_t index_offset;
+	/// Value added to each index
+	GLint base_vertex;
+	int nelems;
+};
+
+/// Number of frames the GPU can be measuring at the same time. Results are normally
+/// available one or two frames later.
+#define GL_TIME_QUERIES 4
+
+/// Timer queries measuring how long the GPU takes to render the frames
+struct gl_frame_timer {
+	bool enabled;
+	/// Whether the current frame is being measured
+	bool active;
+	GLuint queries[GL_TIME_QUERIES];
+	/// The oldest query waiting for its result, and number of queries waiting
+	int head, npending;
+};
+
+/// Counters of GL operations done in a frame
+struct gl_frame_stats {
+	unsigned int draw_calls;
+	/// Number of times vertex or index data is uploaded
+	unsigned int buffer_uploads;
+	/// Number of textures the texture pool had to allocate
+	unsigned int texture_allocations;
+};
+
 struct gl_data {
 	backend_t base;
 	// If we are using proprietary NVIDIA driver
 	bool is_nvidia;
 	// Height and width of the root window
 	int height, width;
-	gl_win_shader_t win_shader;
+	/// Window shaders for each combination of `enum gl_win_shader_feature`, compiled
+	/// when first used. prog is 0 if it hasn't been compiled yet.
+	gl_win_shader_t win_shaders[GL_WIN_SHADER_NPERMUTATIONS];
+	/// Projection matrix for the viewport, which lets all vertices be given in screen
+	/// coordinates
+	GLfloat projection[4][4];
 	gl_brightness_shader_t brightness_shader;
 	gl_fill_shader_t fill_shader;
+	gl_shadow_shader_t shadow_shader;
 	GLuint back_texture, back_fbo;
 	GLuint present_prog;
 
+	struct gl_compose_batch compose_batch;
+	struct gl_frame_stats frame_stats;
+	struct gl_frame_timer frame_timer;
+
+	bool has_buffer_storage;
+	/// glImportSyncEXT from GL_EXT_x11_sync_object, NULL if it's not supported
+	GLsync (*import_sync)(GLenum external_sync_type, GLintptr external_sync,
+	                      GLbitfield flags);
+	/// Whether compute shaders and image load/store are available, i.e. OpenGL 4.3
+	bool has_compute_shader;
+	/// Streaming buffers all vertices and indices are uploaded to
+	struct gl_ring_buffer vertex_ring, index_ring;
+	/// Vertex arrays sourcing from the ring buffers. `vao` has texture coordinates
+	/// interleaved with the vertex coordinates, `fill_vao` only has the latter.
+	GLuint vao, fill_vao;
+
+	struct gl_texture_pool texture_pool;
+
 	/// Called when an gl_texture is decoupled from the texture it refers. Returns
 	/// the decoupled user_data
 	void *(*decouple_texture_user_data)(backend_t *base, void *user_data);
@@ -94,6 +257,9 @@ GLuint gl_create_program_from_str(const char *vert_shader_str, const char *frag_
 void gl_compose(backend_t *, void *ptex, int dst_x, int dst_y, const region_t *reg_tgt,
                 const region_t *reg_visible);
 
+/// Draw all the queued compose operations
+void gl_compose_flush(struct gl_data *gd);
+
 void gl_resize(struct gl_data *, int width, int height);
 
 bool gl_init(struct gl_data *gd, session_t *);
@@ -101,6 +267,18 @@ void gl_deinit(struct gl_data *gd);
 
 GLuint gl_new_texture(GLenum target);
 
+/// Take a texture with the internal format `format`, which is at least `width` x
+/// `height`, from the texture pool. A new texture is allocated if there is no free
+/// one in the same size class. The content and the parameters of the texture are
+/// undefined. Returns NULL if a framebuffer can't be made for the new texture.
+///
+/// Changes the GL_TEXTURE_2D and GL_DRAW_FRAMEBUFFER bindings.
+struct gl_pooled_texture *
+gl_texture_pool_acquire(struct gl_data *gd, GLenum format, int width, int height);
+
+/// Give a texture back to the texture pool
+void gl_texture_pool_release(struct gl_data *gd, struct gl_pooled_texture *tex);
+
 bool gl_image_op(backend_t *base, enum image_operations op, void *image_data,
                  const region_t *reg_op, const region_t *reg_visible, void *arg);
 
@@ -108,6 +286,9 @@ void gl_release_image(backend_t *base, void *image_data);
 
 void *gl_clone(backend_t *base, const void *image_data, const region_t *reg_visible);
 
+void *gl_copy_area(backend_t *base, void *image_data, int x, int y, int width, int height,
+                   const region_t *reg_copy);
+
 bool gl_blur(backend_t *base, double opacity, void *, const region_t *reg_blur,
              const region_t *reg_visible);
 void *gl_create_blur_context(backend_t *base, enum blur_method, void *args);
@@ -116,7 +297,14 @@ void gl_get_blur_size(void *blur_context, int *width, int *height);
 
 void gl_fill(backend_t *base, struct color, const region_t *clip);
 
+void *gl_render_shadow(backend_t *base, int width, int height, const conv *kernel,
+                       double r, double g, double b, double a);
+
+void gl_prepare(backend_t *base, const region_t *reg_damage);
 void gl_present(backend_t *base, const region_t *);
+void gl_set_gpu_timing(backend_t *base, bool enable);
+bool gl_gpu_frame_time(backend_t *base, uint64_t *time);
+bool gl_wait_x_fence(backend_t *base, xcb_sync_fence_t fence);
 bool gl_read_pixel(backend_t *base, void *image_data, int x, int y, struct color *output);
 
 static inline void gl_delete_texture(GLuint texture) {
@@ -12,6 +12,7 @@
 
 #include <X11/Xlib-xcb.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <pixman.h>
 #include <stdbool.h>
@@ -24,6 +25,7 @@
 #include "backend/backend_common.h"
 #include "backend/gl/gl_common.h"
 #include "backend/gl/glx.h"
+#include "cache.h"
 #include "common.h"
 #include "compiler.h"
 #include "config.h"
@@ -40,12 +42,27 @@ struct _glx_pixmap {
 	bool owned;
 };
 
+/// Maximum number of texture objects kept around for reuse
+#define GLX_TEXTURE_POOL_SIZE 32
+
 struct _glx_data {
 	struct gl_data gl;
 	Display *display;
 	int screen;
 	xcb_window_t target_win;
 	GLXContext ctx;
+
+	/// FBConfigs found for visuals, from visual ids to `struct glx_fbconfig_info *`,
+	/// which is NULL if there is no usable FBConfig for the visual
+	struct icache *fbconfigs;
+	/// Texture objects that were bound to pixmaps, their storage has been released,
+	/// they can be bound to new pixmaps
+	GLuint free_textures[GLX_TEXTURE_POOL_SIZE];
+	int nfree_textures;
+
+	// Statistics of the caches
+	uint64_t fbconfig_lookups, fbconfig_hits;
+	uint64_t texture_binds, texture_reuses;
 };
 
 #define glXGetFBConfigAttribChecked(a, b, attr, c)                                       \
@@ -169,6 +186,13 @@ static void glx_release_image(backend_t *base, struct gl_texture *tex) {
 		glBindTexture(GL_TEXTURE_2D, tex->texture);
 		glXReleaseTexImageEXT(gd->display, p->glpixmap, GLX_FRONT_LEFT_EXT);
 		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// The texture has no storage of its own, keep it for the next pixmap
+		// instead of letting it be deleted
+		if (gd->nfree_textures < GLX_TEXTURE_POOL_SIZE) {
+			gd->free_textures[gd->nfree_textures++] = tex->texture;
+			tex->texture = 0;
+		}
 	}
 
 	// Free GLX Pixmap
@@ -186,12 +210,32 @@ static void glx_release_image(backend_t *base, struct gl_texture *tex) {
 	tex->user_data = NULL;
 }
 
+/// Free an FBConfig info cached in `fbconfigs`
+static void glx_free_fbconfig(void *ud attr_unused, uint64_t info) {
+	free((struct glx_fbconfig_info *)(uintptr_t)info);
+}
+
 /**
  * Destroy GLX related resources.
  */
 void glx_deinit(backend_t *base) {
 	struct _glx_data *gd = (void *)base;
 
+	if (gd->fbconfig_lookups) {
+		log_info("GLX: %" PRIu64 " of %" PRIu64 " FBConfig lookups and %" PRIu64
+		         " of %" PRIu64 " texture binds were served from the caches",
+		         gd->fbconfig_hits, gd->fbconfig_lookups, gd->texture_reuses,
+		         gd->texture_binds);
+	}
+	if (gd->fbconfigs) {
+		icache_free(gd->fbconfigs, glx_free_fbconfig, NULL);
+		gd->fbconfigs = NULL;
+	}
+	if (gd->nfree_textures) {
+		glDeleteTextures(gd->nfree_textures, gd->free_textures);
+		gd->nfree_textures = 0;
+	}
+
 	gl_deinit(&gd->gl);
 
 	// Destroy GLX context
@@ -240,6 +284,7 @@ static backend_t *glx_init(session_t *ps) {
 	gd->display = ps->dpy;
 	gd->screen = ps->scr;
 	gd->target_win = session_get_target_window(ps);
+	gd->fbconfigs = new_icache();
 
 	XVisualInfo *pvis = NULL;
 
@@ -341,6 +386,10 @@ static backend_t *glx_init(session_t *ps) {
 
 	gd->gl.decouple_texture_user_data = glx_decouple_user_data;
 	gd->gl.release_user_data = glx_release_image;
+	if (gl_has_extension("GL_EXT_x11_sync_object")) {
+		gd->gl.import_sync =
+		    (void *)glXGetProcAddress((const GLubyte *)"glImportSyncEXT");
+	}
 
 	if (ps->o.vsync) {
 		if (!glx_set_swap_interval(1, ps->dpy, tgt)) {
@@ -365,6 +414,31 @@ end:
 	return &gd->gl.base;
 }
 
+/// Find the FBConfig for a visual, the result is owned by the cache and must not be
+/// freed.
+static const struct glx_fbconfig_info *
+glx_get_fbconfig(struct _glx_data *gd, struct xvisual_info fmt) {
+	gd->fbconfig_lookups++;
+	uint64_t cached;
+	if (icache_get(gd->fbconfigs, fmt.visual, &cached)) {
+		gd->fbconfig_hits++;
+		return (const struct glx_fbconfig_info *)(uintptr_t)cached;
+	}
+	auto info = glx_find_fbconfig(gd->display, gd->screen, fmt);
+	icache_set(gd->fbconfigs, fmt.visual, (uintptr_t)info);
+	return info;
+}
+
+/// Get a texture object to bind a pixmap to, reusing a released one if possible
+static GLuint glx_new_pixmap_texture(struct _glx_data *gd) {
+	gd->texture_binds++;
+	if (gd->nfree_textures) {
+		gd->texture_reuses++;
+		return gd->free_textures[--gd->nfree_textures];
+	}
+	return gl_new_texture(GL_TEXTURE_2D);
+}
+
 static void *
 glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, bool owned) {
 	struct _glx_data *gd = (void *)base;
@@ -381,7 +455,8 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 		return false;
 	}
 
-	auto r = xcb_get_geometry_reply(base->c, xcb_get_geometry(base->c, pixmap), NULL);
+	auto r = X_REPLY(
+	    xcb_get_geometry_reply(base->c, xcb_get_geometry(base->c, pixmap), NULL));
 	if (!r) {
 		log_error("Invalid pixmap %#010x", pixmap);
 		return NULL;
@@ -396,7 +471,14 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 	wd->inner = (struct backend_image_inner_base *)inner;
 	free(r);
 
-	auto fbcfg = glx_find_fbconfig(gd->display, gd->screen, fmt);
+	// The FBConfig can only be cached if we know which visual the pixmap has
+	struct glx_fbconfig_info *fbcfg_owned = NULL;
+	const struct glx_fbconfig_info *fbcfg;
+	if (fmt.visual != XCB_NONE) {
+		fbcfg = glx_get_fbconfig(gd, fmt);
+	} else {
+		fbcfg = fbcfg_owned = glx_find_fbconfig(gd->display, gd->screen, fmt);
+	}
 	if (!fbcfg) {
 		log_error("Couldn't find FBConfig with requested visual %x", fmt.visual);
 		goto err;
@@ -427,7 +509,8 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 	glxpixmap->pixmap = pixmap;
 	glxpixmap->glpixmap = glXCreatePixmap(gd->display, fbcfg->cfg, pixmap, attrs);
 	glxpixmap->owned = owned;
-	free(fbcfg);
+	free(fbcfg_owned);
+	fbcfg_owned = NULL;
 
 	if (!glxpixmap->glpixmap) {
 		log_error("Failed to create glpixmap for pixmap %#010x", pixmap);
@@ -438,7 +521,7 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 
 	// Create texture
 	inner->user_data = glxpixmap;
-	inner->texture = gl_new_texture(GL_TEXTURE_2D);
+	inner->texture = glx_new_pixmap_texture(gd);
 	inner->has_alpha = fmt.alpha_size != 0;
 	wd->opacity = 1;
 	wd->color_inverted = false;
@@ -447,10 +530,12 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 	glBindTexture(GL_TEXTURE_2D, inner->texture);
 	glXBindTexImageEXT(gd->display, glxpixmap->glpixmap, GLX_FRONT_LEFT_EXT, NULL);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	backend_image_created(base, inner->width, inner->height);
 
 	gl_check_err();
 	return wd;
 err:
+	free(fbcfg_owned);
 	if (glxpixmap && glxpixmap->glpixmap) {
 		glXDestroyPixmap(gd->display, glxpixmap->glpixmap);
 	}
@@ -533,15 +618,20 @@ struct backend_operations glx_ops = {
     .read_pixel = gl_read_pixel,
     .clone_image = default_clone_image,
     .blur = gl_blur,
+    .copy_area = gl_copy_area,
     .is_image_transparent = default_is_image_transparent,
+    .prepare = gl_prepare,
     .present = glx_present,
     .buffer_age = glx_buffer_age,
-    .render_shadow = default_backend_render_shadow,
+    .render_shadow = gl_render_shadow,
     .fill = gl_fill,
     .create_blur_context = gl_create_blur_context,
     .destroy_blur_context = gl_destroy_blur_context,
     .get_blur_size = gl_get_blur_size,
     .diagnostics = glx_diagnostics,
+    .set_gpu_timing = gl_set_gpu_timing,
+    .gpu_frame_time = gl_gpu_frame_time,
+    .wait_x_fence = gl_wait_x_fence,
     .max_buffer_age = 5,        // Why?
 };
 
@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "backend/gl/gl_common.h"
+#include "backend/gl/program_cache.h"
+#include "log.h"
+#include "string_utils.h"
+#include "utils.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/// Header of the cached program files
+struct program_cache_header {
+	char magic[8];
+	/// The binary format returned by glGetProgramBinary
+	uint32_t format;
+	uint32_t length;
+};
+
+static const char PROGRAM_CACHE_MAGIC[8] = "picomprg";
+
+static struct program_cache {
+	bool enabled;
+	/// Directory the programs are stored in
+	char *dir;
+	/// Hash of the strings identifying the GL driver
+	uint64_t driver_hash;
+	unsigned hits, misses;
+} program_cache;
+
+/// FNV-1a, including the terminating NUL, so concatenated strings don't collide
+static uint64_t hash_string(uint64_t hash, const char *str) {
+	do {
+		hash ^= (uint8_t)*str;
+		hash *= FNV_PRIME;
+	} while (*str++);
+	return hash;
+}
+
+static uint64_t hash_gl_string(uint64_t hash, GLenum name) {
+	auto str = (const char *)glGetString(name);
+	return hash_string(hash, str ? str : "");
+}
+
+/// Create a directory if it doesn't exist yet
+static bool ensure_dir(const char *path) {
+	if (mkdir(path, 0755) == 0 || errno == EEXIST) {
+		return true;
+	}
+	log_info("Failed to create directory %s: %s", path, strerror(errno));
+	return false;
+}
+
+void gl_program_cache_init(void) {
+	program_cache = (struct program_cache){0};
+
+	GLint nformats = 0;
+	if (gl_has_extension("GL_ARB_get_program_binary")) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nformats);
+	}
+	if (nformats <= 0) {
+		log_info("GL programs can't be cached, they will be compiled every "
+		         "time.");
+		return;
+	}
+
+	char *base;
+	const char *xdg_cache = getenv("XDG_CACHE_HOME");
+	if (xdg_cache && *xdg_cache) {
+		base = strdup(xdg_cache);
+	} else {
+		const char *home = getenv("HOME");
+		if (!home) {
+			return;
+		}
+		base = mstrjoin(home, "/.cache");
+	}
+	char *picom_dir = mstrjoin(base, "/picom");
+	program_cache.dir = mstrjoin(picom_dir, "/programs");
+	bool ok = ensure_dir(base) && ensure_dir(picom_dir) &&
+	          ensure_dir(program_cache.dir);
+	free(picom_dir);
+	free(base);
+	if (!ok) {
+		free(program_cache.dir);
+		program_cache.dir = NULL;
+		return;
+	}
+
+	uint64_t hash = FNV_OFFSET_BASIS;
+	hash = hash_gl_string(hash, GL_VENDOR);
+	hash = hash_gl_string(hash, GL_RENDERER);
+	hash = hash_gl_string(hash, GL_VERSION);
+	hash = hash_gl_string(hash, GL_SHADING_LANGUAGE_VERSION);
+	program_cache.driver_hash = hash;
+	program_cache.enabled = true;
+	log_debug("Caching GL programs in %s", program_cache.dir);
+}
+
+void gl_program_cache_deinit(void) {
+	if (program_cache.enabled) {
+		log_debug("GL program cache: %u hits, %u misses", program_cache.hits,
+		          program_cache.misses);
+	}
+	free(program_cache.dir);
+	program_cache = (struct program_cache){0};
+}
+
+bool gl_program_cache_enabled(void) {
+	return program_cache.enabled;
+}
+
+uint64_t gl_program_cache_key(const char *vert_shader_str, const char *frag_shader_str) {
+	uint64_t hash = program_cache.driver_hash;
+	hash = hash_string(hash, vert_shader_str ? vert_shader_str : "");
+	hash = hash_string(hash, frag_shader_str ? frag_shader_str : "");
+	return hash;
+}
+
+static char *program_cache_path(uint64_t key) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016" PRIx64 ".bin", key);
+	return mstrjoin(program_cache.dir, name);
+}
+
+GLuint gl_program_cache_load(uint64_t key) {
+	if (!program_cache.enabled) {
+		return 0;
+	}
+
+	auto path = program_cache_path(key);
+	GLuint prog = 0;
+	void *data = NULL;
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		goto out;
+	}
+
+	// The length has to match the file, so a truncated or corrupted file doesn't
+	// make us allocate and read more than there is
+	struct stat st;
+	struct program_cache_header header;
+	if (fstat(fileno(f), &st) != 0 || st.st_size < (off_t)sizeof(header) ||
+	    fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.length == 0 || header.length > INT32_MAX ||
+	    (off_t)header.length != st.st_size - (off_t)sizeof(header)) {
+		goto invalid;
+	}
+	data = cvalloc(header.length);
+	if (fread(data, 1, header.length, f) != header.length) {
+		goto invalid;
+	}
+
+	prog = glCreateProgram();
+	glProgramBinary(prog, header.format, data, (GLsizei)header.length);
+	GLint status = GL_FALSE;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		// Most likely the driver changed in a way that didn't change its version
+		// strings
+		glDeleteProgram(prog);
+		prog = 0;
+		gl_clear_err();
+		goto invalid;
+	}
+	goto out;
+
+invalid:
+	log_debug("Discarding unusable cached program %s", path);
+	unlink(path);
+out:
+	if (f) {
+		fclose(f);
+	}
+	if (prog) {
+		program_cache.hits++;
+	} else {
+		program_cache.misses++;
+	}
+	free(data);
+	free(path);
+	return prog;
+}
+
+void gl_program_cache_store(uint64_t key, GLuint prog) {
+	if (!program_cache.enabled) {
+		return;
+	}
+
+	GLint length = 0;
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+	void *data = cvalloc((size_t)length);
+	struct program_cache_header header;
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	GLsizei actual_length = 0;
+	GLenum format = 0;
+	glGetProgramBinary(prog, length, &actual_length, &format, data);
+	if (actual_length <= 0) {
+		gl_clear_err();
+		free(data);
+		return;
+	}
+	header.format = format;
+	header.length = (uint32_t)actual_length;
+
+	// Write to a temporary file first, so another instance never sees a partially
+	// written program
+	auto path = program_cache_path(key);
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%d.tmp", getpid());
+	auto tmp_path = mstrjoin(path, suffix);
+	FILE *f = fopen(tmp_path, "wb");
+	bool ok = f && fwrite(&header, sizeof(header), 1, f) == 1 &&
+	          fwrite(data, 1, header.length, f) == header.length;
+	if (f) {
+		ok = fclose(f) == 0 && ok;
+	}
+	if (ok && rename(tmp_path, path) == 0) {
+		log_debug("Cached program in %s", path);
+	} else {
+		log_debug("Failed to cache program in %s", path);
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+	free(path);
+	free(data);
+}
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+#include <GL/gl.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Cache of linked GL programs on disk, under $XDG_CACHE_HOME/picom/programs, so they
+/// don't have to be compiled from source every time we start. Programs are keyed by
+/// their sources and the GL driver, so a driver update invalidates them.
+///
+/// Needs ARB_get_program_binary, all functions are no-ops if it's not available.
+
+/// Check if the driver supports program binaries and prepare the cache directory. Needs
+/// a current GL context.
+void gl_program_cache_init(void);
+void gl_program_cache_deinit(void);
+bool gl_program_cache_enabled(void);
+
+/// Key of the program built from the given shader sources, either can be NULL
+uint64_t gl_program_cache_key(const char *vert_shader_str, const char *frag_shader_str);
+
+/// Load a program from the cache
+///
+/// @return the program, 0 if it's not in the cache, or the cached binary could not be
+///         used
+GLuint gl_program_cache_load(uint64_t key);
+
+/// Save a linked program into the cache. The program should have been linked with
+/// GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+void gl_program_cache_store(uint64_t key, GLuint prog);
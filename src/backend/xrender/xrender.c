@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: MPL-2.0
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +11,7 @@
 #include <xcb/render.h>
 #include <xcb/sync.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 
 #include "backend/backend.h"
 #include "backend/backend_common.h"
@@ -33,15 +35,29 @@ typedef struct _xrender_data {
 	xcb_window_t target_win;
 	/// Painting target, it is either the root or the overlay
 	xcb_render_picture_t target;
-	/// Back buffers. Double buffer, with 1 for temporary render use
-	xcb_render_picture_t back[3];
-	/// The back buffer that is for temporary use
-	/// Age of each back buffer.
-	int buffer_age[3];
+	/// Back buffers. With vsync, each one is either rendered into, idle, or held by
+	/// the X server for a present. Without vsync there is only one, which is copied
+	/// into the target.
+	xcb_render_picture_t back[XRENDER_MAX_BUFFERS];
+	/// The corresponding pixmap to the back buffer
+	xcb_pixmap_t back_pixmap[XRENDER_MAX_BUFFERS];
+	/// Number of back buffers
+	int nbuffers;
+	/// Depth of the back buffers
+	uint8_t back_depth;
 	/// The back buffer we should be painting into
 	int curr_back;
-	/// The corresponding pixmap to the back buffer
-	xcb_pixmap_t back_pixmap[3];
+	/// Which frame each back buffer holds, 0 if it is empty
+	uint64_t buffer_frame[XRENDER_MAX_BUFFERS];
+	/// Whether the X server holds each back buffer, so it can't be rendered into
+	bool buffer_busy[XRENDER_MAX_BUFFERS];
+	/// The PresentPixmap request of each busy back buffer, whose result we haven't
+	/// seen yet. sequence is 0 if there is none
+	xcb_void_cookie_t present_cookie[XRENDER_MAX_BUFFERS];
+	/// Number of frames presented
+	uint64_t frame;
+	/// Region used to tell PresentPixmap which part of the screen changed
+	xcb_xfixes_region_t present_region;
 	/// Pictures of pixel of different alpha value, used as a mask to
 	/// paint transparent images
 	xcb_render_picture_t alpha_pict[256];
@@ -57,6 +73,10 @@ typedef struct _xrender_data {
 	int target_width, target_height;
 
 	xcb_special_event_t *present_event;
+
+	/// Called when a back buffer becomes idle, and we are no longer busy
+	backend_ready_callback_t ready_callback;
+	void *ready_callback_data;
 } xrender_data;
 
 struct _xrender_blur_context {
@@ -68,6 +88,15 @@ struct _xrender_blur_context {
 
 	/// Number of blur kernels
 	int x_blur_kernel_count;
+
+	/// How many times smaller the image is blurred at, 1 for full resolution
+	int downscale;
+	/// Box filter used to scale the image down, if downscale > 1
+	struct x_convolution_kernel *x_downscale_kernel;
+
+	/// Dual kawase blur, rendered with scaling composites, if method is
+	/// BLUR_METHOD_DUAL_KAWASE
+	struct x_kawase_blur kawase;
 };
 
 struct _xrender_image_data_inner {
@@ -199,16 +228,18 @@ static void compose_impl(struct _xrender_data *xd, const struct backend_image *i
 static void compose(backend_t *base, void *img_data, int dst_x, int dst_y,
                     const region_t *reg_paint, const region_t *reg_visible) {
 	struct _xrender_data *xd = (void *)base;
-	return compose_impl(xd, img_data, dst_x, dst_y, reg_paint, reg_visible, xd->back[2]);
+	return compose_impl(xd, img_data, dst_x, dst_y, reg_paint, reg_visible,
+	                    xd->back[xd->curr_back]);
 }
 
 static void fill(backend_t *base, struct color c, const region_t *clip) {
 	struct _xrender_data *xd = (void *)base;
+	xcb_render_picture_t back = xd->back[xd->curr_back];
 	const rect_t *extent = pixman_region32_extents((region_t *)clip);
-	x_set_picture_clip_region(base->c, xd->back[2], 0, 0, clip);
+	x_set_picture_clip_region(base->c, back, 0, 0, clip);
 	// color is in X fixed point representation
 	xcb_render_fill_rectangles(
-	    base->c, XCB_RENDER_PICT_OP_OVER, xd->back[2],
+	    base->c, XCB_RENDER_PICT_OP_OVER, back,
 	    (xcb_render_color_t){.red = (uint16_t)(c.red * 0xffff),
 	                         .green = (uint16_t)(c.green * 0xffff),
 	                         .blue = (uint16_t)(c.blue * 0xffff),
@@ -220,6 +251,104 @@ static void fill(backend_t *base, struct color c, const region_t *clip) {
 	                         .height = to_u16_checked(extent->y2 - extent->y1)}});
 }
 
+/// Blur at a reduced resolution: the region is scaled down into a temporary picture,
+/// blurred there, then scaled back up into the back buffer with bilinear filtering.
+static bool blur_downscaled(struct _xrender_data *xd, struct _xrender_blur_context *bctx,
+                            double opacity, const region_t *reg_op,
+                            const region_t *reg_op_resized) {
+	xcb_render_picture_t back = xd->back[xd->curr_back];
+	xcb_connection_t *c = xd->base.c;
+	const pixman_box32_t *extent_resized =
+	    pixman_region32_extents((region_t *)reg_op_resized);
+	const auto height_resized =
+	    to_u16_checked(extent_resized->y2 - extent_resized->y1);
+	const auto width_resized =
+	    to_u16_checked(extent_resized->x2 - extent_resized->x1);
+	const int scale = bctx->downscale;
+	const auto height = to_u16_checked((height_resized + scale - 1) / scale);
+	const auto width = to_u16_checked((width_resized + scale - 1) / scale);
+	static const char *filter0 = "Nearest";        // The "null" filter
+	static const char *filter = "convolution";
+	static const char *filter_up = "bilinear";
+
+	const uint32_t pic_attrs_mask = XCB_RENDER_CP_REPEAT;
+	const xcb_render_create_picture_value_list_t pic_attrs = {
+	    .repeat = XCB_RENDER_REPEAT_PAD};
+	xcb_render_picture_t tmp_picture[2] = {
+	    x_create_picture_with_visual(xd->base.c, xd->base.root, width, height,
+	                                 xd->default_visual, pic_attrs_mask, &pic_attrs),
+	    x_create_picture_with_visual(xd->base.c, xd->base.root, width, height,
+	                                 xd->default_visual, pic_attrs_mask, &pic_attrs)};
+	if (!tmp_picture[0] || !tmp_picture[1]) {
+		log_error("Failed to build intermediate Picture.");
+		for (int i = 0; i < 2; i++) {
+			if (tmp_picture[i]) {
+				xcb_render_free_picture(c, tmp_picture[i]);
+			}
+		}
+		return false;
+	}
+
+	// Picture transforms map coordinates in the destination to the source
+	const xcb_render_transform_t identity = {
+	    DOUBLE_TO_XFIXED(1), 0, 0, 0, DOUBLE_TO_XFIXED(1), 0, 0, 0,
+	    DOUBLE_TO_XFIXED(1),
+	};
+	const xcb_render_transform_t down = {
+	    DOUBLE_TO_XFIXED(scale), 0, DOUBLE_TO_XFIXED(extent_resized->x1),
+	    0, DOUBLE_TO_XFIXED(scale), DOUBLE_TO_XFIXED(extent_resized->y1),
+	    0, 0, DOUBLE_TO_XFIXED(1),
+	};
+	const xcb_render_transform_t up = {
+	    DOUBLE_TO_XFIXED(1.0 / scale), 0, 0, 0, DOUBLE_TO_XFIXED(1.0 / scale), 0,
+	    0, 0, DOUBLE_TO_XFIXED(1),
+	};
+
+	// Scale down the back buffer, averaging each scale x scale block of pixels
+	xcb_render_picture_t src_pict = back;
+	x_set_picture_clip_region(c, src_pict, 0, 0, reg_op_resized);
+	xcb_render_set_picture_transform(c, src_pict, down);
+	xcb_render_set_picture_filter(c, src_pict, to_u16_checked(strlen(filter)), filter,
+	                              to_u32_checked(bctx->x_downscale_kernel->size),
+	                              bctx->x_downscale_kernel->kernel);
+	xcb_render_composite(c, XCB_RENDER_PICT_OP_SRC, src_pict, XCB_NONE,
+	                     tmp_picture[0], 0, 0, 0, 0, 0, 0, width, height);
+	xcb_render_set_picture_filter(c, src_pict, to_u16_checked(strlen(filter0)),
+	                              filter0, 0, NULL);
+	xcb_render_set_picture_transform(c, src_pict, identity);
+
+	int current = 0;
+	for (int i = 0; i < bctx->x_blur_kernel_count; i++) {
+		auto kernel = bctx->x_blur_kernel[i];
+		src_pict = tmp_picture[current];
+		xcb_render_set_picture_filter(c, src_pict, to_u16_checked(strlen(filter)),
+		                              filter, to_u32_checked(kernel->size),
+		                              kernel->kernel);
+		xcb_render_composite(c, XCB_RENDER_PICT_OP_SRC, src_pict, XCB_NONE,
+		                     tmp_picture[!current], 0, 0, 0, 0, 0, 0, width,
+		                     height);
+		xcb_render_set_picture_filter(
+		    c, src_pict, to_u16_checked(strlen(filter0)), filter0, 0, NULL);
+		current = !current;
+	}
+
+	// Scale the result back up into the back buffer
+	src_pict = tmp_picture[current];
+	auto alpha_pict = xd->alpha_pict[(int)(opacity * MAX_ALPHA)];
+	xcb_render_set_picture_transform(c, src_pict, up);
+	xcb_render_set_picture_filter(c, src_pict, to_u16_checked(strlen(filter_up)),
+	                              filter_up, 0, NULL);
+	x_set_picture_clip_region(c, back, 0, 0, reg_op);
+	xcb_render_composite(c, XCB_RENDER_PICT_OP_OVER, src_pict, alpha_pict,
+	                     back, 0, 0, 0, 0, to_i16_checked(extent_resized->x1),
+	                     to_i16_checked(extent_resized->y1), width_resized,
+	                     height_resized);
+
+	xcb_render_free_picture(c, tmp_picture[0]);
+	xcb_render_free_picture(c, tmp_picture[1]);
+	return true;
+}
+
 static bool blur(backend_t *backend_data, double opacity, void *ctx_,
                  const region_t *reg_blur, const region_t *reg_visible) {
 	struct _xrender_blur_context *bctx = ctx_;
@@ -228,6 +357,7 @@ static bool blur(backend_t *backend_data, double opacity, void *ctx_,
 	}
 
 	struct _xrender_data *xd = (void *)backend_data;
+	xcb_render_picture_t back = xd->back[xd->curr_back];
 	xcb_connection_t *c = xd->base.c;
 	region_t reg_op;
 	pixman_region32_init(&reg_op);
@@ -240,6 +370,23 @@ static bool blur(backend_t *backend_data, double opacity, void *ctx_,
 	region_t reg_op_resized =
 	    resize_region(&reg_op, bctx->resize_width, bctx->resize_height);
 
+	if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
+		bool ret = x_kawase_blur(c, &bctx->kawase, xd->base.root, xd->default_visual,
+		                         back, pixman_region32_extents(&reg_op_resized),
+		                         &reg_op, xd->alpha_pict[(int)(opacity * MAX_ALPHA)]);
+		x_clear_picture_clip_region(c, back);
+		pixman_region32_fini(&reg_op);
+		pixman_region32_fini(&reg_op_resized);
+		return ret;
+	}
+
+	if (bctx->downscale > 1) {
+		bool ret = blur_downscaled(xd, bctx, opacity, &reg_op, &reg_op_resized);
+		pixman_region32_fini(&reg_op);
+		pixman_region32_fini(&reg_op_resized);
+		return ret;
+	}
+
 	const pixman_box32_t *extent_resized = pixman_region32_extents(&reg_op_resized);
 	const auto height_resized = to_u16_checked(extent_resized->y2 - extent_resized->y1);
 	const auto width_resized = to_u16_checked(extent_resized->x2 - extent_resized->x1);
@@ -271,7 +418,7 @@ static bool blur(backend_t *backend_data, double opacity, void *ctx_,
 	x_set_picture_clip_region(c, tmp_picture[1], 0, 0, &clip);
 	pixman_region32_fini(&clip);
 
-	xcb_render_picture_t src_pict = xd->back[2], dst_pict = tmp_picture[0];
+	xcb_render_picture_t src_pict = back, dst_pict = tmp_picture[0];
 	auto alpha_pict = xd->alpha_pict[(int)(opacity * MAX_ALPHA)];
 	int current = 0;
 	x_set_picture_clip_region(c, src_pict, 0, 0, &reg_op_resized);
@@ -306,10 +453,10 @@ static bool blur(backend_t *backend_data, double opacity, void *ctx_,
 			                     XCB_NONE, dst_pict, 0, 0, 0, 0, 0, 0,
 			                     width_resized, height_resized);
 		} else {
-			x_set_picture_clip_region(c, xd->back[2], 0, 0, &reg_op);
+			x_set_picture_clip_region(c, back, 0, 0, &reg_op);
 			// This is the last pass, and we are doing more than 1 pass
 			xcb_render_composite(c, XCB_RENDER_PICT_OP_OVER, src_pict,
-			                     alpha_pict, xd->back[2], 0, 0, 0, 0,
+			                     alpha_pict, back, 0, 0, 0, 0,
 			                     to_i16_checked(extent_resized->x1),
 			                     to_i16_checked(extent_resized->y1),
 			                     width_resized, height_resized);
@@ -326,9 +473,9 @@ static bool blur(backend_t *backend_data, double opacity, void *ctx_,
 
 	// There is only 1 pass
 	if (i == 1) {
-		x_set_picture_clip_region(c, xd->back[2], 0, 0, &reg_op);
+		x_set_picture_clip_region(c, back, 0, 0, &reg_op);
 		xcb_render_composite(
-		    c, XCB_RENDER_PICT_OP_OVER, src_pict, alpha_pict, xd->back[2], 0, 0,
+		    c, XCB_RENDER_PICT_OP_OVER, src_pict, alpha_pict, back, 0, 0,
 		    0, 0, to_i16_checked(extent_resized->x1),
 		    to_i16_checked(extent_resized->y1), width_resized, height_resized);
 	}
@@ -343,7 +490,8 @@ static bool blur(backend_t *backend_data, double opacity, void *ctx_,
 static void *
 bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, bool owned) {
 	xcb_generic_error_t *e;
-	auto r = xcb_get_geometry_reply(base->c, xcb_get_geometry(base->c, pixmap), &e);
+	auto r = X_REPLY(
+	    xcb_get_geometry_reply(base->c, xcb_get_geometry(base->c, pixmap), &e));
 	if (!r) {
 		log_error("Invalid pixmap: %#010x", pixmap);
 		x_print_error(e->full_sequence, e->major_code, e->minor_code, e->error_code);
@@ -372,9 +520,11 @@ bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, bool
 		free(img);
 		return NULL;
 	}
+	backend_image_created(base, inner->width, inner->height);
 	return img;
 }
 static void release_image_inner(backend_t *base, struct _xrender_image_data_inner *inner) {
+	backend_image_released(base, inner->width, inner->height);
 	xcb_render_free_picture(base->c, inner->pict);
 	if (inner->owned) {
 		xcb_free_pixmap(base->c, inner->pixmap);
@@ -396,9 +546,19 @@ static void deinit(backend_t *backend_data) {
 		xcb_render_free_picture(xd->base.c, xd->alpha_pict[i]);
 	}
 	xcb_render_free_picture(xd->base.c, xd->target);
-	for (int i = 0; i < 2; i++) {
-		xcb_render_free_picture(xd->base.c, xd->back[i]);
-		xcb_free_pixmap(xd->base.c, xd->back_pixmap[i]);
+	for (int i = 0; i < xd->nbuffers; i++) {
+		if (xd->back[i] != XCB_NONE) {
+			xcb_render_free_picture(xd->base.c, xd->back[i]);
+		}
+		if (xd->back_pixmap[i] != XCB_NONE) {
+			xcb_free_pixmap(xd->base.c, xd->back_pixmap[i]);
+		}
+		if (xd->present_cookie[i].sequence) {
+			xcb_discard_reply(xd->base.c, xd->present_cookie[i].sequence);
+		}
+	}
+	if (xd->present_region != XCB_NONE) {
+		xcb_xfixes_destroy_region(xd->base.c, xd->present_region);
 	}
 	if (xd->present_event) {
 		xcb_unregister_for_special_event(xd->base.c, xd->present_event);
@@ -408,69 +568,148 @@ static void deinit(backend_t *backend_data) {
 	free(xd);
 }
 
+/// Pick the back buffer to render the next frame into. Of the idle back buffers, the
+/// one with the newest content is picked, so the least has to be repainted. Returns
+/// false if the X server holds all of them.
+static bool pick_back_buffer(struct _xrender_data *xd) {
+	int best = -1;
+	for (int i = 0; i < xd->nbuffers; i++) {
+		if (!xd->buffer_busy[i] &&
+		    (best < 0 || xd->buffer_frame[i] > xd->buffer_frame[best])) {
+			best = i;
+		}
+	}
+	if (best < 0) {
+		return false;
+	}
+	xd->curr_back = best;
+	return true;
+}
+
 static void present(backend_t *base, const region_t *region) {
 	struct _xrender_data *xd = (void *)base;
-	const rect_t *extent = pixman_region32_extents((region_t *)region);
-	int16_t orig_x = to_i16_checked(extent->x1), orig_y = to_i16_checked(extent->y1);
-	uint16_t region_width = to_u16_checked(extent->x2 - extent->x1),
-	         region_height = to_u16_checked(extent->y2 - extent->y1);
+	if (!xd->vsync) {
+		// No vsync needed, copy the updated part straight into the target picture
+		const rect_t *extent = pixman_region32_extents((region_t *)region);
+		int16_t orig_x = to_i16_checked(extent->x1),
+		        orig_y = to_i16_checked(extent->y1);
+		uint16_t region_width = to_u16_checked(extent->x2 - extent->x1),
+		         region_height = to_u16_checked(extent->y2 - extent->y1);
+		x_set_picture_clip_region(base->c, xd->back[0], 0, 0, region);
+		xcb_render_composite(base->c, XCB_RENDER_PICT_OP_SRC, xd->back[0],
+		                     XCB_NONE, xd->target, orig_x, orig_y, 0, 0, orig_x,
+		                     orig_y, region_width, region_height);
+		return;
+	}
 
-	// compose() sets clip region on the back buffer, so clear it first
-	x_clear_picture_clip_region(base->c, xd->back[xd->curr_back]);
+	// The frame was rendered into the back buffer directly, present it. If the X
+	// server copies it instead of flipping, only the updated part is copied.
+	auto b = xd->curr_back;
+	x_set_region(base->c, xd->present_region, region);
+	xd->present_cookie[b] = xcb_present_pixmap_checked(
+	    base->c, xd->target_win, xd->back_pixmap[b], 0, XCB_NONE,
+	    xd->present_region, 0, 0, XCB_NONE, XCB_NONE, XCB_NONE, 0, 0, 0, 0, 0, NULL);
+	xd->buffer_busy[b] = true;
+	xd->buffer_frame[b] = ++xd->frame;
+
+	// Carry on with another back buffer, if there is one the X server doesn't hold.
+	// Otherwise we wait for one to become idle in handle_events.
+	if (!pick_back_buffer(xd)) {
+		base->busy = true;
+	}
+}
 
-	// limit the region of update
-	x_set_picture_clip_region(base->c, xd->back[2], 0, 0, region);
+static bool present_image(backend_t *base, void *image_data) {
+	struct _xrender_data *xd = (void *)base;
+	const struct backend_image *img = image_data;
+	auto inner = (struct _xrender_image_data_inner *)img->inner;
+	// Without vsync the target is updated from the back buffer piece by piece, which
+	// needs the back buffer to always match the target
+	if (!xd->vsync || inner->width != xd->target_width ||
+	    inner->height != xd->target_height || inner->depth != xd->back_depth) {
+		return false;
+	}
+	if (img->ewidth != inner->width || img->eheight != inner->height ||
+	    img->opacity != 1 || img->dim != 0 || img->max_brightness < 1 ||
+	    img->color_inverted) {
+		return false;
+	}
 
-	if (xd->vsync) {
-		// Update the back buffer first, then present
-		xcb_render_composite(base->c, XCB_RENDER_PICT_OP_SRC, xd->back[2],
-		                     XCB_NONE, xd->back[xd->curr_back], orig_x, orig_y, 0,
-		                     0, orig_x, orig_y, region_width, region_height);
-
-		// Make sure we got reply from PresentPixmap before waiting for events,
-		// to avoid deadlock
-		auto e = xcb_request_check(
-		    base->c, xcb_present_pixmap_checked(
-		                 xd->base.c, xd->target_win,
-		                 xd->back_pixmap[xd->curr_back], 0, XCB_NONE, XCB_NONE, 0,
-		                 0, XCB_NONE, XCB_NONE, XCB_NONE, 0, 0, 0, 0, 0, NULL));
+	xcb_present_pixmap(base->c, xd->target_win, inner->pixmap, 0, XCB_NONE, XCB_NONE,
+	                   0, 0, XCB_NONE, XCB_NONE, XCB_NONE, 0, 0, 0, 0, 0, NULL);
+	// What's on screen has nothing to do with any of the back buffers now
+	for (int i = 0; i < xd->nbuffers; i++) {
+		xd->buffer_frame[i] = 0;
+	}
+	xd->frame++;
+	return true;
+}
+
+static void handle_events(backend_t *base) {
+	struct _xrender_data *xd = (void *)base;
+	if (!xd->present_event) {
+		return;
+	}
+
+	for (int i = 0; i < xd->nbuffers; i++) {
+		if (!xd->present_cookie[i].sequence) {
+			continue;
+		}
+		void *reply = NULL;
+		xcb_generic_error_t *e = NULL;
+		if (!xcb_poll_for_reply(base->c, xd->present_cookie[i].sequence, &reply,
+		                        &e)) {
+			continue;
+		}
+		xd->present_cookie[i].sequence = 0;
+		free(reply);
 		if (e) {
 			log_error("Failed to present pixmap");
 			free(e);
-			return;
-		}
-		// TODO(yshui) don't block wait for present completion
-		xcb_present_generic_event_t *pev =
-		    (void *)xcb_wait_for_special_event(base->c, xd->present_event);
-		if (!pev) {
-			// We don't know what happened, maybe X died
-			// But reset buffer age, so in case we do recover, we will
-			// render correctly.
-			xd->buffer_age[0] = xd->buffer_age[1] = -1;
-			return;
-		}
-		assert(pev->evtype == XCB_PRESENT_COMPLETE_NOTIFY);
-		xcb_present_complete_notify_event_t *pcev = (void *)pev;
-		// log_trace("Present complete: %d %ld", pcev->mode, pcev->msc);
-		xd->buffer_age[xd->curr_back] = 1;
-
-		// buffer_age < 0 means that back buffer is empty
-		if (xd->buffer_age[1 - xd->curr_back] > 0) {
-			xd->buffer_age[1 - xd->curr_back]++;
+			// There won't be an IdleNotify for this back buffer. And since
+			// the frame never made it to the screen, we don't know how the
+			// back buffers differ from what's on screen.
+			xd->buffer_busy[i] = false;
+			for (int j = 0; j < xd->nbuffers; j++) {
+				xd->buffer_frame[j] = 0;
+			}
 		}
-		if (pcev->mode == XCB_PRESENT_COMPLETE_MODE_FLIP) {
-			// We cannot use the pixmap we used anymore
-			xd->curr_back = 1 - xd->curr_back;
+	}
+
+	xcb_present_generic_event_t *pev;
+	while ((pev = (void *)xcb_poll_for_special_event(base->c, xd->present_event))) {
+		if (pev->evtype == XCB_PRESENT_IDLE_NOTIFY) {
+			xcb_present_idle_notify_event_t *ine = (void *)pev;
+			for (int i = 0; i < xd->nbuffers; i++) {
+				if (xd->back_pixmap[i] != ine->pixmap) {
+					continue;
+				}
+				xd->buffer_busy[i] = false;
+				if (xd->present_cookie[i].sequence) {
+					xcb_discard_reply(base->c,
+					                  xd->present_cookie[i].sequence);
+					xd->present_cookie[i].sequence = 0;
+				}
+			}
 		}
 		free(pev);
-	} else {
-		// No vsync needed, draw into the target picture directly
-		xcb_render_composite(base->c, XCB_RENDER_PICT_OP_SRC, xd->back[2],
-		                     XCB_NONE, xd->target, orig_x, orig_y, 0, 0, orig_x,
-		                     orig_y, region_width, region_height);
+	}
+
+	if (base->busy && pick_back_buffer(xd)) {
+		base->busy = false;
+		if (xd->ready_callback) {
+			xd->ready_callback(xd->ready_callback_data);
+		}
 	}
 }
 
+static void
+set_ready_callback(backend_t *base, backend_ready_callback_t cb, void *data) {
+	struct _xrender_data *xd = (void *)base;
+	xd->ready_callback = cb;
+	xd->ready_callback_data = data;
+}
+
 static int buffer_age(backend_t *backend_data) {
 	struct _xrender_data *xd = (void *)backend_data;
 	if (!xd->vsync) {
@@ -478,7 +717,11 @@ static int buffer_age(backend_t *backend_data) {
 		// content is always up to date. So buffer age is always 1.
 		return 1;
 	}
-	return xd->buffer_age[xd->curr_back];
+	auto frame = xd->buffer_frame[xd->curr_back];
+	if (!frame || xd->frame - frame >= INT_MAX) {
+		return -1;
+	}
+	return (int)(xd->frame - frame) + 1;
 }
 
 static struct _xrender_image_data_inner *
@@ -504,6 +747,7 @@ new_inner(backend_t *base, int w, int h, xcb_visualid_t visual, uint8_t depth) {
 	new_inner->depth = depth;
 	new_inner->refcount = 1;
 	new_inner->owned = true;
+	backend_image_created(base, w, h);
 	return new_inner;
 }
 
@@ -532,6 +776,33 @@ static bool decouple_image(backend_t *base, struct backend_image *img, const reg
 	return true;
 }
 
+static void *copy_area(backend_t *base, void *image_data, int x, int y, int width,
+                       int height, const region_t *reg_copy) {
+	struct _xrender_data *xd = (void *)base;
+	xcb_render_picture_t back = xd->back[xd->curr_back];
+	struct backend_image *img = image_data;
+	if (!img) {
+		auto depth = x_get_visual_depth(base->c, xd->default_visual);
+		auto inner = new_inner(base, width, height, xd->default_visual,
+		                       (uint8_t)depth);
+		if (!inner) {
+			return NULL;
+		}
+		img = default_new_backend_image(width, height);
+		img->inner = (struct backend_image_inner_base *)inner;
+	}
+	auto inner = (struct _xrender_image_data_inner *)img->inner;
+
+	x_set_picture_clip_region(base->c, inner->pict, to_i16_checked(-x),
+	                          to_i16_checked(-y), reg_copy);
+	xcb_render_composite(base->c, XCB_RENDER_PICT_OP_SRC, back, XCB_NONE,
+	                     inner->pict, to_i16_checked(x), to_i16_checked(y), 0, 0, 0,
+	                     0, to_u16_checked(inner->width),
+	                     to_u16_checked(inner->height));
+	x_clear_picture_clip_region(base->c, inner->pict);
+	return img;
+}
+
 static bool image_op(backend_t *base, enum image_operations op, void *image,
                      const region_t *reg_op, const region_t *reg_visible, void *arg) {
 	struct _xrender_data *xd = (void *)base;
@@ -568,6 +839,9 @@ static bool image_op(backend_t *base, enum image_operations op, void *image,
 		                     to_u16_checked(inner->height));
 		inner->has_alpha = true;
 		break;
+	case IMAGE_OP_CONTENT_CHANGED:
+		// Nothing derived from the content is kept
+		break;
 	}
 	pixman_region32_fini(&reg);
 	return true;
@@ -581,9 +855,12 @@ create_blur_context(backend_t *base attr_unused, enum blur_method method, void *
 		return ret;
 	}
 	if (method == BLUR_METHOD_DUAL_KAWASE) {
-		log_warn("Blur method 'dual_kawase' is not compatible with the 'xrender' "
-		         "backend.");
-		ret->method = BLUR_METHOD_NONE;
+		// Not a convolution, it's done with bilinear scaling, see x_kawase_blur
+		struct dual_kawase_params *params = generate_dual_kawase_params(args);
+		ret->method = BLUR_METHOD_DUAL_KAWASE;
+		x_kawase_blur_init(&ret->kawase, params->iterations, params->offset);
+		ret->resize_width = ret->resize_height = params->expand;
+		free(params);
 		return ret;
 	}
 
@@ -607,6 +884,24 @@ create_blur_context(backend_t *base attr_unused, enum blur_method method, void *
 	}
 	ret->x_blur_kernel_count = kernel_count;
 
+	ret->downscale = blur_downscale(method, args);
+	if (ret->downscale > 1) {
+		int size = ret->downscale * ret->downscale;
+		struct conv *box =
+		    cvalloc(sizeof(struct conv) + sizeof(double) * (size_t)size);
+		box->w = box->h = ret->downscale;
+		for (int i = 0; i < size; i++) {
+			box->data[i] = 1;
+		}
+		x_create_convolution_kernel(box, 1, &ret->x_downscale_kernel);
+		free(box);
+
+		// The kernels are for the downscaled image, plus we need the pixels
+		// the scaling filters reach
+		ret->resize_width = ret->resize_width * ret->downscale + ret->downscale;
+		ret->resize_height = ret->resize_height * ret->downscale + ret->downscale;
+	}
+
 	if (method != BLUR_METHOD_KERNEL) {
 		// Kernels generated by generate_blur_kernel, so we need to free them.
 		for (int i = 0; i < kernel_count; i++) {
@@ -617,12 +912,16 @@ create_blur_context(backend_t *base attr_unused, enum blur_method method, void *
 	return ret;
 }
 
-static void destroy_blur_context(backend_t *base attr_unused, void *ctx_) {
+static void destroy_blur_context(backend_t *base, void *ctx_) {
 	struct _xrender_blur_context *ctx = ctx_;
+	if (ctx->method == BLUR_METHOD_DUAL_KAWASE) {
+		x_kawase_blur_deinit(base->c, &ctx->kawase);
+	}
 	for (int i = 0; i < ctx->x_blur_kernel_count; i++) {
 		free(ctx->x_blur_kernel[i]);
 	}
 	free(ctx->x_blur_kernel);
+	free(ctx->x_downscale_kernel);
 	free(ctx);
 }
 
@@ -638,7 +937,7 @@ read_pixel(backend_t *backend_data, void *image_data, int x, int y, struct color
 	auto img = (struct backend_image *)image_data;
 	auto inner = (struct _xrender_image_data_inner *)img->inner;
 
-	auto r = XCB_AWAIT(xcb_get_image, xd->base.c, XCB_IMAGE_FORMAT_XY_PIXMAP, inner->pixmap,
+	auto r = XCB_AWAIT(xcb_get_image, xd->base.c, XCB_IMAGE_FORMAT_Z_PIXMAP, inner->pixmap,
 	                   to_i16_checked(x), to_i16_checked(y), 1, 1, (uint32_t)-1L);
 
 	if (!r) {
@@ -688,10 +987,10 @@ static backend_t *backend_xrender_init(session_t *ps) {
 	xd->vsync = ps->o.vsync;
 	if (ps->present_exists) {
 		auto eid = x_new_id(ps->c);
-		auto e =
-		    xcb_request_check(ps->c, xcb_present_select_input_checked(
-		                                 ps->c, eid, xd->target_win,
-		                                 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY));
+		auto e = X_REPLY(xcb_request_check(
+		    ps->c, xcb_present_select_input_checked(
+		               ps->c, eid, xd->target_win,
+		               XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY)));
 		if (e) {
 			log_error("Cannot select present input, vsync will be disabled");
 			xd->vsync = false;
@@ -709,10 +1008,16 @@ static backend_t *backend_xrender_init(session_t *ps) {
 		xd->vsync = false;
 	}
 
-	// We might need to do double buffering for vsync, and buffer 0 and 1 are for
-	// double buffering.
-	int first_buffer_index = xd->vsync ? 0 : 2;
-	for (int i = first_buffer_index; i < 3; i++) {
+	// With vsync, we render into as many back buffers as we are asked to, and
+	// present them. Otherwise one is enough, it's copied into the target.
+	xd->nbuffers = xd->vsync ? ps->o.xrender_buffers : 1;
+	xd->back_depth = pictfmt->depth;
+	assert(xd->nbuffers <= XRENDER_MAX_BUFFERS);
+	if (xd->vsync) {
+		xd->present_region = x_new_id(ps->c);
+		xcb_xfixes_create_region(ps->c, xd->present_region, 0, NULL);
+	}
+	for (int i = 0; i < xd->nbuffers; i++) {
 		xd->back_pixmap[i] = x_create_pixmap(ps->c, pictfmt->depth, ps->root,
 		                                     to_u16_checked(ps->root_width),
 		                                     to_u16_checked(ps->root_height));
@@ -721,7 +1026,6 @@ static backend_t *backend_xrender_init(session_t *ps) {
 		    .repeat = XCB_RENDER_REPEAT_PAD};
 		xd->back[i] = x_create_picture_with_pictfmt_and_pixmap(
 		    ps->c, pictfmt, xd->back_pixmap[i], pic_attrs_mask, &pic_attrs);
-		xd->buffer_age[i] = -1;
 		if (xd->back_pixmap[i] == XCB_NONE || xd->back[i] == XCB_NONE) {
 			log_error("Cannot create pixmap for rendering");
 			goto err;
@@ -739,7 +1043,11 @@ struct backend_operations xrender_ops = {
     .init = backend_xrender_init,
     .deinit = deinit,
     .blur = blur,
+    .copy_area = copy_area,
     .present = present,
+    .present_image = present_image,
+    .set_ready_callback = set_ready_callback,
+    .handle_events = handle_events,
     .compose = compose,
     .fill = fill,
     .bind_pixmap = bind_pixmap,
@@ -749,7 +1057,8 @@ struct backend_operations xrender_ops = {
     //.release_win = release_win,
     .is_image_transparent = default_is_image_transparent,
     .buffer_age = buffer_age,
-    .max_buffer_age = 2,
+    // A back buffer can stay idle for a few frames, while newer ones are reused
+    .max_buffer_age = XRENDER_MAX_BUFFERS * 2,
 
     .image_op = image_op,
     .read_pixel = read_pixel,
@@ -37,6 +37,7 @@
 #include "compiler.h"
 #include "config.h"
 #include "log.h"
+#include "microbench.h"
 #include "string_utils.h"
 #include "utils.h"
 #include "win.h"
@@ -152,6 +153,11 @@ struct _c2_l {
 	pcre *regex_pcre;
 	pcre_extra *regex_pcre_extra;
 #endif
+	/// The group this leaf's string pattern is matched in, together with other
+	/// leaves having the same target. NULL if it's matched on its own.
+	struct c2_string_group *group;
+	/// Index of this leaf in its group
+	int group_index;
 };
 
 /// Initializer for c2_l_t.
@@ -161,6 +167,7 @@ struct _c2_l {
 		.match_ignorecase = false, .tgt = NULL, .tgtatom = 0, .tgt_onframe = false, \
 		.predef = C2_L_PUNDEFINED, .index = 0, .type = C2_L_TUNDEFINED,             \
 		.format = 0, .ptntype = C2_L_PTUNDEFINED, .ptnstr = NULL, .ptnint = 0,      \
+		.group = NULL, .group_index = -1,                                        \
 	}
 
 static const c2_l_t leaf_def = C2_L_INIT;
@@ -170,11 +177,115 @@ struct _c2_lptr {
 	c2_ptr_t ptr;
 	void *data;
 	struct _c2_lptr *next;
+	/// Index of this condition, to find its cached match result. Assigned by
+	/// c2_list_postprocess.
+	int id;
+	/// Whether this condition only depends on window properties, so its match
+	/// result can be cached until one of them changes.
+	bool cacheable;
 };
 
 /// Initializer for c2_lptr_t.
 #define C2_LPTR_INIT                                                                     \
-	{ .ptr = C2_PTR_INIT, .data = NULL, .next = NULL, }
+	{ .ptr = C2_PTR_INIT, .data = NULL, .next = NULL, .id = -1, .cacheable = false, }
+
+/// Conditions that depend on an atom
+struct c2_atom_deps {
+	xcb_atom_t atom;
+	/// Ids of the conditions
+	int *conds;
+	int nconds;
+	int capacity;
+	UT_hash_handle hh;
+};
+
+/// A pattern found by the Aho-Corasick automaton
+struct c2_ac_output {
+	/// Index of the leaf in its group
+	int member;
+	/// Whether the pattern must match at the start of the string
+	bool anchored;
+};
+
+/// A node in the Aho-Corasick automaton
+struct c2_ac_node {
+	unsigned char byte;
+	/// Length of the string leading to this node
+	int depth;
+	int first_child;
+	int next_sibling;
+	/// The node of the longest proper suffix of this node's string
+	int fail;
+	/// The closest node on the fail chain that has outputs, or -1
+	int output_link;
+	struct c2_ac_output *outputs;
+	int noutputs;
+};
+
+/// Aho-Corasick automaton, matches many substring patterns in one pass
+struct c2_ac {
+	struct c2_ac_node *nodes;
+	int nnodes;
+	int capacity;
+	/// Whether patterns and the input are lower cased
+	bool ignorecase;
+};
+
+/// An exact pattern, and the leaves using it
+struct c2_exact_entry {
+	char *key;
+	int *members;
+	int nmembers;
+	UT_hash_handle hh;
+};
+
+enum c2_group_result {
+	/// The leaf needs to be matched on its own
+	C2_GROUP_UNKNOWN = 0,
+	C2_GROUP_FALSE,
+	C2_GROUP_TRUE,
+};
+
+/// String leaves in a condition list that have the same predefined target. Their
+/// patterns are matched together in one pass over the target string.
+struct c2_string_group {
+	int predef;
+	int nmembers;
+	/// Results of the last match, indexed by member index
+	enum c2_group_result *results;
+	/// Generation of the last match, see c2_state::generation
+	unsigned long generation;
+
+	/// Exact patterns, keyed by the pattern, or the lower cased pattern if
+	/// ignoring case
+	struct c2_exact_entry *exact;
+	struct c2_exact_entry *exact_icase;
+	/// Prefix and substring patterns
+	struct c2_ac contains;
+	struct c2_ac contains_icase;
+#ifdef CONFIG_REGEX_PCRE
+	/// All the PCRE patterns combined into one alternation. If this doesn't
+	/// match, none of them do. NULL if there aren't enough combinable patterns.
+	pcre *combined_pcre;
+	pcre_extra *combined_pcre_extra;
+	/// Members with combined PCRE patterns
+	int *pcre_members;
+	int npcre_members;
+#endif
+	struct c2_string_group *next;
+};
+
+struct c2_state {
+	/// Number of conditions that have been assigned an id
+	int nconds;
+	/// Map from atoms to conditions depending on them
+	struct c2_atom_deps *deps;
+	/// All string groups, for freeing
+	struct c2_string_group *groups;
+	/// Incremented for each c2_match call, string groups are matched again when
+	/// this changes
+	unsigned long generation;
+};
 
 /// Structure representing a predefined target.
 typedef struct {
@@ -333,7 +444,7 @@ static void attr_unused c2_dump(c2_ptr_t p);
 
 static xcb_atom_t c2_get_atom_type(const c2_l_t *pleaf);
 
-static bool c2_match_once(session_t *ps, const struct managed_win *w, const c2_ptr_t cond);
+static bool c2_match_once(session_t *ps, struct managed_win *w, const c2_ptr_t cond);
 
 /**
  * Parse a condition string.
@@ -1104,15 +1215,556 @@ static bool c2_tree_postprocess(session_t *ps, c2_ptr_t node) {
 	return c2_tree_postprocess(ps, node.b->opr2);
 }
 
+/// Get the child of an Aho-Corasick node for a byte, or -1
+static int c2_ac_child(const struct c2_ac *ac, int node, unsigned char byte) {
+	for (int i = ac->nodes[node].first_child; i >= 0; i = ac->nodes[i].next_sibling) {
+		if (ac->nodes[i].byte == byte) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/// Follow the transition for a byte from a node, going through fail links if needed
+static int c2_ac_next(const struct c2_ac *ac, int node, unsigned char byte) {
+	int next;
+	while ((next = c2_ac_child(ac, node, byte)) < 0 && node != 0) {
+		node = ac->nodes[node].fail;
+	}
+	return next >= 0 ? next : 0;
+}
+
+static int c2_ac_new_node(struct c2_ac *ac) {
+	if (ac->nnodes == ac->capacity) {
+		ac->capacity = ac->capacity * 2 + 16;
+		ac->nodes = crealloc(ac->nodes, ac->capacity);
+	}
+	ac->nodes[ac->nnodes] = (struct c2_ac_node){
+	    .first_child = -1, .next_sibling = -1, .fail = 0, .output_link = -1};
+	return ac->nnodes++;
+}
+
+static void c2_ac_add(struct c2_ac *ac, const char *pattern, int member, bool anchored) {
+	if (!ac->nnodes) {
+		c2_ac_new_node(ac);
+	}
+	int node = 0;
+	for (const char *pc = pattern; *pc; pc++) {
+		auto byte = (unsigned char)*pc;
+		if (ac->ignorecase) {
+			byte = (unsigned char)tolower(byte);
+		}
+		int child = c2_ac_child(ac, node, byte);
+		if (child < 0) {
+			child = c2_ac_new_node(ac);
+			ac->nodes[child].byte = byte;
+			ac->nodes[child].depth = ac->nodes[node].depth + 1;
+			ac->nodes[child].next_sibling = ac->nodes[node].first_child;
+			ac->nodes[node].first_child = child;
+		}
+		node = child;
+	}
+	auto pnode = &ac->nodes[node];
+	pnode->outputs = crealloc(pnode->outputs, pnode->noutputs + 1);
+	pnode->outputs[pnode->noutputs++] =
+	    (struct c2_ac_output){.member = member, .anchored = anchored};
+}
+
+/// Compute the fail and output links, after all the patterns are added
+static void c2_ac_build(struct c2_ac *ac) {
+	if (!ac->nnodes) {
+		return;
+	}
+	// Breadth first, so the fail node of a node is always done before it
+	auto queue = ccalloc(ac->nnodes, int);
+	int head = 0, tail = 0;
+	queue[tail++] = 0;
+	while (head < tail) {
+		int node = queue[head++];
+		for (int child = ac->nodes[node].first_child; child >= 0;
+		     child = ac->nodes[child].next_sibling) {
+			queue[tail++] = child;
+			if (node != 0) {
+				ac->nodes[child].fail = c2_ac_next(
+				    ac, ac->nodes[node].fail, ac->nodes[child].byte);
+			}
+			int fail = ac->nodes[child].fail;
+			ac->nodes[child].output_link =
+			    ac->nodes[fail].noutputs ? fail : ac->nodes[fail].output_link;
+		}
+	}
+	free(queue);
+}
+
+/// Report the patterns ending at `node`, after `offset` bytes of the input
+static void c2_ac_report(const struct c2_ac *ac, int node, size_t offset,
+                         enum c2_group_result *results) {
+	for (; node >= 0; node = ac->nodes[node].output_link) {
+		const struct c2_ac_node *pnode = &ac->nodes[node];
+		for (int i = 0; i < pnode->noutputs; i++) {
+			const struct c2_ac_output *output = &pnode->outputs[i];
+			if (!output->anchored || offset == (size_t)pnode->depth) {
+				results[output->member] = C2_GROUP_TRUE;
+			}
+		}
+	}
+}
+
+static void
+c2_ac_match(const struct c2_ac *ac, const char *str, enum c2_group_result *results) {
+	if (!ac->nnodes) {
+		return;
+	}
+	int node = 0;
+	// Empty patterns
+	c2_ac_report(ac, 0, 0, results);
+	for (size_t i = 0; str[i]; i++) {
+		auto byte = (unsigned char)str[i];
+		if (ac->ignorecase) {
+			byte = (unsigned char)tolower(byte);
+		}
+		node = c2_ac_next(ac, node, byte);
+		if (node != 0) {
+			c2_ac_report(ac, node, i + 1, results);
+		}
+	}
+}
+
+static void c2_ac_free(struct c2_ac *ac) {
+	for (int i = 0; i < ac->nnodes; i++) {
+		free(ac->nodes[i].outputs);
+	}
+	free(ac->nodes);
+	ac->nodes = NULL;
+	ac->nnodes = ac->capacity = 0;
+}
+
+static void c2_exact_add(struct c2_exact_entry **set, const char *key, int member) {
+	struct c2_exact_entry *entry = NULL;
+	HASH_FIND_STR(*set, key, entry);
+	if (!entry) {
+		entry = ccalloc(1, struct c2_exact_entry);
+		entry->key = strdup(key);
+		HASH_ADD_KEYPTR(hh, *set, entry->key, strlen(entry->key), entry);
+	}
+	entry->members = crealloc(entry->members, entry->nmembers + 1);
+	entry->members[entry->nmembers++] = member;
+}
+
+static void c2_exact_match(struct c2_exact_entry *set, const char *key,
+                           enum c2_group_result *results) {
+	struct c2_exact_entry *entry = NULL;
+	HASH_FIND_STR(set, key, entry);
+	if (entry) {
+		for (int i = 0; i < entry->nmembers; i++) {
+			results[entry->members[i]] = C2_GROUP_TRUE;
+		}
+	}
+}
+
+static inline char *c2_str_tolower(const char *str) {
+	char *ret = strdup(str);
+	for (char *pc = ret; *pc; pc++) {
+		*pc = (char)tolower((unsigned char)*pc);
+	}
+	return ret;
+}
+
+#ifdef CONFIG_REGEX_PCRE
+/// Whether a PCRE pattern still means the same thing after being put into an
+/// alternation with other patterns. Rejects anything that refers to groups by number,
+/// or otherwise depends on its position in the whole pattern.
+static bool c2_pcre_combinable(const char *pattern) {
+	for (const char *pc = pattern; *pc; pc++) {
+		if (pc[0] == '\\') {
+			if (pc[1] && strchr("0123456789gkQ", pc[1])) {
+				return false;
+			}
+			if (pc[1]) {
+				pc++;
+			}
+		} else if (pc[0] == '(' && (pc[1] == '*' || pc[1] == '?') &&
+		           !(pc[1] == '?' && pc[2] == ':')) {
+			return false;
+		}
+	}
+	return true;
+}
+#endif
+
+/// Whether a leaf can be matched in a string group
+static bool c2_l_groupable(const c2_l_t *pleaf) {
+	if (pleaf->ptntype != C2_L_PTSTRING || pleaf->op != C2_L_OEQ) {
+		return false;
+	}
+	switch (pleaf->predef) {
+	case C2_L_PWINDOWTYPE:
+	case C2_L_PNAME:
+	case C2_L_PCLASSG:
+	case C2_L_PCLASSI:
+	case C2_L_PROLE: break;
+	default: return false;
+	}
+	switch (pleaf->match) {
+	case C2_L_MEXACT:
+	case C2_L_MSTART:
+	case C2_L_MCONTAINS: return true;
+#ifdef CONFIG_REGEX_PCRE
+	case C2_L_MPCRE: return c2_pcre_combinable(pleaf->ptnstr);
+#endif
+	default: return false;
+	}
+}
+
+
+static struct c2_string_group *c2_string_group_new(struct c2_state *state, int predef) {
+	auto group = ccalloc(1, struct c2_string_group);
+	group->predef = predef;
+	group->contains_icase.ignorecase = true;
+	group->next = state->groups;
+	state->groups = group;
+	return group;
+}
+
+static void c2_string_group_add(struct c2_string_group *group, c2_l_t *pleaf) {
+	int member = group->nmembers++;
+	pleaf->group = group;
+	pleaf->group_index = member;
+
+	switch (pleaf->match) {
+	case C2_L_MEXACT:
+		if (pleaf->match_ignorecase) {
+			char *key = c2_str_tolower(pleaf->ptnstr);
+			c2_exact_add(&group->exact_icase, key, member);
+			free(key);
+		} else {
+			c2_exact_add(&group->exact, pleaf->ptnstr, member);
+		}
+		break;
+	case C2_L_MSTART:
+	case C2_L_MCONTAINS:
+		c2_ac_add(pleaf->match_ignorecase ? &group->contains_icase
+		                                  : &group->contains,
+		          pleaf->ptnstr, member, pleaf->match == C2_L_MSTART);
+		break;
+	case C2_L_MPCRE:
+#ifdef CONFIG_REGEX_PCRE
+		group->pcre_members =
+		    crealloc(group->pcre_members, group->npcre_members + 1);
+		group->pcre_members[group->npcre_members++] = member;
+#endif
+		break;
+	default: assert(false);
+	}
+}
+
+#ifdef CONFIG_REGEX_PCRE
+/// Combine the PCRE patterns in a group into one alternation. Leaves the group without
+/// a combined pattern if that's not worthwhile or not possible.
+static void c2_string_group_combine_pcre(struct c2_string_group *group,
+                                         const char **patterns, const bool *ignorecase) {
+	if (group->npcre_members < 2) {
+		free(group->pcre_members);
+		group->pcre_members = NULL;
+		group->npcre_members = 0;
+		return;
+	}
+
+	char *combined = NULL;
+	for (int i = 0; i < group->npcre_members; i++) {
+		int member = group->pcre_members[i];
+		mstrextend(&combined, i ? "|(?:" : "(?:");
+		if (ignorecase[member]) {
+			mstrextend(&combined, "(?i)");
+		}
+		mstrextend(&combined, patterns[member]);
+		mstrextend(&combined, ")");
+	}
+
+	const char *error = NULL;
+	int erroffset = 0;
+	group->combined_pcre = pcre_compile(combined, 0, &error, &erroffset, NULL);
+	if (!group->combined_pcre) {
+		log_debug("Failed to combine PCRE patterns \"%s\": %s", combined, error);
+		free(group->pcre_members);
+		group->pcre_members = NULL;
+		group->npcre_members = 0;
+	} else {
+#ifdef CONFIG_REGEX_PCRE_JIT
+		group->combined_pcre_extra = pcre_study(
+		    group->combined_pcre, PCRE_STUDY_JIT_COMPILE, &error);
+#endif
+	}
+	free(combined);
+}
+#endif
+
+static void c2_tree_collect_groupable(c2_ptr_t node, c2_l_t ***leaves, int *nleaves,
+                                      int *capacity) {
+	if (node.isbranch) {
+		c2_tree_collect_groupable(node.b->opr1, leaves, nleaves, capacity);
+		c2_tree_collect_groupable(node.b->opr2, leaves, nleaves, capacity);
+		return;
+	}
+	if (!c2_l_groupable(node.l)) {
+		return;
+	}
+	if (*nleaves == *capacity) {
+		*capacity = *capacity * 2 + 8;
+		*leaves = crealloc(*leaves, *capacity);
+	}
+	(*leaves)[(*nleaves)++] = node.l;
+}
+
+/// Put string leaves of a condition list that have the same target into groups, so
+/// their patterns are matched in one pass. Targets used by only one leaf are left
+/// alone.
+static void c2_list_build_string_groups(struct c2_state *state, c2_lptr_t *list) {
+	c2_l_t **leaves = NULL;
+	int nleaves = 0, capacity = 0;
+	for (c2_lptr_t *head = list; head; head = head->next) {
+		c2_tree_collect_groupable(head->ptr, &leaves, &nleaves, &capacity);
+	}
+
+	for (int i = 0; i < nleaves; i++) {
+		if (leaves[i]->group) {
+			continue;
+		}
+		int count = 0;
+		for (int j = i; j < nleaves; j++) {
+			count += leaves[j]->predef == leaves[i]->predef;
+		}
+		if (count < 2) {
+			continue;
+		}
+
+		auto group = c2_string_group_new(state, leaves[i]->predef);
+		auto patterns = ccalloc(count, const char *);
+		auto ignorecase = ccalloc(count, bool);
+		for (int j = i; j < nleaves; j++) {
+			if (leaves[j]->predef == leaves[i]->predef) {
+				patterns[group->nmembers] = leaves[j]->ptnstr;
+				ignorecase[group->nmembers] = leaves[j]->match_ignorecase;
+				c2_string_group_add(group, leaves[j]);
+			}
+		}
+		c2_ac_build(&group->contains);
+		c2_ac_build(&group->contains_icase);
+#ifdef CONFIG_REGEX_PCRE
+		c2_string_group_combine_pcre(group, patterns, ignorecase);
+#endif
+		group->results = ccalloc(group->nmembers, enum c2_group_result);
+		log_debug("Matching %d patterns on target %s together", group->nmembers,
+		          C2_PREDEFS[group->predef].name);
+		free(patterns);
+		free(ignorecase);
+	}
+	free(leaves);
+}
+
+/// Get the result of matching a leaf in a string group against `tgt`, which is the
+/// value of the group's target. All patterns in the group are matched the first time
+/// this is called in a c2_match call.
+static enum c2_group_result
+c2_string_group_get(struct c2_state *state, const c2_l_t *pleaf, const char *tgt) {
+	struct c2_string_group *group = pleaf->group;
+	if (group->generation != state->generation) {
+		group->generation = state->generation;
+		for (int i = 0; i < group->nmembers; i++) {
+			group->results[i] = C2_GROUP_FALSE;
+		}
+
+		c2_exact_match(group->exact, tgt, group->results);
+		if (group->exact_icase) {
+			char *lower = c2_str_tolower(tgt);
+			c2_exact_match(group->exact_icase, lower, group->results);
+			free(lower);
+		}
+		c2_ac_match(&group->contains, tgt, group->results);
+		c2_ac_match(&group->contains_icase, tgt, group->results);
+#ifdef CONFIG_REGEX_PCRE
+		// If the combined pattern matches, the PCRE leaves still need to be
+		// matched on their own to know which ones matched
+		bool pcre_maybe = true;
+		if (group->combined_pcre) {
+			assert(strlen(tgt) <= INT_MAX);
+			pcre_maybe = pcre_exec(group->combined_pcre,
+			                       group->combined_pcre_extra, tgt,
+			                       (int)strlen(tgt), 0, 0, NULL, 0) >= 0;
+		}
+		for (int i = 0; pcre_maybe && i < group->npcre_members; i++) {
+			group->results[group->pcre_members[i]] = C2_GROUP_UNKNOWN;
+		}
+#endif
+	}
+#ifdef CONFIG_REGEX_PCRE
+	if (pleaf->match == C2_L_MPCRE && !group->combined_pcre) {
+		return C2_GROUP_UNKNOWN;
+	}
+#endif
+	return group->results[pleaf->group_index];
+}
+
+static void c2_string_group_free(struct c2_string_group *group) {
+	struct c2_exact_entry *sets[] = {group->exact, group->exact_icase};
+	for (size_t i = 0; i < ARR_SIZE(sets); i++) {
+		HASH_ITER2(sets[i], entry) {
+			HASH_DEL(sets[i], entry);
+			free(entry->key);
+			free(entry->members);
+			free(entry);
+		}
+	}
+	c2_ac_free(&group->contains);
+	c2_ac_free(&group->contains_icase);
+#ifdef CONFIG_REGEX_PCRE
+	pcre_free(group->combined_pcre);
+	LPCRE_FREE_STUDY(group->combined_pcre_extra);
+	free(group->pcre_members);
+#endif
+	free(group->results);
+	free(group);
+}
+
+/// Record that condition `id` depends on `atom`
+static void c2_add_dep(struct c2_state *state, xcb_atom_t atom, int id) {
+	struct c2_atom_deps *deps = NULL;
+	HASH_FIND_INT(state->deps, &atom, deps);
+	if (!deps) {
+		deps = ccalloc(1, struct c2_atom_deps);
+		deps->atom = atom;
+		HASH_ADD_INT(state->deps, atom, deps);
+	}
+	if (deps->nconds && deps->conds[deps->nconds - 1] == id) {
+		return;
+	}
+	if (deps->nconds == deps->capacity) {
+		deps->capacity = deps->capacity * 2 + 4;
+		deps->conds = crealloc(deps->conds, deps->capacity);
+	}
+	deps->conds[deps->nconds++] = id;
+}
+
+/// Add the atoms a condition tree depends on to the dependency index.
+///
+/// @return whether the condition only depends on window properties
+static bool c2_tree_add_deps(session_t *ps, c2_ptr_t node, int id) {
+	if (node.isbranch) {
+		bool ret = c2_tree_add_deps(ps, node.b->opr1, id);
+		return c2_tree_add_deps(ps, node.b->opr2, id) && ret;
+	}
+
+	const c2_l_t *pleaf = node.l;
+	switch (pleaf->predef) {
+	case C2_L_PUNDEFINED: c2_add_dep(ps->c2_state, pleaf->tgtatom, id); return true;
+	case C2_L_PNAME:
+		c2_add_dep(ps->c2_state, ps->atoms->a_NET_WM_NAME, id);
+		c2_add_dep(ps->c2_state, ps->atoms->aWM_NAME, id);
+		return true;
+	case C2_L_PCLASSG:
+	case C2_L_PCLASSI:
+		c2_add_dep(ps->c2_state, ps->atoms->aWM_CLASS, id);
+		return true;
+	case C2_L_PROLE:
+		c2_add_dep(ps->c2_state, ps->atoms->aWM_WINDOW_ROLE, id);
+		return true;
+	default:
+		// Other predefined targets can change without any property changes
+		return false;
+	}
+}
+
+/// Collect the names of the target atoms that are not predefined
+static void c2_tree_collect_atoms(c2_ptr_t node, const char ***names, size_t *n,
+                                  size_t *cap) {
+	if (node.isbranch) {
+		c2_tree_collect_atoms(node.b->opr1, names, n, cap);
+		c2_tree_collect_atoms(node.b->opr2, names, n, cap);
+		return;
+	}
+	if (node.l->predef != C2_L_PUNDEFINED) {
+		return;
+	}
+	if (*n == *cap) {
+		*cap = *cap * 2 + 8;
+		*names = crealloc(*names, *cap);
+	}
+	(*names)[(*n)++] = node.l->tgt;
+}
+
 bool c2_list_postprocess(session_t *ps, c2_lptr_t *list) {
+	if (!ps->c2_state) {
+		ps->c2_state = ccalloc(1, struct c2_state);
+	}
+
+	// Intern the atoms of all the conditions in one go, instead of one round-trip
+	// per condition
+	const char **names = NULL;
+	size_t nnames = 0, names_cap = 0;
+	for (c2_lptr_t *head = list; head; head = head->next) {
+		c2_tree_collect_atoms(head->ptr, &names, &nnames, &names_cap);
+	}
+	if (nnames) {
+		prefetch_atoms(ps->atoms, names, nnames);
+	}
+	free(names);
+
 	c2_lptr_t *head = list;
 	while (head) {
 		if (!c2_tree_postprocess(ps, head->ptr))
 			return false;
+		head->id = ps->c2_state->nconds++;
+		head->cacheable = c2_tree_add_deps(ps, head->ptr, head->id);
 		head = head->next;
 	}
+	c2_list_build_string_groups(ps->c2_state, list);
 	return true;
 }
+
+void c2_state_free(struct c2_state *state) {
+	if (!state) {
+		return;
+	}
+	HASH_ITER2(state->deps, deps) {
+		HASH_DEL(state->deps, deps);
+		free(deps->conds);
+		free(deps);
+	}
+	while (state->groups) {
+		auto next = state->groups->next;
+		c2_string_group_free(state->groups);
+		state->groups = next;
+	}
+	free(state);
+}
+
+static void c2_tree_reset_postprocess(c2_ptr_t node) {
+	if (node.isbranch) {
+		if (node.b) {
+			c2_tree_reset_postprocess(node.b->opr1);
+			c2_tree_reset_postprocess(node.b->opr2);
+		}
+		return;
+	}
+	if (!node.l) {
+		return;
+	}
+	// The groups belong to the state, they are freed with it
+	node.l->group = NULL;
+	node.l->group_index = -1;
+#ifdef CONFIG_REGEX_PCRE
+	pcre_free(node.l->regex_pcre);
+	LPCRE_FREE_STUDY(node.l->regex_pcre_extra);
+	node.l->regex_pcre = NULL;
+	node.l->regex_pcre_extra = NULL;
+#endif
+}
+
+void c2_list_reset_postprocess(c2_lptr_t *list) {
+	for (c2_lptr_t *head = list; head; head = head->next) {
+		c2_tree_reset_postprocess(head->ptr);
+	}
+}
 /**
  * Free a condition tree.
  */
@@ -1159,6 +1811,47 @@ c2_lptr_t *c2_free_lptr(c2_lptr_t *lp) {
 	return pnext;
 }
 
+/**
+ * Compare two condition trees, ignoring what's set up by c2_list_postprocess.
+ */
+static bool c2_tree_equal(c2_ptr_t a, c2_ptr_t b) {
+	if (a.isbranch != b.isbranch) {
+		return false;
+	}
+	if (a.isbranch) {
+		if (!a.b || !b.b) {
+			return a.b == b.b;
+		}
+		return a.b->neg == b.b->neg && a.b->op == b.b->op &&
+		       c2_tree_equal(a.b->opr1, b.b->opr1) &&
+		       c2_tree_equal(a.b->opr2, b.b->opr2);
+	}
+
+	const c2_l_t *la = a.l, *lb = b.l;
+	if (!la || !lb) {
+		return la == lb;
+	}
+	// Leaves with the exists operator are given a pattern type by postprocessing
+	if (la->op != C2_L_OEXISTS && la->ptntype != lb->ptntype) {
+		return false;
+	}
+	return la->neg == lb->neg && la->op == lb->op && la->match == lb->match &&
+	       la->match_ignorecase == lb->match_ignorecase &&
+	       la->tgt_onframe == lb->tgt_onframe && la->index == lb->index &&
+	       la->predef == lb->predef && la->type == lb->type &&
+	       la->format == lb->format && la->ptnint == lb->ptnint &&
+	       str_equal(la->tgt, lb->tgt) && str_equal(la->ptnstr, lb->ptnstr);
+}
+
+bool c2_list_equal(const c2_lptr_t *a, const c2_lptr_t *b) {
+	for (; a && b; a = a->next, b = b->next) {
+		if (a->data != b->data || !c2_tree_equal(a->ptr, b->ptr)) {
+			return false;
+		}
+	}
+	return !a && !b;
+}
+
 /**
  * Get a string representation of a rule target.
  */
@@ -1303,12 +1996,213 @@ static xcb_atom_t c2_get_atom_type(const c2_l_t *pleaf) {
 	unreachable;
 }
 
+/// A property of a window, fetched in whole
+struct c2_property_value {
+	xcb_window_t wid;
+	xcb_atom_t atom;
+	/// The reply, NULL if we failed to get the property. Note a reply is still
+	/// returned by the X server if the property doesn't exist.
+	xcb_get_property_reply_t *r;
+};
+
+/// Number of 32-bit words to request for a property. Longer properties are requested
+/// again with their actual length.
+#define C2_PROPERTY_REQUEST_LENGTH 256
+
+void c2_window_state_clear(struct c2_window_state *state) {
+	for (size_t i = 0; i < state->nvalues; i++) {
+		free(state->values[i].r);
+	}
+	state->nvalues = 0;
+	if (state->results_valid) {
+		memset(state->results_valid, 0,
+		       state->results_capacity * sizeof(*state->results_valid));
+	}
+}
+
+void c2_window_state_destroy(struct c2_window_state *state) {
+	c2_window_state_clear(state);
+	free(state->values);
+	free(state->results);
+	free(state->results_valid);
+	*state = (struct c2_window_state){0};
+}
+
+void c2_window_state_mark_dirty(session_t *ps, struct c2_window_state *state,
+                                xcb_window_t wid, xcb_atom_t atom) {
+	for (size_t i = 0; i < state->nvalues; i++) {
+		if (state->values[i].wid == wid && state->values[i].atom == atom) {
+			free(state->values[i].r);
+			state->values[i] = state->values[--state->nvalues];
+			break;
+		}
+	}
+
+	struct c2_atom_deps *deps = NULL;
+	if (ps->c2_state) {
+		HASH_FIND_INT(ps->c2_state->deps, &atom, deps);
+	}
+	if (!deps || !state->results_valid) {
+		return;
+	}
+	const size_t bits_per_element = sizeof(*state->results_valid) * 8;
+	for (int i = 0; i < deps->nconds; i++) {
+		auto id = (size_t)deps->conds[i];
+		if (id / bits_per_element < state->results_capacity) {
+			state->results_valid[id / bits_per_element] &=
+			    ~((uint64_t)1 << (id % bits_per_element));
+		}
+	}
+}
+
+/// Get the cached match result of a condition
+///
+/// @return whether there is a valid cached result
+static bool
+c2_window_state_get_result(struct c2_window_state *state, int id, bool *result) {
+	const size_t bits_per_element = sizeof(*state->results) * 8;
+	auto idx = (size_t)id / bits_per_element;
+	auto mask = (uint64_t)1 << ((size_t)id % bits_per_element);
+	if (idx >= state->results_capacity || !(state->results_valid[idx] & mask)) {
+		return false;
+	}
+	*result = state->results[idx] & mask;
+	return true;
+}
+
+static void
+c2_window_state_set_result(struct c2_window_state *state, int id, bool result) {
+	const size_t bits_per_element = sizeof(*state->results) * 8;
+	auto idx = (size_t)id / bits_per_element;
+	auto mask = (uint64_t)1 << ((size_t)id % bits_per_element);
+	if (idx >= state->results_capacity) {
+		auto new_capacity = idx + 1;
+		state->results = crealloc(state->results, new_capacity);
+		state->results_valid = crealloc(state->results_valid, new_capacity);
+		auto grown = new_capacity - state->results_capacity;
+		memset(state->results + state->results_capacity, 0,
+		       grown * sizeof(*state->results));
+		memset(state->results_valid + state->results_capacity, 0,
+		       grown * sizeof(*state->results_valid));
+		state->results_capacity = new_capacity;
+	}
+	state->results_valid[idx] |= mask;
+	if (result) {
+		state->results[idx] |= mask;
+	} else {
+		state->results[idx] &= ~mask;
+	}
+}
+
+static struct c2_property_value *
+c2_window_state_find(struct c2_window_state *state, xcb_window_t wid, xcb_atom_t atom) {
+	for (size_t i = 0; i < state->nvalues; i++) {
+		if (state->values[i].wid == wid && state->values[i].atom == atom) {
+			return &state->values[i];
+		}
+	}
+	return NULL;
+}
+
+/// Fetch all the properties we track for `w` that are not cached yet. Requests are
+/// sent together, so there is at most one round trip no matter how many rules there
+/// are.
+static void c2_fetch_properties(session_t *ps, struct managed_win *w) {
+	struct c2_window_state *state = &w->c2_state;
+	const xcb_window_t wids[] = {w->base.id, w->client_win};
+	const size_t nwids = (w->client_win && w->client_win != w->base.id) ? 2 : 1;
+
+	size_t nmissing = 0;
+	for (latom_t *platom = ps->track_atom_lst; platom; platom = platom->next) {
+		for (size_t i = 0; i < nwids; i++) {
+			if (!c2_window_state_find(state, wids[i], platom->atom)) {
+				nmissing++;
+			}
+		}
+	}
+	if (!nmissing) {
+		return;
+	}
+
+	if (state->nvalues + nmissing > state->capacity) {
+		state->capacity = state->nvalues + nmissing;
+		state->values = crealloc(state->values, state->capacity);
+	}
+
+	auto cookies = ccalloc(nmissing, xcb_get_property_cookie_t);
+	const size_t first = state->nvalues;
+	for (latom_t *platom = ps->track_atom_lst; platom; platom = platom->next) {
+		for (size_t i = 0; i < nwids; i++) {
+			if (c2_window_state_find(state, wids[i], platom->atom)) {
+				continue;
+			}
+			cookies[state->nvalues - first] = xcb_get_property(
+			    ps->c, 0, wids[i], platom->atom, XCB_GET_PROPERTY_TYPE_ANY, 0,
+			    C2_PROPERTY_REQUEST_LENGTH);
+			state->values[state->nvalues++] = (struct c2_property_value){
+			    .wid = wids[i], .atom = platom->atom, .r = NULL};
+		}
+	}
+
+	for (size_t i = first; i < state->nvalues; i++) {
+		auto value = &state->values[i];
+		value->r =
+		    X_REPLY(xcb_get_property_reply(ps->c, cookies[i - first], NULL));
+		if (value->r && value->r->bytes_after) {
+			// Property is longer than what we asked for, ask for all of it
+			auto length = (uint32_t)xcb_get_property_value_length(value->r) +
+			              value->r->bytes_after;
+			free(value->r);
+			auto cookie = xcb_get_property(ps->c, 0, value->wid, value->atom,
+			                               XCB_GET_PROPERTY_TYPE_ANY, 0,
+			                               (length + 3) / 4);
+			value->r = X_REPLY(xcb_get_property_reply(ps->c, cookie, NULL));
+		}
+	}
+	free(cookies);
+}
+
+/// Get the value of a property of a window for matching against a leaf. Equivalent to
+/// what x_get_prop_with_offset would return, but uses the cached property value.
+///
+/// The returned winprop_t doesn't own the reply, and don't need to be freed.
+static winprop_t
+c2_get_leaf_prop(struct managed_win *w, xcb_window_t wid, const c2_l_t *pleaf) {
+	winprop_t ret = {
+	    .ptr = NULL, .nitems = 0, .type = XCB_GET_PROPERTY_TYPE_ANY, .format = 0};
+	auto value = c2_window_state_find(&w->c2_state, wid, pleaf->tgtatom);
+	if (!value || !value->r) {
+		return ret;
+	}
+
+	auto r = value->r;
+	if (r->type != c2_get_atom_type(pleaf) ||
+	    (pleaf->format && r->format != pleaf->format) ||
+	    (r->format != 8 && r->format != 16 && r->format != 32)) {
+		return ret;
+	}
+
+	// Offset is in 32-bit multiples, as it would have been if we sent the
+	// request with the offset.
+	auto len = (size_t)xcb_get_property_value_length(r);
+	auto offset = pleaf->index < 0 ? 0 : (size_t)pleaf->index * 4;
+	if (offset >= len) {
+		return ret;
+	}
+	auto nbytes = pleaf->index < 0 ? len - offset : min2(len - offset, 4);
+	ret.ptr = (char *)xcb_get_property_value(r) + offset;
+	ret.nitems = nbytes / (size_t)(r->format / 8);
+	ret.type = r->type;
+	ret.format = r->format;
+	return ret;
+}
+
 /**
  * Match a window against a single leaf window condition.
  *
  * For internal use.
  */
-static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w,
+static inline void c2_match_once_leaf(session_t *ps, struct managed_win *w,
                                       const c2_l_t *pleaf, bool *pres, bool *perr) {
 	assert(pleaf);
 
@@ -1367,15 +2261,7 @@ static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w
 		}
 		// A raw window property
 		else {
-			int word_count = 1;
-			if (pleaf->index < 0) {
-				// Get length of property in 32-bit multiples
-				auto prop_info = x_get_prop_info(ps->c, wid, pleaf->tgtatom);
-				word_count = to_int_checked((prop_info.length + 4 - 1) / 4);
-			}
-			winprop_t prop = x_get_prop_with_offset(
-			    ps->c, wid, pleaf->tgtatom, idx, word_count,
-			    c2_get_atom_type(pleaf), pleaf->format);
+			winprop_t prop = c2_get_leaf_prop(w, wid, pleaf);
 
 			ntargets = (pleaf->index < 0 ? prop.nitems : min2(prop.nitems, 1));
 			if (ntargets > 0) {
@@ -1385,7 +2271,6 @@ static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w
 					targets[i] = winprop_get_int(prop, i);
 				}
 			}
-			free_winprop(&prop);
 		}
 
 		if (*perr) {
@@ -1423,7 +2308,6 @@ static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w
 	case C2_L_PTSTRING: {
 		const char **targets = NULL;
 		const char **targets_free = NULL;
-		const char **targets_free_inner = NULL;
 		size_t ntargets = 0;
 
 		// A predefined target
@@ -1444,40 +2328,31 @@ static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w
 		}
 		// An atom type property, convert it to string
 		else if (pleaf->type == C2_L_TATOM) {
-			int word_count = 1;
-			if (pleaf->index < 0) {
-				// Get length of property in 32-bit multiples
-				auto prop_info = x_get_prop_info(ps->c, wid, pleaf->tgtatom);
-				word_count = to_int_checked((prop_info.length + 4 - 1) / 4);
-			}
-			winprop_t prop = x_get_prop_with_offset(
-			    ps->c, wid, pleaf->tgtatom, idx, word_count,
-			    c2_get_atom_type(pleaf), pleaf->format);
+			winprop_t prop = c2_get_leaf_prop(w, wid, pleaf);
 
 			ntargets = (pleaf->index < 0 ? prop.nitems : min2(prop.nitems, 1));
-			targets = targets_free = (const char **)ccalloc(2 * ntargets, char *);
-			targets_free_inner = targets + ntargets;
+			targets = targets_free = (const char **)ccalloc(ntargets, char *);
 
+			// Fetch all the names we don't know yet in one round-trip
+			auto atoms = ccalloc(ntargets, xcb_atom_t);
 			for (size_t i = 0; i < ntargets; ++i) {
-				xcb_atom_t atom = (xcb_atom_t)winprop_get_int(prop, i);
-				if (atom) {
-					xcb_get_atom_name_reply_t *reply = xcb_get_atom_name_reply(
-					    ps->c, xcb_get_atom_name(ps->c, atom), NULL);
-					if (reply) {
-						targets[i] = targets_free_inner[i] = strndup(
-						    xcb_get_atom_name_name(reply),
-						    (size_t)xcb_get_atom_name_name_length(reply));
-						free(reply);
-					}
-				}
+				atoms[i] = (xcb_atom_t)winprop_get_int(prop, i);
+			}
+			prefetch_atom_names(ps->atoms, atoms, ntargets);
+			for (size_t i = 0; i < ntargets; ++i) {
+				targets[i] = get_atom_name(ps->atoms, atoms[i]);
 			}
-			free_winprop(&prop);
+			free(atoms);
 		}
 		// Not an atom type, just fetch the string list
 		else {
 			char **strlst = NULL;
 			int nstr = 0;
-			if (wid_get_text_prop(ps, wid, pleaf->tgtatom, &strlst, &nstr)) {
+			auto value =
+			    c2_window_state_find(&w->c2_state, wid, pleaf->tgtatom);
+			if (value && value->r &&
+			    wid_get_text_prop_from_reply(ps, wid, pleaf->tgtatom,
+			                                 value->r, &strlst, &nstr)) {
 				if (pleaf->index < 0 && nstr > 0 && strlen(strlst[0]) > 0) {
 					ntargets = to_u32_checked(nstr);
 					targets = (const char **)strlst;
@@ -1508,6 +2383,14 @@ static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w
 			switch (pleaf->op) {
 			case C2_L_OEXISTS: res = true; break;
 			case C2_L_OEQ:
+				if (pleaf->group) {
+					auto gres =
+					    c2_string_group_get(ps->c2_state, pleaf, tgt);
+					if (gres != C2_GROUP_UNKNOWN) {
+						res = gres == C2_GROUP_TRUE;
+						break;
+					}
+				}
 				switch (pleaf->match) {
 				case C2_L_MEXACT:
 					if (pleaf->match_ignorecase) {
@@ -1560,14 +2443,6 @@ static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w
 		*pres = res;
 
 	fail_str:
-		// Free the string after usage, if necessary
-		if (targets_free_inner) {
-			for (size_t i = 0; i < ntargets; ++i) {
-				if (targets_free_inner[i]) {
-					free((void *)targets_free_inner[i]);
-				}
-			}
-		}
 		// Free property values after usage, if necessary
 		if (targets_free) {
 			free(targets_free);
@@ -1582,7 +2457,7 @@ static inline void c2_match_once_leaf(session_t *ps, const struct managed_win *w
  *
  * @return true if matched, false otherwise.
  */
-static bool c2_match_once(session_t *ps, const struct managed_win *w, const c2_ptr_t cond) {
+static bool c2_match_once(session_t *ps, struct managed_win *w, const c2_ptr_t cond) {
 	bool result = false;
 	bool error = true;
 
@@ -1658,12 +2533,25 @@ static bool c2_match_once(session_t *ps, const struct managed_win *w, const c2_p
  * @param pdata a place to return the data
  * @return true if matched, false otherwise.
  */
-bool c2_match(session_t *ps, const struct managed_win *w, const c2_lptr_t *condlst,
+bool c2_match(session_t *ps, struct managed_win *w, const c2_lptr_t *condlst,
               void **pdata) {
 	assert(ps->server_grabbed);
+	c2_fetch_properties(ps, w);
+	if (ps->c2_state) {
+		ps->c2_state->generation++;
+	}
 	// Then go through the whole linked list
 	for (; condlst; condlst = condlst->next) {
-		if (c2_match_once(ps, w, condlst->ptr)) {
+		bool matched;
+		if (!condlst->cacheable ||
+		    !c2_window_state_get_result(&w->c2_state, condlst->id, &matched)) {
+			matched = c2_match_once(ps, w, condlst->ptr);
+			if (condlst->cacheable) {
+				c2_window_state_set_result(&w->c2_state, condlst->id,
+				                           matched);
+			}
+		}
+		if (matched) {
 			if (pdata)
 				*pdata = condlst->data;
 			return true;
@@ -1672,3 +2560,197 @@ bool c2_match(session_t *ps, const struct managed_win *w, const c2_lptr_t *condl
 
 	return false;
 }
+
+/// Remove a condition tree's leaves from their string groups, so they are matched on
+/// their own
+static void attr_unused c2_tree_ungroup(c2_ptr_t node) {
+	if (node.isbranch) {
+		c2_tree_ungroup(node.b->opr1);
+		c2_tree_ungroup(node.b->opr2);
+		return;
+	}
+	node.l->group = NULL;
+	node.l->group_index = -1;
+}
+
+// Typical rules a user would have for the same target, like in
+// opacity-rule or shadow-exclude
+static const char *const c2_bench_rules[] = {
+    "class_g = 'Firefox'",
+    "class_g = 'firefox'",
+    "class_g = 'Chromium'",
+    "class_g = 'Google-chrome'",
+    "class_g = 'Alacritty'",
+    "class_g = 'kitty'",
+    "class_g = 'URxvt'",
+    "class_g = 'XTerm'",
+    "class_g = 'Rofi'",
+    "class_g = 'dmenu'",
+    "class_g = 'Polybar'",
+    "class_g = 'Conky'",
+    "class_g = 'Dunst'",
+    "class_g = 'Thunderbird'",
+    "class_g = 'mpv'",
+    "class_g = 'Code'",
+    "class_g ?= 'slack'",
+    "class_g ?= 'discord'",
+    "class_g ^= 'jetbrains-'",
+    "class_i = 'Navigator'",
+    "class_i = 'vlc'",
+    "name *= 'YouTube'",
+    "name *= 'Netflix'",
+    "name *?= 'Picture-in-Picture'",
+    "name *= 'Vim'",
+    "name *= '- Zoom'",
+    "name ^= 'Screenshot'",
+    "name = 'Notification'",
+    "name *?= 'password'",
+    "role = 'pop-up'",
+    "role = 'browser'",
+    "window_type = 'dock'",
+    "window_type = 'desktop'",
+    "window_type = 'notification'",
+#ifdef CONFIG_REGEX_PCRE
+    "name ~= '^Steam( - .*)?$'",
+    "name ~?= 'spotify|rhythmbox'",
+    "class_g ~= '^(Gimp|Inkscape)'",
+#endif
+    "class_g = 'Firefox' && role = 'GtkFileChooserDialog'",
+};
+static const struct {
+	const char *name, *class_general, *class_instance, *role;
+	wintype_t window_type;
+} c2_bench_windows[] = {
+    {"Mozilla Firefox", "Firefox", "Navigator", "browser", WINTYPE_NORMAL},
+    {"vim src/c2.c - Vim", "kitty", "kitty", NULL, WINTYPE_NORMAL},
+    {"Never Gonna Give You Up - YOUTUBE", "Chromium", "chromium", "browser",
+     WINTYPE_NORMAL},
+    {"Slack | general", "Slack", "slack", "browser-window", WINTYPE_NORMAL},
+    {"Steam - News", "Steam", "Steam", NULL, WINTYPE_NORMAL},
+    {"IntelliJ IDEA", "jetbrains-idea", "jetbrains-idea", NULL, WINTYPE_NORMAL},
+    {"Enter password", "Pinentry", "pinentry", NULL, WINTYPE_DIALOG},
+    {"polybar-main", "Polybar", "polybar", NULL, WINTYPE_DOCK},
+    {"Unmatched", "Unmatched", "unmatched", "none", WINTYPE_UTILITY},
+};
+
+TEST_CASE(c2_match_string_rules) {
+	bool has_logger = tls_logger;
+	if (!has_logger) {
+		log_init_tls();
+	}
+
+	session_t *ps = ccalloc(1, session_t);
+	ps->atoms = ccalloc(1, struct atom);
+	ps->server_grabbed = true;
+
+	// `grouped` uses the string groups, `reference` matches every leaf on its
+	// own
+	c2_lptr_t *grouped = NULL, *reference = NULL;
+	for (size_t i = 0; i < ARR_SIZE(c2_bench_rules); i++) {
+		void *data = (void *)(intptr_t)(i + 1);
+		TEST_TRUE(c2_parse(&grouped, c2_bench_rules[i], data));
+		TEST_TRUE(c2_parse(&reference, c2_bench_rules[i], data));
+	}
+	TEST_TRUE(c2_list_postprocess(ps, grouped));
+	TEST_TRUE(c2_list_postprocess(ps, reference));
+	for (c2_lptr_t *head = reference; head; head = head->next) {
+		c2_tree_ungroup(head->ptr);
+	}
+
+	for (size_t i = 0; i < ARR_SIZE(c2_bench_windows); i++) {
+		struct managed_win w = {0};
+		w.base.id = w.client_win = (xcb_window_t)(i + 1);
+		w.name = (char *)c2_bench_windows[i].name;
+		w.class_general = (char *)c2_bench_windows[i].class_general;
+		w.class_instance = (char *)c2_bench_windows[i].class_instance;
+		w.role = (char *)c2_bench_windows[i].role;
+		w.window_type = c2_bench_windows[i].window_type;
+
+		void *grouped_data = NULL, *reference_data = NULL;
+		bool grouped_ret = c2_match(ps, &w, grouped, &grouped_data);
+		// Drop the cached results, so the reference list is actually matched
+		c2_window_state_clear(&w.c2_state);
+		bool reference_ret = c2_match(ps, &w, reference, &reference_data);
+		c2_window_state_destroy(&w.c2_state);
+		TEST_EQUAL(grouped_ret, reference_ret);
+		TEST_EQUAL(grouped_data, reference_data);
+	}
+
+	while (grouped) {
+		grouped = c2_free_lptr(grouped);
+	}
+	while (reference) {
+		reference = c2_free_lptr(reference);
+	}
+	c2_state_free(ps->c2_state);
+	free(ps->atoms);
+	free(ps);
+	if (!has_logger) {
+		log_deinit_tls();
+	}
+}
+
+/// Match the synthetic windows against the typical rules, one window per iteration. If
+/// `cached` is false, the cached results are dropped first, so every condition is
+/// actually matched. If `grouped` is false, every leaf is matched on its own instead
+/// of through its string group.
+static void bench_c2_match(struct microbench *bench, bool cached, bool grouped) {
+	session_t *ps = ccalloc(1, session_t);
+	ps->atoms = ccalloc(1, struct atom);
+	ps->server_grabbed = true;
+
+	c2_lptr_t *list = NULL;
+	for (size_t i = 0; i < ARR_SIZE(c2_bench_rules); i++) {
+		c2_parse(&list, c2_bench_rules[i], (void *)(intptr_t)(i + 1));
+	}
+	c2_list_postprocess(ps, list);
+	if (!grouped) {
+		for (c2_lptr_t *head = list; head; head = head->next) {
+			c2_tree_ungroup(head->ptr);
+		}
+	}
+
+	struct managed_win windows[ARR_SIZE(c2_bench_windows)] = {0};
+	for (size_t i = 0; i < ARR_SIZE(c2_bench_windows); i++) {
+		auto w = &windows[i];
+		w->base.id = w->client_win = (xcb_window_t)(i + 1);
+		w->name = (char *)c2_bench_windows[i].name;
+		w->class_general = (char *)c2_bench_windows[i].class_general;
+		w->class_instance = (char *)c2_bench_windows[i].class_instance;
+		w->role = (char *)c2_bench_windows[i].role;
+		w->window_type = c2_bench_windows[i].window_type;
+	}
+
+	size_t i = 0;
+	MICROBENCH_LOOP() {
+		auto w = &windows[i];
+		if (!cached) {
+			c2_window_state_clear(&w->c2_state);
+		}
+		void *data = NULL;
+		microbench_keep(c2_match(ps, w, list, &data));
+		i = (i + 1) % ARR_SIZE(windows);
+	}
+
+	for (i = 0; i < ARR_SIZE(windows); i++) {
+		c2_window_state_destroy(&windows[i].c2_state);
+	}
+	while (list) {
+		list = c2_free_lptr(list);
+	}
+	c2_state_free(ps->c2_state);
+	free(ps->atoms);
+	free(ps);
+}
+
+MICROBENCH(c2_match) {
+	bench_c2_match(bench, false, true);
+}
+
+MICROBENCH(c2_match_ungrouped) {
+	bench_c2_match(bench, false, false);
+}
+
+MICROBENCH(c2_match_cached) {
+	bench_c2_match(bench, true, true);
+}
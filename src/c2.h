@@ -12,15 +12,59 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xcb/xproto.h>
 
 typedef struct _c2_lptr c2_lptr_t;
 typedef struct session session_t;
 struct managed_win;
+struct c2_property_value;
+struct c2_state;
+
+/// Per-window state of the window condition matcher. Holds the X properties fetched
+/// for matching, so each of them is only fetched once, until it changes. And the match
+/// results of conditions that only depend on window properties.
+struct c2_window_state {
+	struct c2_property_value *values;
+	size_t nvalues;
+	size_t capacity;
+
+	/// Bitmap of cached match results, indexed by condition id
+	uint64_t *results;
+	/// Bitmap of which entries in `results` are valid
+	uint64_t *results_valid;
+	/// Number of uint64_ts allocated for `results` and `results_valid`
+	size_t results_capacity;
+};
 
 c2_lptr_t *c2_parse(c2_lptr_t **pcondlst, const char *pattern, void *data);
 
 c2_lptr_t *c2_free_lptr(c2_lptr_t *lp);
 
-bool c2_match(session_t *ps, const struct managed_win *w, const c2_lptr_t *condlst, void **pdata);
+bool c2_match(session_t *ps, struct managed_win *w, const c2_lptr_t *condlst,
+              void **pdata);
 
 bool c2_list_postprocess(session_t *ps, c2_lptr_t *list);
+
+/// Check if two condition lists have the same conditions and data, `a` and `b` needn't
+/// both be postprocessed
+bool c2_list_equal(const c2_lptr_t *a, const c2_lptr_t *b);
+
+/// Free the state created by c2_list_postprocess
+void c2_state_free(struct c2_state *state);
+/// Undo what c2_list_postprocess did to the conditions in `list`, so they can be
+/// postprocessed again after the state they were postprocessed with is freed.
+void c2_list_reset_postprocess(c2_lptr_t *list);
+
+/// Drop all the cached properties and match results
+void c2_window_state_clear(struct c2_window_state *state);
+
+/// Free resources held by a c2_window_state
+void c2_window_state_destroy(struct c2_window_state *state);
+
+/// Mark property `atom` of `wid` as changed. It will be fetched again when it's needed,
+/// and conditions depending on it will be re-evaluated. Other conditions keep their
+/// cached results.
+void c2_window_state_mark_dirty(session_t *ps, struct c2_window_state *state,
+                                xcb_window_t wid, xcb_atom_t atom);
@@ -1,6 +1,9 @@
+#include <stdatomic.h>
+#include <stdio.h>
 #include <uthash.h>
 
 #include "compiler.h"
+#include "microbench.h"
 #include "utils.h"
 #include "cache.h"
 
@@ -54,6 +57,45 @@ void *cache_get(struct cache *c, const char *key, int *err) {
 	return e->value;
 }
 
+int cache_warm(struct cache *c, const char *const *keys, size_t nkeys,
+               cache_request_t request, cache_collect_t collect) {
+	auto requests = ccalloc(nkeys, void *);
+	auto pending = ccalloc(nkeys, bool);
+	for (size_t i = 0; i < nkeys; i++) {
+		struct cache_entry *e;
+		HASH_FIND_STR(c->entries, keys[i], e);
+		if (e) {
+			continue;
+		}
+		// The same key can be listed more than once, only request it once
+		bool duplicate = false;
+		for (size_t j = 0; j < i && !duplicate; j++) {
+			duplicate = pending[j] && strcmp(keys[i], keys[j]) == 0;
+		}
+		if (!duplicate) {
+			requests[i] = request(c->user_data, keys[i]);
+			pending[i] = true;
+		}
+	}
+
+	int nfailed = 0;
+	for (size_t i = 0; i < nkeys; i++) {
+		if (!pending[i]) {
+			continue;
+		}
+		int err = 0;
+		void *value = collect(c->user_data, keys[i], requests[i], &err);
+		if (err) {
+			nfailed++;
+			continue;
+		}
+		cache_set(c, keys[i], value);
+	}
+	free(requests);
+	free(pending);
+	return nfailed;
+}
+
 static inline void _cache_invalidate(struct cache *c, struct cache_entry *e) {
 	if (c->free) {
 		c->free(c->user_data, e->value);
@@ -93,3 +135,210 @@ struct cache *new_cache(void *ud, cache_getter_t getter, cache_free_t f) {
 	c->free = f;
 	return c;
 }
+
+struct icache_slot {
+	_Atomic uint64_t key;
+	_Atomic uint64_t value;
+};
+
+struct icache_table {
+	/// Number of slots, always a power of 2
+	size_t cap;
+	struct icache_slot slots[];
+};
+
+struct icache {
+	_Atomic(struct icache_table *) table;
+	/// Number of entries, only used by the writer
+	size_t size;
+	/// Tables replaced by bigger ones, readers might still be using them
+	struct icache_table **retired;
+	size_t nretired;
+};
+
+static inline size_t icache_hash(const struct icache_table *t, uint64_t key) {
+	// Fibonacci hashing, spreads consecutive ids like atoms over the table
+	return (size_t)(key * 0x9E3779B97F4A7C15ULL) & (t->cap - 1);
+}
+
+static struct icache_table *icache_table_new(size_t cap) {
+	struct icache_table *t = allocchk(
+	    calloc(1, sizeof(struct icache_table) + cap * sizeof(struct icache_slot)));
+	t->cap = cap;
+	return t;
+}
+
+/// Find the slot `key` is in, or the empty slot it should go into
+static struct icache_slot *icache_find(struct icache_table *t, uint64_t key) {
+	for (size_t i = icache_hash(t, key);; i = (i + 1) & (t->cap - 1)) {
+		uint64_t k = atomic_load_explicit(&t->slots[i].key, memory_order_acquire);
+		if (k == key || k == 0) {
+			return &t->slots[i];
+		}
+	}
+}
+
+/// Copy an entry into a table that isn't published yet
+static void icache_slot_copy(struct icache_table *t, struct icache_slot *slot) {
+	uint64_t key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+	if (!key) {
+		return;
+	}
+	struct icache_slot *dst = icache_find(t, key);
+	uint64_t value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+	atomic_store_explicit(&dst->value, value, memory_order_relaxed);
+	atomic_store_explicit(&dst->key, key, memory_order_relaxed);
+}
+
+struct icache *new_icache(void) {
+	auto c = ccalloc(1, struct icache);
+	atomic_init(&c->table, icache_table_new(16));
+	return c;
+}
+
+bool icache_get(const struct icache *c, uint64_t key, uint64_t *value) {
+	assert(key != 0);
+	struct icache_table *t =
+	    atomic_load_explicit(&((struct icache *)c)->table, memory_order_acquire);
+	struct icache_slot *slot = icache_find(t, key);
+	if (atomic_load_explicit(&slot->key, memory_order_acquire) != key) {
+		return false;
+	}
+	if (value) {
+		*value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+	}
+	return true;
+}
+
+void icache_set(struct icache *c, uint64_t key, uint64_t value) {
+	assert(key != 0);
+	struct icache_table *t = atomic_load_explicit(&c->table, memory_order_relaxed);
+	struct icache_slot *slot = icache_find(t, key);
+	if (atomic_load_explicit(&slot->key, memory_order_relaxed) == key) {
+		atomic_store_explicit(&slot->value, value, memory_order_relaxed);
+		return;
+	}
+
+	// Keep the load factor under 1/2
+	if ((c->size + 1) * 2 > t->cap) {
+		auto nt = icache_table_new(t->cap * 2);
+		for (size_t i = 0; i < t->cap; i++) {
+			icache_slot_copy(nt, &t->slots[i]);
+		}
+		atomic_store_explicit(&c->table, nt, memory_order_release);
+		c->retired = crealloc(c->retired, c->nretired + 1);
+		c->retired[c->nretired++] = t;
+		t = nt;
+		slot = icache_find(t, key);
+	}
+
+	// The value has to be visible before the key is
+	atomic_store_explicit(&slot->value, value, memory_order_relaxed);
+	atomic_store_explicit(&slot->key, key, memory_order_release);
+	c->size++;
+}
+
+int icache_warm(struct icache *c, const uint64_t *keys, size_t nkeys,
+                icache_request_t request, icache_collect_t collect, void *user_data) {
+	auto requests = ccalloc(nkeys, void *);
+	auto pending = ccalloc(nkeys, bool);
+	for (size_t i = 0; i < nkeys; i++) {
+		if (icache_get(c, keys[i], NULL)) {
+			continue;
+		}
+		bool duplicate = false;
+		for (size_t j = 0; j < i && !duplicate; j++) {
+			duplicate = pending[j] && keys[i] == keys[j];
+		}
+		if (!duplicate) {
+			requests[i] = request(user_data, keys[i]);
+			pending[i] = true;
+		}
+	}
+
+	int nfailed = 0;
+	for (size_t i = 0; i < nkeys; i++) {
+		if (!pending[i]) {
+			continue;
+		}
+		int err = 0;
+		uint64_t value = collect(user_data, keys[i], requests[i], &err);
+		if (err) {
+			nfailed++;
+			continue;
+		}
+		icache_set(c, keys[i], value);
+	}
+	free(requests);
+	free(pending);
+	return nfailed;
+}
+
+void icache_free(struct icache *c, icache_free_t f, void *user_data) {
+	struct icache_table *t = atomic_load_explicit(&c->table, memory_order_relaxed);
+	if (f) {
+		for (size_t i = 0; i < t->cap; i++) {
+			// Nobody else can be using the cache by now
+			if (t->slots[i].key) {
+				f(user_data, t->slots[i].value);
+			}
+		}
+	}
+	for (size_t i = 0; i < c->nretired; i++) {
+		free(c->retired[i]);
+	}
+	free(c->retired);
+	free(t);
+	free(c);
+}
+
+TEST_CASE(icache) {
+	auto c = new_icache();
+	for (uint64_t i = 1; i <= 1000; i++) {
+		icache_set(c, i * 7, i);
+	}
+	icache_set(c, 7, 42);
+
+	uint64_t value = 0;
+	TEST_TRUE(icache_get(c, 7, &value));
+	TEST_EQUAL(value, 42);
+	TEST_TRUE(icache_get(c, 700, &value));
+	TEST_EQUAL(value, 100);
+	TEST_TRUE(!icache_get(c, 701, NULL));
+	icache_free(c, NULL, NULL);
+}
+
+static void *bench_cache_getter(void *user_data attr_unused, const char *key,
+                                int *err attr_unused) {
+	return (void *)key;
+}
+
+MICROBENCH(cache_get) {
+	// About as many atoms as we intern
+	char keys[128][32];
+	auto c = new_cache(NULL, bench_cache_getter, NULL);
+	for (size_t i = 0; i < ARR_SIZE(keys); i++) {
+		snprintf(keys[i], sizeof(keys[i]), "_NET_WM_BENCHMARK_ATOM_%zu", i);
+		cache_get(c, keys[i], NULL);
+	}
+	size_t i = 0;
+	MICROBENCH_LOOP() {
+		microbench_keep(cache_get(c, keys[i], NULL));
+		i = (i + 1) % ARR_SIZE(keys);
+	}
+	cache_free(c);
+}
+
+MICROBENCH(icache_get) {
+	auto c = new_icache();
+	for (uint64_t i = 1; i <= 1000; i++) {
+		icache_set(c, i * 7, i);
+	}
+	uint64_t i = 0;
+	MICROBENCH_LOOP() {
+		uint64_t value;
+		microbench_keep(icache_get(c, (i % 1000 + 1) * 7, &value));
+		i++;
+	}
+	icache_free(c, NULL, NULL);
+}
@@ -1,9 +1,20 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 struct cache;
 
 typedef void *(*cache_getter_t)(void *user_data, const char *key, int *err);
 typedef void (*cache_free_t)(void *user_data, void *data);
+/// Start fetching the value for `key` without waiting for it. Returns a handle that is
+/// later passed to the matching `cache_collect_t`.
+typedef void *(*cache_request_t)(void *user_data, const char *key);
+/// Wait for the value requested by a `cache_request_t`, `request` is the handle it
+/// returned.
+typedef void *(*cache_collect_t)(void *user_data, const char *key, void *request,
+                                 int *err);
 
 /// Create a cache with `getter`, and a free function `f` which is used to free the cache
 /// value when they are invalidated.
@@ -15,6 +26,15 @@ struct cache *new_cache(void *user_data, cache_getter_t getter, cache_free_t f);
 /// getter will be called, and the returned value will be stored into the cache.
 void *cache_get(struct cache *, const char *key, int *err);
 
+/// Fetch the values of many keys into the cache at once. `request` is called for every
+/// key that is not in the cache yet, before `collect` is called for any of them, so
+/// getters that talk to a server only pay for one round-trip in total.
+///
+/// Returns the number of keys whose value couldn't be fetched, those are not added to
+/// the cache.
+int cache_warm(struct cache *, const char *const *keys, size_t nkeys,
+               cache_request_t request, cache_collect_t collect);
+
 /// Invalidate a value in the cache.
 void cache_invalidate(struct cache *, const char *key);
 
@@ -30,3 +50,36 @@ void *cache_free(struct cache *);
 ///
 /// If `key` already exists in the cache, this function will abort the program.
 void cache_set(struct cache *c, const char *key, void *data);
+
+/// A cache keyed by integers, for things like atoms and visuals that are looked up much
+/// more often than they are added. It is an open-addressing hash table that entries are
+/// never removed from.
+///
+/// There can only be one writer, but readers on other threads don't need a lock: a new
+/// entry is published only after it is completely written, and when the table grows, a
+/// new table is published and the old one is kept alive until the cache is freed.
+///
+/// 0 is not a valid key.
+struct icache;
+
+typedef void *(*icache_request_t)(void *user_data, uint64_t key);
+typedef uint64_t (*icache_collect_t)(void *user_data, uint64_t key, void *request,
+                                     int *err);
+typedef void (*icache_free_t)(void *user_data, uint64_t value);
+
+struct icache *new_icache(void);
+
+/// Look up `key`. Returns false if it is not in the cache. `value` can be NULL.
+bool icache_get(const struct icache *, uint64_t key, uint64_t *value);
+
+/// Insert a key-value pair into the cache, or replace the value of an existing key.
+/// Replaced values are not freed.
+void icache_set(struct icache *, uint64_t key, uint64_t value);
+
+/// Same as `cache_warm`, but for an integer-keyed cache. `user_data` is passed to
+/// `request` and `collect`.
+int icache_warm(struct icache *, const uint64_t *keys, size_t nkeys,
+                icache_request_t request, icache_collect_t collect, void *user_data);
+
+/// Free the cache, calling `f` for every value in it if it is not NULL.
+void icache_free(struct icache *, icache_free_t f, void *user_data);
@@ -38,6 +38,7 @@
 #include <pixman.h>
 #include <xcb/xproto.h>
 #include <xcb/render.h>
+#include <xcb/present.h>
 #include <xcb/sync.h>
 
 #include "uthash_extra.h"
@@ -55,6 +56,9 @@
 #include "backend/driver.h"
 #include "compiler.h"
 #include "config.h"
+#include "frame_pacing.h"
+#include "frame_timing.h"
+#include "trace.h"
 #include "region.h"
 #include "types.h"
 #include "utils.h"
@@ -82,12 +86,27 @@ typedef struct glx_fbconfig glx_fbconfig_t;
 struct glx_session;
 struct atom;
 struct conv;
+struct c2_state;
+struct leader_group;
+struct corner_mask;
+struct workqueue;
 
 typedef struct _ignore {
 	struct _ignore *next;
 	unsigned long sequence;
 } ignore_t;
 
+/// A damage fetch request that has been sent to the X server, but whose reply has not
+/// been collected yet.
+struct pending_damage_fetch {
+	xcb_xfixes_fetch_region_cookie_t cookie;
+	/// The window the damage belongs to
+	xcb_window_t wid;
+	/// Offset to translate the fetched region to screen coordinates, the window
+	/// might move before we collect the reply.
+	int dx, dy;
+};
+
 #ifdef CONFIG_OPENGL
 #ifdef DEBUG_GLX_DEBUG_CONTEXT
 typedef GLXContext (*f_glXCreateContextAttribsARB)(Display *dpy, GLXFBConfig config,
@@ -137,11 +156,18 @@ typedef struct session {
 	ev_io xiow;
 	/// Timeout for delayed unredirection.
 	ev_timer unredir_timer;
-	/// Timer for fading
+	/// Timeout for delayed redirection, after the screen was unredirected.
+	ev_timer redir_timer;
+	/// Timer for fading, only used without frame pacing
 	ev_timer fade_timer;
-	/// Timer for delayed drawing, right now only used by
-	/// swopti
+	/// Timer for delayed drawing, used by swopti and frame pacing
 	ev_timer delayed_draw_timer;
+	/// Timer for giving up on the vblank of a rendered frame, see
+	/// `FRAME_PACING_TIMEOUT`
+	ev_timer frame_pacing_timer;
+	/// Timer for drawing damage on unfocused windows, see
+	/// `options_t::unfocused_damage_delay`
+	ev_timer unfocused_damage_timer;
 	/// Use an ev_idle callback for drawing
 	/// So we only start drawing when events are processed
 	ev_idle draw_idle;
@@ -151,6 +177,8 @@ typedef struct session {
 	ev_prepare event_check;
 	/// Signal handler for SIGUSR1
 	ev_signal usr1_signal;
+	/// Signal handler for SIGUSR2
+	ev_signal usr2_signal;
 	/// Signal handler for SIGINT
 	ev_signal int_signal;
 	/// backend data
@@ -161,8 +189,16 @@ typedef struct session {
 	enum driver drivers;
 	/// file watch handle
 	void *file_watch_handle;
+	/// Path of the config file in use, NULL if there isn't one
+	char *config_file;
+	/// Command line arguments, the config file is parsed together with them again
+	/// on reload
+	int argc;
+	char **argv;
 	/// libev mainloop
 	struct ev_loop *loop;
+	/// Worker threads for CPU heavy work, NULL if none could be started
+	struct workqueue *workqueue;
 
 	// === Display related ===
 	/// Whether the X server is grabbed by us
@@ -197,6 +233,16 @@ typedef struct session {
 	paint_t root_tile_paint;
 	/// The backend data the root pixmap bound to
 	void *root_image;
+	/// Whether root_image has to be tiled or scaled to cover the screen
+	bool root_image_tiled;
+	/// Screen sized copy of the tiled root_image, painted where root_cache_valid
+	/// says it's up to date, instead of tiling root_image again
+	void *root_cache;
+	region_t root_cache_valid;
+	/// The wallpaper pixmap the root is painted from, XCB_NONE if there is none
+	xcb_pixmap_t root_pixmap;
+	/// Damage object tracking changes to the content of root_pixmap
+	xcb_damage_damage_t root_pixmap_damage;
 	/// A region of the size of the screen.
 	region_t screen_reg;
 	/// Picture of root window. Destination of painting in no-DBE painting
@@ -216,10 +262,14 @@ typedef struct session {
 	glx_prog_main_t glx_prog_win;
 	struct glx_fbconfig_info *argb_fbconfig;
 #endif
-	/// Sync fence to sync draw operations
-	xcb_sync_fence_t sync_fence;
+	/// Sync fences to make painting wait for the X rendering before it, used with
+	/// xrender-sync-fence
+	struct x_fence_ring sync_fences;
 	/// Whether we are rendering the first frame after screen is redirected
 	bool first_frame;
+	/// When the session started to initialize. Used to report how long it takes for
+	/// us to get ready, cleared once reported.
+	struct timespec init_time;
 
 	// === Operation related ===
 	/// Flags related to the root window
@@ -228,24 +278,68 @@ typedef struct session {
 	options_t o;
 	/// Whether we have hit unredirection timeout.
 	bool tmout_unredir_hit;
+	/// Whether we have hit redirection timeout.
+	bool tmout_redir_hit;
+	/// Whether the screen was unredirected by unredir-if-possible, so redirecting it
+	/// again is delayed by unredir-if-possible-redirect-delay.
+	bool unredirected_if_possible;
 	/// Whether we need to redraw the screen
 	bool redraw_needed;
+	/// Whether frames are scheduled for the vblanks reported by the Present extension
+	bool use_frame_pacing;
+	/// Vblank and render time predictions used for frame pacing
+	struct frame_pacing pacing;
+	/// Present event context the vblanks are reported through
+	xcb_present_event_t present_eid;
+	/// When the frame being rendered was started, in microseconds
+	uint64_t render_start;
+	/// Number of frames rendered so far
+	uint64_t frame_count;
+	/// Timings of the recent frames, NULL if frame timing is disabled
+	struct frame_timing *frame_timing;
+	/// The trace being written, NULL if tracing is disabled
+	struct trace *trace;
+	/// Log target copying the log messages into the trace
+	struct log_target *trace_logger;
 
 	/// Cache a xfixes region so we don't need to allocate it everytime.
 	/// A workaround for yshui/picom#301
 	xcb_xfixes_region_t damaged_region;
+	/// Damage fetch requests sent in this iteration of the event loop, their replies
+	/// are collected all at once right before painting.
+	struct pending_damage_fetch *pending_damage_fetches;
+	/// Number of pending damage fetch requests
+	int npending_damage_fetches;
+	/// Capacity of `pending_damage_fetches`
+	int pending_damage_fetches_capacity;
+	/// Buffer for the events read from the X connection in one go, which are then
+	/// handled as one batch.
+	xcb_generic_event_t **event_batch;
+	/// Capacity of `event_batch`
+	int event_batch_capacity;
+	/// Number of X events received
+	uint64_t nevents_received;
+	/// Number of X events handled, the rest were made redundant by later events
+	uint64_t nevents_handled;
 	/// The region needs to painted on next paint.
 	region_t *damage;
 	/// The region damaged on the last paint.
 	region_t *damage_ring;
 	/// Number of damage regions we track
 	int ndamage;
+	/// Damage since the last paint, that might have changed what is behind any of the
+	/// windows. This is all the damage, except what is caused by the content of a
+	/// window changing, which only changes what's behind the windows above it. See
+	/// `managed_win::content_damage`.
+	region_t background_damage;
 	/// Whether all windows are currently redirected.
 	bool redirected;
 	/// Pre-generated alpha pictures.
 	xcb_render_picture_t *alpha_picts;
-	/// Time of last fading. In milliseconds.
-	long fade_time;
+	/// Masks for the corners of rounded windows, one for each corner radius in use.
+	struct corner_mask *corner_masks;
+	/// Time the fades have been advanced to, in microseconds. 0 if nothing is fading.
+	uint64_t fade_time;
 	/// Head pointer of the error ignore linked list.
 	ignore_t *ignore_head;
 	/// Pointer to the <code>next</code> member of tail element of the error
@@ -253,6 +347,8 @@ typedef struct session {
 	ignore_t **ignore_tail;
 	// Cached blur convolution kernels.
 	struct x_convolution_kernel **blur_kerns_cache;
+	/// Dual kawase blur, for the xrender legacy backends
+	struct x_kawase_blur blur_kawase;
 	/// If we should quit
 	bool quit:1;
 	// TODO(yshui) use separate flags for dfferent kinds of updates so we don't
@@ -274,6 +370,16 @@ typedef struct session {
 	struct win *windows;
 	/// Windows in their stacking order
 	struct list_node window_stack;
+	/// Stack label of the topmost window whose reg_ignore_valid has been cleared
+	/// since the last paint_preprocess, or 0 if there isn't one. UINT64_MAX if the
+	/// windows have been relabelled since.
+	uint64_t reg_ignore_dirty_label;
+	/// The windows to paint in the current frame, from bottom to top
+	struct win_paint_entry *paint_list;
+	/// Number of windows in `paint_list`
+	int npaint_list;
+	/// Capacity of `paint_list`
+	int paint_list_capacity;
 	/// Pointer to <code>win</code> of current active window. Used by
 	/// EWMH <code>_NET_ACTIVE_WINDOW</code> focus detection. In theory,
 	/// it's more reliable to store the window ID directly here, just in
@@ -283,6 +389,9 @@ typedef struct session {
 	/// Window ID of leader window of currently active window. Used for
 	/// subsidiary window detection.
 	xcb_window_t active_leader;
+	/// Window groups, a hash table of leader window IDs to the windows whose
+	/// cache_leader is that window.
+	struct leader_group *leader_groups;
 
 	// === Shadow/dimming related ===
 	/// 1x1 black Picture.
@@ -293,6 +402,8 @@ typedef struct session {
 	xcb_render_picture_t white_picture;
 	/// Gaussian map of shadow.
 	struct conv *gaussian_map;
+	/// Shadow image shared by all windows big enough, see win_bind_shadow
+	void *shadow_template;
 	// for shadow precomputation
 	/// A region in which shadow is not painted on.
 	region_t shadow_exclude_reg;
@@ -309,6 +420,10 @@ typedef struct session {
 	// === DRM VSync related ===
 	/// File descriptor of DRI device file. Used for DRM VSync.
 	int drm_fd;
+	/// Watches drm_fd for vblank events, when frames are started from them
+	ev_io drm_io;
+	/// Whether a vblank event has been requested, and hasn't arrived yet
+	bool drm_vblank_pending;
 #endif
 
 	// === X extension related ===
@@ -344,6 +459,8 @@ typedef struct session {
 	int randr_error;
 	/// Whether X Present extension exists.
 	bool present_exists;
+	/// Major opcode for X Present extension.
+	int present_opcode;
 	/// Whether X GLX extension exists.
 	bool glx_exists;
 	/// Event base number for X GLX extension.
@@ -356,12 +473,26 @@ typedef struct session {
 	region_t *xinerama_scr_regs;
 	/// Number of Xinerama screens.
 	int xinerama_nscrs;
+	/// Monitors from RandR, NULL if RandR doesn't exist or we failed to query them.
+	///
+	/// They are used to keep the damage of different monitors apart when it's
+	/// simplified, and to not render faster than the monitors the damage is on can
+	/// show (see `damage_frame_interval`). Rendering itself is not split by monitor:
+	/// everything is rendered into the overlay window, which has one back buffer, one
+	/// buffer age and one swap for all of them. Per-monitor render targets, damage
+	/// rings and vblank scheduling would need a window, or a DRM lease, per monitor,
+	/// and are out of scope.
+	struct x_monitor *monitors;
+	/// Number of monitors
+	int nmonitors;
 	/// Whether X Sync extension exists.
 	bool xsync_exists;
 	/// Event base number for X Sync extension.
 	int xsync_event;
 	/// Error base number for X Sync extension.
 	int xsync_error;
+	/// Major opcode for X Sync extension.
+	uint8_t xsync_opcode;
 	/// Whether X Render convolution filter exists.
 	bool xrfilter_convolution_exists;
 
@@ -371,6 +502,9 @@ typedef struct session {
 	xcb_atom_t atoms_wintypes[NUM_WINTYPES];
 	/// Linked list of additional atoms to track.
 	latom_t *track_atom_lst;
+	/// State of the window condition matcher, e.g. which conditions depend on which
+	/// atoms.
+	struct c2_state *c2_state;
 
 #ifdef CONFIG_DBUS
 	// === DBus related ===
@@ -449,6 +583,15 @@ static inline struct timespec get_time_timespec(void) {
 	return tm;
 }
 
+/**
+ * Get current time in microseconds, on the same clock as the timestamps of the X Present
+ * extension.
+ */
+static inline uint64_t get_time_us(void) {
+	auto tm = get_time_timespec();
+	return (uint64_t)tm.tv_sec * US_PER_SEC + (uint64_t)tm.tv_nsec / 1000;
+}
+
 /**
  * Return the painting target window.
  */
@@ -493,8 +636,9 @@ static inline void set_ignore_cookie(session_t *ps, xcb_void_cookie_t cookie) {
  * @return true if it has the attribute, false otherwise
  */
 static inline bool wid_has_prop(const session_t *ps, xcb_window_t w, xcb_atom_t atom) {
-	auto r = xcb_get_property_reply(
-	    ps->c, xcb_get_property(ps->c, 0, w, atom, XCB_GET_PROPERTY_TYPE_ANY, 0, 0), NULL);
+	auto r = X_REPLY(xcb_get_property_reply(
+	    ps->c, xcb_get_property(ps->c, 0, w, atom, XCB_GET_PROPERTY_TYPE_ANY, 0, 0),
+	    NULL));
 	if (!r) {
 		return false;
 	}
@@ -510,6 +654,15 @@ static inline bool wid_has_prop(const session_t *ps, xcb_window_t w, xcb_atom_t
 
 void force_repaint(session_t *ps);
 
+/// Start or stop recording the frame timings
+void set_frame_timing(session_t *ps, bool enable);
+
+/// Start writing a trace into `path`, replacing the current trace if there is one. Stop
+/// tracing if `path` is NULL or empty.
+///
+/// @return false if the trace file could not be opened
+bool set_trace_file(session_t *ps, const char *path);
+
 /** @name DBus handling
  */
 ///@{
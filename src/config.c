@@ -101,6 +101,19 @@ enum blur_method parse_blur_method(const char *src) {
 	return BLUR_METHOD_INVALID;
 }
 
+enum animation_curve parse_animation_curve(const char *src) {
+	if (strcmp(src, "linear") == 0) {
+		return ANIMATION_CURVE_LINEAR;
+	} else if (strcmp(src, "ease-in") == 0) {
+		return ANIMATION_CURVE_EASE_IN;
+	} else if (strcmp(src, "ease-out") == 0) {
+		return ANIMATION_CURVE_EASE_OUT;
+	} else if (strcmp(src, "ease-in-out") == 0) {
+		return ANIMATION_CURVE_EASE_IN_OUT;
+	}
+	return ANIMATION_CURVE_INVALID;
+}
+
 /**
  * Parse a matrix.
  *
@@ -513,6 +526,8 @@ char *parse_config(options_t *opt, const char *config_file, bool *shadow_enable,
 	*opt = (struct options){
 	    .backend = BKEND_XRENDER,
 	    .glx_no_stencil = false,
+	    .glx_texture_pool_size = 64,
+	    .image_memory_budget = 0,
 	    .mark_wmwin_focused = false,
 	    .mark_ovredir_focused = false,
 	    .detect_rounded_corners = false,
@@ -520,15 +535,24 @@ char *parse_config(options_t *opt, const char *config_file, bool *shadow_enable,
 	    .unredir_if_possible = false,
 	    .unredir_if_possible_blacklist = NULL,
 	    .unredir_if_possible_delay = 0,
+	    .unredir_if_possible_redirect_delay = 0,
+	    .unfocused_damage_delay = 0,
 	    .redirected_force = UNSET,
 	    .stoppaint_force = UNSET,
 	    .dbus = false,
 	    .benchmark = 0,
 	    .benchmark_wid = XCB_NONE,
 	    .logpath = NULL,
+	    .log_async = false,
+	    .frame_timing = false,
+	    .trace_file = NULL,
 
 	    .refresh_rate = 0,
 	    .sw_opti = false,
+	    .frame_pacing = true,
+	    .xrender_buffers = 3,
+	    .max_damage_rects = 64,
+	    .damage_merge_waste = 1024,
 	    .use_damage = true,
 
 	    .shadow_red = 0.0,
@@ -548,6 +572,7 @@ char *parse_config(options_t *opt, const char *config_file, bool *shadow_enable,
 	    .fade_in_step = 0.028,
 	    .fade_out_step = 0.03,
 	    .fade_delta = 10,
+	    .fade_curve = ANIMATION_CURVE_LINEAR,
 	    .no_fading_openclose = false,
 	    .no_fading_destroyed_argb = false,
 	    .fade_blacklist = NULL,
@@ -562,6 +587,7 @@ char *parse_config(options_t *opt, const char *config_file, bool *shadow_enable,
 	    .blur_radius = 3,
 	    .blur_deviation = 0.84089642,
 	    .blur_strength = 5,
+	    .blur_downscale = 1,
 	    .blur_background_frame = false,
 	    .blur_background_fixed = false,
 	    .blur_background_blacklist = NULL,
@@ -598,3 +624,41 @@ char *parse_config(options_t *opt, const char *config_file, bool *shadow_enable,
 #endif
 	return ret;
 }
+
+void options_destroy(options_t *opt) {
+	c2_lptr_t **lists[] = {
+	    &opt->unredir_if_possible_blacklist,
+	    &opt->paint_blacklist,
+	    &opt->shadow_blacklist,
+	    &opt->shadow_clip_list,
+	    &opt->fade_blacklist,
+	    &opt->blur_background_blacklist,
+	    &opt->invert_color_list,
+	    &opt->opacity_rules,
+	    &opt->rounded_corners_blacklist,
+	    &opt->focus_blacklist,
+	};
+	for (size_t i = 0; i < ARR_SIZE(lists); i++) {
+		while ((*lists[i] = c2_free_lptr(*lists[i]))) {
+			continue;
+		}
+	}
+
+	for (int i = 0; i < opt->blur_kernel_count; ++i) {
+		free(opt->blur_kerns[i]);
+	}
+	free(opt->blur_kerns);
+	opt->blur_kerns = NULL;
+	opt->blur_kernel_count = 0;
+
+	free(opt->write_pid_path);
+	free(opt->logpath);
+	free(opt->trace_file);
+	free(opt->glx_fshader_win_str);
+	free(opt->shadow_exclude_reg_str);
+	opt->write_pid_path = NULL;
+	opt->logpath = NULL;
+	opt->trace_file = NULL;
+	opt->glx_fshader_win_str = NULL;
+	opt->shadow_exclude_reg_str = NULL;
+}
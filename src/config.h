@@ -19,6 +19,7 @@
 #include <libconfig.h>
 #endif
 
+#include "animation.h"
 #include "compiler.h"
 #include "kernel.h"
 #include "log.h"
@@ -26,6 +27,9 @@
 #include "types.h"
 #include "win_defs.h"
 
+/// Maximum number of back buffers the xrender backend can use
+#define XRENDER_MAX_BUFFERS 4
+
 typedef struct session session_t;
 
 /// @brief Possible backends
@@ -34,6 +38,7 @@ enum backend {
 	BKEND_GLX,
 	BKEND_XR_GLX_HYBRID,
 	BKEND_DUMMY,
+	BKEND_EGL,
 	NUM_BKEND,
 };
 
@@ -77,6 +82,10 @@ typedef struct options {
 	bool print_diagnostics;
 	/// Render to a separate window instead of taking over the screen
 	bool debug_mode;
+	/// Record how long each phase of the frames takes
+	bool frame_timing;
+	/// Write a trace of the frames into this file, NULL if tracing is disabled
+	char *trace_file;
 	// === General ===
 	/// Use the experimental new backends?
 	bool experimental_backends;
@@ -92,6 +101,16 @@ typedef struct options {
 	bool glx_no_stencil;
 	/// Whether to avoid rebinding pixmap on window damage.
 	bool glx_no_rebind_pixmap;
+	/// How much video memory unused textures can be kept around in, in MiB.
+	int glx_texture_pool_size;
+	/// How much memory the images of windows can take, in MiB, 0 for no limit.
+	int image_memory_budget;
+	/// Number of back buffers the xrender backend uses with vsync.
+	int xrender_buffers;
+	/// Most rectangles the damage is painted with, 0 for no limit.
+	int max_damage_rects;
+	/// Most pixels merging two damage rectangles may add to the damage.
+	int damage_merge_waste;
 	/// Custom fragment shader for painting windows, as a string.
 	char *glx_fshader_win_str;
 	/// Whether to detect rounded corners.
@@ -108,6 +127,12 @@ typedef struct options {
 	c2_lptr_t *unredir_if_possible_blacklist;
 	/// Delay before unredirecting screen, in milliseconds.
 	long unredir_if_possible_delay;
+	/// Delay before redirecting the screen again after unredirecting it, in
+	/// milliseconds.
+	long unredir_if_possible_redirect_delay;
+	/// How long damage on windows other than the focused one can wait to be drawn,
+	/// in milliseconds, 0 to draw it right away.
+	long unfocused_damage_delay;
 	/// Forced redirection setting through D-Bus.
 	switch_t redirected_force;
 	/// Whether to stop painting. Controlled through D-Bus.
@@ -116,6 +141,8 @@ typedef struct options {
 	bool dbus;
 	/// Path to log file.
 	char *logpath;
+	/// Write to the log file on a background thread.
+	bool log_async;
 	/// Number of cycles to paint in benchmark mode. 0 for disabled.
 	int benchmark;
 	/// Window to constantly repaint in benchmark mode. 0 for full-screen.
@@ -134,6 +161,8 @@ typedef struct options {
 	int refresh_rate;
 	/// Whether to enable refresh-rate-based software optimization.
 	bool sw_opti;
+	/// Whether to schedule frames for the vblanks reported by the Present extension
+	bool frame_pacing;
 	/// VSync method to use;
 	bool vsync;
 	/// Whether to use glFinish() instead of glFlush() for (possibly) better
@@ -166,6 +195,8 @@ typedef struct options {
 	double fade_out_step;
 	/// Fading time delta. In milliseconds.
 	int fade_delta;
+	/// Easing curve of fading and dimming.
+	enum animation_curve fade_curve;
 	/// Whether to disable fading on window open/close.
 	bool no_fading_openclose;
 	/// Whether to disable fading on ARGB managed destroyed windows.
@@ -198,6 +229,9 @@ typedef struct options {
 	double blur_deviation;
 	// Strength of the dual_kawase blur
 	int blur_strength;
+	/// How much to scale down the background by before blurring it, for the
+	/// gaussian and box blur
+	int blur_downscale;
 	/// Whether to blur background when the window frame is not opaque.
 	/// Implies blur_background.
 	bool blur_background_frame;
@@ -260,6 +294,7 @@ struct conv **must_use parse_blur_kern_lst(const char *, bool *hasneg, int *coun
 bool must_use parse_geometry(session_t *, const char *, region_t *);
 bool must_use parse_rule_opacity(c2_lptr_t **, const char *);
 enum blur_method must_use parse_blur_method(const char *src);
+enum animation_curve must_use parse_animation_curve(const char *src);
 
 /**
  * Add a pattern to a condition linked list.
@@ -280,6 +315,9 @@ parse_config_libconfig(options_t *, const char *config_file, bool *shadow_enable
                        bool *fading_enable, bool *hasneg, win_option_mask_t *winopt_mask);
 #endif
 
+/// Free the condition lists, strings and blur kernels owned by the options
+void options_destroy(options_t *);
+
 void set_default_winopts(options_t *, win_option_mask_t *, bool shadow_enable,
                          bool fading_enable, bool blur_enable);
 /// Parse a configuration file is that is enabled, also initialize the winopt_mask with
@@ -364,6 +364,15 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
 	// -O (fade_out_step)
 	if (config_lookup_float(&cfg, "fade-out-step", &dval))
 		opt->fade_out_step = normalize_d(dval);
+	// --fade-curve
+	if (config_lookup_string(&cfg, "fade-curve", &sval)) {
+		enum animation_curve curve = parse_animation_curve(sval);
+		if (curve >= ANIMATION_CURVE_INVALID) {
+			log_fatal("Invalid fade curve %s", sval);
+			goto err;
+		}
+		opt->fade_curve = curve;
+	}
 	// -r (shadow_radius)
 	config_lookup_int(&cfg, "shadow-radius", &opt->shadow_radius);
 	// -o (shadow_opacity)
@@ -491,8 +500,18 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
 		}
 		opt->logpath = strdup(sval);
 	}
+	// --log-async
+	lcfg_lookup_bool(&cfg, "log-async", &opt->log_async);
 	// --sw-opti
 	lcfg_lookup_bool(&cfg, "sw-opti", &opt->sw_opti);
+	// --xrender-buffers
+	config_lookup_int(&cfg, "xrender-buffers", &opt->xrender_buffers);
+	// --max-damage-rects
+	config_lookup_int(&cfg, "max-damage-rects", &opt->max_damage_rects);
+	// --damage-merge-waste
+	config_lookup_int(&cfg, "damage-merge-waste", &opt->damage_merge_waste);
+	// --no-frame-pacing
+	lcfg_lookup_bool(&cfg, "frame-pacing", &opt->frame_pacing);
 	// --use-ewmh-active-win
 	lcfg_lookup_bool(&cfg, "use-ewmh-active-win", &opt->use_ewmh_active_win);
 	// --unredir-if-possible
@@ -505,6 +524,22 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
 			opt->unredir_if_possible_delay = ival;
 		}
 	}
+	// --unredir-if-possible-redirect-delay
+	if (config_lookup_int(&cfg, "unredir-if-possible-redirect-delay", &ival)) {
+		if (ival < 0) {
+			log_warn("Invalid unredir-if-possible-redirect-delay %d", ival);
+		} else {
+			opt->unredir_if_possible_redirect_delay = ival;
+		}
+	}
+	// --unfocused-damage-delay
+	if (config_lookup_int(&cfg, "unfocused-damage-delay", &ival)) {
+		if (ival < 0) {
+			log_warn("Invalid unfocused-damage-delay %d", ival);
+		} else {
+			opt->unfocused_damage_delay = ival;
+		}
+	}
 	// --inactive-dim-fixed
 	lcfg_lookup_bool(&cfg, "inactive-dim-fixed", &opt->inactive_dim_fixed);
 	// --detect-transient
@@ -515,6 +550,13 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
 	lcfg_lookup_bool(&cfg, "no-ewmh-fullscreen", &opt->no_ewmh_fullscreen);
 	// --transparent-clipping
 	lcfg_lookup_bool(&cfg, "transparent-clipping", &opt->transparent_clipping);
+	// --frame-timing
+	lcfg_lookup_bool(&cfg, "frame-timing", &opt->frame_timing);
+	// --trace-file
+	if (config_lookup_string(&cfg, "trace-file", &sval)) {
+		free(opt->trace_file);
+		opt->trace_file = strdup(sval);
+	}
 	// --shadow-exclude
 	parse_cfg_condlst(&cfg, &opt->shadow_blacklist, "shadow-exclude");
 	// --clip-shadow-above
@@ -547,6 +589,8 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
 	config_lookup_float(&cfg, "blur-deviation", &opt->blur_deviation);
 	// --blur-strength
 	config_lookup_int(&cfg, "blur-strength", &opt->blur_strength);
+	// --blur-downscale
+	config_lookup_int(&cfg, "blur-downscale", &opt->blur_downscale);
 	// --blur-background
 	if (config_lookup_bool(&cfg, "blur-background", &ival) && ival) {
 		if (opt->blur_method == BLUR_METHOD_NONE) {
@@ -572,6 +616,10 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
 	lcfg_lookup_bool(&cfg, "glx-no-stencil", &opt->glx_no_stencil);
 	// --glx-no-rebind-pixmap
 	lcfg_lookup_bool(&cfg, "glx-no-rebind-pixmap", &opt->glx_no_rebind_pixmap);
+	// --glx-texture-pool-size
+	config_lookup_int(&cfg, "glx-texture-pool-size", &opt->glx_texture_pool_size);
+	// --image-memory-budget
+	config_lookup_int(&cfg, "image-memory-budget", &opt->image_memory_budget);
 	lcfg_lookup_bool(&cfg, "force-win-blend", &opt->force_win_blend);
 	// --glx-swap-method
 	if (config_lookup_string(&cfg, "glx-swap-method", &sval)) {
@@ -658,6 +706,7 @@ char *parse_config_libconfig(options_t *opt, const char *config_file, bool *shad
 
 		config_setting_lookup_float(blur_cfg, "deviation", &opt->blur_deviation);
 		config_setting_lookup_int(blur_cfg, "strength", &opt->blur_strength);
+		config_setting_lookup_int(blur_cfg, "downscale", &opt->blur_downscale);
 	}
 
 	// --write-pid-path
@@ -11,6 +11,7 @@
 
 #include <X11/Xlib.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,6 +22,7 @@
 #include "common.h"
 #include "compiler.h"
 #include "config.h"
+#include "frame_timing.h"
 #include "list.h"
 #include "log.h"
 #include "string_utils.h"
@@ -28,6 +30,7 @@
 #include "uthash_extra.h"
 #include "utils.h"
 #include "win.h"
+#include "x.h"
 
 #include "dbus.h"
 
@@ -36,6 +39,14 @@ struct cdbus_data {
 	DBusConnection *dbus_conn;
 	/// DBus service name.
 	char *dbus_service;
+	/// Clients subscribed to changes of windows.
+	struct cdbus_subscriber *subscribers;
+	/// Bit mask of the targets any of the subscribers is interested in.
+	uint64_t watched;
+	/// Snapshots of the watched targets of the windows, keyed by window ID.
+	struct cdbus_win_snapshot *snapshots;
+	/// Number of times the windows have been checked for changes.
+	uint64_t generation;
 };
 
 // Window type
@@ -86,11 +97,13 @@ static void cdbus_callback_remove_watch(DBusWatch *watch, void *data);
 
 static void cdbus_callback_watch_toggled(DBusWatch *watch, void *data);
 
+static void cdbus_subscriptions_free(struct cdbus_data *cd);
+
 /**
  * Initialize D-Bus connection.
  */
 bool cdbus_init(session_t *ps, const char *uniq) {
-	auto cd = cmalloc(struct cdbus_data);
+	auto cd = ccalloc(1, struct cdbus_data);
 	cd->dbus_service = NULL;
 
 	// Set ps->dbus_data here because add_watch functions need it
@@ -193,6 +206,7 @@ fail:
  */
 void cdbus_destroy(session_t *ps) {
 	struct cdbus_data *cd = ps->dbus_data;
+	cdbus_subscriptions_free(cd);
 	if (cd->dbus_conn) {
 		// Release DBus name firstly
 		if (cd->dbus_service) {
@@ -465,6 +479,34 @@ cdbus_apdarg_string(session_t *ps attr_unused, DBusMessage *msg, const void *dat
 	return true;
 }
 
+/**
+ * Callback to append the summary of the timings of a frame phase to a message: the
+ * number of frames, the 50th, 90th and 99th percentiles and the maximum in
+ * microseconds, and the histogram.
+ */
+static bool
+cdbus_apdarg_frame_timing(session_t *ps attr_unused, DBusMessage *msg, const void *data) {
+	const struct frame_timing_summary *summary = data;
+	dbus_uint32_t count = summary->count;
+	double p50 = (double)summary->p50 / 1000.0, p90 = (double)summary->p90 / 1000.0,
+	       p99 = (double)summary->p99 / 1000.0, max = (double)summary->max / 1000.0;
+	dbus_uint32_t histogram[FRAME_TIMING_BUCKETS];
+	for (int i = 0; i < FRAME_TIMING_BUCKETS; i++) {
+		histogram[i] = summary->histogram[i];
+	}
+	const dbus_uint32_t *phistogram = histogram;
+
+	if (!dbus_message_append_args(
+	        msg, DBUS_TYPE_UINT32, &count, DBUS_TYPE_DOUBLE, &p50, DBUS_TYPE_DOUBLE,
+	        &p90, DBUS_TYPE_DOUBLE, &p99, DBUS_TYPE_DOUBLE, &max, DBUS_TYPE_ARRAY,
+	        DBUS_TYPE_UINT32, &phistogram, FRAME_TIMING_BUCKETS, DBUS_TYPE_INVALID)) {
+		log_error("Failed to append argument.");
+		return false;
+	}
+
+	return true;
+}
+
 /**
  * Callback to append all window IDs to a message.
  */
@@ -682,18 +724,15 @@ static bool cdbus_reply_errm(session_t *ps, DBusMessage *msg) {
 }
 
 /**
- * Get n-th argument of a D-Bus message.
+ * Get an iterator pointing to the n-th argument of a D-Bus message.
  *
- * @param count the position of the argument to get, starting from 0
- * @param type libdbus type number of the type
- * @param pdest pointer to the target
+ * @param count the position of the argument, starting from 0
  * @return true if successful, false otherwise.
  */
-static bool cdbus_msg_get_arg(DBusMessage *msg, int count, const int type, void *pdest) {
+static bool cdbus_msg_get_iter(DBusMessage *msg, int count, DBusMessageIter *iter) {
 	assert(count >= 0);
 
-	DBusMessageIter iter = {};
-	if (!dbus_message_iter_init(msg, &iter)) {
+	if (!dbus_message_iter_init(msg, iter)) {
 		log_error("Message has no argument.");
 		return false;
 	}
@@ -701,7 +740,7 @@ static bool cdbus_msg_get_arg(DBusMessage *msg, int count, const int type, void
 	{
 		const int oldcount = count;
 		while (count) {
-			if (!dbus_message_iter_next(&iter)) {
+			if (!dbus_message_iter_next(iter)) {
 				log_error("Failed to find argument %d.", oldcount);
 				return false;
 			}
@@ -709,16 +748,559 @@ static bool cdbus_msg_get_arg(DBusMessage *msg, int count, const int type, void
 		}
 	}
 
-	if (type != dbus_message_iter_get_arg_type(&iter)) {
+	return true;
+}
+
+/**
+ * Get the basic value an iterator points to, looking into it if it's a variant.
+ *
+ * @param type libdbus type number of the type
+ * @param pdest pointer to the target
+ * @return true if successful, false otherwise.
+ */
+static bool cdbus_iter_get_basic(DBusMessageIter *iter, const int type, void *pdest) {
+	DBusMessageIter variant;
+	if (dbus_message_iter_get_arg_type(iter) == DBUS_TYPE_VARIANT) {
+		dbus_message_iter_recurse(iter, &variant);
+		iter = &variant;
+	}
+
+	if (type != dbus_message_iter_get_arg_type(iter)) {
 		log_error("Argument has incorrect type.");
 		return false;
 	}
 
-	dbus_message_iter_get_basic(&iter, pdest);
+	dbus_message_iter_get_basic(iter, pdest);
+
+	return true;
+}
+
+/**
+ * Get n-th argument of a D-Bus message.
+ *
+ * @param count the position of the argument to get, starting from 0
+ * @param type libdbus type number of the type
+ * @param pdest pointer to the target
+ * @return true if successful, false otherwise.
+ */
+static bool cdbus_msg_get_arg(DBusMessage *msg, int count, const int type, void *pdest) {
+	DBusMessageIter iter = {};
+	return cdbus_msg_get_iter(msg, count, &iter) &&
+	       cdbus_iter_get_basic(&iter, type, pdest);
+}
+
+/** @name Window properties
+ */
+///@{
+
+/// Properties of a window that can be read with win_get and win_get_many, and watched
+/// with win_subscribe
+enum cdbus_win_target {
+	CDBUS_WIN_ID,
+	CDBUS_WIN_NEXT,
+	CDBUS_WIN_MAP_STATE,
+	CDBUS_WIN_MODE,
+	CDBUS_WIN_CLIENT_WIN,
+	CDBUS_WIN_EVER_DAMAGED,
+	CDBUS_WIN_WINDOW_TYPE,
+	CDBUS_WIN_WMWIN,
+	CDBUS_WIN_LEADER,
+	CDBUS_WIN_FOCUSED_RAW,
+	CDBUS_WIN_FADE_FORCE,
+	CDBUS_WIN_SHADOW_FORCE,
+	CDBUS_WIN_FOCUSED_FORCE,
+	CDBUS_WIN_INVERT_COLOR_FORCE,
+	CDBUS_WIN_NAME,
+	CDBUS_WIN_CLASS_INSTANCE,
+	CDBUS_WIN_CLASS_GENERAL,
+	CDBUS_WIN_ROLE,
+	CDBUS_WIN_OPACITY,
+	CDBUS_WIN_OPACITY_TARGET,
+	CDBUS_WIN_HAS_OPACITY_PROP,
+	CDBUS_WIN_OPACITY_PROP,
+	CDBUS_WIN_OPACITY_IS_SET,
+	CDBUS_WIN_OPACITY_SET,
+	CDBUS_WIN_FRAME_OPACITY,
+	CDBUS_WIN_LEFT_WIDTH,
+	CDBUS_WIN_RIGHT_WIDTH,
+	CDBUS_WIN_TOP_WIDTH,
+	CDBUS_WIN_BOTTOM_WIDTH,
+	CDBUS_WIN_SHADOW,
+	CDBUS_WIN_INVERT_COLOR,
+	CDBUS_WIN_BLUR_BACKGROUND,
+	NUM_CDBUS_WIN_TARGETS,
+};
+
+static const char *const CDBUS_WIN_TARGET_NAMES[NUM_CDBUS_WIN_TARGETS] = {
+    [CDBUS_WIN_ID] = "base.id",
+    [CDBUS_WIN_NEXT] = "next",
+    [CDBUS_WIN_MAP_STATE] = "map_state",
+    [CDBUS_WIN_MODE] = "mode",
+    [CDBUS_WIN_CLIENT_WIN] = "client_win",
+    [CDBUS_WIN_EVER_DAMAGED] = "ever_damaged",
+    [CDBUS_WIN_WINDOW_TYPE] = "window_type",
+    [CDBUS_WIN_WMWIN] = "wmwin",
+    [CDBUS_WIN_LEADER] = "leader",
+    [CDBUS_WIN_FOCUSED_RAW] = "focused_raw",
+    [CDBUS_WIN_FADE_FORCE] = "fade_force",
+    [CDBUS_WIN_SHADOW_FORCE] = "shadow_force",
+    [CDBUS_WIN_FOCUSED_FORCE] = "focused_force",
+    [CDBUS_WIN_INVERT_COLOR_FORCE] = "invert_color_force",
+    [CDBUS_WIN_NAME] = "name",
+    [CDBUS_WIN_CLASS_INSTANCE] = "class_instance",
+    [CDBUS_WIN_CLASS_GENERAL] = "class_general",
+    [CDBUS_WIN_ROLE] = "role",
+    [CDBUS_WIN_OPACITY] = "opacity",
+    [CDBUS_WIN_OPACITY_TARGET] = "opacity_target",
+    [CDBUS_WIN_HAS_OPACITY_PROP] = "has_opacity_prop",
+    [CDBUS_WIN_OPACITY_PROP] = "opacity_prop",
+    [CDBUS_WIN_OPACITY_IS_SET] = "opacity_is_set",
+    [CDBUS_WIN_OPACITY_SET] = "opacity_set",
+    [CDBUS_WIN_FRAME_OPACITY] = "frame_opacity",
+    [CDBUS_WIN_LEFT_WIDTH] = "left_width",
+    [CDBUS_WIN_RIGHT_WIDTH] = "right_width",
+    [CDBUS_WIN_TOP_WIDTH] = "top_width",
+    [CDBUS_WIN_BOTTOM_WIDTH] = "bottom_width",
+    [CDBUS_WIN_SHADOW] = "shadow",
+    [CDBUS_WIN_INVERT_COLOR] = "invert_color",
+    [CDBUS_WIN_BLUR_BACKGROUND] = "blur_background",
+};
+
+/// A value of a basic D-Bus type
+struct cdbus_value {
+	int type;
+	union {
+		dbus_bool_t b;
+		dbus_int32_t i;
+		dbus_uint32_t u;
+		double d;
+		const char *s;
+	} v;
+};
+
+static enum cdbus_win_target cdbus_win_target_from_name(const char *name) {
+	for (int i = 0; i < NUM_CDBUS_WIN_TARGETS; i++) {
+		if (strcmp(CDBUS_WIN_TARGET_NAMES[i], name) == 0) {
+			return i;
+		}
+	}
+	return NUM_CDBUS_WIN_TARGETS;
+}
+
+static inline struct cdbus_value cdbus_value_bool(bool val) {
+	return (struct cdbus_value){.type = DBUS_TYPE_BOOLEAN, .v.b = val};
+}
+
+static inline struct cdbus_value cdbus_value_int32(int32_t val) {
+	return (struct cdbus_value){.type = DBUS_TYPE_INT32, .v.i = val};
+}
+
+static inline struct cdbus_value cdbus_value_uint32(uint32_t val) {
+	return (struct cdbus_value){.type = DBUS_TYPE_UINT32, .v.u = val};
+}
+
+static inline struct cdbus_value cdbus_value_double(double val) {
+	return (struct cdbus_value){.type = DBUS_TYPE_DOUBLE, .v.d = val};
+}
+
+static inline struct cdbus_value cdbus_value_string(const char *val) {
+	return (struct cdbus_value){.type = DBUS_TYPE_STRING, .v.s = val ? val : ""};
+}
+
+/**
+ * Get the value of a target of a window. Strings are owned by the window.
+ */
+static struct cdbus_value cdbus_win_get_value(session_t *ps, const struct managed_win *w,
+                                              enum cdbus_win_target target) {
+	// Both window IDs and enums are sent as uint32
+	switch (target) {
+	case CDBUS_WIN_ID: return cdbus_value_uint32(w->base.id);
+	case CDBUS_WIN_NEXT:
+		if (list_node_is_last(&ps->window_stack, &w->base.stack_neighbour)) {
+			return cdbus_value_uint32(0);
+		}
+		auto next =
+		    list_entry(w->base.stack_neighbour.next, struct win, stack_neighbour);
+		return cdbus_value_uint32(next->id);
+	case CDBUS_WIN_MAP_STATE: return cdbus_value_bool(w->a.map_state);
+	case CDBUS_WIN_MODE: return cdbus_value_uint32(w->mode);
+	case CDBUS_WIN_CLIENT_WIN: return cdbus_value_uint32(w->client_win);
+	case CDBUS_WIN_EVER_DAMAGED: return cdbus_value_bool(w->ever_damaged);
+	case CDBUS_WIN_WINDOW_TYPE: return cdbus_value_uint32(w->window_type);
+	case CDBUS_WIN_WMWIN: return cdbus_value_bool(w->wmwin);
+	case CDBUS_WIN_LEADER: return cdbus_value_uint32(w->leader);
+	case CDBUS_WIN_FOCUSED_RAW: return cdbus_value_bool(win_is_focused_raw(ps, w));
+	case CDBUS_WIN_FADE_FORCE: return cdbus_value_uint32(w->fade_force);
+	case CDBUS_WIN_SHADOW_FORCE: return cdbus_value_uint32(w->shadow_force);
+	case CDBUS_WIN_FOCUSED_FORCE: return cdbus_value_uint32(w->focused_force);
+	case CDBUS_WIN_INVERT_COLOR_FORCE:
+		return cdbus_value_uint32(w->invert_color_force);
+	case CDBUS_WIN_NAME: return cdbus_value_string(w->name);
+	case CDBUS_WIN_CLASS_INSTANCE: return cdbus_value_string(w->class_instance);
+	case CDBUS_WIN_CLASS_GENERAL: return cdbus_value_string(w->class_general);
+	case CDBUS_WIN_ROLE: return cdbus_value_string(w->role);
+	case CDBUS_WIN_OPACITY: return cdbus_value_double(w->opacity);
+	case CDBUS_WIN_OPACITY_TARGET: return cdbus_value_double(w->opacity_target);
+	case CDBUS_WIN_HAS_OPACITY_PROP: return cdbus_value_bool(w->has_opacity_prop);
+	case CDBUS_WIN_OPACITY_PROP: return cdbus_value_uint32(w->opacity_prop);
+	case CDBUS_WIN_OPACITY_IS_SET: return cdbus_value_bool(w->opacity_is_set);
+	case CDBUS_WIN_OPACITY_SET: return cdbus_value_double(w->opacity_set);
+	case CDBUS_WIN_FRAME_OPACITY: return cdbus_value_double(w->frame_opacity);
+	case CDBUS_WIN_LEFT_WIDTH: return cdbus_value_int32(w->frame_extents.left);
+	case CDBUS_WIN_RIGHT_WIDTH: return cdbus_value_int32(w->frame_extents.right);
+	case CDBUS_WIN_TOP_WIDTH: return cdbus_value_int32(w->frame_extents.top);
+	case CDBUS_WIN_BOTTOM_WIDTH: return cdbus_value_int32(w->frame_extents.bottom);
+	case CDBUS_WIN_SHADOW: return cdbus_value_bool(w->shadow);
+	case CDBUS_WIN_INVERT_COLOR: return cdbus_value_bool(w->invert_color);
+	case CDBUS_WIN_BLUR_BACKGROUND: return cdbus_value_bool(w->blur_background);
+	case NUM_CDBUS_WIN_TARGETS: assert(0); break;
+	}
+	unreachable;
+}
+
+static bool cdbus_value_equal(const struct cdbus_value *a, const struct cdbus_value *b) {
+	assert(a->type == b->type);
+	switch (a->type) {
+	case DBUS_TYPE_BOOLEAN: return a->v.b == b->v.b;
+	case DBUS_TYPE_INT32: return a->v.i == b->v.i;
+	case DBUS_TYPE_UINT32: return a->v.u == b->v.u;
+	case DBUS_TYPE_DOUBLE: return a->v.d == b->v.d;
+	case DBUS_TYPE_STRING: return strcmp(a->v.s, b->v.s) == 0;
+	default: unreachable;
+	}
+}
+
+/**
+ * Append a value to a message, wrapped in a variant if `variant` is true.
+ */
+static bool
+cdbus_append_value(DBusMessageIter *iter, const struct cdbus_value *value, bool variant) {
+	if (!variant) {
+		return dbus_message_iter_append_basic(iter, value->type, &value->v);
+	}
+
+	DBusMessageIter sub;
+	const char signature[] = {(char)value->type, '\0'};
+	return dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, signature,
+	                                        &sub) &&
+	       dbus_message_iter_append_basic(&sub, value->type, &value->v) &&
+	       dbus_message_iter_close_container(iter, &sub);
+}
+
+/**
+ * Append a target and its value to a dictionary of type a{sv}.
+ */
+static bool cdbus_append_dict_entry(DBusMessageIter *dict, enum cdbus_win_target target,
+                                    const struct cdbus_value *value) {
+	DBusMessageIter entry;
+	const char *name = CDBUS_WIN_TARGET_NAMES[target];
+	return dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL,
+	                                        &entry) &&
+	       dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name) &&
+	       cdbus_append_value(&entry, value, true) &&
+	       dbus_message_iter_close_container(dict, &entry);
+}
+
+/**
+ * Callback to append a cdbus_value argument to a message.
+ */
+static bool
+cdbus_apdarg_value(session_t *ps attr_unused, DBusMessage *msg, const void *data) {
+	DBusMessageIter iter;
+	dbus_message_iter_init_append(msg, &iter);
+	if (!cdbus_append_value(&iter, data, false)) {
+		log_error("Failed to append argument.");
+		return false;
+	}
+
+	return true;
+}
+///@}
+
+/** @name Window change subscriptions
+ */
+///@{
+
+struct cdbus_subscriber {
+	/// Unique bus name of the client
+	char *name;
+	/// Bit mask of the targets the client is interested in
+	uint64_t targets;
+	struct cdbus_subscriber *next;
+};
+
+/// Values of the watched targets of a window, as of the last check
+struct cdbus_win_snapshot {
+	xcb_window_t wid;
+	/// The last check the window was seen in
+	uint64_t generation;
+	struct cdbus_value values[NUM_CDBUS_WIN_TARGETS];
+	UT_hash_handle hh;
+};
+
+/// Most clients that can subscribe to changes of windows at the same time
+#define CDBUS_MAX_SUBSCRIBERS 16
+
+/**
+ * Match the NameOwnerChanged signal sent when a subscriber leaves the bus.
+ */
+static void cdbus_watch_subscriber(struct cdbus_data *cd, const char *name, bool add) {
+	char *rule = mstrjoin("type='signal',sender='" DBUS_SERVICE_DBUS
+	                      "',interface='" DBUS_INTERFACE_DBUS
+	                      "',member='NameOwnerChanged',arg0='",
+	                      name);
+	mstrextend(&rule, "'");
+	// Without an error, the match rule is sent without waiting for the reply
+	if (add) {
+		dbus_bus_add_match(cd->dbus_conn, rule, NULL);
+	} else {
+		dbus_bus_remove_match(cd->dbus_conn, rule, NULL);
+	}
+	free(rule);
+}
+
+static void cdbus_snapshot_set(struct cdbus_win_snapshot *snapshot,
+                               enum cdbus_win_target target, struct cdbus_value value) {
+	auto old = &snapshot->values[target];
+	if (old->type == DBUS_TYPE_STRING) {
+		free((char *)old->v.s);
+	}
+	if (value.type == DBUS_TYPE_STRING) {
+		value.v.s = strdup(value.v.s);
+	}
+	*old = value;
+}
+
+static void
+cdbus_snapshot_free(struct cdbus_data *cd, struct cdbus_win_snapshot *snapshot) {
+	HASH_DEL(cd->snapshots, snapshot);
+	for (int i = 0; i < NUM_CDBUS_WIN_TARGETS; i++) {
+		if (snapshot->values[i].type == DBUS_TYPE_STRING) {
+			free((char *)snapshot->values[i].v.s);
+		}
+	}
+	free(snapshot);
+}
+
+/**
+ * Take the snapshot of `targets` of a window, creating the snapshot if the window
+ * doesn't have one.
+ */
+static struct cdbus_win_snapshot *
+cdbus_snapshot_take(session_t *ps, const struct managed_win *w, uint64_t targets) {
+	struct cdbus_data *cd = ps->dbus_data;
+	struct cdbus_win_snapshot *snapshot = NULL;
+	HASH_FIND_INT(cd->snapshots, &w->base.id, snapshot);
+	if (!snapshot) {
+		snapshot = ccalloc(1, struct cdbus_win_snapshot);
+		snapshot->wid = w->base.id;
+		HASH_ADD_INT(cd->snapshots, wid, snapshot);
+		targets = cd->watched;
+	}
+	for (int i = 0; i < NUM_CDBUS_WIN_TARGETS; i++) {
+		if (targets & (1ULL << i)) {
+			cdbus_snapshot_set(snapshot, i, cdbus_win_get_value(ps, w, i));
+		}
+	}
+	snapshot->generation = cd->generation;
+	return snapshot;
+}
+
+/**
+ * Update the targets being watched after the subscriptions changed, taking the snapshot
+ * of the new ones right away, so changes made before the next check aren't missed.
+ */
+static void cdbus_update_watched(session_t *ps) {
+	struct cdbus_data *cd = ps->dbus_data;
+	uint64_t watched = 0;
+	for (auto sub = cd->subscribers; sub; sub = sub->next) {
+		watched |= sub->targets;
+	}
+
+	uint64_t added = watched & ~cd->watched;
+	cd->watched = watched;
+	if (!watched) {
+		HASH_ITER2(cd->snapshots, snapshot) {
+			cdbus_snapshot_free(cd, snapshot);
+		}
+		return;
+	}
+	if (added) {
+		win_stack_foreach_managed(w, &ps->window_stack) {
+			if (w->state != WSTATE_DESTROYING) {
+				cdbus_snapshot_take(ps, w, added);
+			}
+		}
+	}
+}
+
+static void cdbus_subscriber_free(struct cdbus_data *cd, struct cdbus_subscriber **psub) {
+	auto sub = *psub;
+	*psub = sub->next;
+	cdbus_watch_subscriber(cd, sub->name, false);
+	free(sub->name);
+	free(sub);
+}
+
+/**
+ * Process a win_subscribe D-Bus request.
+ *
+ * Takes an array of targets, the sender is then sent a win_changed signal with the
+ * window ID and the new values when any of these targets of a window changes. Each call
+ * replaces the previous subscription of the sender, an empty array unsubscribes.
+ */
+static bool cdbus_process_win_subscribe(session_t *ps, DBusMessage *msg) {
+	struct cdbus_data *cd = ps->dbus_data;
+	char **names = NULL;
+	int nnames = 0;
+	DBusError err = {};
+
+	if (!dbus_message_get_args(msg, &err, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &names,
+	                           &nnames, DBUS_TYPE_INVALID)) {
+		log_error("Failed to parse argument of \"win_subscribe\" (%s).",
+		          err.message);
+		dbus_error_free(&err);
+		return false;
+	}
+
+	uint64_t targets = 0;
+	for (int i = 0; i < nnames; i++) {
+		auto target = cdbus_win_target_from_name(names[i]);
+		if (target == NUM_CDBUS_WIN_TARGETS) {
+			log_error(CDBUS_ERROR_BADTGT_S, names[i]);
+			cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S,
+			                names[i]);
+			dbus_free_string_array(names);
+			return true;
+		}
+		targets |= 1ULL << target;
+	}
+	dbus_free_string_array(names);
+
+	const char *sender = dbus_message_get_sender(msg);
+	if (!sender) {
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_CUSTOM, CDBUS_ERROR_CUSTOM_S,
+		                "The sender of the message is unknown.");
+		return true;
+	}
+
+	auto psub = &cd->subscribers;
+	int nsubscribers = 0;
+	while (*psub && strcmp((*psub)->name, sender) != 0) {
+		psub = &(*psub)->next;
+		nsubscribers++;
+	}
+	if (*psub && !targets) {
+		cdbus_subscriber_free(cd, psub);
+	} else if (*psub) {
+		(*psub)->targets = targets;
+	} else if (targets) {
+		if (nsubscribers >= CDBUS_MAX_SUBSCRIBERS) {
+			cdbus_reply_err(ps, msg, CDBUS_ERROR_CUSTOM, CDBUS_ERROR_CUSTOM_S,
+			                "Too many subscribers.");
+			return true;
+		}
+		auto sub = ccalloc(1, struct cdbus_subscriber);
+		sub->name = strdup(sender);
+		sub->targets = targets;
+		*psub = sub;
+		cdbus_watch_subscriber(cd, sender, true);
+	}
+	cdbus_update_watched(ps);
 
+	if (!dbus_message_get_no_reply(msg)) {
+		cdbus_reply_bool(ps, msg, true);
+	}
 	return true;
 }
 
+/**
+ * Forget the subscription of a client that left the bus.
+ */
+static void cdbus_process_name_owner_changed(session_t *ps, DBusMessage *msg) {
+	struct cdbus_data *cd = ps->dbus_data;
+	const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING,
+	                           &old_owner, DBUS_TYPE_STRING, &new_owner,
+	                           DBUS_TYPE_INVALID) ||
+	    new_owner[0] != '\0') {
+		return;
+	}
+	for (auto psub = &cd->subscribers; *psub; psub = &(*psub)->next) {
+		if (strcmp((*psub)->name, name) == 0) {
+			log_debug("D-Bus subscriber %s left", name);
+			cdbus_subscriber_free(cd, psub);
+			cdbus_update_watched(ps);
+			return;
+		}
+	}
+}
+
+/**
+ * Send a win_changed signal to each subscriber interested in the `changed` targets of a
+ * window.
+ *
+ * @return whether any signal was sent
+ */
+static bool cdbus_signal_win_changed(session_t *ps,
+                                     const struct cdbus_win_snapshot *snapshot,
+                                     uint64_t changed) {
+	struct cdbus_data *cd = ps->dbus_data;
+	bool sent = false;
+	for (auto sub = cd->subscribers; sub; sub = sub->next) {
+		uint64_t targets = sub->targets & changed;
+		if (!targets) {
+			continue;
+		}
+
+		DBusMessage *msg = dbus_message_new_signal(
+		    CDBUS_OBJECT_NAME, CDBUS_INTERFACE_NAME, "win_changed");
+		if (!msg) {
+			log_error("Failed to create D-Bus signal.");
+			continue;
+		}
+
+		// Only the subscriber gets the signal
+		cdbus_window_t wid = snapshot->wid;
+		DBusMessageIter iter, dict;
+		dbus_message_iter_init_append(msg, &iter);
+		bool ok = dbus_message_set_destination(msg, sub->name) &&
+		          dbus_message_iter_append_basic(&iter, CDBUS_TYPE_WINDOW,
+		                                         &wid) &&
+		          dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+		                                           "{sv}", &dict);
+		for (int i = 0; ok && i < NUM_CDBUS_WIN_TARGETS; i++) {
+			if (targets & (1ULL << i)) {
+				ok = cdbus_append_dict_entry(&dict, i,
+				                             &snapshot->values[i]);
+			}
+		}
+		ok = ok && dbus_message_iter_close_container(&iter, &dict) &&
+		     dbus_connection_send(cd->dbus_conn, msg, NULL);
+		if (ok) {
+			sent = true;
+		} else {
+			log_error("Failed to send D-Bus signal.");
+		}
+		dbus_message_unref(msg);
+	}
+	return sent;
+}
+
+static void cdbus_subscriptions_free(struct cdbus_data *cd) {
+	while (cd->subscribers) {
+		auto sub = cd->subscribers;
+		cd->subscribers = sub->next;
+		free(sub->name);
+		free(sub);
+	}
+	HASH_ITER2(cd->snapshots, snapshot) {
+		cdbus_snapshot_free(cd, snapshot);
+	}
+	cd->watched = 0;
+}
+///@}
+
 /** @name Message processing
  */
 ///@{
@@ -755,86 +1337,186 @@ static bool cdbus_process_win_get(session_t *ps, DBusMessage *msg) {
 		return true;
 	}
 
-#define cdbus_m_win_get_do(tgt, apdarg_func)                                             \
-	if (!strcmp(#tgt, target)) {                                                     \
-		apdarg_func(ps, msg, w->tgt);                                            \
-		return true;                                                             \
+	auto win_target = cdbus_win_target_from_name(target);
+	if (win_target == NUM_CDBUS_WIN_TARGETS) {
+		log_error(CDBUS_ERROR_BADTGT_S, target);
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S,
+		                target);
+		return true;
 	}
 
-	cdbus_m_win_get_do(base.id, cdbus_reply_wid);
+	auto value = cdbus_win_get_value(ps, w, win_target);
+	cdbus_reply(ps, msg, cdbus_apdarg_value, &value);
 
-	// next
-	if (!strcmp("next", target)) {
-		cdbus_reply_wid(
-		    ps, msg,
-		    (list_node_is_last(&ps->window_stack, &w->base.stack_neighbour)
-		         ? 0
-		         : list_entry(w->base.stack_neighbour.next, struct win, stack_neighbour)
-		               ->id));
-		return true;
-	}
+	return true;
+}
 
-	// map_state
-	if (!strcmp("map_state", target)) {
-		cdbus_reply_bool(ps, msg, w->a.map_state);
-		return true;
-	}
+struct cdbus_win_get_many {
+	const cdbus_window_t *wids;
+	int nwids;
+	const enum cdbus_win_target *targets;
+	int ntargets;
+};
 
-	cdbus_m_win_get_do(mode, cdbus_reply_enum);
-	cdbus_m_win_get_do(client_win, cdbus_reply_wid);
-	cdbus_m_win_get_do(ever_damaged, cdbus_reply_bool);
-	cdbus_m_win_get_do(window_type, cdbus_reply_enum);
-	cdbus_m_win_get_do(wmwin, cdbus_reply_bool);
-	cdbus_m_win_get_do(leader, cdbus_reply_wid);
-	if (!strcmp("focused_raw", target)) {
-		cdbus_reply_bool(ps, msg, win_is_focused_raw(ps, w));
-		return true;
+/**
+ * Append a record of the requested targets of a window to an array of records.
+ */
+static bool cdbus_append_win_record(session_t *ps, DBusMessageIter *array,
+                                    const struct managed_win *w,
+                                    const struct cdbus_win_get_many *req) {
+	cdbus_window_t wid = w->base.id;
+	DBusMessageIter record, dict;
+	if (!dbus_message_iter_open_container(array, DBUS_TYPE_STRUCT, NULL, &record) ||
+	    !dbus_message_iter_append_basic(&record, CDBUS_TYPE_WINDOW, &wid) ||
+	    !dbus_message_iter_open_container(&record, DBUS_TYPE_ARRAY, "{sv}", &dict)) {
+		return false;
 	}
-	cdbus_m_win_get_do(fade_force, cdbus_reply_enum);
-	cdbus_m_win_get_do(shadow_force, cdbus_reply_enum);
-	cdbus_m_win_get_do(focused_force, cdbus_reply_enum);
-	cdbus_m_win_get_do(invert_color_force, cdbus_reply_enum);
-	cdbus_m_win_get_do(name, cdbus_reply_string);
-	cdbus_m_win_get_do(class_instance, cdbus_reply_string);
-	cdbus_m_win_get_do(class_general, cdbus_reply_string);
-	cdbus_m_win_get_do(role, cdbus_reply_string);
-
-	cdbus_m_win_get_do(opacity, cdbus_reply_double);
-	cdbus_m_win_get_do(opacity_target, cdbus_reply_double);
-	cdbus_m_win_get_do(has_opacity_prop, cdbus_reply_bool);
-	cdbus_m_win_get_do(opacity_prop, cdbus_reply_uint32);
-	cdbus_m_win_get_do(opacity_is_set, cdbus_reply_bool);
-	cdbus_m_win_get_do(opacity_set, cdbus_reply_double);
-
-	cdbus_m_win_get_do(frame_opacity, cdbus_reply_double);
-	if (!strcmp("left_width", target)) {
-		cdbus_reply_int32(ps, msg, w->frame_extents.left);
-		return true;
+	for (int i = 0; i < req->ntargets; i++) {
+		auto value = cdbus_win_get_value(ps, w, req->targets[i]);
+		if (!cdbus_append_dict_entry(&dict, req->targets[i], &value)) {
+			return false;
+		}
 	}
-	if (!strcmp("right_width", target)) {
-		cdbus_reply_int32(ps, msg, w->frame_extents.right);
-		return true;
+	return dbus_message_iter_close_container(&record, &dict) &&
+	       dbus_message_iter_close_container(array, &record);
+}
+
+/**
+ * Callback to append the records of a win_get_many request to a message.
+ */
+static bool
+cdbus_apdarg_win_records(session_t *ps, DBusMessage *msg, const void *data) {
+	const struct cdbus_win_get_many *req = data;
+	DBusMessageIter iter, array;
+	dbus_message_iter_init_append(msg, &iter);
+	if (!dbus_message_iter_open_container(
+	        &iter, DBUS_TYPE_ARRAY, "(" CDBUS_TYPE_WINDOW_STR "a{sv})", &array)) {
+		goto err;
+	}
+
+	if (req->nwids == 0) {
+		// All of the windows, from the top
+		win_stack_foreach_managed(w, &ps->window_stack) {
+			if (w->state != WSTATE_DESTROYING &&
+			    !cdbus_append_win_record(ps, &array, w, req)) {
+				goto err;
+			}
+		}
 	}
-	if (!strcmp("top_width", target)) {
-		cdbus_reply_int32(ps, msg, w->frame_extents.top);
-		return true;
+	for (int i = 0; i < req->nwids; i++) {
+		auto w = find_managed_win(ps, req->wids[i]);
+		if (w && !cdbus_append_win_record(ps, &array, w, req)) {
+			goto err;
+		}
 	}
-	if (!strcmp("bottom_width", target)) {
-		cdbus_reply_int32(ps, msg, w->frame_extents.bottom);
-		return true;
+
+	if (!dbus_message_iter_close_container(&iter, &array)) {
+		goto err;
 	}
+	return true;
+err:
+	log_error("Failed to append argument.");
+	return false;
+}
 
-	cdbus_m_win_get_do(shadow, cdbus_reply_bool);
-	cdbus_m_win_get_do(invert_color, cdbus_reply_bool);
-	cdbus_m_win_get_do(blur_background, cdbus_reply_bool);
-#undef cdbus_m_win_get_do
+/**
+ * Process a win_get_many D-Bus request.
+ *
+ * Takes an array of window IDs, or an empty array for all the windows, and an array of
+ * targets. Replies with a record of the targets of each window, in one message, so
+ * clients don't have to call win_get for every property of every window. Windows that
+ * are not found are left out.
+ */
+static bool cdbus_process_win_get_many(session_t *ps, DBusMessage *msg) {
+	cdbus_window_t *wids = NULL;
+	char **names = NULL;
+	int nwids = 0, nnames = 0;
+	DBusError err = {};
 
-	log_error(CDBUS_ERROR_BADTGT_S, target);
-	cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S, target);
+	if (!dbus_message_get_args(msg, &err, DBUS_TYPE_ARRAY, CDBUS_TYPE_WINDOW, &wids,
+	                           &nwids, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &names,
+	                           &nnames, DBUS_TYPE_INVALID)) {
+		log_error("Failed to parse argument of \"win_get_many\" (%s).",
+		          err.message);
+		dbus_error_free(&err);
+		return false;
+	}
 
+	auto targets = ccalloc(max2(nnames, 1), enum cdbus_win_target);
+	for (int i = 0; i < nnames; i++) {
+		targets[i] = cdbus_win_target_from_name(names[i]);
+		if (targets[i] == NUM_CDBUS_WIN_TARGETS) {
+			log_error(CDBUS_ERROR_BADTGT_S, names[i]);
+			cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S,
+			                names[i]);
+			goto out;
+		}
+	}
+
+	struct cdbus_win_get_many req = {
+	    .wids = wids, .nwids = nwids, .targets = targets, .ntargets = nnames};
+	cdbus_reply(ps, msg, cdbus_apdarg_win_records, &req);
+
+out:
+	free(targets);
+	dbus_free_string_array(names);
 	return true;
 }
 
+// XXX Remove this after header clean up
+void queue_redraw(session_t *ps);
+
+/**
+ * Get the type of the values a target of a window is set to.
+ *
+ * @return the libdbus type number, DBUS_TYPE_INVALID if the target can't be set
+ */
+static int cdbus_win_set_type(enum cdbus_win_target target) {
+	switch (target) {
+	case CDBUS_WIN_SHADOW_FORCE:
+	case CDBUS_WIN_FADE_FORCE:
+	case CDBUS_WIN_FOCUSED_FORCE:
+	case CDBUS_WIN_INVERT_COLOR_FORCE: return CDBUS_TYPE_ENUM;
+	default: return DBUS_TYPE_INVALID;
+	}
+}
+
+/**
+ * Set a target of a window. The window is re-evaluated right away, unless `defer` is
+ * true, then it's only flagged with WIN_FLAGS_FACTOR_CHANGED, so a batch of changes to
+ * the window can be evaluated at once.
+ */
+static void cdbus_win_set_value(session_t *ps, struct managed_win *w,
+                                enum cdbus_win_target target,
+                                const struct cdbus_value *value, bool defer) {
+	switch_t val = value->v.u;
+	if (!defer) {
+		switch (target) {
+		case CDBUS_WIN_SHADOW_FORCE: win_set_shadow_force(ps, w, val); return;
+		case CDBUS_WIN_FADE_FORCE: win_set_fade_force(w, val); return;
+		case CDBUS_WIN_FOCUSED_FORCE: win_set_focused_force(ps, w, val); return;
+		case CDBUS_WIN_INVERT_COLOR_FORCE:
+			win_set_invert_color_force(ps, w, val);
+			return;
+		default: unreachable;
+		}
+	}
+
+	switch_t *field = NULL;
+	switch (target) {
+	case CDBUS_WIN_SHADOW_FORCE: field = &w->shadow_force; break;
+	case CDBUS_WIN_FOCUSED_FORCE: field = &w->focused_force; break;
+	case CDBUS_WIN_INVERT_COLOR_FORCE: field = &w->invert_color_force; break;
+	// Only affects the fading started afterwards, nothing to evaluate
+	case CDBUS_WIN_FADE_FORCE: win_set_fade_force(w, val); return;
+	default: unreachable;
+	}
+	if (*field != val) {
+		*field = val;
+		win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
+	}
+}
+
 /**
  * Process a win_set D-Bus request.
  */
@@ -858,56 +1540,145 @@ static bool cdbus_process_win_set(session_t *ps, DBusMessage *msg) {
 		return true;
 	}
 
-#define cdbus_m_win_set_do(tgt, type, real_type)                                         \
-	if (!strcmp(MSTR(tgt), target)) {                                                \
-		real_type val;                                                           \
-		if (!cdbus_msg_get_arg(msg, 2, type, &val))                              \
-			return false;                                                    \
-		w->tgt = val;                                                            \
-		goto cdbus_process_win_set_success;                                      \
+	auto win_target = cdbus_win_target_from_name(target);
+	struct cdbus_value value = {.type = cdbus_win_set_type(win_target)};
+	if (value.type == DBUS_TYPE_INVALID) {
+		log_error(CDBUS_ERROR_BADTGT_S, target);
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S,
+		                target);
+		return true;
 	}
-
-	if (!strcmp("shadow_force", target)) {
-		cdbus_enum_t val = UNSET;
-		if (!cdbus_msg_get_arg(msg, 2, CDBUS_TYPE_ENUM, &val))
-			return false;
-		win_set_shadow_force(ps, w, val);
-		goto cdbus_process_win_set_success;
+	if (!cdbus_msg_get_arg(msg, 2, value.type, &value.v)) {
+		return false;
 	}
+	cdbus_win_set_value(ps, w, win_target, &value, false);
 
-	if (!strcmp("fade_force", target)) {
-		cdbus_enum_t val = UNSET;
-		if (!cdbus_msg_get_arg(msg, 2, CDBUS_TYPE_ENUM, &val))
-			return false;
-		win_set_fade_force(w, val);
-		goto cdbus_process_win_set_success;
+	if (!dbus_message_get_no_reply(msg))
+		cdbus_reply_bool(ps, msg, true);
+	return true;
+}
+
+/**
+ * Process a win_set_many D-Bus request.
+ *
+ * Takes an array of (window ID, target, value) changes. Either all of them are made, or
+ * none of them if any is invalid. Each window is re-evaluated once after all of its
+ * changes are made, and one frame is rendered for all of them, instead of once per
+ * change as with win_set.
+ */
+static bool cdbus_process_win_set_many(session_t *ps, DBusMessage *msg) {
+	if (!dbus_message_has_signature(msg, "a(" CDBUS_TYPE_WINDOW_STR "sv)")) {
+		log_error("Failed to parse argument of \"win_set_many\" (signature is "
+		          "%s).",
+		          dbus_message_get_signature(msg));
+		return false;
 	}
 
-	if (!strcmp("focused_force", target)) {
-		cdbus_enum_t val = UNSET;
-		if (!cdbus_msg_get_arg(msg, 2, CDBUS_TYPE_ENUM, &val))
-			return false;
-		win_set_focused_force(ps, w, val);
-		goto cdbus_process_win_set_success;
+	// The changes are gone through 3 times: check all of them before making any,
+	// make them, then evaluate the windows that changed.
+	int nchanges = 0;
+	for (int pass = 0; pass < 3; pass++) {
+		DBusMessageIter iter, array;
+		dbus_message_iter_init(msg, &iter);
+		dbus_message_iter_recurse(&iter, &array);
+		for (int i = 0;
+		     dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT;
+		     i++, dbus_message_iter_next(&array)) {
+			DBusMessageIter change;
+			cdbus_window_t wid = XCB_NONE;
+			const char *target = NULL;
+			dbus_message_iter_recurse(&array, &change);
+			dbus_message_iter_get_basic(&change, &wid);
+			dbus_message_iter_next(&change);
+			dbus_message_iter_get_basic(&change, &target);
+			dbus_message_iter_next(&change);
+
+			auto w = find_managed_win(ps, wid);
+			auto win_target = cdbus_win_target_from_name(target);
+			struct cdbus_value value = {
+			    .type = cdbus_win_set_type(win_target)};
+			if (pass == 0 && !w) {
+				log_error("Window %#010x not found.", wid);
+				cdbus_reply_err(ps, msg, CDBUS_ERROR_BADWIN,
+				                CDBUS_ERROR_BADWIN_S, wid);
+				return true;
+			}
+			if (pass == 0 && value.type == DBUS_TYPE_INVALID) {
+				log_error(CDBUS_ERROR_BADTGT_S, target);
+				cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT,
+				                CDBUS_ERROR_BADTGT_S, target);
+				return true;
+			}
+			if (pass == 0 &&
+			    !cdbus_iter_get_basic(&change, value.type, &value.v)) {
+				cdbus_reply_err(ps, msg, CDBUS_ERROR_BADARG,
+				                CDBUS_ERROR_BADARG_S, i,
+				                "value has incorrect type");
+				return true;
+			}
+
+			if (pass == 1) {
+				cdbus_iter_get_basic(&change, value.type, &value.v);
+				cdbus_win_set_value(ps, w, win_target, &value, true);
+				nchanges++;
+			} else if (pass == 2 &&
+			           win_check_flags_all(w, WIN_FLAGS_FACTOR_CHANGED)) {
+				win_on_factor_change(ps, w);
+				win_clear_flags(w, WIN_FLAGS_FACTOR_CHANGED);
+			}
+		}
+	}
+	if (nchanges) {
+		queue_redraw(ps);
 	}
 
-	if (!strcmp("invert_color_force", target)) {
-		cdbus_enum_t val = UNSET;
-		if (!cdbus_msg_get_arg(msg, 2, CDBUS_TYPE_ENUM, &val))
-			return false;
-		win_set_invert_color_force(ps, w, val);
-		goto cdbus_process_win_set_success;
+	if (!dbus_message_get_no_reply(msg))
+		cdbus_reply_bool(ps, msg, true);
+	return true;
+}
+
+/**
+ * Process a frame_timing D-Bus request.
+ */
+static bool cdbus_process_frame_timing(session_t *ps, DBusMessage *msg) {
+	const char *target = NULL;
+
+	if (!cdbus_msg_get_arg(msg, 0, DBUS_TYPE_STRING, &target))
+		return false;
+
+	auto phase = frame_timing_phase_from_name(target);
+	if (phase == NUM_FRAME_TIMING_PHASES) {
+		log_error(CDBUS_ERROR_BADTGT_S, target);
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S, target);
+		return true;
+	}
+	if (!ps->frame_timing) {
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_CUSTOM, CDBUS_ERROR_CUSTOM_S,
+		                "Frame timing is disabled.");
+		return true;
 	}
-#undef cdbus_m_win_set_do
 
-	log_error(CDBUS_ERROR_BADTGT_S, target);
-	cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S, target);
+	// All zeros if no recent frame went through the phase
+	struct frame_timing_summary summary;
+	frame_timing_summarize(ps->frame_timing, phase, &summary);
+	cdbus_reply(ps, msg, cdbus_apdarg_frame_timing, &summary);
 
 	return true;
+}
+
+/**
+ * Process a round_trips D-Bus request.
+ */
+static bool cdbus_process_round_trips(session_t *ps, DBusMessage *msg) {
+	char *report = x_round_trips_report(INT_MAX);
+	if (!report) {
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_CUSTOM, CDBUS_ERROR_CUSTOM_S,
+		                "Failed to describe the round trips.");
+		return true;
+	}
+	cdbus_reply_string(ps, msg, report);
+	free(report);
 
-cdbus_process_win_set_success:
-	if (!dbus_message_get_no_reply(msg))
-		cdbus_reply_bool(ps, msg, true);
 	return true;
 }
 
@@ -1001,13 +1772,34 @@ static bool cdbus_process_opts_get(session_t *ps, DBusMessage *msg) {
 	}
 	cdbus_m_opts_get_do(unredir_if_possible, cdbus_reply_bool);
 	cdbus_m_opts_get_do(unredir_if_possible_delay, cdbus_reply_int32l);
+	cdbus_m_opts_get_do(unredir_if_possible_redirect_delay, cdbus_reply_int32l);
+	cdbus_m_opts_get_do(unfocused_damage_delay, cdbus_reply_int32l);
 	cdbus_m_opts_get_do(redirected_force, cdbus_reply_enum);
 	cdbus_m_opts_get_do(stoppaint_force, cdbus_reply_enum);
 	cdbus_m_opts_get_do(logpath, cdbus_reply_string);
 
 	cdbus_m_opts_get_do(refresh_rate, cdbus_reply_int32);
 	cdbus_m_opts_get_do(sw_opti, cdbus_reply_bool);
+	cdbus_m_opts_get_do(frame_pacing, cdbus_reply_bool);
+	// Statistics of frame pacing, how many frames were scheduled for a vblank, how
+	// many of them missed it, and how far off the predicted vblanks were
+	cdbus_m_opts_get_stub(frame_pacing_frames, cdbus_reply_uint32,
+	                      (uint32_t)ps->pacing.nframes);
+	cdbus_m_opts_get_stub(frame_pacing_missed, cdbus_reply_uint32,
+	                      (uint32_t)ps->pacing.nmissed);
+	cdbus_m_opts_get_stub(frame_pacing_error_us, cdbus_reply_uint32,
+	                      (uint32_t)frame_pacing_average_error(&ps->pacing));
 	cdbus_m_opts_get_do(vsync, cdbus_reply_bool);
+	cdbus_m_opts_get_do(frame_timing, cdbus_reply_bool);
+	cdbus_m_opts_get_stub(frame_count, cdbus_reply_uint32, (uint32_t)ps->frame_count);
+	cdbus_m_opts_get_stub(round_trips, cdbus_reply_uint32,
+	                      (uint32_t)x_round_trip_count());
+	cdbus_m_opts_get_do(trace_file, cdbus_reply_string);
+	cdbus_m_opts_get_do(image_memory_budget, cdbus_reply_int32);
+	// Memory taken by the images of the backend, in KiB
+	cdbus_m_opts_get_stub(
+	    image_memory_kib, cdbus_reply_uint32,
+	    ps->backend_data ? (uint32_t)(ps->backend_data->image_bytes / 1024) : 0);
 	if (!strcmp("backend", target)) {
 		assert(ps->o.backend < sizeof(BACKEND_STRS) / sizeof(BACKEND_STRS[0]));
 		cdbus_reply_string(ps, msg, BACKEND_STRS[ps->o.backend]);
@@ -1026,6 +1818,7 @@ static bool cdbus_process_opts_get(session_t *ps, DBusMessage *msg) {
 	cdbus_m_opts_get_do(fade_delta, cdbus_reply_int32);
 	cdbus_m_opts_get_do(fade_in_step, cdbus_reply_double);
 	cdbus_m_opts_get_do(fade_out_step, cdbus_reply_double);
+	cdbus_m_opts_get_stub(fade_curve, cdbus_reply_uint32, ps->o.fade_curve);
 	cdbus_m_opts_get_do(no_fading_openclose, cdbus_reply_bool);
 
 	cdbus_m_opts_get_do(blur_method, cdbus_reply_bool);
@@ -1056,97 +1849,129 @@ static bool cdbus_process_opts_get(session_t *ps, DBusMessage *msg) {
 	return true;
 }
 
-// XXX Remove this after header clean up
-void queue_redraw(session_t *ps);
+enum cdbus_set_result {
+	CDBUS_SET_OK,
+	/// The target doesn't exist
+	CDBUS_SET_BAD_TARGET,
+	/// The value has the wrong type, or is out of range
+	CDBUS_SET_BAD_VALUE,
+	/// The value is valid, but couldn't be applied
+	CDBUS_SET_FAILED,
+};
 
 /**
- * Process a opts_set D-Bus request.
+ * Set an option to the value an iterator points to. If `apply` is false, the target and
+ * the value are only checked.
  */
-static bool cdbus_process_opts_set(session_t *ps, DBusMessage *msg) {
-	const char *target = NULL;
-
-	if (!cdbus_msg_get_arg(msg, 0, DBUS_TYPE_STRING, &target))
-		return false;
-
+static enum cdbus_set_result cdbus_opts_set_value(session_t *ps, const char *target,
+                                                  DBusMessageIter *iter, bool apply) {
 #define cdbus_m_opts_set_do(tgt, type, real_type)                                        \
 	if (!strcmp(#tgt, target)) {                                                     \
 		real_type val;                                                           \
-		if (!cdbus_msg_get_arg(msg, 1, type, &val))                              \
-			return false;                                                    \
-		ps->o.tgt = val;                                                         \
-		goto cdbus_process_opts_set_success;                                     \
+		if (!cdbus_iter_get_basic(iter, type, &val))                             \
+			return CDBUS_SET_BAD_VALUE;                                      \
+		if (apply)                                                               \
+			ps->o.tgt = val;                                                 \
+		return CDBUS_SET_OK;                                                     \
 	}
 
 	// fade_delta
 	if (!strcmp("fade_delta", target)) {
 		int32_t val = 0;
-		if (!cdbus_msg_get_arg(msg, 1, DBUS_TYPE_INT32, &val)) {
-			return false;
+		if (!cdbus_iter_get_basic(iter, DBUS_TYPE_INT32, &val)) {
+			return CDBUS_SET_BAD_VALUE;
 		}
 		if (val <= 0) {
-			return false;
+			return CDBUS_SET_BAD_VALUE;
+		}
+		if (apply) {
+			ps->o.fade_delta = max2(val, 1);
 		}
-		ps->o.fade_delta = max2(val, 1);
-		goto cdbus_process_opts_set_success;
+		return CDBUS_SET_OK;
 	}
 
 	// fade_in_step
 	if (!strcmp("fade_in_step", target)) {
 		double val = 0.0;
-		if (!cdbus_msg_get_arg(msg, 1, DBUS_TYPE_DOUBLE, &val))
-			return false;
-		ps->o.fade_in_step = normalize_d(val);
-		goto cdbus_process_opts_set_success;
+		if (!cdbus_iter_get_basic(iter, DBUS_TYPE_DOUBLE, &val))
+			return CDBUS_SET_BAD_VALUE;
+		if (apply)
+			ps->o.fade_in_step = normalize_d(val);
+		return CDBUS_SET_OK;
 	}
 
 	// fade_out_step
 	if (!strcmp("fade_out_step", target)) {
 		double val = 0.0;
-		if (!cdbus_msg_get_arg(msg, 1, DBUS_TYPE_DOUBLE, &val))
-			return false;
-		ps->o.fade_out_step = normalize_d(val);
-		goto cdbus_process_opts_set_success;
+		if (!cdbus_iter_get_basic(iter, DBUS_TYPE_DOUBLE, &val))
+			return CDBUS_SET_BAD_VALUE;
+		if (apply)
+			ps->o.fade_out_step = normalize_d(val);
+		return CDBUS_SET_OK;
 	}
 
 	// no_fading_openclose
 	if (!strcmp("no_fading_openclose", target)) {
 		dbus_bool_t val = FALSE;
-		if (!cdbus_msg_get_arg(msg, 1, DBUS_TYPE_BOOLEAN, &val))
-			return false;
-		opts_set_no_fading_openclose(ps, val);
-		goto cdbus_process_opts_set_success;
+		if (!cdbus_iter_get_basic(iter, DBUS_TYPE_BOOLEAN, &val))
+			return CDBUS_SET_BAD_VALUE;
+		if (apply)
+			opts_set_no_fading_openclose(ps, val);
+		return CDBUS_SET_OK;
 	}
 
 	// unredir_if_possible
 	if (!strcmp("unredir_if_possible", target)) {
 		dbus_bool_t val = FALSE;
-		if (!cdbus_msg_get_arg(msg, 1, DBUS_TYPE_BOOLEAN, &val))
-			return false;
-		if (ps->o.unredir_if_possible != val) {
+		if (!cdbus_iter_get_basic(iter, DBUS_TYPE_BOOLEAN, &val))
+			return CDBUS_SET_BAD_VALUE;
+		if (apply && ps->o.unredir_if_possible != val) {
 			ps->o.unredir_if_possible = val;
 			queue_redraw(ps);
 		}
-		goto cdbus_process_opts_set_success;
+		return CDBUS_SET_OK;
 	}
 
 	// clear_shadow
 	if (!strcmp("clear_shadow", target)) {
-		goto cdbus_process_opts_set_success;
+		return CDBUS_SET_OK;
 	}
 
 	// track_focus
 	if (!strcmp("track_focus", target)) {
-		goto cdbus_process_opts_set_success;
+		return CDBUS_SET_OK;
+	}
+
+	// frame_timing
+	if (!strcmp("frame_timing", target)) {
+		dbus_bool_t val = FALSE;
+		if (!cdbus_iter_get_basic(iter, DBUS_TYPE_BOOLEAN, &val))
+			return CDBUS_SET_BAD_VALUE;
+		if (apply)
+			set_frame_timing(ps, val);
+		return CDBUS_SET_OK;
+	}
+
+	// trace_file
+	if (!strcmp("trace_file", target)) {
+		const char *val = NULL;
+		if (!cdbus_iter_get_basic(iter, DBUS_TYPE_STRING, &val))
+			return CDBUS_SET_BAD_VALUE;
+		if (apply && !set_trace_file(ps, val))
+			return CDBUS_SET_FAILED;
+		return CDBUS_SET_OK;
 	}
 
 	// redirected_force
 	if (!strcmp("redirected_force", target)) {
 		cdbus_enum_t val = UNSET;
-		if (!cdbus_msg_get_arg(msg, 1, CDBUS_TYPE_ENUM, &val))
-			return false;
-		ps->o.redirected_force = val;
-		force_repaint(ps);
-		goto cdbus_process_opts_set_success;
+		if (!cdbus_iter_get_basic(iter, CDBUS_TYPE_ENUM, &val))
+			return CDBUS_SET_BAD_VALUE;
+		if (apply) {
+			ps->o.redirected_force = val;
+			force_repaint(ps);
+		}
+		return CDBUS_SET_OK;
 	}
 
 	// stoppaint_force
@@ -1154,12 +1979,84 @@ static bool cdbus_process_opts_set(session_t *ps, DBusMessage *msg) {
 
 #undef cdbus_m_opts_set_do
 
-	log_error(CDBUS_ERROR_BADTGT_S, target);
-	cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S, target);
+	return CDBUS_SET_BAD_TARGET;
+}
 
+/**
+ * Process a opts_set D-Bus request.
+ */
+static bool cdbus_process_opts_set(session_t *ps, DBusMessage *msg) {
+	const char *target = NULL;
+	DBusMessageIter iter;
+
+	if (!cdbus_msg_get_arg(msg, 0, DBUS_TYPE_STRING, &target) ||
+	    !cdbus_msg_get_iter(msg, 1, &iter))
+		return false;
+
+	switch (cdbus_opts_set_value(ps, target, &iter, true)) {
+	case CDBUS_SET_OK: break;
+	case CDBUS_SET_BAD_TARGET:
+		log_error(CDBUS_ERROR_BADTGT_S, target);
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT, CDBUS_ERROR_BADTGT_S,
+		                target);
+		return true;
+	case CDBUS_SET_BAD_VALUE: return false;
+	case CDBUS_SET_FAILED:
+		cdbus_reply_err(ps, msg, CDBUS_ERROR_CUSTOM, "Failed to set %s.", target);
+		return true;
+	}
+
+	if (!dbus_message_get_no_reply(msg))
+		cdbus_reply_bool(ps, msg, true);
 	return true;
+}
+
+/**
+ * Process a opts_set_many D-Bus request.
+ *
+ * Takes a dictionary of options and their values. All of them are checked before any is
+ * set, so none of them are set if any is invalid. Only setting trace_file can still fail
+ * afterwards, the options before it are then already set.
+ */
+static bool cdbus_process_opts_set_many(session_t *ps, DBusMessage *msg) {
+	if (!dbus_message_has_signature(msg, "a{sv}")) {
+		log_error("Failed to parse argument of \"opts_set_many\" (signature is "
+		          "%s).",
+		          dbus_message_get_signature(msg));
+		return false;
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		DBusMessageIter iter, dict;
+		dbus_message_iter_init(msg, &iter);
+		dbus_message_iter_recurse(&iter, &dict);
+		for (; dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY;
+		     dbus_message_iter_next(&dict)) {
+			DBusMessageIter entry;
+			const char *target = NULL;
+			dbus_message_iter_recurse(&dict, &entry);
+			dbus_message_iter_get_basic(&entry, &target);
+			dbus_message_iter_next(&entry);
+
+			switch (cdbus_opts_set_value(ps, target, &entry, pass == 1)) {
+			case CDBUS_SET_OK: break;
+			case CDBUS_SET_BAD_TARGET:
+				log_error(CDBUS_ERROR_BADTGT_S, target);
+				cdbus_reply_err(ps, msg, CDBUS_ERROR_BADTGT,
+				                CDBUS_ERROR_BADTGT_S, target);
+				return true;
+			case CDBUS_SET_BAD_VALUE:
+				cdbus_reply_err(ps, msg, CDBUS_ERROR_BADARG,
+				                CDBUS_ERROR_BADARG_S, 0, target);
+				return true;
+			case CDBUS_SET_FAILED:
+				cdbus_reply_err(ps, msg, CDBUS_ERROR_CUSTOM,
+				                "Failed to set %s.", target);
+				return true;
+			}
+		}
+	}
 
-cdbus_process_opts_set_success:
 	if (!dbus_message_get_no_reply(msg))
 		cdbus_reply_bool(ps, msg, true);
 	return true;
@@ -1204,8 +2101,28 @@ static bool cdbus_process_introspect(session_t *ps, DBusMessage *msg) {
 	    "    <signal name='win_focusout'>\n"
 	    "      <arg name='wid' type='" CDBUS_TYPE_WINDOW_STR "'/>\n"
 	    "    </signal>\n"
+	    "    <signal name='win_changed'>\n"
+	    "      <arg name='wid' type='" CDBUS_TYPE_WINDOW_STR "'/>\n"
+	    "      <arg name='changes' type='a{sv}'/>\n"
+	    "    </signal>\n"
 	    "    <method name='reset' />\n"
 	    "    <method name='repaint' />\n"
+	    "    <method name='win_get_many'>\n"
+	    "      <arg name='wids' direction='in' type='a" CDBUS_TYPE_WINDOW_STR "'/>\n"
+	    "      <arg name='targets' direction='in' type='as'/>\n"
+	    "      <arg name='records' direction='out' type='a(" CDBUS_TYPE_WINDOW_STR
+	    "a{sv})'/>\n"
+	    "    </method>\n"
+	    "    <method name='win_subscribe'>\n"
+	    "      <arg name='targets' direction='in' type='as'/>\n"
+	    "    </method>\n"
+	    "    <method name='win_set_many'>\n"
+	    "      <arg name='changes' direction='in' type='a(" CDBUS_TYPE_WINDOW_STR
+	    "sv)'/>\n"
+	    "    </method>\n"
+	    "    <method name='opts_set_many'>\n"
+	    "      <arg name='changes' direction='in' type='a{sv}'/>\n"
+	    "    </method>\n"
 	    "  </interface>\n"
 	    "</node>\n";
 
@@ -1226,6 +2143,12 @@ cdbus_process(DBusConnection *c attr_unused, DBusMessage *msg, void *ud) {
 #define cdbus_m_ismethod(method)                                                         \
 	dbus_message_is_method_call(msg, CDBUS_INTERFACE_NAME, method)
 
+	if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged")) {
+		// Only received for the subscribers, see cdbus_watch_subscriber
+		cdbus_process_name_owner_changed(ps, msg);
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
 	if (cdbus_m_ismethod("reset")) {
 		log_info("picom is resetting...");
 		ev_break(ps->loop, EVBREAK_ALL);
@@ -1241,14 +2164,26 @@ cdbus_process(DBusConnection *c attr_unused, DBusMessage *msg, void *ud) {
 		handled = cdbus_process_list_win(ps, msg);
 	} else if (cdbus_m_ismethod("win_get")) {
 		handled = cdbus_process_win_get(ps, msg);
+	} else if (cdbus_m_ismethod("win_get_many")) {
+		handled = cdbus_process_win_get_many(ps, msg);
+	} else if (cdbus_m_ismethod("win_subscribe")) {
+		handled = cdbus_process_win_subscribe(ps, msg);
 	} else if (cdbus_m_ismethod("win_set")) {
 		handled = cdbus_process_win_set(ps, msg);
+	} else if (cdbus_m_ismethod("win_set_many")) {
+		handled = cdbus_process_win_set_many(ps, msg);
 	} else if (cdbus_m_ismethod("find_win")) {
 		handled = cdbus_process_find_win(ps, msg);
 	} else if (cdbus_m_ismethod("opts_get")) {
 		handled = cdbus_process_opts_get(ps, msg);
 	} else if (cdbus_m_ismethod("opts_set")) {
 		handled = cdbus_process_opts_set(ps, msg);
+	} else if (cdbus_m_ismethod("opts_set_many")) {
+		handled = cdbus_process_opts_set_many(ps, msg);
+	} else if (cdbus_m_ismethod("frame_timing")) {
+		handled = cdbus_process_frame_timing(ps, msg);
+	} else if (cdbus_m_ismethod("round_trips")) {
+		handled = cdbus_process_round_trips(ps, msg);
 	}
 #undef cdbus_m_ismethod
 	else if (dbus_message_is_method_call(msg, "org.freedesktop.DBus.Introspectable",
@@ -1337,4 +2272,52 @@ void cdbus_ev_win_focusin(session_t *ps, struct win *w) {
 	if (cd->dbus_conn)
 		cdbus_signal_wid(ps, "win_focusin", w->id);
 }
+
+void cdbus_check_win_changes(session_t *ps) {
+	struct cdbus_data *cd = ps->dbus_data;
+	if (!cd->dbus_conn || !cd->watched) {
+		return;
+	}
+
+	cd->generation++;
+	bool sent = false;
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		if (w->state == WSTATE_DESTROYING) {
+			continue;
+		}
+		struct cdbus_win_snapshot *snapshot = NULL;
+		HASH_FIND_INT(cd->snapshots, &w->base.id, snapshot);
+		if (!snapshot) {
+			// The initial values of a new window are not changes
+			cdbus_snapshot_take(ps, w, cd->watched);
+			continue;
+		}
+
+		uint64_t changed = 0;
+		for (int i = 0; i < NUM_CDBUS_WIN_TARGETS; i++) {
+			if (!(cd->watched & (1ULL << i))) {
+				continue;
+			}
+			auto value = cdbus_win_get_value(ps, w, i);
+			if (!cdbus_value_equal(&snapshot->values[i], &value)) {
+				cdbus_snapshot_set(snapshot, i, value);
+				changed |= 1ULL << i;
+			}
+		}
+		snapshot->generation = cd->generation;
+		if (changed && cdbus_signal_win_changed(ps, snapshot, changed)) {
+			sent = true;
+		}
+	}
+
+	// Forget the windows that are gone
+	HASH_ITER2(cd->snapshots, snapshot) {
+		if (snapshot->generation != cd->generation) {
+			cdbus_snapshot_free(cd, snapshot);
+		}
+	}
+	if (sent) {
+		dbus_connection_flush(cd->dbus_conn);
+	}
+}
 //!@}
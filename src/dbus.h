@@ -51,4 +51,8 @@ void cdbus_ev_win_focusout(session_t *ps, struct win *w);
 /// Generate dbus win_focusin signal
 void cdbus_ev_win_focusin(session_t *ps, struct win *w);
 
+/// Send dbus win_changed signals for the windows whose targets the clients subscribed to
+/// have changed since the last call
+void cdbus_check_win_changes(session_t *ps);
+
 // vim: set noet sw=8 ts=8 :
@@ -33,6 +33,13 @@ void print_diagnostics(session_t *ps, const char *config_file, bool compositor_r
 	printf("* Fast Math: Yes\n");
 #endif
 	printf("* Config file used: %s\n", config_file ?: "None");
+	if (ps->o.image_memory_budget) {
+		printf("* Image memory budget: %d MiB\n", ps->o.image_memory_budget);
+	} else {
+		printf("* Image memory budget: None\n");
+	}
+	printf("* Image memory in use: %zu KiB\n",
+	       ps->backend_data ? ps->backend_data->image_bytes / 1024 : 0);
 	printf("\n### Drivers (inaccurate):\n\n");
 	print_drivers(ps->drivers);
 
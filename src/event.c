@@ -6,6 +6,7 @@
 #include <X11/Xlibint.h>
 #include <X11/extensions/sync.h>
 #include <xcb/damage.h>
+#include <xcb/present.h>
 #include <xcb/randr.h>
 
 #include "atom.h"
@@ -281,7 +282,8 @@ static inline void ev_map_notify(session_t *ps, xcb_map_notify_event_t *ev) {
 	// in redirected state.
 	if (ps->overlay && ev->window == ps->overlay && !ps->redirected) {
 		log_debug("Overlay is mapped while we are not redirected");
-		auto e = xcb_request_check(ps->c, xcb_unmap_window(ps->c, ps->overlay));
+		auto e = X_REPLY(
+		    xcb_request_check(ps->c, xcb_unmap_window(ps->c, ps->overlay)));
 		if (e) {
 			log_error("Failed to unmap the overlay window");
 			free(e);
@@ -373,9 +375,11 @@ static inline void ev_reparent_notify(session_t *ps, xcb_reparent_notify_event_t
 					log_debug("parent %#010x not found", ev->parent);
 				else {
 					// Window is not currently mapped, unmark its
-					// client to trigger a client recheck when it is
-					// mapped later.
+					// client and flag it, so the client is rechecked
+					// when it is mapped later. Flags of invisible
+					// windows are processed when they are mapped.
 					win_unmark_client(ps, w_real_top);
+					win_set_flags(w_real_top, WIN_FLAGS_CLIENT_STALE);
 					log_debug("parent %#010x (%s) is in state %d",
 					          w_real_top->base.id, w_real_top->name,
 					          w_real_top->state);
@@ -435,17 +439,8 @@ static inline void ev_expose(session_t *ps, xcb_expose_event_t *ev) {
 static inline void ev_property_notify(session_t *ps, xcb_property_notify_event_t *ev) {
 	if (unlikely(log_get_level_tls() <= LOG_LEVEL_TRACE)) {
 		// Print out changed atom
-		xcb_get_atom_name_reply_t *reply =
-		    xcb_get_atom_name_reply(ps->c, xcb_get_atom_name(ps->c, ev->atom), NULL);
-		const char *name = "?";
-		int name_len = 1;
-		if (reply) {
-			name = xcb_get_atom_name_name(reply);
-			name_len = xcb_get_atom_name_name_length(reply);
-		}
-
-		log_debug("{ atom = %.*s }", name_len, name);
-		free(reply);
+		const char *name = get_atom_name(ps->atoms, ev->atom);
+		log_debug("{ atom = %s }", name ? name : "?");
 	}
 
 	if (ps->root == ev->window) {
@@ -455,7 +450,7 @@ static inline void ev_property_notify(session_t *ps, xcb_property_notify_event_t
 		} else {
 			// Destroy the root "image" if the wallpaper probably changed
 			if (x_is_root_back_pixmap_atom(ps->atoms, ev->atom)) {
-				root_damaged(ps);
+				root_back_pixmap_changed(ps);
 			}
 		}
 
@@ -562,10 +557,13 @@ static inline void ev_property_notify(session_t *ps, xcb_property_notify_event_t
 				w = find_toplevel(ps, ev->window);
 			}
 			if (w) {
-				// Set FACTOR_CHANGED so rules based on properties will be
+				// Drop the cached value and results of rules depending
+				// on it, and set FACTOR_CHANGED so those rules will be
 				// re-evaluated.
 				// Don't need to set property stale here, since that only
 				// concerns properties we explicitly check.
+				c2_window_state_mark_dirty(ps, &w->c2_state, ev->window,
+				                           ev->atom);
 				win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
 			}
 			break;
@@ -573,51 +571,112 @@ static inline void ev_property_notify(session_t *ps, xcb_property_notify_event_t
 	}
 }
 
+/// Add damage fetched from a window to the screen damage. `parts` must be in screen
+/// coordinates.
+static inline void add_damage_from_fetch(session_t *ps, struct managed_win *w, region_t *parts) {
+	// Remove the part in the damage area that could be ignored
+	if (w && w->reg_ignore && win_is_region_ignore_valid(ps, w)) {
+		pixman_region32_subtract(parts, parts, w->reg_ignore);
+	}
+
+	if (w) {
+		add_damage_from_content(ps, w, parts);
+	} else {
+		add_damage(ps, parts);
+	}
+}
+
 static inline void repair_win(session_t *ps, struct managed_win *w) {
 	// Only mapped window can receive damages
 	assert(win_is_mapped_in_x(w));
 
-	region_t parts;
-	pixman_region32_init(&parts);
+	log_trace("Mark window %#010x (%s) as having received damage", w->base.id, w->name);
+	w->content_changed = true;
+
+	// Why care about damage when screen is unredirected?
+	// We will force full-screen repaint on redirection.
+	// Likewise, a window hidden behind other windows is repainted in full when it
+	// becomes visible again.
+	if (!ps->redirected || w->occluded) {
+		set_ignore_cookie(
+		    ps, xcb_damage_subtract(ps->c, w->damage, XCB_NONE, XCB_NONE));
+		w->ever_damaged = true;
+		w->pixmap_damaged = true;
+		return;
+	}
 
 	if (!w->ever_damaged) {
+		region_t parts;
+		pixman_region32_init(&parts);
 		win_extents(w, &parts);
 		set_ignore_cookie(
 		    ps, xcb_damage_subtract(ps->c, w->damage, XCB_NONE, XCB_NONE));
+		add_damage_from_fetch(ps, w, &parts);
+		pixman_region32_fini(&parts);
 	} else {
+		// Don't wait for the reply here, that would be a round trip for every
+		// damage event. The requests are processed in order by the server, so
+		// reusing damaged_region is fine, each fetch sees the result of the
+		// subtract preceding it. Replies are collected in
+		// collect_pending_damage_fetches.
 		set_ignore_cookie(
 		    ps, xcb_damage_subtract(ps->c, w->damage, XCB_NONE, ps->damaged_region));
-		x_fetch_region(ps->c, ps->damaged_region, &parts);
-		pixman_region32_translate(&parts, w->g.x + w->g.border_width,
-		                          w->g.y + w->g.border_width);
+		if (ps->npending_damage_fetches == ps->pending_damage_fetches_capacity) {
+			ps->pending_damage_fetches_capacity =
+			    ps->pending_damage_fetches_capacity * 2 + 8;
+			ps->pending_damage_fetches =
+			    crealloc(ps->pending_damage_fetches,
+			             ps->pending_damage_fetches_capacity);
+		}
+		ps->pending_damage_fetches[ps->npending_damage_fetches++] =
+		    (struct pending_damage_fetch){
+		        .cookie = xcb_xfixes_fetch_region(ps->c, ps->damaged_region),
+		        .wid = w->base.id,
+		        .dx = w->g.x + w->g.border_width,
+		        .dy = w->g.y + w->g.border_width,
+		    };
 	}
 
-	log_trace("Mark window %#010x (%s) as having received damage", w->base.id, w->name);
 	w->ever_damaged = true;
 	w->pixmap_damaged = true;
+}
 
-	// Why care about damage when screen is unredirected?
-	// We will force full-screen repaint on redirection.
-	if (!ps->redirected) {
-		pixman_region32_fini(&parts);
+void collect_pending_damage_fetches(session_t *ps) {
+	if (!ps->npending_damage_fetches) {
 		return;
 	}
 
-	// Remove the part in the damage area that could be ignored
-	if (w->reg_ignore && win_is_region_ignore_valid(ps, w)) {
-		pixman_region32_subtract(&parts, &parts, w->reg_ignore);
+	for (int i = 0; i < ps->npending_damage_fetches; i++) {
+		auto f = &ps->pending_damage_fetches[i];
+		region_t parts;
+		if (!x_fetch_region_reply(ps->c, f->cookie, &parts)) {
+			continue;
+		}
+		pixman_region32_translate(&parts, f->dx, f->dy);
+		add_damage_from_fetch(ps, find_managed_win(ps, f->wid), &parts);
+		pixman_region32_fini(&parts);
 	}
 
-	add_damage(ps, &parts);
-	pixman_region32_fini(&parts);
+	// Only the first reply is actually waited for, the rest should already be
+	// in by the time we get it.
+	log_trace("Collected %d damage fetches, %d round trips saved",
+	          ps->npending_damage_fetches, ps->npending_damage_fetches - 1);
+	ps->npending_damage_fetches = 0;
+}
+
+void discard_pending_damage_fetches(session_t *ps) {
+	for (int i = 0; i < ps->npending_damage_fetches; i++) {
+		xcb_discard_reply(ps->c, ps->pending_damage_fetches[i].cookie.sequence);
+	}
+	ps->npending_damage_fetches = 0;
 }
 
 static inline void ev_damage_notify(session_t *ps, xcb_damage_notify_event_t *de) {
-	/*
-	if (ps->root == de->drawable) {
-	  root_damaged();
-	  return;
-	} */
+	if (de->damage == ps->root_pixmap_damage && ps->root_pixmap_damage != XCB_NONE) {
+		root_pixmap_content_changed(ps);
+		queue_redraw(ps);
+		return;
+	}
 
 	auto w = find_managed_win(ps, de->drawable);
 
@@ -626,29 +685,24 @@ static inline void ev_damage_notify(session_t *ps, xcb_damage_notify_event_t *de
 	}
 
 	repair_win(ps, w);
+	queue_redraw_for_damage(ps, w);
 }
 
 static inline void ev_shape_notify(session_t *ps, xcb_shape_notify_event_t *ev) {
+	// We only use the bounding shape
+	if (ev->shape_kind != XCB_SHAPE_SK_BOUNDING) {
+		return;
+	}
 	auto w = find_managed_win(ps, ev->affected_window);
 	if (!w || w->a.map_state == XCB_MAP_STATE_UNMAPPED) {
 		return;
 	}
 
-	/*
-	 * Empty bounding_shape may indicated an
-	 * unmapped/destroyed window, in which case
-	 * seemingly BadRegion errors would be triggered
-	 * if we attempt to rebuild border_size
-	 */
-	// Mark the old bounding shape as damaged
-	if (!win_check_flags_any(w, WIN_FLAGS_SIZE_STALE | WIN_FLAGS_POSITION_STALE)) {
-		region_t tmp = win_get_bounding_shape_global_by_val(w);
-		add_damage(ps, &tmp);
-		pixman_region32_fini(&tmp);
-	}
-	w->reg_ignore_valid = false;
-
-	win_set_flags(w, WIN_FLAGS_SIZE_STALE);
+	// The shape is fetched and compared with the old one when the updates are
+	// handled, the window is only damaged if it has really changed. Requests sent
+	// before this event might have an outdated shape, send them again.
+	win_discard_shape_request(ps, w);
+	win_set_flags(w, WIN_FLAGS_SHAPE_STALE);
 	ps->pending_updates = true;
 }
 
@@ -661,11 +715,28 @@ ev_selection_clear(session_t *ps, xcb_selection_clear_event_t attr_unused *ev) {
 	quit(ps);
 }
 
+static inline void ev_present_event(session_t *ps, xcb_ge_generic_event_t *ev) {
+	if (ev->event_type != XCB_PRESENT_COMPLETE_NOTIFY) {
+		return;
+	}
+	auto cne = (xcb_present_complete_notify_event_t *)ev;
+	if (cne->kind == XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC) {
+		handle_vblank(ps, cne->msc, cne->ust);
+	}
+}
+
 void ev_handle(session_t *ps, xcb_generic_event_t *ev) {
 	if ((ev->response_type & 0x7f) != KeymapNotify) {
 		discard_ignore(ps, ev->full_sequence);
 	}
 
+	// Vblank notifications come once every frame, and don't change anything on screen
+	if (ps->present_exists && ev->response_type == XCB_GE_GENERIC &&
+	    ((xcb_ge_generic_event_t *)ev)->extension == ps->present_opcode) {
+		ev_present_event(ps, (xcb_ge_generic_event_t *)ev);
+		return;
+	}
+
 	xcb_window_t wid = ev_window(ps, ev);
 	if (ev->response_type != ps->damage_event + XCB_DAMAGE_NOTIFY) {
 		log_debug("event %10.10s serial %#010x window %#010x \"%s\"",
@@ -700,7 +771,10 @@ void ev_handle(session_t *ps, xcb_generic_event_t *ev) {
 	}
 
 	// XXX redraw needs to be more fine grained
-	queue_redraw(ps);
+	// Damage on windows queues its own redraw, which might be delayed
+	if (ev->response_type != ps->damage_event + XCB_DAMAGE_NOTIFY) {
+		queue_redraw(ps);
+	}
 
 	switch (ev->response_type) {
 	case FocusIn: ev_focus_in(ps, (xcb_focus_in_event_t *)ev); break;
@@ -734,7 +808,9 @@ void ev_handle(session_t *ps, xcb_generic_event_t *ev) {
 			break;
 		}
 		if (ps->randr_exists &&
-		    ev->response_type == (ps->randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY)) {
+		    (ev->response_type == ps->randr_event + XCB_RANDR_NOTIFY ||
+		     ev->response_type ==
+		         ps->randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY)) {
 			set_root_flags(ps, ROOT_FLAGS_SCREEN_CHANGE);
 			break;
 		}
@@ -744,3 +820,91 @@ void ev_handle(session_t *ps, xcb_generic_event_t *ev) {
 		}
 	}
 }
+
+/// What makes an event redundant, when a later event has the same key. The fields
+/// have the same size, so there is no padding and the key can be hashed as bytes.
+struct ev_coalesce_key {
+	uint32_t type;
+	xcb_window_t window;
+	xcb_atom_t atom;
+};
+
+struct ev_coalesce_entry {
+	struct ev_coalesce_key key;
+	UT_hash_handle hh;
+};
+
+void ev_handle_batch(session_t *ps, xcb_generic_event_t **events, int nevents) {
+	// Walk the batch from the newest event backwards, dropping the events a later one
+	// makes redundant:
+	// - DamageNotify: repair_win takes all the damage a window has accumulated, so
+	//   only the last one of a window matters.
+	// - PropertyNotify: the handlers read the current value of the property, so only
+	//   the last one of a window and atom matters.
+	// - ConfigureNotify: the last one has the final geometry and stacking of the
+	//   window. They are only merged if no other window was restacked in between,
+	//   because that could be relative to this window.
+	// Any other event is a barrier, nothing is merged across it.
+	auto entries = ccalloc(nevents, struct ev_coalesce_entry);
+	struct ev_coalesce_entry *seen = NULL;
+	int nseen = 0;
+	xcb_window_t last_configure = XCB_NONE;
+	int nhandled = nevents;
+	for (int i = nevents - 1; i >= 0; i--) {
+		auto ev = events[i];
+		struct ev_coalesce_key key = {.type = ev->response_type};
+		if (ev->response_type == ps->damage_event + XCB_DAMAGE_NOTIFY) {
+			key.window = ((xcb_damage_notify_event_t *)ev)->drawable;
+		} else if (ev->response_type == PropertyNotify) {
+			key.window = ((xcb_property_notify_event_t *)ev)->window;
+			key.atom = ((xcb_property_notify_event_t *)ev)->atom;
+		} else if (ev->response_type == ConfigureNotify) {
+			auto window = ((xcb_configure_notify_event_t *)ev)->window;
+			if (window == last_configure) {
+				free(ev);
+				events[i] = NULL;
+				nhandled--;
+			}
+			last_configure = window;
+			continue;
+		} else if (ev->response_type == XCB_GE_GENERIC && ps->present_exists &&
+		           ((xcb_ge_generic_event_t *)ev)->extension ==
+		               ps->present_opcode) {
+			// Vblank notifications don't affect anything else
+			continue;
+		} else {
+			HASH_CLEAR(hh, seen);
+			nseen = 0;
+			last_configure = XCB_NONE;
+			continue;
+		}
+
+		struct ev_coalesce_entry *found = NULL;
+		HASH_FIND(hh, seen, &key, sizeof(key), found);
+		if (found) {
+			free(ev);
+			events[i] = NULL;
+			nhandled--;
+		} else {
+			auto entry = &entries[nseen++];
+			entry->key = key;
+			HASH_ADD(hh, seen, key, sizeof(key), entry);
+		}
+	}
+	HASH_CLEAR(hh, seen);
+	free(entries);
+
+	for (int i = 0; i < nevents; i++) {
+		if (events[i]) {
+			ev_handle(ps, events[i]);
+			free(events[i]);
+		}
+	}
+
+	if (nhandled != nevents) {
+		log_trace("Handled %d of %d events, the rest were redundant", nhandled,
+		          nevents);
+	}
+	ps->nevents_received += (uint64_t)nevents;
+	ps->nevents_handled += (uint64_t)nhandled;
+}
@@ -6,3 +6,14 @@
 #include "common.h"
 
 void ev_handle(session_t *ps, xcb_generic_event_t *ev);
+
+/// Handle a batch of events, in order, skipping the ones made redundant by a later event
+/// in the same batch. The events are freed.
+void ev_handle_batch(session_t *ps, xcb_generic_event_t **events, int nevents);
+
+/// Collect the replies of all damage fetch requests sent by the event handlers, and add
+/// them to the screen damage.
+void collect_pending_damage_fetches(session_t *ps);
+
+/// Drop all pending damage fetch requests without waiting for their replies.
+void discard_pending_damage_fetches(session_t *ps);
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include <test.h>
+
+#include "frame_pacing.h"
+#include "log.h"
+#include "utils.h"
+
+/// Extra time given to every frame on top of the estimated render time, to cover the
+/// time it takes for the X server to show the frame
+#define FRAME_PACING_SLACK 500
+
+void frame_pacing_init(struct frame_pacing *fp) {
+	memset(fp, 0, sizeof(*fp));
+}
+
+bool frame_pacing_vblank(struct frame_pacing *fp, uint64_t msc, uint64_t ust) {
+	if (fp->last_ust && msc > fp->last_msc && ust > fp->last_ust) {
+		// Vblanks are not reported when nothing is rendered, so there can be many
+		// of them between two reports
+		double interval =
+		    (double)(ust - fp->last_ust) / (double)(msc - fp->last_msc);
+		if (fp->refresh_interval == 0) {
+			fp->refresh_interval = interval;
+		} else {
+			// Smooth out the jitter of the timestamps
+			fp->refresh_interval = (fp->refresh_interval * 7 + interval) / 8;
+		}
+	}
+	fp->last_msc = msc;
+	fp->last_ust = ust;
+
+	if (!fp->frame_pending) {
+		return false;
+	}
+	fp->frame_pending = false;
+	fp->last_frame_ust = ust;
+	if (fp->target_ust) {
+		uint64_t error =
+		    ust > fp->target_ust ? ust - fp->target_ust : fp->target_ust - ust;
+		fp->nframes++;
+		fp->total_error += error;
+		if (msc > fp->target_msc) {
+			fp->nmissed++;
+		}
+		log_trace("Frame meant for vblank at %" PRIu64 " shown at %" PRIu64
+		          ", missed %" PRIu64 "/%" PRIu64 " frames",
+		          fp->target_ust, ust, fp->nmissed, fp->nframes);
+	}
+	return true;
+}
+
+void frame_pacing_frame_rendered(struct frame_pacing *fp, uint64_t render_time) {
+	fp->render_times[fp->next_render_time] = render_time;
+	fp->next_render_time = (fp->next_render_time + 1) % FRAME_PACING_SAMPLES;
+	fp->nrender_times = min2(fp->nrender_times + 1, FRAME_PACING_SAMPLES);
+	fp->frame_pending = true;
+}
+
+bool frame_pacing_schedule(const struct frame_pacing *fp, uint64_t now,
+                           uint64_t min_interval, uint64_t *start, uint64_t *target,
+                           uint64_t *target_msc) {
+	if (!fp->last_ust || fp->refresh_interval <= 0 || !fp->nrender_times) {
+		return false;
+	}
+
+	// Budget for the slowest of the recent frames, a frame that misses its vblank
+	// costs a lot more than one started a little too early
+	uint64_t budget = 0;
+	for (int i = 0; i < fp->nrender_times; i++) {
+		budget = max2(budget, fp->render_times[i]);
+	}
+	budget += FRAME_PACING_SLACK;
+
+	// The first vblank a frame started now could make
+	uint64_t earliest = now + budget;
+	if (min_interval && fp->last_frame_ust) {
+		// Half a vblank of tolerance, so jitter doesn't make us skip one more
+		uint64_t not_before = fp->last_frame_ust + min_interval -
+		                      (uint64_t)(fp->refresh_interval / 2);
+		earliest = max2(earliest, not_before);
+	}
+	uint64_t next = fp->last_ust;
+	uint64_t n = 0;
+	if (earliest > next) {
+		n = (uint64_t)ceil((double)(earliest - next) / fp->refresh_interval);
+		next += (uint64_t)((double)n * fp->refresh_interval);
+	}
+	*target = next;
+	*target_msc = fp->last_msc + n;
+	*start = next - budget;
+	return true;
+}
+
+uint64_t frame_pacing_average_error(const struct frame_pacing *fp) {
+	if (!fp->nframes) {
+		return 0;
+	}
+	return fp->total_error / fp->nframes;
+}
+
+TEST_CASE(frame_pacing_schedule) {
+	struct frame_pacing fp;
+	frame_pacing_init(&fp);
+
+	uint64_t start, target, target_msc;
+	TEST_TRUE(!frame_pacing_schedule(&fp, 0, 0, &start, &target, &target_msc));
+
+	frame_pacing_vblank(&fp, 100, 1000000);
+	frame_pacing_vblank(&fp, 101, 1010000);
+	frame_pacing_frame_rendered(&fp, 2500);
+	TEST_TRUE(frame_pacing_vblank(&fp, 103, 1030000));
+
+	// Plenty of time before the next vblank, start as late as possible
+	TEST_TRUE(frame_pacing_schedule(&fp, 1031000, 0, &start, &target, &target_msc));
+	TEST_EQUAL(target, 1040000);
+	TEST_EQUAL(target_msc, 104);
+	TEST_EQUAL(start, 1040000 - 2500 - FRAME_PACING_SLACK);
+
+	// Too late for the next vblank, aim for the one after
+	TEST_TRUE(frame_pacing_schedule(&fp, 1038000, 0, &start, &target, &target_msc));
+	TEST_EQUAL(target, 1050000);
+	TEST_EQUAL(target_msc, 105);
+
+	// Only slower monitors are damaged, skip the vblanks they can't show
+	TEST_TRUE(frame_pacing_schedule(&fp, 1031000, 30000, &start, &target, &target_msc));
+	TEST_EQUAL(target, 1060000);
+	TEST_EQUAL(target_msc, 106);
+
+	// A frame shown at the vblank after the one it was meant for is missed
+	fp.target_ust = 1040000;
+	fp.target_msc = 104;
+	frame_pacing_frame_rendered(&fp, 2500);
+	TEST_TRUE(frame_pacing_vblank(&fp, 105, 1050000));
+	TEST_EQUAL(fp.nmissed, 1);
+	fp.target_ust = 1060000;
+	fp.target_msc = 106;
+	frame_pacing_frame_rendered(&fp, 2500);
+	TEST_TRUE(frame_pacing_vblank(&fp, 106, 1060100));
+	TEST_EQUAL(fp.nmissed, 1);
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Number of render times kept to estimate how long the next frame will take
+#define FRAME_PACING_SAMPLES 64
+/// How long to wait for the vblank a frame is shown at before giving up on it
+#define FRAME_PACING_TIMEOUT 100000
+
+/// Predicts when the next vblanks are from the timestamps the X server reports through
+/// the Present extension, and how long rendering takes from the recent frames, so
+/// rendering can be started just in time for a vblank.
+///
+/// All times are in microseconds, UST is CLOCK_MONOTONIC on Linux.
+struct frame_pacing {
+	/// MSC and UST of the last vblank reported, 0 if none has been reported yet
+	uint64_t last_msc, last_ust;
+	/// UST of the vblank the last frame was shown at, 0 if none has been shown yet
+	uint64_t last_frame_ust;
+	/// Estimated time between two vblanks, 0 if unknown
+	double refresh_interval;
+
+	/// Ring buffer of the most recent render times
+	uint64_t render_times[FRAME_PACING_SAMPLES];
+	int nrender_times;
+	int next_render_time;
+
+	/// Whether a frame has been rendered, and we are waiting for the vblank it should
+	/// be shown at
+	bool frame_pending;
+	/// The vblank the pending frame is meant for, 0 if it was not scheduled for a
+	/// particular vblank
+	uint64_t target_ust;
+	/// MSC of that vblank
+	uint64_t target_msc;
+
+	// Statistics of the predictions
+	/// Number of frames that were scheduled for a particular vblank
+	uint64_t nframes;
+	/// Number of those that were shown after the vblank they were meant for
+	uint64_t nmissed;
+	/// Sum of the differences between the predicted and the actual vblank
+	uint64_t total_error;
+};
+
+void frame_pacing_init(struct frame_pacing *fp);
+
+/// Record a vblank reported by the X server. Returns true if this is the vblank the
+/// pending frame was waiting for.
+bool frame_pacing_vblank(struct frame_pacing *fp, uint64_t msc, uint64_t ust);
+
+/// Record how long a frame took to render. The frame is pending until the next vblank is
+/// reported.
+void frame_pacing_frame_rendered(struct frame_pacing *fp, uint64_t render_time);
+
+/// Decide when to start rendering the next frame.
+///
+/// @param now current time
+/// @param min_interval minimum time between two frames, for when the frame will only be
+///                     shown by monitors slower than the one the vblanks are reported
+///                     for. 0 means no limit.
+/// @param[out] start when rendering should start, can be earlier than now if we are
+///                   already late
+/// @param[out] target the vblank the frame will be rendered for
+/// @param[out] target_msc the MSC of that vblank
+/// @return false if there is not enough information to predict, the frame should be
+///         rendered right away
+bool frame_pacing_schedule(const struct frame_pacing *fp, uint64_t now,
+                           uint64_t min_interval, uint64_t *start, uint64_t *target,
+                           uint64_t *target_msc);
+
+/// Average difference between the predicted and the actual vblank of the frames, in
+/// microseconds
+uint64_t frame_pacing_average_error(const struct frame_pacing *fp);
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <test.h>
+
+#include "frame_timing.h"
+#include "utils.h"
+
+static const char *const FRAME_TIMING_PHASE_NAMES[NUM_FRAME_TIMING_PHASES] = {
+    [FRAME_TIMING_EVENTS] = "events",   [FRAME_TIMING_PREPROCESS] = "preprocess",
+    [FRAME_TIMING_ROOT] = "root",       [FRAME_TIMING_SHADOW] = "shadow",
+    [FRAME_TIMING_BLUR] = "blur",       [FRAME_TIMING_COMPOSE] = "compose",
+    [FRAME_TIMING_PRESENT] = "present", [FRAME_TIMING_GPU] = "gpu",
+    [FRAME_TIMING_TOTAL] = "total",
+};
+
+struct frame_timing *frame_timing_new(void) {
+	return ccalloc(1, struct frame_timing);
+}
+
+void frame_timing_free(struct frame_timing *ft) {
+	free(ft);
+}
+
+uint64_t frame_timing_now(const struct frame_timing *ft) {
+	if (!ft) {
+		return 0;
+	}
+	struct timespec tm = {0, 0};
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return (uint64_t)tm.tv_sec * 1000000000ULL + (uint64_t)tm.tv_nsec;
+}
+
+void frame_timing_add(struct frame_timing *ft, enum frame_timing_phase phase,
+                      uint64_t time) {
+	uint64_t total = ft->current.time[phase] + time;
+	ft->current.time[phase] = total > UINT32_MAX ? UINT32_MAX : (uint32_t)total;
+	ft->current.recorded |= 1U << phase;
+}
+
+void frame_timing_lap(struct frame_timing *ft, enum frame_timing_phase phase,
+                      uint64_t *since) {
+	if (!ft) {
+		return;
+	}
+	auto now = frame_timing_now(ft);
+	frame_timing_add(ft, phase, now - *since);
+	*since = now;
+}
+
+void frame_timing_end_frame(struct frame_timing *ft) {
+	uint64_t total = 0;
+	for (int i = 0; i < FRAME_TIMING_GPU; i++) {
+		total += ft->current.time[i];
+	}
+	frame_timing_add(ft, FRAME_TIMING_TOTAL, total);
+
+	ft->frames[ft->next] = ft->current;
+	ft->next = (ft->next + 1) % FRAME_TIMING_SAMPLES;
+	if (ft->nframes < FRAME_TIMING_SAMPLES) {
+		ft->nframes++;
+	}
+	ft->current = (struct frame_timing_record){0};
+}
+
+static int compare_uint32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+bool frame_timing_summarize(const struct frame_timing *ft, enum frame_timing_phase phase,
+                            struct frame_timing_summary *summary) {
+	*summary = (struct frame_timing_summary){0};
+
+	uint32_t times[FRAME_TIMING_SAMPLES];
+	unsigned count = 0;
+	for (unsigned i = 0; i < ft->nframes; i++) {
+		if (!(ft->frames[i].recorded & (1U << phase))) {
+			continue;
+		}
+		uint32_t time = ft->frames[i].time[phase];
+		times[count++] = time;
+
+		unsigned us = time / 1000, bucket = 0;
+		while (us && bucket < FRAME_TIMING_BUCKETS - 1) {
+			us >>= 1;
+			bucket++;
+		}
+		summary->histogram[bucket]++;
+	}
+	if (!count) {
+		return false;
+	}
+
+	qsort(times, count, sizeof(*times), compare_uint32);
+	summary->count = count;
+	summary->p50 = times[(count - 1) * 50 / 100];
+	summary->p90 = times[(count - 1) * 90 / 100];
+	summary->p99 = times[(count - 1) * 99 / 100];
+	summary->max = times[count - 1];
+	return true;
+}
+
+const char *frame_timing_phase_name(enum frame_timing_phase phase) {
+	return FRAME_TIMING_PHASE_NAMES[phase];
+}
+
+enum frame_timing_phase frame_timing_phase_from_name(const char *name) {
+	for (int i = 0; i < NUM_FRAME_TIMING_PHASES; i++) {
+		if (strcmp(FRAME_TIMING_PHASE_NAMES[i], name) == 0) {
+			return i;
+		}
+	}
+	return NUM_FRAME_TIMING_PHASES;
+}
+
+TEST_CASE(frame_timing_summarize) {
+	auto ft = frame_timing_new();
+	struct frame_timing_summary summary;
+	TEST_TRUE(!frame_timing_summarize(ft, FRAME_TIMING_BLUR, &summary));
+
+	for (int i = 1; i <= 100; i++) {
+		frame_timing_add(ft, FRAME_TIMING_COMPOSE, (uint64_t)i * 1000);
+		if (i % 2 == 0) {
+			frame_timing_add(ft, FRAME_TIMING_BLUR, 500);
+		}
+		frame_timing_end_frame(ft);
+	}
+
+	// Frames that didn't blur don't count
+	TEST_TRUE(frame_timing_summarize(ft, FRAME_TIMING_BLUR, &summary));
+	TEST_EQUAL(summary.count, 50);
+	TEST_EQUAL(summary.histogram[0], 50);
+
+	TEST_TRUE(frame_timing_summarize(ft, FRAME_TIMING_COMPOSE, &summary));
+	TEST_EQUAL(summary.count, 100);
+	TEST_EQUAL(summary.p50, 50000);
+	TEST_EQUAL(summary.p99, 99000);
+	TEST_EQUAL(summary.max, 100000);
+	// 1 us is in bucket 1, 2-3 us in bucket 2, ...
+	TEST_EQUAL(summary.histogram[1], 1);
+	TEST_EQUAL(summary.histogram[2], 2);
+	TEST_EQUAL(summary.histogram[7], 37);
+
+	TEST_TRUE(frame_timing_summarize(ft, FRAME_TIMING_TOTAL, &summary));
+	TEST_EQUAL(summary.max, 100500);
+
+	TEST_EQUAL(frame_timing_phase_from_name("gpu"), FRAME_TIMING_GPU);
+	TEST_EQUAL(frame_timing_phase_from_name("nonsense"), NUM_FRAME_TIMING_PHASES);
+	frame_timing_free(ft);
+}
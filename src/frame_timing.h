@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Number of the most recent frames whose timings are kept
+#define FRAME_TIMING_SAMPLES 1024
+/// Number of buckets in the histograms. Bucket 0 counts the times shorter than 1 us,
+/// bucket i the times in [2^(i-1), 2^i) us, the last bucket also counts everything
+/// longer than that.
+#define FRAME_TIMING_BUCKETS 20
+
+/// Where the time of a frame goes
+enum frame_timing_phase {
+	/// Handling X events, and the window updates they cause
+	FRAME_TIMING_EVENTS,
+	FRAME_TIMING_PREPROCESS,
+	/// Preparing the frame and painting the wallpaper
+	FRAME_TIMING_ROOT,
+	FRAME_TIMING_SHADOW,
+	FRAME_TIMING_BLUR,
+	/// Painting the windows
+	FRAME_TIMING_COMPOSE,
+	FRAME_TIMING_PRESENT,
+	/// Time the GPU spent rendering a frame. The backend reports it a few frames
+	/// late, it's recorded with the frame it's reported in.
+	FRAME_TIMING_GPU,
+	/// CPU time of the whole frame, the sum of all the phases above except GPU
+	FRAME_TIMING_TOTAL,
+	NUM_FRAME_TIMING_PHASES,
+};
+
+struct frame_timing_record {
+	/// Time spent in each phase, in nanoseconds
+	uint32_t time[NUM_FRAME_TIMING_PHASES];
+	/// Bitmask of the phases the frame went through
+	uint32_t recorded;
+};
+
+/// Records how long each phase of the recent frames took, in a ring buffer. Everything
+/// happens on the main thread, there is no locking.
+struct frame_timing {
+	struct frame_timing_record frames[FRAME_TIMING_SAMPLES];
+	/// The frame being recorded
+	struct frame_timing_record current;
+	/// Where the next frame goes in `frames`
+	unsigned next;
+	/// Number of valid entries in `frames`
+	unsigned nframes;
+};
+
+struct frame_timing_summary {
+	/// Number of recent frames that went through the phase
+	unsigned count;
+	/// Percentiles of the time spent in the phase, in nanoseconds
+	uint64_t p50, p90, p99, max;
+	unsigned histogram[FRAME_TIMING_BUCKETS];
+};
+
+struct frame_timing *frame_timing_new(void);
+void frame_timing_free(struct frame_timing *ft);
+
+/// Current time in nanoseconds, to be passed to frame_timing_lap. 0 if `ft` is NULL, so
+/// timing costs nothing when it's disabled.
+uint64_t frame_timing_now(const struct frame_timing *ft);
+
+/// Add `time` nanoseconds to `phase` of the current frame
+void frame_timing_add(struct frame_timing *ft, enum frame_timing_phase phase,
+                      uint64_t time);
+
+/// Add the time since `*since` to `phase` of the current frame, and set `*since` to the
+/// current time. Does nothing if `ft` is NULL.
+void frame_timing_lap(struct frame_timing *ft, enum frame_timing_phase phase,
+                      uint64_t *since);
+
+/// Finish the current frame and put it into the ring buffer
+void frame_timing_end_frame(struct frame_timing *ft);
+
+/// Calculate the percentiles and the histogram of `phase` over the recent frames.
+/// Returns false if no recent frame went through the phase.
+bool frame_timing_summarize(const struct frame_timing *ft, enum frame_timing_phase phase,
+                            struct frame_timing_summary *summary);
+
+const char *frame_timing_phase_name(enum frame_timing_phase phase);
+/// Returns NUM_FRAME_TIMING_PHASES if `name` is not a phase
+enum frame_timing_phase frame_timing_phase_from_name(const char *name);
@@ -3,10 +3,12 @@
 
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 
 #include "compiler.h"
 #include "kernel.h"
 #include "log.h"
+#include "microbench.h"
 #include "utils.h"
 
 /// Sum a region convolution kernel. Region is defined by a width x height rectangle whose
@@ -87,6 +89,20 @@ conv *gaussian_kernel(double r, int size) {
 	return c;
 }
 
+conv *conv_dup(const conv *k) {
+	size_t n = (size_t)(k->w * k->h);
+	conv *ret = cvalloc(sizeof(conv) + n * sizeof(double));
+	ret->w = k->w;
+	ret->h = k->h;
+	memcpy(ret->data, k->data, n * sizeof(double));
+	ret->rsum = NULL;
+	if (k->rsum) {
+		ret->rsum = ccalloc(n, double);
+		memcpy(ret->rsum, k->rsum, n * sizeof(double));
+	}
+	return ret;
+}
+
 /// Estimate the element of the sum of the first row in a gaussian kernel with standard
 /// deviation `r` and size `size`,
 static inline double estimate_first_row_sum(double size, double r) {
@@ -158,3 +174,39 @@ void sum_kernel_preprocess(conv *map) {
 }
 
 // vim: set noet sw=8 ts=8 :
+
+MICROBENCH(gaussian_kernel) {
+	MICROBENCH_LOOP() {
+		conv *kernel = gaussian_kernel(12, 49);
+		microbench_keep(kernel);
+		free_conv(kernel);
+	}
+}
+
+/// Sum the kernel over every rectangle a shadow needs, either straightforwardly or
+/// with the preprocessed sums
+static void bench_sum_kernel(struct microbench *bench, bool preprocess) {
+	conv *kernel = gaussian_kernel_autodetect_deviation(12);
+	if (preprocess) {
+		sum_kernel_preprocess(kernel);
+	}
+	int d = kernel->w;
+	int x = 0, y = 0;
+	MICROBENCH_LOOP() {
+		double sum = sum_kernel(kernel, d - x - 1, d - y - 1, 100, 100);
+		microbench_keep(sum);
+		if (++x == d + 99) {
+			x = 0;
+			y = (y + 1) % (d + 99);
+		}
+	}
+	free_conv(kernel);
+}
+
+MICROBENCH(sum_kernel) {
+	bench_sum_kernel(bench, false);
+}
+
+MICROBENCH(sum_kernel_preprocessed) {
+	bench_sum_kernel(bench, true);
+}
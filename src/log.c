@@ -1,5 +1,9 @@
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,8 +18,11 @@
 #include "backend/gl/glx.h"
 #endif
 
+#include <test.h>
+
 #include "compiler.h"
 #include "log.h"
+#include "trace.h"
 #include "utils.h"
 
 thread_local struct log *tls_logger;
@@ -328,6 +335,249 @@ struct log_target *stderr_logger_new(void) {
 	return &ret->tgt;
 }
 
+/// Size of the ring buffer of an async logger, must be a power of 2
+#define ASYNC_LOGGER_RING_SIZE (1 << 20)
+
+/// A logger that copies the log messages into a ring buffer, and leaves writing them
+/// out to another log target, on a separate thread. So logging doesn't wait for the
+/// disk. Messages that don't fit in the ring are dropped and counted.
+///
+/// The ring has a single producer, the thread the logger belongs to, and a single
+/// consumer, the flusher thread, so it doesn't need a lock.
+struct async_logger {
+	struct log_target tgt;
+	struct log_ops ops;
+	/// The target the messages are eventually written to
+	struct log_target *inner;
+
+	pthread_t flusher;
+	/// Posted when there are new messages, or when the flusher should quit
+	sem_t wakeup;
+	atomic_bool quit;
+
+	/// Number of bytes ever written into the ring, only changed by the producer
+	atomic_size_t head;
+	/// Number of bytes ever flushed from the ring, only changed by the flusher
+	atomic_size_t tail;
+	/// Messages dropped since the flusher last reported them
+	atomic_ulong dropped;
+	/// Messages dropped in total
+	atomic_ulong total_dropped;
+	char *ring;
+};
+
+static void async_logger_flush(struct async_logger *a) {
+	size_t head = atomic_load_explicit(&a->head, memory_order_acquire);
+	size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+	if (head != tail) {
+		size_t start = tail & (ASYNC_LOGGER_RING_SIZE - 1);
+		size_t len = head - tail;
+		size_t first = min2(len, ASYNC_LOGGER_RING_SIZE - start);
+		struct iovec vec[] = {
+		    {.iov_base = a->ring + start, .iov_len = first},
+		    {.iov_base = a->ring, .iov_len = len - first},
+		};
+		a->inner->ops->writev(a->inner, vec, len > first ? 2 : 1);
+		atomic_store_explicit(&a->tail, head, memory_order_release);
+	}
+
+	unsigned long dropped =
+	    atomic_exchange_explicit(&a->dropped, 0, memory_order_relaxed);
+	if (dropped) {
+		char buf[100];
+		int blen = snprintf(buf, sizeof buf,
+		                    "[ async logger ] %lu log messages dropped\n", dropped);
+		a->inner->ops->write(a->inner, buf, (size_t)blen);
+	}
+}
+
+static void *async_logger_flusher(void *arg) {
+	struct async_logger *a = arg;
+	while (true) {
+		if (sem_wait(&a->wakeup) != 0 && errno == EINTR) {
+			continue;
+		}
+		// Load quit before flushing, so messages written before the logger is
+		// destroyed are not lost
+		bool quit = atomic_load(&a->quit);
+		async_logger_flush(a);
+		if (quit) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void async_logger_writev(struct log_target *tgt, const struct iovec *vec, int vcnt) {
+	auto a = (struct async_logger *)tgt;
+	size_t total = 0;
+	for (int i = 0; i < vcnt; i++) {
+		total += vec[i].iov_len;
+	}
+
+	size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+	if (total > ASYNC_LOGGER_RING_SIZE - (head - tail)) {
+		atomic_fetch_add_explicit(&a->dropped, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&a->total_dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	size_t pos = head;
+	for (int i = 0; i < vcnt; i++) {
+		const char *src = vec[i].iov_base;
+		size_t len = vec[i].iov_len;
+		while (len > 0) {
+			size_t start = pos & (ASYNC_LOGGER_RING_SIZE - 1);
+			size_t n = min2(len, ASYNC_LOGGER_RING_SIZE - start);
+			memcpy(a->ring + start, src, n);
+			src += n;
+			len -= n;
+			pos += n;
+		}
+	}
+	atomic_store_explicit(&a->head, pos, memory_order_release);
+	sem_post(&a->wakeup);
+}
+
+static void async_logger_write(struct log_target *tgt, const char *str, size_t len) {
+	async_logger_writev(tgt, &(struct iovec){.iov_base = (void *)str, .iov_len = len},
+	                    1);
+}
+
+static void async_logger_destroy(struct log_target *tgt) {
+	auto a = (struct async_logger *)tgt;
+	atomic_store(&a->quit, true);
+	sem_post(&a->wakeup);
+	pthread_join(a->flusher, NULL);
+
+	unsigned long dropped = atomic_load(&a->total_dropped);
+	if (dropped) {
+		char buf[100];
+		int blen = snprintf(buf, sizeof buf,
+		                    "[ async logger ] %lu log messages dropped in total\n",
+		                    dropped);
+		a->inner->ops->write(a->inner, buf, (size_t)blen);
+	}
+	a->inner->ops->destroy(a->inner);
+	sem_destroy(&a->wakeup);
+	free(a->ring);
+	free(a);
+}
+
+static const struct log_ops async_logger_ops = {
+    .write = async_logger_write,
+    .writev = async_logger_writev,
+    .destroy = async_logger_destroy,
+};
+
+struct log_target *async_logger_new(struct log_target *inner) {
+	auto ret = ccalloc(1, struct async_logger);
+	ret->tgt.ops = &ret->ops;
+	ret->ops = async_logger_ops;
+	// Messages should look the same as when they are written to `inner` directly
+	ret->ops.colorize_begin = inner->ops->colorize_begin;
+	ret->ops.colorize_end = inner->ops->colorize_end;
+	ret->inner = inner;
+	ret->ring = ccalloc(ASYNC_LOGGER_RING_SIZE, char);
+	atomic_init(&ret->quit, false);
+	atomic_init(&ret->head, 0);
+	atomic_init(&ret->tail, 0);
+	atomic_init(&ret->dropped, 0);
+	atomic_init(&ret->total_dropped, 0);
+
+	if (sem_init(&ret->wakeup, 0, 0) != 0) {
+		goto err;
+	}
+	if (pthread_create(&ret->flusher, NULL, async_logger_flusher, ret) != 0) {
+		sem_destroy(&ret->wakeup);
+		goto err;
+	}
+	return &ret->tgt;
+
+err:
+	free(ret->ring);
+	free(ret);
+	return NULL;
+}
+
+/// A log target that counts the bytes written to it
+struct counting_logger {
+	struct log_target tgt;
+	size_t bytes;
+	size_t *result;
+};
+
+static void counting_logger_write(struct log_target *tgt, const char *str attr_unused,
+                                  size_t len) {
+	auto c = (struct counting_logger *)tgt;
+	c->bytes += len;
+}
+
+static void counting_logger_destroy(struct log_target *tgt) {
+	auto c = (struct counting_logger *)tgt;
+	*c->result = c->bytes;
+	free(c);
+}
+
+static attr_unused const struct log_ops counting_logger_ops = {
+    .write = counting_logger_write,
+    .writev = log_default_writev,
+    .destroy = counting_logger_destroy,
+};
+
+TEST_CASE(async_logger) {
+	size_t bytes = 0;
+	auto inner = ccalloc(1, struct counting_logger);
+	inner->tgt.ops = &counting_logger_ops;
+	inner->result = &bytes;
+
+	auto tgt = async_logger_new(&inner->tgt);
+	TEST_TRUE(tgt != NULL);
+	char msg[1000];
+	memset(msg, 'a', sizeof msg);
+	for (int i = 0; i < 100; i++) {
+		tgt->ops->writev(tgt,
+		                 (struct iovec[]){{.iov_base = msg, .iov_len = 500},
+		                                  {.iov_base = msg, .iov_len = 500}},
+		                 2);
+	}
+	// Too big to ever fit
+	auto big = ccalloc(ASYNC_LOGGER_RING_SIZE + 1, char);
+	tgt->ops->write(tgt, big, ASYNC_LOGGER_RING_SIZE + 1);
+	free(big);
+
+	// Everything that fit is flushed when the logger is destroyed, followed by the
+	// drop report
+	tgt->ops->destroy(tgt);
+	TEST_TRUE(bytes > 100 * sizeof msg);
+}
+
+/// A logger that records the log messages as events in a trace, so they show up next to
+/// what the compositor was doing at the time
+struct trace_logger {
+	struct log_target tgt;
+	struct trace *trace;
+};
+
+static void trace_logger_write(struct log_target *tgt, const char *str, size_t len) {
+	auto t = (struct trace_logger *)tgt;
+	trace_message(t->trace, str, len);
+}
+
+static const struct log_ops trace_logger_ops = {
+    .write = trace_logger_write,
+    .writev = log_default_writev,
+    .destroy = logger_trivial_destroy,
+};
+
+struct log_target *trace_logger_new(struct trace *trace) {
+	auto ret = cmalloc(struct trace_logger);
+	ret->tgt.ops = &trace_logger_ops;
+	ret->trace = trace;
+	return &ret->tgt;
+}
+
 #ifdef CONFIG_OPENGL
 /// An opengl logger that can be used for logging into opengl debugging tools,
 /// such as apitrace
@@ -91,6 +91,12 @@ static inline void log_deinit_tls(void) {
 attr_malloc struct log_target *stderr_logger_new(void);
 attr_malloc struct log_target *file_logger_new(const char *file);
 attr_malloc struct log_target *null_logger_new(void);
+/// A log target that writes to `inner` on a background thread, so logging doesn't block.
+/// Takes ownership of `inner`. Returns NULL on failure, `inner` is left alone then.
+attr_malloc struct log_target *async_logger_new(struct log_target *inner);
 attr_malloc struct log_target *gl_string_marker_logger_new(void);
+struct trace;
+/// A log target writing into a trace, the trace must outlive it
+attr_malloc struct log_target *trace_logger_new(struct trace *);
 
 // vim: set noet sw=8 ts=8:
@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "microbench.h"
+#include "region.h"
+#include "utils.h"
+
+/// A benchmark is first run with more and more iterations, until it runs for at least
+/// this long, to estimate how long an iteration takes
+#define MICROBENCH_CALIBRATION_NS 10000000ULL
+/// How long each of the measured runs should take
+#define MICROBENCH_RUN_NS 50000000ULL
+/// Number of measured runs, the median is reported
+#define MICROBENCH_RUNS 7
+
+static struct microbench_case *microbench_head, **microbench_tail = &microbench_head;
+
+void microbench_register(struct microbench_case *c) {
+	// Keep them in the order they are defined
+	c->next = NULL;
+	*microbench_tail = c;
+	microbench_tail = &c->next;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void microbench_run_one(const struct microbench_case *c) {
+	struct microbench b = {.iterations = 1};
+	while (true) {
+		c->fn(&b);
+		if (b.elapsed >= MICROBENCH_CALIBRATION_NS ||
+		    b.iterations >= (1ULL << 40)) {
+			break;
+		}
+		b.iterations *= 2;
+	}
+	double ns_per_op = (double)b.elapsed / (double)b.iterations;
+	ns_per_op = max2(ns_per_op, 1e-3);
+	b.iterations = max2((uint64_t)((double)MICROBENCH_RUN_NS / ns_per_op), 1);
+
+	double results[MICROBENCH_RUNS];
+	for (int i = 0; i < MICROBENCH_RUNS; i++) {
+		c->fn(&b);
+		results[i] = (double)b.elapsed / (double)b.iterations;
+	}
+	qsort(results, MICROBENCH_RUNS, sizeof(*results), compare_double);
+	printf("%-32s %14.1f ns/op  (min %.1f, max %.1f, %" PRIu64 " iterations)\n",
+	       c->name, results[MICROBENCH_RUNS / 2], results[0],
+	       results[MICROBENCH_RUNS - 1], b.iterations);
+	fflush(stdout);
+}
+
+int microbench_run(const char *filter) {
+	const char *file = NULL;
+	for (auto c = microbench_head; c; c = c->next) {
+		if (filter && !strstr(c->name, filter)) {
+			continue;
+		}
+		if (!file || strcmp(file, c->file) != 0) {
+			file = c->file;
+			printf("%s:\n", file);
+		}
+		microbench_run_one(c);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Benchmarks of the functions that only live in headers
+
+/// A region made of `n` x `n` squares in a checkerboard pattern
+static void checkerboard_region(region_t *region, int n) {
+	pixman_region32_init(region);
+	for (int y = 0; y < n; y++) {
+		for (int x = y % 2; x < n; x += 2) {
+			pixman_region32_union_rect(region, region, x * 20, y * 20, 20,
+			                           20);
+		}
+	}
+}
+
+MICROBENCH(resize_region) {
+	region_t region;
+	checkerboard_region(&region, 20);
+	MICROBENCH_LOOP() {
+		region_t resized = resize_region(&region, 5, 5);
+		microbench_keep(&resized);
+		pixman_region32_fini(&resized);
+	}
+	pixman_region32_fini(&region);
+}
+
+MICROBENCH(resize_region_shrink) {
+	region_t region, output;
+	checkerboard_region(&region, 20);
+	pixman_region32_init(&output);
+	MICROBENCH_LOOP() {
+		_resize_region(&region, &output, -5, -5);
+		microbench_keep(&output);
+	}
+	pixman_region32_fini(&output);
+	pixman_region32_fini(&region);
+}
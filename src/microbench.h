@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// Microbenchmarks of the hot functions. Like the unit tests, they are defined next to
+/// the functions they measure:
+///
+///     MICROBENCH(name) {
+///             // setup
+///             MICROBENCH_LOOP() {
+///                     // the code being measured
+///             }
+///             // cleanup
+///     }
+///
+/// They are only built with the `microbench` build option, and run with
+/// `picom --microbench [filter]`, which prints the time per iteration of the loop of
+/// every benchmark whose name contains `filter`.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "compiler.h"
+
+struct microbench {
+	/// Number of times the loop should run
+	uint64_t iterations;
+	uint64_t i;
+	/// How long the loop took, in nanoseconds
+	uint64_t elapsed;
+	struct timespec start;
+};
+
+struct microbench_case {
+	const char *name;
+	const char *file;
+	void (*fn)(struct microbench *);
+	struct microbench_case *next;
+};
+
+void microbench_register(struct microbench_case *);
+/// Run the benchmarks whose names contain `filter`, all of them if it's NULL
+///
+/// @return the exit code
+int microbench_run(const char *filter);
+
+static inline void microbench_start(struct microbench *b) {
+	b->i = 0;
+	clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static inline bool microbench_next(struct microbench *b) {
+	if (likely(b->i++ < b->iterations)) {
+		return true;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	b->elapsed = (uint64_t)(now.tv_sec - b->start.tv_sec) * 1000000000ULL +
+	             (uint64_t)now.tv_nsec - (uint64_t)b->start.tv_nsec;
+	return false;
+}
+
+/// Make the compiler believe `value` is used, so the computation of it isn't optimized
+/// away
+#define microbench_keep(value) __asm__ volatile("" : : "g"(value) : "memory")
+
+#define MICROBENCH_LOOP() for (microbench_start(bench); microbench_next(bench);)
+
+#ifdef MICRO_BENCHMARK
+#define MICROBENCH(_name)                                                                \
+	static void __microbench_##_name(struct microbench *);                           \
+	static struct microbench_case __microbench_case_##_name = {                      \
+	    .name = #_name,                                                              \
+	    .file = __FILE__,                                                            \
+	    .fn = __microbench_##_name,                                                  \
+	};                                                                               \
+	static void __attribute__((constructor)) __microbench_register_##_name(void) {   \
+		microbench_register(&__microbench_case_##_name);                         \
+	}                                                                                \
+	static void __microbench_##_name(struct microbench *bench)
+#else
+#define MICROBENCH(_name)                                                                \
+	static void attr_unused __microbench_##_name(struct microbench *bench)
+#endif
@@ -9,6 +9,7 @@
  *
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -215,6 +216,91 @@ glx_init_end:
 	return success;
 }
 
+static inline GLuint glx_gen_texture(GLenum tex_tgt, int width, int height) {
+	GLuint tex = 0;
+	glGenTextures(1, &tex);
+	if (!tex) {
+		return 0;
+	}
+	glEnable(tex_tgt);
+	glBindTexture(tex_tgt, tex);
+	glTexParameteri(tex_tgt, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(tex_tgt, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(tex_tgt, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(tex_tgt, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(tex_tgt, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(tex_tgt, 0);
+
+	return tex;
+}
+
+static inline GLenum glx_screen_tex_tgt(session_t *ps) {
+	return ps->psglx->has_texture_non_power_of_two ? GL_TEXTURE_2D : GL_TEXTURE_RECTANGLE;
+}
+
+static void glx_free_render_targets(session_t *ps) {
+	glx_session_t *psglx = ps->psglx;
+	free_glx_fbo(&psglx->back_fbo);
+	free_texture_r(ps, &psglx->back_texture);
+	for (int i = 0; i < 2; i++) {
+		free_glx_fbo(&psglx->blur_fbos[i]);
+		free_texture_r(ps, &psglx->blur_textures[i]);
+	}
+}
+
+static GLuint glx_gen_render_target(session_t *ps, GLuint texture) {
+	GLuint fbo = 0;
+	glGenFramebuffers(1, &fbo);
+	if (!fbo) {
+		return 0;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+	                       glx_screen_tex_tgt(ps), texture, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		glDeleteFramebuffers(1, &fbo);
+		return 0;
+	}
+	return fbo;
+}
+
+/**
+ * Create the offscreen framebuffer the frame is rendered into for blurring, and the
+ * textures the blur passes render into.
+ */
+static bool glx_init_render_targets(session_t *ps) {
+	glx_session_t *psglx = ps->psglx;
+	const GLenum tex_tgt = glx_screen_tex_tgt(ps);
+	glx_free_render_targets(ps);
+
+	psglx->back_texture = glx_gen_texture(tex_tgt, ps->root_width, ps->root_height);
+	if (psglx->back_texture) {
+		psglx->back_fbo = glx_gen_render_target(ps, psglx->back_texture);
+	}
+	bool success = psglx->back_fbo;
+	for (int i = 0; success && i < 2; i++) {
+		psglx->blur_textures[i] =
+		    glx_gen_texture(tex_tgt, ps->root_width, ps->root_height);
+		if (psglx->blur_textures[i]) {
+			psglx->blur_fbos[i] =
+			    glx_gen_render_target(ps, psglx->blur_textures[i]);
+		}
+		success = psglx->blur_fbos[i];
+	}
+	glDisable(tex_tgt);
+
+	if (!success) {
+		log_warn("Failed to create offscreen framebuffers, blurring will copy "
+		         "from the back buffer.");
+		glx_free_render_targets(ps);
+	}
+	gl_check_err();
+	return success;
+}
+
 static void glx_free_prog_main(glx_prog_main_t *pprogram) {
 	if (!pprogram)
 		return;
@@ -261,6 +347,7 @@ void glx_destroy(session_t *ps) {
 	free(ps->psglx->round_passes);
 
 	glx_free_prog_main(&ps->glx_prog_win);
+	glx_free_render_targets(ps);
 
 	gl_check_err();
 
@@ -288,6 +375,10 @@ void glx_on_root_change(session_t *ps) {
 	glOrtho(0, ps->root_width, 0, ps->root_height, -1000.0, 1000.0);
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
+
+	if (ps->psglx->back_fbo) {
+		glx_init_render_targets(ps);
+	}
 }
 
 /**
@@ -431,6 +522,9 @@ bool glx_init_blur(session_t *ps) {
 		free(lc_numeric_old);
 	}
 
+	// Not fatal, glx_blur_dst() falls back to copying from the back buffer
+	glx_init_render_targets(ps);
+
 	gl_check_err();
 
 	return true;
@@ -611,26 +705,9 @@ static inline void glx_copy_region_to_tex(session_t *ps, GLenum tex_tgt, int bas
 	}
 }
 
-static inline GLuint glx_gen_texture(GLenum tex_tgt, int width, int height) {
-	GLuint tex = 0;
-	glGenTextures(1, &tex);
-	if (!tex) {
-		return 0;
-	}
-	glEnable(tex_tgt);
-	glBindTexture(tex_tgt, tex);
-	glTexParameteri(tex_tgt, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(tex_tgt, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(tex_tgt, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(tex_tgt, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(tex_tgt, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(tex_tgt, 0);
-
-	return tex;
-}
-
 /**
- * Bind an OpenGL texture and fill it with pixel data from back buffer
+ * Bind an OpenGL texture and fill it with pixel data from back buffer, or from the
+ * offscreen frame if it is rendered into one.
  */
 bool glx_bind_texture(session_t *ps attr_unused, glx_texture_t **pptex, int x, int y,
                       int width, int height) {
@@ -731,8 +808,8 @@ bool glx_bind_pixmap(session_t *ps, glx_texture_t **pptex, xcb_pixmap_t pixmap,
 
 		// Retrieve pixmap parameters, if they aren't provided
 		if (!width || !height) {
-			auto r = xcb_get_geometry_reply(
-			    ps->c, xcb_get_geometry(ps->c, pixmap), NULL);
+			auto r = X_REPLY(xcb_get_geometry_reply(
+			    ps->c, xcb_get_geometry(ps->c, pixmap), NULL));
 			if (!r) {
 				log_error("Failed to query info of pixmap %#010x.", pixmap);
 				return false;
@@ -898,6 +975,128 @@ void glx_set_clip(session_t *ps, const region_t *reg) {
                                                                                          \
 	pixman_region32_fini(&reg_new);
 
+void glx_paint_begin(session_t *ps) {
+	if (ps->psglx->back_fbo) {
+		glBindFramebuffer(GL_FRAMEBUFFER, ps->psglx->back_fbo);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	}
+}
+
+void glx_paint_end(session_t *ps, const region_t *reg) {
+	if (!ps->psglx->back_fbo) {
+		return;
+	}
+
+	// Blitting is clipped by the scissor box
+	const bool have_scissors = glIsEnabled(GL_SCISSOR_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, ps->psglx->back_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glDrawBuffer(GL_BACK);
+
+	int nrects;
+	const rect_t *rects = pixman_region32_rectangles((region_t *)reg, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		auto r = rects[i];
+		glBlitFramebuffer(r.x1, ps->root_height - r.y2, r.x2,
+		                  ps->root_height - r.y1, r.x1, ps->root_height - r.y2,
+		                  r.x2, ps->root_height - r.y1, GL_COLOR_BUFFER_BIT,
+		                  GL_NEAREST);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (have_scissors) {
+		glEnable(GL_SCISSOR_TEST);
+	}
+	gl_check_err();
+}
+
+/**
+ * Blur contents in a particular region, when the frame is rendered into the
+ * offscreen framebuffer.
+ *
+ * All the textures involved are the size of the screen, so every pass uses the same
+ * coordinates, and the clip region still applies.
+ */
+static bool glx_blur_dst_fbo(session_t *ps, int dx, int dy, int width, int height,
+                             float z, GLfloat factor_center, const region_t *reg_tgt) {
+	glx_session_t *psglx = ps->psglx;
+	const GLenum tex_tgt = glx_screen_tex_tgt(ps);
+
+	// Texture scaling factor
+	GLfloat texfac_x = 1.0f, texfac_y = 1.0f;
+	if (tex_tgt == GL_TEXTURE_2D) {
+		texfac_x /= (GLfloat)ps->root_width;
+		texfac_y /= (GLfloat)ps->root_height;
+	}
+
+	// The first pass samples the frame, the last one writes back into it. A pass
+	// can't read the texture it's rendering into, so with only one kernel, its
+	// result is copied back with an extra pass that doesn't blur.
+	const int nsteps = max2(ps->o.blur_kernel_count, 2);
+	// The next pass samples around the damage, so only the last pass is clipped
+	const bool have_scissors = glIsEnabled(GL_SCISSOR_TEST);
+	const bool have_stencil = glIsEnabled(GL_STENCIL_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glEnable(tex_tgt);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	for (int i = 0; i < nsteps; i++) {
+		const bool last_pass = i == nsteps - 1;
+		glBindTexture(tex_tgt, i == 0 ? psglx->back_texture
+		                              : psglx->blur_textures[(i - 1) % 2]);
+		glBindFramebuffer(GL_FRAMEBUFFER,
+		                  last_pass ? psglx->back_fbo : psglx->blur_fbos[i % 2]);
+		if (last_pass) {
+			if (have_scissors)
+				glEnable(GL_SCISSOR_TEST);
+			if (have_stencil)
+				glEnable(GL_STENCIL_TEST);
+		}
+
+		if (i < ps->o.blur_kernel_count) {
+			const glx_blur_pass_t *ppass = &psglx->blur_passes[i];
+			assert(ppass->prog);
+			glUseProgram(ppass->prog);
+			if (ppass->unifm_offset_x >= 0)
+				glUniform1f(ppass->unifm_offset_x, texfac_x);
+			if (ppass->unifm_offset_y >= 0)
+				glUniform1f(ppass->unifm_offset_y, texfac_y);
+			if (ppass->unifm_factor_center >= 0)
+				glUniform1f(ppass->unifm_factor_center, factor_center);
+		}
+
+		P_PAINTREG_START(crect) {
+			auto rdx = (GLfloat)crect.x1;
+			auto rdy = (GLfloat)(ps->root_height - crect.y1);
+			auto rdxe = rdx + (GLfloat)(crect.x2 - crect.x1);
+			auto rdye = rdy - (GLfloat)(crect.y2 - crect.y1);
+
+			glTexCoord2f(rdx * texfac_x, rdy * texfac_y);
+			glVertex3f(rdx, rdy, z);
+
+			glTexCoord2f(rdxe * texfac_x, rdy * texfac_y);
+			glVertex3f(rdxe, rdy, z);
+
+			glTexCoord2f(rdxe * texfac_x, rdye * texfac_y);
+			glVertex3f(rdxe, rdye, z);
+
+			glTexCoord2f(rdx * texfac_x, rdye * texfac_y);
+			glVertex3f(rdx, rdye, z);
+		}
+		P_PAINTREG_END();
+
+		glUseProgram(0);
+	}
+
+	glBindTexture(tex_tgt, 0);
+	glDisable(tex_tgt);
+
+	gl_check_err();
+
+	return true;
+}
+
 /**
  * Blur contents in a particular region.
  *
@@ -906,6 +1105,11 @@ void glx_set_clip(session_t *ps, const region_t *reg) {
 bool glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
                   GLfloat factor_center, const region_t *reg_tgt, glx_blur_cache_t *pbc) {
 	assert(ps->psglx->blur_passes[0].prog);
+	if (ps->psglx->back_fbo) {
+		return glx_blur_dst_fbo(ps, dx, dy, width, height, z, factor_center,
+		                        reg_tgt);
+	}
+
 	const bool more_passes = ps->o.blur_kernel_count > 1;
 	const bool have_scissors = glIsEnabled(GL_SCISSOR_TEST);
 	const bool have_stencil = glIsEnabled(GL_STENCIL_TEST);
@@ -1166,6 +1370,29 @@ bool glx_round_corners_dst(session_t *ps, struct managed_win *w,
 		                      height, &w->border_col[0]);
 	}
 
+	// The shader leaves alone the pixels more than a pixel away from the edge of the
+	// rounded rectangle, or from the border if there is one. Only run it on the
+	// corners and along the edges, the rest of the window costs nothing more than
+	// a square window.
+	const int band = (w->border_col[0] != -1. ? w->g.border_width : 0) + 2;
+	const int corner = max2((int)ceilf(cr) + 1, band);
+	region_t reg_edges, reg_inner;
+	pixman_region32_init(&reg_inner);
+	if (width > 2 * corner && height > 2 * band) {
+		pixman_region32_union_rect(&reg_inner, &reg_inner, dx + corner, dy + band,
+		                           (uint)(width - 2 * corner),
+		                           (uint)(height - 2 * band));
+	}
+	if (width > 2 * band && height > 2 * corner) {
+		pixman_region32_union_rect(&reg_inner, &reg_inner, dx + band, dy + corner,
+		                           (uint)(width - 2 * band),
+		                           (uint)(height - 2 * corner));
+	}
+	pixman_region32_init(&reg_edges);
+	pixman_region32_subtract(&reg_edges, (region_t *)reg_tgt, &reg_inner);
+	pixman_region32_fini(&reg_inner);
+	reg_tgt = &reg_edges;
+
 	{
 		const glx_round_pass_t *ppass = ps->psglx->round_passes;
 		assert(ppass->prog);
@@ -1259,6 +1486,7 @@ bool glx_round_corners_dst(session_t *ps, struct managed_win *w,
 	}
 
 	ret = true;
+	pixman_region32_fini(&reg_edges);
 
 	glBindTexture(ptex->target, 0);
 	glDisable(ptex->target);
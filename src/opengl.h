@@ -73,6 +73,15 @@ typedef struct glx_session {
 	int z;
 	glx_blur_pass_t *blur_passes;
 	glx_round_pass_t *round_passes;
+	/// When blurring, the frame is rendered into `back_texture` instead of the back
+	/// buffer, and copied to the back buffer before it's presented. The blur passes
+	/// sample the screen from it, and ping-pong between `blur_textures`, instead of
+	/// copying the back buffer into textures for each window. They are all the size
+	/// of the screen, and shared by all windows. 0 if not used.
+	GLuint back_fbo;
+	GLuint back_texture;
+	GLuint blur_fbos[2];
+	GLuint blur_textures[2];
 } glx_session_t;
 
 /// @brief Wrapper of a binded GLX texture.
@@ -120,6 +129,13 @@ bool glx_bind_texture(session_t *ps, glx_texture_t **pptex, int x, int y, int wi
 
 void glx_paint_pre(session_t *ps, region_t *preg) attr_nonnull(1, 2);
 
+/// Start rendering a frame, into the offscreen framebuffer if there is one.
+void glx_paint_begin(session_t *ps);
+
+/// Copy the painted region of the offscreen framebuffer to the back buffer, if the
+/// frame was rendered into it.
+void glx_paint_end(session_t *ps, const region_t *reg);
+
 /**
  * Check if a texture is binded, or is binded to the given pixmap.
  */
@@ -133,6 +133,10 @@ static void usage(const char *argv0, int ret) {
 	    "--fade-exclude condition\n"
 	    "  Exclude conditions for fading.\n"
 	    "\n"
+	    "--fade-curve curve\n"
+	    "  Easing curve of fading and dimming, one of linear, ease-in, ease-out\n"
+	    "  and ease-in-out. Defaults to linear.\n"
+	    "\n"
 	    "--mark-ovredir-focused\n"
 	    "  Mark windows that have no WM frame as active.\n"
 	    "\n"
@@ -182,6 +186,12 @@ static void usage(const char *argv0, int ret) {
 	    "  Delay before unredirecting the window, in milliseconds.\n"
 	    "  Defaults to 0.\n"
 	    "\n"
+	    "--unredir-if-possible-redirect-delay ms\n"
+	    "  Delay before redirecting the screen again after it was\n"
+	    "  unredirected, in milliseconds, so windows showing up briefly on\n"
+	    "  top of a full-screen window don't make us redirect and\n"
+	    "  unredirect repeatedly. Defaults to 0.\n"
+	    "\n"
 	    "--unredir-if-possible-exclude condition\n"
 	    "  Conditions of windows that shouldn't be considered full-screen\n"
 	    "  for unredirecting screen.\n"
@@ -222,6 +232,10 @@ static void usage(const char *argv0, int ret) {
 	    "--blur-strength\n"
 	    "  The strength level of the 'dual_kawase' blur method.\n"
 	    "\n"
+	    "--blur-downscale\n"
+	    "  Blur at a reduced resolution, 1, 2 or 4 times smaller, for the\n"
+	    "  'gaussian' and 'box' blur method. Cheaper, but less accurate.\n"
+	    "\n"
 	    "--blur-background\n"
 	    "  Blur background of semi-transparent / ARGB windows. Bad in\n"
 	    "  performance. The switch name may change without prior\n"
@@ -292,7 +306,7 @@ static void usage(const char *argv0, int ret) {
 	    "  screen.\n"
 	    "\n"
 	    "--backend backend\n"
-	    "  Choose backend. Possible choices are xrender, glx, and\n"
+	    "  Choose backend. Possible choices are xrender, glx, egl, and\n"
 	    "  xr_glx_hybrid."
 #ifndef CONFIG_OPENGL
 	    " (GLX BACKENDS DISABLED AT COMPILE TIME)"
@@ -309,12 +323,46 @@ static void usage(const char *argv0, int ret) {
 	    "  known to break things on some drivers (LLVMpipe, xf86-video-intel,\n"
 	    "  etc.).\n"
 	    "\n"
+	    "--glx-texture-pool-size megabytes\n"
+	    "  GLX and EGL backends: How much video memory textures no longer in\n"
+	    "  use can take up, so they can be reused instead of allocated again.\n"
+	    "  Defaults to 64.\n"
+	    "\n"
+	    "--image-memory-budget megabytes\n"
+	    "  Experimental backends: How much memory the images of windows can\n"
+	    "  take up. Above it, the images of the windows that weren't painted\n"
+	    "  for the longest time are released, and bound again when they are\n"
+	    "  painted. Defaults to 0, no limit.\n"
+	    "\n"
+	    "--unfocused-damage-delay ms\n"
+	    "  Draw damage on the focused window right away, but let damage on\n"
+	    "  other windows wait up to this long, so it's drawn in fewer frames.\n"
+	    "  Defaults to 0, no delay.\n"
+	    "\n"
+	    "--no-frame-pacing\n"
+	    "  Don't schedule frames for the vblanks reported by the X Present\n"
+	    "  extension, render as soon as something changed instead.\n"
+	    "\n"
 	    "--no-use-damage\n"
 	    "  Disable the use of damage information. This cause the whole screen to\n"
 	    "  be redrawn everytime, instead of the part of the screen that has\n"
 	    "  actually changed. Potentially degrades the performance, but might fix\n"
 	    "  some artifacts.\n"
 	    "\n"
+	    "--xrender-buffers count\n"
+	    "  xrender backend: How many back buffers to render into with vsync, so\n"
+	    "  rendering can go on while a frame is being presented. 2 to 4,\n"
+	    "  defaults to 3.\n"
+	    "\n"
+	    "--max-damage-rects count\n"
+	    "  Merge the damaged rectangles until there are at most this many, so\n"
+	    "  frames are painted with fewer draw calls. 0 for no limit, defaults\n"
+	    "  to 64.\n"
+	    "\n"
+	    "--damage-merge-waste pixels\n"
+	    "  Merge neighbouring damaged rectangles if that adds at most this many\n"
+	    "  pixels to the damage. Defaults to 1024.\n"
+	    "\n"
 	    "--xrender-sync-fence\n"
 	    "  Additionally use X Sync fence to sync clients' draw calls. Needed\n"
 	    "  on nvidia-drivers with GLX backend for some users.\n"
@@ -345,6 +393,18 @@ static void usage(const char *argv0, int ret) {
 	    "  Render into a separate window, and don't take over the screen. Useful\n"
 	    "  when you want to attach a debugger to picom\n"
 	    "\n"
+	    "--frame-timing\n"
+	    "  Record how long each phase of the recent frames took, and how long\n"
+	    "  the GPU took to render them. The timings can be fetched through D-Bus.\n"
+	    "\n"
+	    "--trace-file path\n"
+	    "  Write a trace of the frames, in the Chrome trace event format, into\n"
+	    "  the given file. The file holds the most recent events.\n"
+	    "\n"
+	    "--log-async\n"
+	    "  Write to the log file on a separate thread, so logging never waits\n"
+	    "  for the disk. Only has an effect with --log-file.\n"
+	    "\n"
 	    "--no-ewmh-fullscreen\n"
 	    "  Do not use EWMH to detect fullscreen windows. Reverts to checking\n"
 	    "  if a window is fullscreen based only on its size and coordinates.\n"
@@ -454,11 +514,24 @@ static const struct option longopts[] = {
     {"corner-radius", required_argument, NULL, 333},
     {"rounded-corners-exclude", required_argument, NULL, 334},
     {"clip-shadow-above", required_argument, NULL, 335},
+    {"glx-texture-pool-size", required_argument, NULL, 336},
+    {"blur-downscale", required_argument, NULL, 337},
+    {"no-frame-pacing", no_argument, NULL, 338},
+    {"xrender-buffers", required_argument, NULL, 339},
+    {"fade-curve", required_argument, NULL, 340},
+    {"max-damage-rects", required_argument, NULL, 341},
+    {"damage-merge-waste", required_argument, NULL, 342},
+    {"unredir-if-possible-redirect-delay", required_argument, NULL, 343},
+    {"log-async", no_argument, NULL, 344},
+    {"image-memory-budget", required_argument, NULL, 345},
+    {"unfocused-damage-delay", required_argument, NULL, 346},
     {"experimental-backends", no_argument, NULL, 733},
     {"monitor-repaint", no_argument, NULL, 800},
     {"diagnostics", no_argument, NULL, 801},
     {"debug-mode", no_argument, NULL, 802},
     {"no-ewmh-fullscreen", no_argument, NULL, 803},
+    {"frame-timing", no_argument, NULL, 804},
+    {"trace-file", required_argument, NULL, 805},
     // Must terminate with a NULL entry
     {NULL, 0, NULL, 0},
 };
@@ -810,6 +883,7 @@ bool get_cfg(options_t *opt, int argc, char *const *argv, bool shadow_enable,
 			condlst_add(&opt->unredir_if_possible_blacklist, optarg);
 			break;
 		P_CASELONG(309, unredir_if_possible_delay);
+		P_CASELONG(343, unredir_if_possible_redirect_delay);
 		case 310:
 			// --write-pid-path
 			free(opt->write_pid_path);
@@ -885,11 +959,57 @@ bool get_cfg(options_t *opt, int argc, char *const *argv, bool shadow_enable,
 			// --clip-shadow-above
 			condlst_add(&opt->shadow_clip_list, optarg);
 			break;
+		case 336:
+			// --glx-texture-pool-size
+			opt->glx_texture_pool_size = atoi(optarg);
+			break;
+		case 337:
+			// --blur-downscale
+			opt->blur_downscale = atoi(optarg);
+			break;
+		case 338:
+			// --no-frame-pacing
+			opt->frame_pacing = false;
+			break;
+		case 339:
+			// --xrender-buffers
+			opt->xrender_buffers = atoi(optarg);
+			break;
+		case 341:
+			// --max-damage-rects
+			opt->max_damage_rects = atoi(optarg);
+			break;
+		case 342:
+			// --damage-merge-waste
+			opt->damage_merge_waste = atoi(optarg);
+			break;
+		P_CASEBOOL(344, log_async);
+		case 345:
+			// --image-memory-budget
+			opt->image_memory_budget = atoi(optarg);
+			break;
+		P_CASELONG(346, unfocused_damage_delay);
+		case 340: {
+			// --fade-curve
+			enum animation_curve curve = parse_animation_curve(optarg);
+			if (curve >= ANIMATION_CURVE_INVALID) {
+				log_warn("Invalid fade curve %s, ignoring.", optarg);
+			} else {
+				opt->fade_curve = curve;
+			}
+			break;
+		}
 		P_CASEBOOL(733, experimental_backends);
 		P_CASEBOOL(800, monitor_repaint);
 		case 801: opt->print_diagnostics = true; break;
 		P_CASEBOOL(802, debug_mode);
 		P_CASEBOOL(803, no_ewmh_fullscreen);
+		P_CASEBOOL(804, frame_timing);
+		case 805:
+			// --trace-file
+			free(opt->trace_file);
+			opt->trace_file = strdup(optarg);
+			break;
 		default: usage(argv[0], 1); break;
 #undef P_CASEBOOL
 		}
@@ -926,6 +1046,11 @@ bool get_cfg(options_t *opt, int argc, char *const *argv, bool shadow_enable,
 		return false;
 	}
 
+	if (opt->backend == BKEND_EGL && !opt->experimental_backends) {
+		log_error("The egl backend only works with the experimental backends");
+		return false;
+	}
+
 	if (opt->transparent_clipping && !opt->experimental_backends) {
 		log_error("Transparent clipping only works with the experimental "
 		          "backends");
@@ -951,8 +1076,9 @@ bool get_cfg(options_t *opt, int argc, char *const *argv, bool shadow_enable,
 			opt->max_brightness = 1.0;
 		}
 
-		if (!opt->experimental_backends || opt->backend != BKEND_GLX) {
-			log_warn("--max-brightness requires the experimental glx "
+		if (!opt->experimental_backends ||
+		    (opt->backend != BKEND_GLX && opt->backend != BKEND_EGL)) {
+			log_warn("--max-brightness requires the experimental glx or egl "
 			         "backend. Falling back to 1.0");
 			opt->max_brightness = 1.0;
 		}
@@ -995,17 +1121,60 @@ bool get_cfg(options_t *opt, int argc, char *const *argv, bool shadow_enable,
 			         "capping to 20.");
 			opt->blur_strength = 20;
 		}
-		if (!opt->experimental_backends) {
-			log_warn("Dual-kawase blur is not implemented by the legacy "
-			         "backends, you must use the `experimental-backends` "
+		if (!opt->experimental_backends && opt->backend == BKEND_GLX) {
+			log_warn("Dual-kawase blur is not implemented by the legacy glx "
+			         "backend, you must use the `experimental-backends` "
 			         "option.");
 		}
 	}
 
+	if (opt->blur_downscale != 1 && opt->blur_downscale != 2 &&
+	    opt->blur_downscale != 4) {
+		log_warn("Invalid --blur-downscale %d, must be 1, 2 or 4. Not "
+		         "downscaling.",
+		         opt->blur_downscale);
+		opt->blur_downscale = 1;
+	}
+
+	if (opt->xrender_buffers < 2 || opt->xrender_buffers > XRENDER_MAX_BUFFERS) {
+		log_warn("Invalid --xrender-buffers %d, must be between 2 and %d. "
+		         "Using 3.",
+		         opt->xrender_buffers, XRENDER_MAX_BUFFERS);
+		opt->xrender_buffers = 3;
+	}
+
+	if (opt->max_damage_rects < 0) {
+		log_warn("Invalid --max-damage-rects %d, using 0 (no limit).",
+		         opt->max_damage_rects);
+		opt->max_damage_rects = 0;
+	}
+
+	if (opt->damage_merge_waste < 0) {
+		log_warn("Invalid --damage-merge-waste %d, using 0.",
+		         opt->damage_merge_waste);
+		opt->damage_merge_waste = 0;
+	}
+
 	if (opt->resize_damage < 0) {
 		log_warn("Negative --resize-damage will not work correctly.");
 	}
 
+	if (opt->glx_texture_pool_size < 0) {
+		log_warn("Negative --glx-texture-pool-size, unused textures will not be "
+		         "kept.");
+		opt->glx_texture_pool_size = 0;
+	}
+
+	if (opt->image_memory_budget < 0) {
+		log_warn("Negative --image-memory-budget, images will not be limited.");
+		opt->image_memory_budget = 0;
+	}
+
+	if (opt->unfocused_damage_delay < 0) {
+		log_warn("Negative --unfocused-damage-delay, damage will not be delayed.");
+		opt->unfocused_damage_delay = 0;
+	}
+
 	if (opt->backend == BKEND_XRENDER && conv_kern_hasneg) {
 		log_warn("A convolution kernel with negative values may not work "
 		         "properly under X Render backend.");
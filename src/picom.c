@@ -16,7 +16,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <xcb/composite.h>
@@ -25,6 +27,7 @@
 #include <xcb/present.h>
 #include <xcb/randr.h>
 #include <xcb/render.h>
+#include <xcb/shm.h>
 #include <xcb/sync.h>
 #include <xcb/xfixes.h>
 #include <xcb/xinerama.h>
@@ -46,10 +49,13 @@
 #include "config.h"
 #include "diagnostic.h"
 #include "log.h"
+#include "microbench.h"
 #include "region.h"
 #include "render.h"
+#include "string_utils.h"
 #include "types.h"
 #include "utils.h"
+#include "vsync.h"
 #include "win.h"
 #include "x.h"
 #ifdef CONFIG_DBUS
@@ -61,6 +67,7 @@
 #include "list.h"
 #include "options.h"
 #include "uthash_extra.h"
+#include "workqueue.h"
 
 /// Get session_t pointer from a pointer to a member of session_t
 #define session_ptr(ptr, member)                                                         \
@@ -70,6 +77,9 @@
 	})
 
 static const long SWOPTI_TOLERANCE = 3000;
+/// How long a window has to stay hidden behind other windows before its images are
+/// released, in microseconds. Windows are often covered only briefly, e.g. by menus.
+static const uint64_t OCCLUDED_RELEASE_DELAY = 5 * US_PER_SEC;
 
 static bool must_use redirect_start(session_t *ps);
 
@@ -90,6 +100,7 @@ const char *const BACKEND_STRS[] = {[BKEND_XRENDER] = "xrender",
                                     [BKEND_GLX] = "glx",
                                     [BKEND_XR_GLX_HYBRID] = "xr_glx_hybrid",
                                     [BKEND_DUMMY] = "dummy",
+                                    [BKEND_EGL] = "egl",
                                     NULL};
 // clang-format on
 
@@ -142,16 +153,16 @@ void cxinerama_upd_scrs(session_t *ps) {
 	if (!ps->o.xinerama_shadow_crop || !ps->xinerama_exists)
 		return;
 
-	xcb_xinerama_is_active_reply_t *active =
-	    xcb_xinerama_is_active_reply(ps->c, xcb_xinerama_is_active(ps->c), NULL);
+	xcb_xinerama_is_active_reply_t *active = X_REPLY(
+	    xcb_xinerama_is_active_reply(ps->c, xcb_xinerama_is_active(ps->c), NULL));
 	if (!active || !active->state) {
 		free(active);
 		return;
 	}
 	free(active);
 
-	auto xinerama_scrs =
-	    xcb_xinerama_query_screens_reply(ps->c, xcb_xinerama_query_screens(ps->c), NULL);
+	auto xinerama_scrs = X_REPLY(xcb_xinerama_query_screens_reply(
+	    ps->c, xcb_xinerama_query_screens(ps->c), NULL));
 	if (!xinerama_scrs) {
 		return;
 	}
@@ -169,6 +180,16 @@ void cxinerama_upd_scrs(session_t *ps) {
 	free(xinerama_scrs);
 }
 
+/// Query the monitors from RandR again
+static void update_monitors(session_t *ps) {
+	free(ps->monitors);
+	ps->monitors = NULL;
+	ps->nmonitors = 0;
+	if (ps->randr_exists) {
+		ps->monitors = x_get_monitors(ps->c, ps->root, &ps->nmonitors);
+	}
+}
+
 /**
  * Find matched window.
  *
@@ -186,7 +207,80 @@ static inline struct managed_win *find_win_all(session_t *ps, const xcb_window_t
 	return w;
 }
 
+/// How often the monitors the current damage is on can show a new frame. The damage can
+/// be on monitors slower than the one whose vblanks we are told about, rendering a frame
+/// for each of those vblanks would be wasted.
+///
+/// @return the frame interval in microseconds, 0 if there is no limit
+static uint64_t damage_frame_interval(session_t *ps) {
+	if (ps->nmonitors <= 1) {
+		return 0;
+	}
+
+	// Damage outside of all monitors is never shown, and doesn't need a frame
+	double max_rate = 0;
+	for (int i = 0; i < ps->nmonitors; i++) {
+		rect_t r = ps->monitors[i].rect;
+		auto overlap = pixman_region32_contains_rectangle(ps->damage, &r);
+		if (overlap == PIXMAN_REGION_OUT) {
+			continue;
+		}
+		if (ps->monitors[i].refresh_rate <= 0) {
+			// Don't know how fast this one is, don't limit anything
+			return 0;
+		}
+		max_rate = max2(max_rate, ps->monitors[i].refresh_rate);
+	}
+	if (max_rate <= 0) {
+		return 0;
+	}
+	return (uint64_t)((double)US_PER_SEC / max_rate);
+}
+
+/// Start rendering a frame just in time for the next vblank it can make, or right away
+/// if we can't predict that.
+static void schedule_render(session_t *ps) {
+	if (ev_is_active(&ps->draw_idle) || ev_is_active(&ps->delayed_draw_timer)) {
+		return;
+	}
+
+	if (ps->pacing.frame_pending) {
+		// The next frame is scheduled once the current one is shown, or
+		// frame_pacing_timer gives up on it
+		return;
+	}
+
+	auto now = get_time_us();
+	uint64_t start, target, target_msc;
+	if (!frame_pacing_schedule(&ps->pacing, now, damage_frame_interval(ps), &start,
+	                           &target, &target_msc)) {
+		ps->pacing.target_ust = 0;
+		ps->pacing.target_msc = 0;
+		ev_idle_start(ps->loop, &ps->draw_idle);
+		return;
+	}
+	ps->pacing.target_ust = target;
+	ps->pacing.target_msc = target_msc;
+	if (start <= now) {
+		ev_idle_start(ps->loop, &ps->draw_idle);
+		return;
+	}
+	ev_timer_set(&ps->delayed_draw_timer, (double)(start - now) / US_PER_SEC, 0);
+	ev_timer_start(ps->loop, &ps->delayed_draw_timer);
+}
+
 void queue_redraw(session_t *ps) {
+	if (vsync_drm_scheduling(ps)) {
+		// The frame is started at the next vblank
+		ps->redraw_needed = true;
+		vsync_drm_request_vblank(ps);
+		return;
+	}
+	if (ps->use_frame_pacing) {
+		ps->redraw_needed = true;
+		schedule_render(ps);
+		return;
+	}
 	// If --benchmark is used, redraw is always queued
 	if (!ps->redraw_needed && !ps->o.benchmark) {
 		ev_idle_start(ps->loop, &ps->draw_idle);
@@ -194,6 +288,35 @@ void queue_redraw(session_t *ps) {
 	ps->redraw_needed = true;
 }
 
+/// Queue a redraw for new damage on the content of `w`. Damage on the focused window is
+/// drawn right away, it's most likely a response to input. With
+/// --unfocused-damage-delay, damage on other windows waits for the next frame, or
+/// until the delay is over, so it doesn't cause frames of its own.
+void queue_redraw_for_damage(session_t *ps, struct managed_win *w) {
+	if (!ps->o.unfocused_damage_delay || w == ps->active_win) {
+		queue_redraw(ps);
+		return;
+	}
+	if (ps->redraw_needed || ev_is_active(&ps->unfocused_damage_timer)) {
+		// The damage is drawn with the frame that's already coming
+		return;
+	}
+	ev_timer_set(&ps->unfocused_damage_timer,
+	             (double)ps->o.unfocused_damage_delay / 1000.0, 0);
+	ev_timer_start(ps->loop, &ps->unfocused_damage_timer);
+}
+
+void handle_vblank(session_t *ps, uint64_t msc, uint64_t ust) {
+	if (!frame_pacing_vblank(&ps->pacing, msc, ust)) {
+		return;
+	}
+	ev_timer_stop(ps->loop, &ps->frame_pacing_timer);
+	// The last frame has been shown, the next one can be scheduled
+	if (ps->redraw_needed) {
+		schedule_render(ps);
+	}
+}
+
 /**
  * Get a region of the screen size.
  */
@@ -215,34 +338,56 @@ void add_damage(session_t *ps, const region_t *damage) {
 	log_trace("Adding damage: ");
 	dump_region(damage);
 	pixman_region32_union(ps->damage, ps->damage, (region_t *)damage);
+	pixman_region32_union(&ps->background_damage, &ps->background_damage,
+	                      (region_t *)damage);
+}
+
+void add_damage_from_content(session_t *ps, struct managed_win *w,
+                             const region_t *damage) {
+	if (!ps->redirected) {
+		return;
+	}
+
+	log_trace("Adding damage from the content of %#010x: ", w->base.id);
+	dump_region(damage);
+	pixman_region32_union(ps->damage, ps->damage, (region_t *)damage);
+	pixman_region32_union(&w->content_damage, &w->content_damage, (region_t *)damage);
 }
 
 // === Fading ===
 
 /**
- * Get the time left before next fading point.
+ * Get the time left before next fading point, only used without frame pacing.
  *
- * In milliseconds.
+ * In seconds.
  */
 static double fade_timeout(session_t *ps) {
-	auto now = get_time_ms();
-	if (ps->o.fade_delta + ps->fade_time < now)
+	auto now = get_time_us();
+	auto next = ps->fade_time + (uint64_t)ps->o.fade_delta * 1000;
+	if (next < now) {
 		return 0;
+	}
 
-	auto diff = ps->o.fade_delta + ps->fade_time - now;
-
-	diff = clamp(diff, 0, ps->o.fade_delta * 2);
+	auto diff = min2(next - now, (uint64_t)ps->o.fade_delta * 2000);
+	return (double)diff / US_PER_SEC;
+}
 
-	return (double)diff / 1000.0;
+/**
+ * How long it takes to fade by `delta`, when fading by `step` every fade_delta. In
+ * microseconds.
+ */
+static uint64_t fade_duration(session_t *ps, double delta, double step) {
+	// A step of 0 would never finish, just make it very slow
+	return (uint64_t)(fabs(delta) / fmax(step, 0.001) * ps->o.fade_delta * 1000);
 }
 
 /**
  * Run fading on a window.
  *
- * @param steps steps of fading
+ * @param now time the frame is going to be shown at
  * @return whether we are still in fading mode
  */
-static bool run_fade(session_t *ps, struct managed_win **_w, long steps) {
+static bool run_fade(session_t *ps, struct managed_win **_w, uint64_t now) {
 	auto w = *_w;
 	if (w->state == WSTATE_MAPPED || w->state == WSTATE_UNMAPPED) {
 		// We are not fading
@@ -262,17 +407,20 @@ static bool run_fade(session_t *ps, struct managed_win **_w, long steps) {
 		return false;
 	}
 
-	if (steps) {
-		log_trace("Window %#010x (%s) opacity was: %lf", w->base.id, w->name,
-		          w->opacity);
-		if (w->opacity < w->opacity_target) {
-			w->opacity = clamp(w->opacity + ps->o.fade_in_step * (double)steps,
-			                   0.0, w->opacity_target);
-		} else {
-			w->opacity = clamp(w->opacity - ps->o.fade_out_step * (double)steps,
-			                   w->opacity_target, 1);
-		}
-		log_trace("... updated to: %lf", w->opacity);
+	auto anim = &w->opacity_animation;
+	if (anim->to != w->opacity_target || anim->value != w->opacity) {
+		// The target changed, or the opacity was changed by something else, start
+		// over from where we are.
+		double step = w->opacity < w->opacity_target ? ps->o.fade_in_step
+		                                             : ps->o.fade_out_step;
+		animation_start(anim, w->opacity, w->opacity_target, now,
+		                fade_duration(ps, w->opacity_target - w->opacity, step),
+		                ps->o.fade_curve);
+	}
+	if (animation_step(anim, now)) {
+		log_trace("Window %#010x (%s) opacity was: %lf, updated to: %lf",
+		          w->base.id, w->name, w->opacity, anim->value);
+		w->opacity = anim->value;
 	}
 
 	// Note even if opacity == opacity_target here, we still want to run preprocess
@@ -280,6 +428,38 @@ static bool run_fade(session_t *ps, struct managed_win **_w, long steps) {
 	return true;
 }
 
+/**
+ * Run the dimming animation of a window.
+ *
+ * @param now time the frame is going to be shown at
+ * @return whether the window is still being dimmed or undimmed
+ */
+static bool run_dim(session_t *ps, struct managed_win *w, uint64_t now) {
+	double target = w->dim ? ps->o.inactive_dim : 0;
+	if (w->dim_level == target) {
+		return false;
+	}
+
+	// Windows that weren't visible are just shown with the right dim
+	if (!w->to_paint || !win_should_fade(ps, w)) {
+		w->dim_level = target;
+		return false;
+	}
+
+	auto anim = &w->dim_animation;
+	if (anim->to != target || anim->value != w->dim_level) {
+		// Dimming is like fading out
+		double step =
+		    target > w->dim_level ? ps->o.fade_out_step : ps->o.fade_in_step;
+		animation_start(anim, w->dim_level, target, now,
+		                fade_duration(ps, target - w->dim_level, step),
+		                ps->o.fade_curve);
+	}
+	animation_step(anim, now);
+	w->dim_level = anim->value;
+	return !animation_done(anim);
+}
+
 // === Error handling ===
 
 void discard_ignore(session_t *ps, unsigned long sequence) {
@@ -369,7 +549,7 @@ static void recheck_focus(session_t *ps) {
 	// opacity on it
 	xcb_window_t wid = XCB_NONE;
 	xcb_get_input_focus_reply_t *reply =
-	    xcb_get_input_focus_reply(ps->c, xcb_get_input_focus(ps->c), NULL);
+	    X_REPLY(xcb_get_input_focus_reply(ps->c, xcb_get_input_focus(ps->c), NULL));
 
 	if (reply) {
 		wid = reply->focus;
@@ -404,6 +584,15 @@ static void rebuild_shadow_exclude_reg(session_t *ps) {
 		exit(1);
 }
 
+/// Drop the screen sized copy of the wallpaper
+static void root_release_cache(session_t *ps) {
+	if (ps->root_cache) {
+		ps->backend_data->ops->release_image(ps->backend_data, ps->root_cache);
+		ps->root_cache = NULL;
+	}
+	pixman_region32_clear(&ps->root_cache_valid);
+}
+
 /// Free up all the images and deinit the backend
 static void destroy_backend(session_t *ps) {
 	win_stack_foreach_managed_safe(w, &ps->window_stack) {
@@ -436,6 +625,13 @@ static void destroy_backend(session_t *ps) {
 		ps->backend_data->ops->release_image(ps->backend_data, ps->root_image);
 		ps->root_image = NULL;
 	}
+	root_release_cache(ps);
+
+	if (ps->backend_data && ps->shadow_template) {
+		ps->backend_data->ops->release_image(ps->backend_data,
+		                                     ps->shadow_template);
+		ps->shadow_template = NULL;
+	}
 
 	if (ps->backend_data) {
 		// deinit backend
@@ -459,6 +655,7 @@ static bool initialize_blur(session_t *ps) {
 	switch (ps->o.blur_method) {
 	case BLUR_METHOD_BOX:
 		bargs.size = ps->o.blur_radius;
+		bargs.downscale = ps->o.blur_downscale;
 		args = (void *)&bargs;
 		break;
 	case BLUR_METHOD_KERNEL:
@@ -469,6 +666,7 @@ static bool initialize_blur(session_t *ps) {
 	case BLUR_METHOD_GAUSSIAN:
 		gargs.size = ps->o.blur_radius;
 		gargs.deviation = ps->o.blur_deviation;
+		gargs.downscale = ps->o.blur_downscale;
 		args = (void *)&gargs;
 		break;
 	case BLUR_METHOD_DUAL_KAWASE:
@@ -484,6 +682,20 @@ static bool initialize_blur(session_t *ps) {
 	return ps->backend_blur_context != NULL;
 }
 
+/// Called by the backend when it can render again, after being busy
+static void backend_ready_callback(void *data) {
+	session_t *ps = data;
+	if (!ps->redraw_needed) {
+		return;
+	}
+	// A frame was put off because the backend was busy
+	if (ps->use_frame_pacing) {
+		schedule_render(ps);
+	} else {
+		ev_idle_start(ps->loop, &ps->draw_idle);
+	}
+}
+
 /// Init the backend and bind all the window pixmap to backend images
 static bool initialize_backend(session_t *ps) {
 	if (ps->o.experimental_backends) {
@@ -497,6 +709,13 @@ static bool initialize_backend(session_t *ps) {
 			return false;
 		}
 		ps->backend_data->ops = backend_list[ps->o.backend];
+		if (ps->backend_data->ops->set_ready_callback) {
+			ps->backend_data->ops->set_ready_callback(
+			    ps->backend_data, backend_ready_callback, ps);
+		}
+		if (ps->frame_timing && ps->backend_data->ops->set_gpu_timing) {
+			ps->backend_data->ops->set_gpu_timing(ps->backend_data, true);
+		}
 
 		if (!initialize_blur(ps)) {
 			log_fatal("Failed to prepare for background blur, aborting...");
@@ -566,7 +785,7 @@ static void configure_root(session_t *ps) {
 	auto top_w = win_stack_find_next_managed(ps, &ps->window_stack);
 	if (top_w) {
 		rc_region_unref(&top_w->reg_ignore);
-		top_w->reg_ignore_valid = false;
+		win_invalidate_reg_ignore(ps, top_w);
 	}
 
 	if (ps->redirected) {
@@ -596,10 +815,11 @@ static void configure_root(session_t *ps) {
 				ev_break(ps->loop, EVBREAK_ALL);
 				return;
 			}
-
-			// Re-acquire the root pixmap.
-			root_damaged(ps);
 		}
+
+		// Re-acquire the root pixmap, the wallpaper covers the screen with its
+		// new size
+		root_damaged(ps);
 		force_repaint(ps);
 	}
 	return;
@@ -607,6 +827,7 @@ static void configure_root(session_t *ps) {
 
 static void handle_root_flags(session_t *ps) {
 	if ((ps->root_flags & ROOT_FLAGS_SCREEN_CHANGE) != 0) {
+		update_monitors(ps);
 		if (ps->o.xinerama_shadow_crop) {
 			cxinerama_upd_scrs(ps);
 		}
@@ -627,46 +848,145 @@ static void handle_root_flags(session_t *ps) {
 	}
 }
 
+/// Add the region of window `w` that obscures windows beneath it to `reg_ignore`
+static void add_win_to_reg_ignore(rc_region_t **reg_ignore, struct managed_win *w) {
+	region_t *tmp = rc_region_new();
+	if (w->mode == WMODE_SOLID) {
+		*tmp = win_get_bounding_shape_global_without_corners_by_val(w);
+	} else {
+		// w->mode == WMODE_FRAME_TRANS
+		win_get_region_noframe_local_without_corners(w, tmp);
+		pixman_region32_intersect(tmp, tmp, &w->bounding_shape);
+		pixman_region32_translate(tmp, w->g.x, w->g.y);
+	}
+
+	pixman_region32_union(tmp, tmp, *reg_ignore);
+	rc_region_unref(reg_ignore);
+	*reg_ignore = tmp;
+}
+
+/// Whether a window is completely covered by the opaque windows above it. Only valid
+/// once the reg_ignore of the window has been calculated.
+static bool win_is_occluded(const struct managed_win *w) {
+	if (w->state != WSTATE_MAPPED || !w->reg_ignore) {
+		return false;
+	}
+	region_t extents;
+	pixman_region32_init(&extents);
+	win_extents(w, &extents);
+	auto box = *pixman_region32_extents(&extents);
+	pixman_region32_fini(&extents);
+	auto overlap = pixman_region32_contains_rectangle(w->reg_ignore, &box);
+	return overlap == PIXMAN_REGION_IN;
+}
+
+/// Prepare a window that was hidden behind other windows to be painted again. Its damage
+/// was ignored, so all of its content is treated as changed, and its pixmap is bound
+/// again if it was released.
+///
+/// @return whether the window can be painted
+static bool reveal_win(session_t *ps, struct managed_win *w) {
+	log_debug("Window %#010x (%s) is visible again", w->base.id, w->name);
+	pixman_region32_union_rect(&w->content_damage, &w->content_damage, w->g.x,
+	                           w->g.y, (uint)w->widthb, (uint)w->heightb);
+	w->pixmap_damaged = true;
+	if (!ps->backend_data || !win_check_flags_all(w, WIN_FLAGS_PIXMAP_NONE)) {
+		return true;
+	}
+	// We are not in the critical section here, the window might have been unmapped
+	// in the meantime, in which case binding fails and we get an UnmapNotify later
+	win_set_flags(w, WIN_FLAGS_PIXMAP_STALE);
+	win_process_image_flags(ps, w);
+	return w->win_image != NULL;
+}
+
+static int cmp_win_last_painted(const void *a, const void *b) {
+	auto wa = *(struct managed_win *const *)a;
+	auto wb = *(struct managed_win *const *)b;
+	return wa->last_painted < wb->last_painted   ? -1
+	       : wa->last_painted > wb->last_painted ? 1
+	                                             : 0;
+}
+
+/// Release the images of the windows that aren't painted in this frame, the least
+/// recently painted first, until the images of the backend fit in the budget again.
+/// Must be called after the paint list is built.
+static void enforce_image_memory_budget(session_t *ps) {
+	if (!ps->backend_data || !ps->o.image_memory_budget) {
+		return;
+	}
+	const size_t budget = (size_t)ps->o.image_memory_budget * 1024 * 1024;
+	if (ps->backend_data->image_bytes <= budget) {
+		return;
+	}
+
+	int ncandidates = 0, capacity = 0;
+	struct managed_win **candidates = NULL;
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		if (w->state != WSTATE_MAPPED || w->to_paint || !w->win_image ||
+		    win_check_flags_any(w, WIN_FLAGS_PIXMAP_NONE | WIN_FLAGS_PIXMAP_STALE)) {
+			continue;
+		}
+		if (ncandidates == capacity) {
+			capacity = capacity * 2 + 16;
+			candidates = crealloc(candidates, capacity);
+		}
+		candidates[ncandidates++] = w;
+	}
+	qsort(candidates, (size_t)ncandidates, sizeof(*candidates), cmp_win_last_painted);
+
+	int i = 0;
+	for (; i < ncandidates && ps->backend_data->image_bytes > budget; i++) {
+		log_debug("Releasing images of window %#010x (%s), over the image memory "
+		          "budget",
+		          candidates[i]->base.id, candidates[i]->name);
+		win_release_hidden_images(ps->backend_data, candidates[i]);
+	}
+	if (ps->backend_data->image_bytes > budget) {
+		log_debug("Images take %zu KiB even after releasing %d windows, the "
+		          "budget is %d MiB",
+		          ps->backend_data->image_bytes / 1024, i,
+		          ps->o.image_memory_budget);
+	}
+	free(candidates);
+}
+
 static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 	// XXX need better, more general name for `fade_running`. It really
 	// means if fade is still ongoing after the current frame is rendered
 	struct managed_win *bottom = NULL;
 	*fade_running = false;
 
-	// Fading step calculation
-	long steps = 0L;
-	auto now = get_time_ms();
-	if (ps->fade_time) {
-		assert(now >= ps->fade_time);
-		steps = (now - ps->fade_time) / ps->o.fade_delta;
-	} else {
-		// Reset fade_time if unset
-		ps->fade_time = get_time_ms();
-		steps = 0L;
+	// Animations are stepped to when this frame is going to be shown, if the frame
+	// was scheduled for a vblank. All the windows are stepped to the same time.
+	uint64_t now = get_time_us();
+	if (ps->use_frame_pacing && ps->pacing.target_ust) {
+		now = ps->pacing.target_ust;
 	}
-	ps->fade_time += steps * ps->o.fade_delta;
+	ps->fade_time = max2(ps->fade_time, now);
 
 	// First, let's process fading
 	win_stack_foreach_managed_safe(w, &ps->window_stack) {
 		const winmode_t mode_old = w->mode;
 		const bool was_painted = w->to_paint;
 		const double opacity_old = w->opacity;
+		const double dim_old = w->dim_level;
 
-		if (win_should_dim(ps, w) != w->dim) {
-			w->dim = win_should_dim(ps, w);
-			add_damage_from_win(ps, w);
+		// Run the animations
+		w->dim = win_should_dim(ps, w);
+		if (run_dim(ps, w, ps->fade_time)) {
+			*fade_running = true;
 		}
-
-		// Run fading
-		if (run_fade(ps, &w, steps)) {
+		if (run_fade(ps, &w, ps->fade_time)) {
 			*fade_running = true;
 		}
 
-		// Add window to damaged area if its opacity changes
+		// Add window to damaged area if its opacity or dim changes
 		// If was_painted == false, and to_paint is also false, we don't care
 		// If was_painted == false, but to_paint is true, damage will be added in
 		// the loop below
-		if (was_painted && w->opacity != opacity_old) {
+		if (was_painted &&
+		    (w->opacity != opacity_old || w->dim_level != dim_old)) {
 			add_damage_from_win(ps, w);
 		}
 
@@ -693,11 +1013,16 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 
 	// Opacity will not change, from now on.
 	rc_region_t *last_reg_ignore = rc_region_new();
+	// The last painted window whose region hasn't been added to last_reg_ignore.
+	// This is only done when a window below it needs its reg_ignore recalculated,
+	// so windows above the topmost changed one don't cost any region operations.
+	struct managed_win *last_reg_ignore_pending = NULL;
 
 	bool unredir_possible = false;
 	// Track whether it's the highest window to paint
 	bool is_highest = true;
 	bool reg_ignore_valid = true;
+	ps->npaint_list = 0;
 	win_stack_foreach_managed(w, &ps->window_stack) {
 		__label__ skip_window;
 		bool to_paint = true;
@@ -752,18 +1077,16 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 			          "image errors",
 			          w->base.id, w->name);
 			to_paint = false;
+		} else if (ps->backend_data && w->state != WSTATE_MAPPED &&
+		           win_check_flags_all(w, WIN_FLAGS_PIXMAP_NONE)) {
+			log_trace("Window %#010x (%s) will not be painted because its "
+			          "image was released while it was hidden",
+			          w->base.id, w->name);
+			to_paint = false;
 		}
 		// log_trace("%s %d %d %d", w->name, to_paint, w->opacity,
 		// w->paint_excluded);
 
-		// Add window to damaged area if its painting status changes
-		// or opacity changes
-		if (to_paint != was_painted) {
-			w->reg_ignore_valid = false;
-			add_damage_from_win(ps, w);
-		}
-
-		// to_paint will never change after this point
 		if (!to_paint) {
 			goto skip_window;
 		}
@@ -774,30 +1097,58 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 		w->shadow_opacity = ps->o.shadow_opacity * w->opacity * ps->o.frame_opacity;
 
 		// Generate ignore region for painting to reduce GPU load
-		if (!w->reg_ignore) {
+		if (w->reg_ignore) {
+			// Nothing above us has changed, so our reg_ignore is what
+			// last_reg_ignore would become after adding the windows above
+			rc_region_unref(&last_reg_ignore);
+			last_reg_ignore = rc_region_ref(w->reg_ignore);
+		} else {
+			if (last_reg_ignore_pending) {
+				add_win_to_reg_ignore(&last_reg_ignore,
+				                      last_reg_ignore_pending);
+			}
 			w->reg_ignore = rc_region_ref(last_reg_ignore);
 		}
+		last_reg_ignore_pending = NULL;
+
+		// Windows completely hidden by the opaque windows above them aren't
+		// painted, and their images are released if they stay hidden
+		if (win_is_occluded(w)) {
+			if (!w->occluded) {
+				w->occluded = true;
+				w->occluded_since = now;
+			} else if (ps->backend_data && w->state == WSTATE_MAPPED &&
+			           now - w->occluded_since > OCCLUDED_RELEASE_DELAY &&
+			           !win_check_flags_all(w, WIN_FLAGS_PIXMAP_NONE)) {
+				log_debug("Window %#010x (%s) has been hidden for a "
+				          "while, releasing its images",
+				          w->base.id, w->name);
+				win_release_hidden_images(ps->backend_data, w);
+			}
+			log_trace("Window %#010x (%s) will not be painted because it is "
+			          "covered by other windows",
+			          w->base.id, w->name);
+			to_paint = false;
+			goto skip_window;
+		}
+		if (w->occluded ||
+		    (ps->backend_data && win_check_flags_all(w, WIN_FLAGS_PIXMAP_NONE))) {
+			// Its pixmap might also have been released to stay within the
+			// image memory budget
+			w->occluded = false;
+			if (!reveal_win(ps, w)) {
+				to_paint = false;
+				goto skip_window;
+			}
+		}
+		w->last_painted = now;
 
 		// If the window is solid, or we enabled clipping for transparent windows,
 		// we add the window region to the ignored region
 		// Otherwise last_reg_ignore shouldn't change
 		if ((w->mode != WMODE_TRANS && !ps->o.force_win_blend) ||
 		    ps->o.transparent_clipping) {
-			// w->mode == WMODE_SOLID or WMODE_FRAME_TRANS
-			region_t *tmp = rc_region_new();
-			if (w->mode == WMODE_SOLID) {
-				*tmp =
-				    win_get_bounding_shape_global_without_corners_by_val(w);
-			} else {
-				// w->mode == WMODE_FRAME_TRANS
-				win_get_region_noframe_local_without_corners(w, tmp);
-				pixman_region32_intersect(tmp, tmp, &w->bounding_shape);
-				pixman_region32_translate(tmp, w->g.x, w->g.y);
-			}
-
-			pixman_region32_union(tmp, tmp, last_reg_ignore);
-			rc_region_unref(&last_reg_ignore);
-			last_reg_ignore = tmp;
+			last_reg_ignore_pending = w;
 		}
 
 		// (Un)redirect screen
@@ -831,6 +1182,26 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 		}
 		bottom = w;
 
+		if (ps->npaint_list == ps->paint_list_capacity) {
+			ps->paint_list_capacity = ps->paint_list_capacity * 2 + 16;
+			ps->paint_list =
+			    crealloc(ps->paint_list, ps->paint_list_capacity);
+		}
+		ps->paint_list[ps->npaint_list++] = (struct win_paint_entry){
+		    .w = w,
+		    .x = w->g.x,
+		    .y = w->g.y,
+		    .widthb = w->widthb,
+		    .heightb = w->heightb,
+		    .opacity = w->opacity,
+		    .mode = w->mode,
+		    .blur_background = win_should_blur_background(ps, w),
+		    .shadow = w->shadow,
+		    .reg_ignore = w->reg_ignore,
+		    .win_image = w->win_image,
+		    .shadow_image = w->shadow_image,
+		};
+
 		// If the screen is not redirected and the window has redir_ignore set,
 		// this window should not cause the screen to become redirected
 		if (!(ps->o.wintype_option[w->window_type].redir_ignore && !ps->redirected)) {
@@ -838,6 +1209,13 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 		}
 
 	skip_window:
+		// Add window to damaged area if its painting status changes. This is
+		// checked after the occlusion test, so a window that stays hidden
+		// doesn't cause damage every frame.
+		if (to_paint != was_painted) {
+			w->reg_ignore_valid = false;
+			add_damage_from_win(ps, w);
+		}
 		reg_ignore_valid = reg_ignore_valid && w->reg_ignore_valid;
 		w->reg_ignore_valid = true;
 
@@ -848,6 +1226,17 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 	}
 
 	rc_region_unref(&last_reg_ignore);
+	// All the reg_ignore are valid now
+	ps->reg_ignore_dirty_label = 0;
+
+	enforce_image_memory_budget(ps);
+
+	// Windows were added from top to bottom, but are painted from bottom to top
+	for (int i = 0, j = ps->npaint_list - 1; i < j; i++, j--) {
+		auto tmp = ps->paint_list[i];
+		ps->paint_list[i] = ps->paint_list[j];
+		ps->paint_list[j] = tmp;
+	}
 
 	// If possible, unredirect all windows and stop painting
 	if (ps->o.redirected_force != UNSET) {
@@ -858,9 +1247,12 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 		unredir_possible = true;
 	}
 	if (unredir_possible) {
+		ev_timer_stop(ps->loop, &ps->redir_timer);
 		if (ps->redirected) {
 			if (!ps->o.unredir_if_possible_delay || ps->tmout_unredir_hit) {
 				unredirect(ps);
+				ps->unredirected_if_possible =
+				    ps->o.redirected_force == UNSET;
 			} else if (!ev_is_active(&ps->unredir_timer)) {
 				ev_timer_set(
 				    &ps->unredir_timer,
@@ -870,7 +1262,21 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 		}
 	} else {
 		ev_timer_stop(ps->loop, &ps->unredir_timer);
-		if (!ps->redirected) {
+		// Don't redirect right away if this is likely to be transient, e.g. a
+		// popup on top of a full-screen window. Only a screen unredirected by
+		// unredir-if-possible is redirected late, forced redirection and the
+		// first redirection aren't delayed.
+		auto redir_delay = ps->o.unredir_if_possible_redirect_delay;
+		bool delay = redir_delay && !ps->tmout_redir_hit &&
+		             ps->unredirected_if_possible &&
+		             ps->o.redirected_force == UNSET;
+		if (!ps->redirected && delay) {
+			if (!ev_is_active(&ps->redir_timer)) {
+				ev_timer_set(&ps->redir_timer,
+				             (double)redir_delay / 1000.0, 0);
+				ev_timer_start(ps->loop, &ps->redir_timer);
+			}
+		} else if (!ps->redirected) {
 			if (!redirect_start(ps)) {
 				return NULL;
 			}
@@ -880,26 +1286,55 @@ static struct managed_win *paint_preprocess(session_t *ps, bool *fade_running) {
 	return bottom;
 }
 
-void root_damaged(session_t *ps) {
+/// Stop tracking changes to the wallpaper pixmap
+static void root_untrack_pixmap(session_t *ps) {
+	if (ps->root_pixmap_damage != XCB_NONE) {
+		// The damage object is gone if the pixmap was freed
+		set_ignore_cookie(ps, xcb_damage_destroy(ps->c, ps->root_pixmap_damage));
+		ps->root_pixmap_damage = XCB_NONE;
+	}
+	ps->root_pixmap = XCB_NONE;
+}
+
+/// Paint the root from `pixmap` from now on
+static void root_use_pixmap(session_t *ps, xcb_pixmap_t pixmap) {
 	if (ps->root_tile_paint.pixmap) {
 		free_root_tile(ps);
 	}
+	root_untrack_pixmap(ps);
 
 	if (!ps->redirected) {
 		return;
 	}
 
+	if (pixmap != XCB_NONE) {
+		// Rendering into the pixmap doesn't change the property, keep track of
+		// it with a damage object
+		ps->root_pixmap = pixmap;
+		ps->root_pixmap_damage = x_new_id(ps->c);
+		set_ignore_cookie(
+		    ps, xcb_damage_create(ps->c, ps->root_pixmap_damage, pixmap,
+		                          XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY));
+	}
+
 	if (ps->backend_data) {
 		if (ps->root_image) {
 			ps->backend_data->ops->release_image(ps->backend_data, ps->root_image);
+			ps->root_image = NULL;
 		}
-		auto pixmap = x_get_root_back_pixmap(ps->c, ps->root, ps->atoms);
+		root_release_cache(ps);
 		if (pixmap != XCB_NONE) {
 			ps->root_image = ps->backend_data->ops->bind_pixmap(
 			    ps->backend_data, pixmap, x_get_visual_info(ps->c, ps->vis), false);
+		}
+		if (ps->root_image) {
 			ps->backend_data->ops->set_image_property(
 			    ps->backend_data, IMAGE_PROPERTY_EFFECTIVE_SIZE,
 			    ps->root_image, (int[]){ps->root_width, ps->root_height});
+			auto r = XCB_AWAIT(xcb_get_geometry, ps->c, pixmap);
+			ps->root_image_tiled =
+			    !r || r->width != ps->root_width || r->height != ps->root_height;
+			free(r);
 		}
 	}
 
@@ -907,6 +1342,43 @@ void root_damaged(session_t *ps) {
 	force_repaint(ps);
 }
 
+void root_damaged(session_t *ps) {
+	root_use_pixmap(ps, ps->redirected
+	                        ? x_get_root_back_pixmap(ps->c, ps->root, ps->atoms)
+	                        : XCB_NONE);
+}
+
+void root_back_pixmap_changed(session_t *ps) {
+	if (!ps->redirected) {
+		root_use_pixmap(ps, XCB_NONE);
+		return;
+	}
+	auto pixmap = x_get_root_back_pixmap(ps->c, ps->root, ps->atoms);
+	if (pixmap != XCB_NONE && pixmap == ps->root_pixmap) {
+		// Wallpaper tools often set the same pixmap again, changes to its content
+		// are reported by root_pixmap_damage
+		log_debug("Wallpaper pixmap %#010x set again, ignoring", pixmap);
+		return;
+	}
+	root_use_pixmap(ps, pixmap);
+}
+
+void root_pixmap_content_changed(session_t *ps) {
+	log_debug("Content of the wallpaper pixmap %#010x changed", ps->root_pixmap);
+	set_ignore_cookie(
+	    ps, xcb_damage_subtract(ps->c, ps->root_pixmap_damage, XCB_NONE, XCB_NONE));
+	if (ps->root_tile_paint.pixmap) {
+		free_root_tile(ps);
+	}
+	if (ps->backend_data && ps->root_image) {
+		ps->backend_data->ops->image_op(ps->backend_data, IMAGE_OP_CONTENT_CHANGED,
+		                                ps->root_image, &ps->screen_reg,
+		                                &ps->screen_reg, NULL);
+		root_release_cache(ps);
+	}
+	force_repaint(ps);
+}
+
 /**
  * Xlib error handler function.
  */
@@ -924,6 +1396,15 @@ void ev_xcb_error(session_t *ps, xcb_generic_error_t *err) {
 	if (!should_ignore(ps, err->sequence)) {
 		x_print_error(err->sequence, err->major_code, err->minor_code, err->error_code);
 	}
+	// The fence requests aren't checked, so they don't cost round trips, their
+	// errors end up here
+	if (ps->xsync_exists && err->major_code == ps->xsync_opcode) {
+		log_error("XSync fence request failed (%s), xrender-sync-fence will be "
+		          "disabled from now on.",
+		          x_strerror(err));
+		ps->o.xrender_sync_fence = false;
+		ps->xsync_exists = false;
+	}
 }
 
 /**
@@ -935,6 +1416,48 @@ void force_repaint(session_t *ps) {
 	add_damage(ps, &ps->screen_reg);
 }
 
+void set_frame_timing(session_t *ps, bool enable) {
+	ps->o.frame_timing = enable;
+	if (enable == (ps->frame_timing != NULL)) {
+		return;
+	}
+	if (enable) {
+		ps->frame_timing = frame_timing_new();
+	} else {
+		frame_timing_free(ps->frame_timing);
+		ps->frame_timing = NULL;
+	}
+	if (ps->backend_data && ps->backend_data->ops->set_gpu_timing) {
+		ps->backend_data->ops->set_gpu_timing(ps->backend_data, enable);
+	}
+}
+
+bool set_trace_file(session_t *ps, const char *path) {
+	// `path` might be ps->o.trace_file itself
+	char *new_path = path && *path ? strdup(path) : NULL;
+	if (ps->trace_logger) {
+		log_remove_target_tls(ps->trace_logger);
+		ps->trace_logger = NULL;
+	}
+	trace_free(ps->trace);
+	ps->trace = NULL;
+	free(ps->o.trace_file);
+	ps->o.trace_file = NULL;
+	if (!new_path) {
+		return true;
+	}
+
+	ps->trace = trace_new(new_path);
+	if (!ps->trace) {
+		free(new_path);
+		return false;
+	}
+	ps->o.trace_file = new_path;
+	ps->trace_logger = trace_logger_new(ps->trace);
+	log_add_target_tls(ps->trace_logger);
+	return true;
+}
+
 #ifdef CONFIG_DBUS
 /** @name DBus hooks
  */
@@ -961,9 +1484,9 @@ static int register_cm(session_t *ps) {
 	assert(!ps->reg_win);
 
 	ps->reg_win = x_new_id(ps->c);
-	auto e = xcb_request_check(
+	auto e = X_REPLY(xcb_request_check(
 	    ps->c, xcb_create_window_checked(ps->c, XCB_COPY_FROM_PARENT, ps->reg_win, ps->root,
-	                                     0, 0, 1, 1, 0, XCB_NONE, ps->vis, 0, NULL));
+	                                     0, 0, 1, 1, 0, XCB_NONE, ps->vis, 0, NULL)));
 
 	if (e) {
 		log_fatal("Failed to create window.");
@@ -981,11 +1504,11 @@ static int register_cm(session_t *ps) {
 
 	// Set names and classes
 	for (size_t i = 0; i < ARR_SIZE(prop_atoms); i++) {
-		e = xcb_request_check(
+		e = X_REPLY(xcb_request_check(
 		    ps->c, xcb_change_property_checked(
 		               ps->c, XCB_PROP_MODE_REPLACE, ps->reg_win, prop_atoms[i],
 		               prop_is_utf8[i] ? ps->atoms->aUTF8_STRING : XCB_ATOM_STRING,
-		               8, strlen("picom"), "picom"));
+		               8, strlen("picom"), "picom")));
 		if (e) {
 			log_error_x_error(e, "Failed to set window property %d",
 			                  prop_atoms[i]);
@@ -994,10 +1517,10 @@ static int register_cm(session_t *ps) {
 	}
 
 	const char picom_class[] = "picom\0picom";
-	e = xcb_request_check(
+	e = X_REPLY(xcb_request_check(
 	    ps->c, xcb_change_property_checked(ps->c, XCB_PROP_MODE_REPLACE, ps->reg_win,
 	                                       ps->atoms->aWM_CLASS, XCB_ATOM_STRING, 8,
-	                                       ARR_SIZE(picom_class), picom_class));
+	                                       ARR_SIZE(picom_class), picom_class)));
 	if (e) {
 		log_error_x_error(e, "Failed to set the WM_CLASS property");
 		free(e);
@@ -1010,11 +1533,11 @@ static int register_cm(session_t *ps) {
 		char *hostname = malloc(hostname_max);
 
 		if (gethostname(hostname, hostname_max) == 0) {
-			e = xcb_request_check(
+			e = X_REPLY(xcb_request_check(
 			    ps->c, xcb_change_property_checked(
 			               ps->c, XCB_PROP_MODE_REPLACE, ps->reg_win,
 			               ps->atoms->aWM_CLIENT_MACHINE, XCB_ATOM_STRING, 8,
-			               (uint32_t)strlen(hostname), hostname));
+			               (uint32_t)strlen(hostname), hostname)));
 			if (e) {
 				log_error_x_error(e, "Failed to set the WM_CLIENT_MACHINE"
 				                     " property");
@@ -1035,11 +1558,11 @@ static int register_cm(session_t *ps) {
 	}
 
 	// Set COMPTON_VERSION
-	e = xcb_request_check(
+	e = X_REPLY(xcb_request_check(
 	    ps->c, xcb_change_property_checked(
 	               ps->c, XCB_PROP_MODE_REPLACE, ps->reg_win,
 	               get_atom(ps->atoms, "COMPTON_VERSION"), XCB_ATOM_STRING, 8,
-	               (uint32_t)strlen(COMPTON_VERSION), COMPTON_VERSION));
+	               (uint32_t)strlen(COMPTON_VERSION), COMPTON_VERSION)));
 	if (e) {
 		log_error_x_error(e, "Failed to set COMPTON_VERSION.");
 		free(e);
@@ -1058,8 +1581,9 @@ static int register_cm(session_t *ps) {
 		atom = get_atom(ps->atoms, buf);
 		free(buf);
 
-		xcb_get_selection_owner_reply_t *reply = xcb_get_selection_owner_reply(
-		    ps->c, xcb_get_selection_owner(ps->c, atom), NULL);
+		xcb_get_selection_owner_reply_t *reply =
+		    X_REPLY(xcb_get_selection_owner_reply(
+		        ps->c, xcb_get_selection_owner(ps->c, atom), NULL));
 
 		if (reply && reply->owner != XCB_NONE) {
 			// Another compositor already running
@@ -1095,15 +1619,27 @@ static inline bool write_pid(session_t *ps) {
 
 /**
  * Update refresh rate info with X Randr extension.
+ *
+ * With monitors of different refresh rates, the fastest one is used, so it is not
+ * capped to the rate of the slower ones.
  */
 void update_refresh_rate(session_t *ps) {
-	xcb_randr_get_screen_info_reply_t *randr_info = xcb_randr_get_screen_info_reply(
-	    ps->c, xcb_randr_get_screen_info(ps->c, ps->root), NULL);
+	double rate = 0;
+	for (int i = 0; i < ps->nmonitors; i++) {
+		rate = max2(rate, ps->monitors[i].refresh_rate);
+	}
+	if (rate > 0) {
+		ps->refresh_rate = (int)lround(rate);
+	} else {
+		xcb_randr_get_screen_info_reply_t *randr_info =
+		    X_REPLY(xcb_randr_get_screen_info_reply(
+		        ps->c, xcb_randr_get_screen_info(ps->c, ps->root), NULL));
 
-	if (!randr_info)
-		return;
-	ps->refresh_rate = randr_info->rate;
-	free(randr_info);
+		if (!randr_info)
+			return;
+		ps->refresh_rate = randr_info->rate;
+		free(randr_info);
+	}
 
 	if (ps->refresh_rate)
 		ps->refresh_intv = US_PER_SEC / ps->refresh_rate;
@@ -1169,8 +1705,8 @@ static double swopti_handle_timeout(session_t *ps) {
  */
 static bool init_overlay(session_t *ps) {
 	xcb_composite_get_overlay_window_reply_t *reply =
-	    xcb_composite_get_overlay_window_reply(
-	        ps->c, xcb_composite_get_overlay_window(ps->c, ps->root), NULL);
+	    X_REPLY(xcb_composite_get_overlay_window_reply(
+	        ps->c, xcb_composite_get_overlay_window(ps->c, ps->root), NULL));
 	if (reply) {
 		ps->overlay = reply->overlay_win;
 		free(reply);
@@ -1216,24 +1752,25 @@ static bool init_debug_window(session_t *ps) {
 	xcb_colormap_t colormap = x_new_id(ps->c);
 	ps->debug_window = x_new_id(ps->c);
 
-	auto err = xcb_request_check(
+	auto err = X_REPLY(xcb_request_check(
 	    ps->c, xcb_create_colormap_checked(ps->c, XCB_COLORMAP_ALLOC_NONE, colormap,
-	                                       ps->root, ps->vis));
+	                                       ps->root, ps->vis)));
 	if (err) {
 		goto err_out;
 	}
 
-	err = xcb_request_check(
+	err = X_REPLY(xcb_request_check(
 	    ps->c, xcb_create_window_checked(ps->c, (uint8_t)ps->depth, ps->debug_window,
 	                                     ps->root, 0, 0, to_u16_checked(ps->root_width),
 	                                     to_u16_checked(ps->root_height), 0,
 	                                     XCB_WINDOW_CLASS_INPUT_OUTPUT, ps->vis,
-	                                     XCB_CW_COLORMAP, (uint32_t[]){colormap, 0}));
+	                                     XCB_CW_COLORMAP,
+	                                     (uint32_t[]){colormap, 0})));
 	if (err) {
 		goto err_out;
 	}
 
-	err = xcb_request_check(ps->c, xcb_map_window(ps->c, ps->debug_window));
+	err = X_REPLY(xcb_request_check(ps->c, xcb_map_window(ps->c, ps->debug_window)));
 	if (err) {
 		goto err_out;
 	}
@@ -1307,11 +1844,13 @@ static bool redirect_start(session_t *ps) {
 	for (int i = 0; i < ps->ndamage; i++) {
 		pixman_region32_init(&ps->damage_ring[i]);
 	}
+	pixman_region32_init(&ps->background_damage);
 
 	// Must call XSync() here
 	x_sync(ps->c);
 
 	ps->redirected = true;
+	ps->unredirected_if_possible = false;
 	ps->first_frame = true;
 
 	// Re-detect driver since we now have a backend
@@ -1348,6 +1887,8 @@ static void unredirect(session_t *ps) {
 	ps->ndamage = 0;
 	free(ps->damage_ring);
 	ps->damage_ring = ps->damage = NULL;
+	pixman_region32_fini(&ps->background_damage);
+	root_untrack_pixmap(ps);
 
 	// Must call XSync() here
 	x_sync(ps->c);
@@ -1356,14 +1897,45 @@ static void unredirect(session_t *ps) {
 	log_debug("Screen unredirected.");
 }
 
+/// Take all the events `poll` returns, and handle them as one batch, so events made
+/// redundant by later ones can be skipped.
+static void
+handle_x_event_batch(session_t *ps, xcb_generic_event_t *(*poll)(xcb_connection_t *)) {
+	int nevents = 0;
+	xcb_generic_event_t *ev;
+	while ((ev = poll(ps->c))) {
+		if (nevents == ps->event_batch_capacity) {
+			ps->event_batch_capacity = ps->event_batch_capacity * 2 + 16;
+			ps->event_batch =
+			    crealloc(ps->event_batch, ps->event_batch_capacity);
+		}
+		ps->event_batch[nevents++] = ev;
+	}
+	if (nevents) {
+		ev_handle_batch(ps, ps->event_batch, nevents);
+	}
+}
+
 // Handle queued events before we go to sleep
 static void handle_queued_x_events(EV_P attr_unused, ev_prepare *w, int revents attr_unused) {
 	session_t *ps = session_ptr(w, event_check);
-	xcb_generic_event_t *ev;
-	while ((ev = xcb_poll_for_queued_event(ps->c))) {
-		ev_handle(ps, ev);
-		free(ev);
-	};
+	auto start = frame_timing_now(ps->frame_timing);
+	handle_x_event_batch(ps, xcb_poll_for_queued_event);
+	if (!ps->server_grabbed) {
+		// Otherwise this is part of handle_pending_updates, which is timed as a
+		// whole
+		frame_timing_lap(ps->frame_timing, FRAME_TIMING_EVENTS, &start);
+	}
+	if (ps->backend_data && ps->backend_data->ops->handle_events) {
+		ps->backend_data->ops->handle_events(ps->backend_data);
+	}
+	if (ps->pending_updates) {
+		// Request the stale window properties now, so the replies will be ready
+		// when the updates are handled.
+		win_stack_foreach_managed(mw, &ps->window_stack) {
+			win_prefetch_properties(ps, mw);
+		}
+	}
 	// Flush because if we go into sleep when there is still
 	// requests in the outgoing buffer, they will not be sent
 	// for an indefinite amount of time.
@@ -1379,9 +1951,32 @@ static void handle_queued_x_events(EV_P attr_unused, ev_prepare *w, int revents
 }
 
 static void handle_new_windows(session_t *ps) {
+	int nnew = 0;
+	list_foreach(struct win, w, &ps->window_stack, stack_neighbour) {
+		if (w->is_new) {
+			nnew++;
+		}
+	}
+	if (!nnew) {
+		return;
+	}
+
+	// Send the requests for all new windows first, then collect the replies, so
+	// we don't have to wait for the X server once for each window. This matters a
+	// lot at startup, when every existing window is new.
+	auto start_time = get_time_timespec();
+	auto requests = ccalloc(nnew, struct fill_win_request);
+	int i = 0;
+	list_foreach(struct win, w, &ps->window_stack, stack_neighbour) {
+		if (w->is_new) {
+			requests[i++] = fill_win_send_requests(ps, w);
+		}
+	}
+
+	i = 0;
 	list_foreach_safe(struct win, w, &ps->window_stack, stack_neighbour) {
 		if (w->is_new) {
-			auto new_w = fill_win(ps, w);
+			auto new_w = fill_win_with_requests(ps, w, requests[i++]);
 			if (!new_w->managed) {
 				continue;
 			}
@@ -1396,9 +1991,20 @@ static void handle_new_windows(session_t *ps) {
 			}
 		}
 	}
+	free(requests);
+
+	struct timespec now = get_time_timespec(), elapsed;
+	timespec_subtract(&elapsed, &now, &start_time);
+	log_debug("Added %d new windows in %ld us", nnew,
+	          elapsed.tv_sec * 1000000L + elapsed.tv_nsec / 1000L);
 }
 
 static void refresh_windows(session_t *ps) {
+	// Send out all property requests at once, so we don't have to wait for them one
+	// by one.
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		win_prefetch_properties(ps, w);
+	}
 	win_stack_foreach_managed(w, &ps->window_stack) {
 		win_process_update_flags(ps, w);
 	}
@@ -1419,15 +2025,41 @@ static void tmout_unredir_callback(EV_P attr_unused, ev_timer *w, int revents at
 	queue_redraw(ps);
 }
 
+/**
+ * Redirection timeout callback.
+ */
+static void tmout_redir_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
+	session_t *ps = session_ptr(w, redir_timer);
+	ps->tmout_redir_hit = true;
+	queue_redraw(ps);
+}
+
 static void fade_timer_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
 	session_t *ps = session_ptr(w, fade_timer);
 	queue_redraw(ps);
 }
 
+static void
+frame_pacing_timer_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
+	session_t *ps = session_ptr(w, frame_pacing_timer);
+	log_debug("The vblank of the last frame never came, not waiting for it.");
+	ps->pacing.frame_pending = false;
+	if (ps->redraw_needed) {
+		schedule_render(ps);
+	}
+}
+
+static void
+unfocused_damage_timer_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
+	session_t *ps = session_ptr(w, unfocused_damage_timer);
+	queue_redraw(ps);
+}
+
 static void handle_pending_updates(EV_P_ struct session *ps) {
 	if (ps->pending_updates) {
 		log_debug("Delayed handling of events, entering critical section");
-		auto e = xcb_request_check(ps->c, xcb_grab_server_checked(ps->c));
+		auto e =
+		    X_REPLY(xcb_request_check(ps->c, xcb_grab_server_checked(ps->c)));
 		if (e) {
 			log_fatal_x_error(e, "failed to grab x server");
 			return quit(ps);
@@ -1451,8 +2083,8 @@ static void handle_pending_updates(EV_P_ struct session *ps) {
 		refresh_windows(ps);
 
 		{
-			auto r = xcb_get_input_focus_reply(
-			    ps->c, xcb_get_input_focus(ps->c), NULL);
+			auto r = X_REPLY(xcb_get_input_focus_reply(
+			    ps->c, xcb_get_input_focus(ps->c), NULL));
 			if (!ps->active_win || (r && r->focus != ps->active_win->base.id)) {
 				recheck_focus(ps);
 			}
@@ -1462,7 +2094,7 @@ static void handle_pending_updates(EV_P_ struct session *ps) {
 		// Process window flags (stale images)
 		refresh_images(ps);
 
-		e = xcb_request_check(ps->c, xcb_ungrab_server_checked(ps->c));
+		e = X_REPLY(xcb_request_check(ps->c, xcb_ungrab_server_checked(ps->c)));
 		if (e) {
 			log_fatal_x_error(e, "failed to ungrab x server");
 			return quit(ps);
@@ -1471,11 +2103,37 @@ static void handle_pending_updates(EV_P_ struct session *ps) {
 		ps->server_grabbed = false;
 		ps->pending_updates = false;
 		log_debug("Exited critical section");
+
+		if (ps->init_time.tv_sec || ps->init_time.tv_nsec) {
+			// The first round of updates, which handles all the windows that
+			// existed before we started, is done.
+			struct timespec now = get_time_timespec(), elapsed;
+			timespec_subtract(&elapsed, &now, &ps->init_time);
+			log_info("Startup finished in %.3f ms, %u windows",
+			         (double)elapsed.tv_sec * 1000.0 +
+			             (double)elapsed.tv_nsec / 1000000.0,
+			         HASH_COUNT(ps->windows));
+			ps->init_time = (struct timespec){0};
+		}
+	}
+}
+
+/// Record the GPU time of one of the previous frames, if the backend has got it.
+/// Frames are measured one at a time, so this keeps up with them.
+static void record_gpu_frame_time(session_t *ps) {
+	if (!ps->backend_data || !ps->backend_data->ops->gpu_frame_time) {
+		return;
+	}
+	uint64_t time;
+	if (ps->backend_data->ops->gpu_frame_time(ps->backend_data, &time)) {
+		frame_timing_add(ps->frame_timing, FRAME_TIMING_GPU, time);
 	}
 }
 
 static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
+	auto timing_start = frame_timing_now(ps->frame_timing);
 	handle_pending_updates(EV_A_ ps);
+	frame_timing_lap(ps->frame_timing, FRAME_TIMING_EVENTS, &timing_start);
 
 	if (ps->first_frame) {
 		// If we are still rendering the first frame, if some of the windows are
@@ -1504,13 +2162,19 @@ static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
 		}
 	}
 
+	ps->render_start = get_time_us();
+	// Round trips from here on stall the frame, see x_reply_account
+	x_round_trips_set_in_frame(true);
+
 	/* TODO(yshui) Have a stripped down version of paint_preprocess that is used when
 	 * screen is not redirected. its sole purpose should be to decide whether the
 	 * screen should be redirected. */
 	bool fade_running = false;
 	bool was_redirected = ps->redirected;
 	auto bottom = paint_preprocess(ps, &fade_running);
+	frame_timing_lap(ps->frame_timing, FRAME_TIMING_PREPROCESS, &timing_start);
 	ps->tmout_unredir_hit = false;
+	ps->tmout_redir_hit = false;
 
 	if (!was_redirected && ps->redirected) {
 		// paint_preprocess redirected the screen, which might change the state of
@@ -1521,44 +2185,93 @@ static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
 		// TODO(yshui) This is not ideal, we should try to avoid setting window
 		// flags in paint_preprocess.
 		log_debug("Re-run _draw_callback");
+		x_round_trips_set_in_frame(false);
 		return draw_callback_impl(EV_A_ ps, revents);
 	}
 
-	// Start/stop fade timer depends on whether window are fading
-	if (!fade_running && ev_is_active(&ps->fade_timer)) {
+#ifdef CONFIG_DBUS
+	// The windows have been updated by now, tell the subscribers what has changed
+	if (ps->o.dbus) {
+		cdbus_check_win_changes(ps);
+	}
+#endif
+
+	// Start/stop fade timer depends on whether window are fading. With frame pacing,
+	// there's no timer, the next frame is requested once this one is done.
+	if (ps->use_frame_pacing) {
+		assert(!ev_is_active(&ps->fade_timer));
+	} else if (!fade_running && ev_is_active(&ps->fade_timer)) {
 		ev_timer_stop(EV_A_ & ps->fade_timer);
 	} else if (fade_running && !ev_is_active(&ps->fade_timer)) {
 		ev_timer_set(&ps->fade_timer, fade_timeout(ps), 0);
 		ev_timer_start(EV_A_ & ps->fade_timer);
 	}
 
-	// If the screen is unredirected, free all_damage to stop painting
-	if (ps->redirected && ps->o.stoppaint_force != ON) {
-		static int paint = 0;
+	// Damage is fetched in batches, collect all of it before we paint. Replies
+	// are collected even if we are not going to paint, so they don't pile up.
+	auto damage_start = trace_now(ps->trace);
+	collect_pending_damage_fetches(ps);
+	trace_span(ps->trace, "damage", damage_start, 0);
 
-		log_trace("Render start, frame %d", paint);
+	// If the backend is still busy with the last frame, the frame is put off until
+	// the backend is ready, see backend_ready_callback
+	bool backend_busy = ps->o.experimental_backends && ps->backend_data &&
+	                    ps->backend_data->busy;
+	if (backend_busy) {
+		log_trace("Backend is busy, putting off the frame");
+	}
+
+	// If the screen is unredirected, free all_damage to stop painting
+	if (ps->redirected && ps->o.stoppaint_force != ON && !backend_busy) {
+		log_trace("Render start, frame %" PRIu64, ps->frame_count);
+		// The frame draws all the damage there is, including the delayed one
+		ev_timer_stop(EV_A_ & ps->unfocused_damage_timer);
 		if (ps->o.experimental_backends) {
-			paint_all_new(ps, bottom, false);
+			paint_all_new(ps, false);
 		} else {
 			paint_all(ps, bottom, false);
 		}
 		log_trace("Render end");
+		// render_start is in the same clock as the trace
+		trace_span(ps->trace, "frame", ps->render_start, 0);
+		if (ps->frame_timing) {
+			record_gpu_frame_time(ps);
+			frame_timing_end_frame(ps->frame_timing);
+		}
+
+		if (ps->use_frame_pacing) {
+			frame_pacing_frame_rendered(&ps->pacing,
+			                            get_time_us() - ps->render_start);
+			// Find out when the frame is shown
+			xcb_present_notify_msc(ps->c, session_get_target_window(ps), 0, 0,
+			                       1, 0);
+			ev_timer_set(&ps->frame_pacing_timer,
+			             (double)FRAME_PACING_TIMEOUT / US_PER_SEC, 0);
+			ev_timer_start(EV_A_ & ps->frame_pacing_timer);
+		}
 
 		ps->first_frame = false;
-		paint++;
-		if (ps->o.benchmark && paint >= ps->o.benchmark) {
+		ps->frame_count++;
+		if (ps->o.benchmark && ps->frame_count >= (uint64_t)ps->o.benchmark) {
 			exit(0);
 		}
 	}
 
+	x_round_trips_set_in_frame(false);
 	if (!fade_running) {
-		ps->fade_time = 0L;
+		ps->fade_time = 0;
 	}
 
 	// TODO(yshui) Investigate how big the X critical section needs to be. There are
 	// suggestions that rendering should be in the critical section as well.
 
-	ps->redraw_needed = false;
+	ps->redraw_needed = backend_busy;
+	// Scratch memory isn't used across frames
+	arena_reset(&tls_scratch);
+	if (fade_running && ps->use_frame_pacing) {
+		// Scheduled for the vblank after the one this frame is shown at
+		queue_redraw(ps);
+	}
 }
 
 static void draw_callback(EV_P_ ev_idle *w, int revents) {
@@ -1615,11 +2328,9 @@ static void delayed_draw_callback(EV_P_ ev_idle *w, int revents) {
 
 static void x_event_callback(EV_P attr_unused, ev_io *w, int revents attr_unused) {
 	session_t *ps = (session_t *)w;
-	xcb_generic_event_t *ev = xcb_poll_for_event(ps->c);
-	if (ev) {
-		ev_handle(ps, ev);
-		free(ev);
-	}
+	auto start = frame_timing_now(ps->frame_timing);
+	handle_x_event_batch(ps, xcb_poll_for_event);
+	frame_timing_lap(ps->frame_timing, FRAME_TIMING_EVENTS, &start);
 }
 
 /**
@@ -1632,15 +2343,292 @@ static void reset_enable(EV_P_ ev_signal *w attr_unused, int revents attr_unused
 	ev_break(EV_A_ EVBREAK_ALL);
 }
 
+/// Log where the round trips to the X server came from
+static void dump_round_trips(EV_P attr_unused, ev_signal *w attr_unused,
+                             int revents attr_unused) {
+	char *report = x_round_trips_report(20);
+	if (report) {
+		log_info("%s", report);
+		free(report);
+	}
+}
+
 static void exit_enable(EV_P attr_unused, ev_signal *w, int revents attr_unused) {
 	session_t *ps = session_ptr(w, int_signal);
 	log_info("picom is quitting...");
 	quit(ps);
 }
 
+/// Get the needed atoms for the condition lists, and assign ids to the conditions
+static void postprocess_condition_lists(session_t *ps) {
+	if (!(c2_list_postprocess(ps, ps->o.unredir_if_possible_blacklist) &&
+	      c2_list_postprocess(ps, ps->o.paint_blacklist) &&
+	      c2_list_postprocess(ps, ps->o.shadow_blacklist) &&
+	      c2_list_postprocess(ps, ps->o.shadow_clip_list) &&
+	      c2_list_postprocess(ps, ps->o.fade_blacklist) &&
+	      c2_list_postprocess(ps, ps->o.blur_background_blacklist) &&
+	      c2_list_postprocess(ps, ps->o.invert_color_list) &&
+	      c2_list_postprocess(ps, ps->o.opacity_rules) &&
+	      c2_list_postprocess(ps, ps->o.rounded_corners_blacklist) &&
+	      c2_list_postprocess(ps, ps->o.focus_blacklist))) {
+		log_error("Post-processing of conditionals failed, some of your rules "
+		          "might not work");
+	}
+}
+
+static void reset_condition_lists(session_t *ps) {
+	c2_list_reset_postprocess(ps->o.unredir_if_possible_blacklist);
+	c2_list_reset_postprocess(ps->o.paint_blacklist);
+	c2_list_reset_postprocess(ps->o.shadow_blacklist);
+	c2_list_reset_postprocess(ps->o.shadow_clip_list);
+	c2_list_reset_postprocess(ps->o.fade_blacklist);
+	c2_list_reset_postprocess(ps->o.blur_background_blacklist);
+	c2_list_reset_postprocess(ps->o.invert_color_list);
+	c2_list_reset_postprocess(ps->o.opacity_rules);
+	c2_list_reset_postprocess(ps->o.rounded_corners_blacklist);
+	c2_list_reset_postprocess(ps->o.focus_blacklist);
+}
+
+/// Whether applying the options `b` in place of `a` needs the session to be reset.
+/// These are the options the backend, the X connection, or the state of the windows
+/// are set up with.
+static bool options_need_reset(const options_t *a, const options_t *b) {
+	return a->experimental_backends != b->experimental_backends ||
+	       a->backend != b->backend || a->debug_mode != b->debug_mode ||
+	       a->monitor_repaint != b->monitor_repaint || a->vsync != b->vsync ||
+	       a->vsync_use_glfinish != b->vsync_use_glfinish ||
+	       a->use_damage != b->use_damage || a->sw_opti != b->sw_opti ||
+	       a->refresh_rate != b->refresh_rate || a->frame_pacing != b->frame_pacing ||
+	       a->xrender_sync_fence != b->xrender_sync_fence ||
+	       a->xrender_buffers != b->xrender_buffers ||
+	       a->glx_no_stencil != b->glx_no_stencil ||
+	       a->glx_no_rebind_pixmap != b->glx_no_rebind_pixmap ||
+	       a->glx_texture_pool_size != b->glx_texture_pool_size ||
+	       !str_equal(a->glx_fshader_win_str, b->glx_fshader_win_str) ||
+	       a->force_win_blend != b->force_win_blend ||
+	       a->transparent_clipping != b->transparent_clipping ||
+	       a->xinerama_shadow_crop != b->xinerama_shadow_crop ||
+	       a->detect_rounded_corners != b->detect_rounded_corners ||
+	       a->detect_client_opacity != b->detect_client_opacity ||
+	       a->detect_transient != b->detect_transient ||
+	       a->detect_client_leader != b->detect_client_leader ||
+	       a->track_leader != b->track_leader ||
+	       a->use_ewmh_active_win != b->use_ewmh_active_win ||
+	       a->mark_wmwin_focused != b->mark_wmwin_focused ||
+	       a->mark_ovredir_focused != b->mark_ovredir_focused ||
+	       a->no_ewmh_fullscreen != b->no_ewmh_fullscreen || a->dbus != b->dbus ||
+	       a->benchmark != b->benchmark || a->benchmark_wid != b->benchmark_wid ||
+	       a->show_all_xerrors != b->show_all_xerrors ||
+	       a->no_x_selection != b->no_x_selection ||
+	       !str_equal(a->logpath, b->logpath) || a->log_async != b->log_async ||
+	       !str_equal(a->write_pid_path, b->write_pid_path);
+}
+
+static bool blur_options_equal(const options_t *a, const options_t *b) {
+	if (a->blur_method != b->blur_method || a->blur_radius != b->blur_radius ||
+	    a->blur_deviation != b->blur_deviation ||
+	    a->blur_strength != b->blur_strength ||
+	    a->blur_downscale != b->blur_downscale ||
+	    a->blur_kernel_count != b->blur_kernel_count) {
+		return false;
+	}
+	for (int i = 0; i < a->blur_kernel_count; i++) {
+		const struct conv *ka = a->blur_kerns[i], *kb = b->blur_kerns[i];
+		if (ka->w != kb->w || ka->h != kb->h) {
+			return false;
+		}
+		size_t size = sizeof(double) * (size_t)(ka->w * ka->h);
+		if (memcmp(ka->data, kb->data, size) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Whether the options win_on_factor_change uses, other than the window conditions,
+/// are different
+static bool window_factors_differ(const options_t *a, const options_t *b) {
+	for (int i = 0; i < NUM_WINTYPES; i++) {
+		const win_option_t *wa = &a->wintype_option[i];
+		const win_option_t *wb = &b->wintype_option[i];
+		if (wa->shadow != wb->shadow || wa->fade != wb->fade ||
+		    wa->focus != wb->focus ||
+		    wa->blur_background != wb->blur_background ||
+		    wa->full_shadow != wb->full_shadow ||
+		    wa->redir_ignore != wb->redir_ignore || wa->opacity != wb->opacity ||
+		    wa->clip_shadow_above != wb->clip_shadow_above) {
+			return true;
+		}
+	}
+	return a->shadow_ignore_shaped != b->shadow_ignore_shaped ||
+	       a->inactive_opacity != b->inactive_opacity ||
+	       a->active_opacity != b->active_opacity ||
+	       a->inactive_opacity_override != b->inactive_opacity_override ||
+	       a->frame_opacity != b->frame_opacity ||
+	       a->blur_background_frame != b->blur_background_frame ||
+	       (a->blur_method == BLUR_METHOD_NONE) !=
+	           (b->blur_method == BLUR_METHOD_NONE) ||
+	       a->corner_radius != b->corner_radius;
+}
+
+/// Parse the config file and the command line again, and apply the new options. Only
+/// what is affected by the changed options is rebuilt, the session is only reset if an
+/// option the backend depends on has changed, or the legacy backends are used.
+static void reload_config(session_t *ps) {
+	if (!ps->o.experimental_backends) {
+		reset_enable(ps->loop, NULL, 0);
+		return;
+	}
+
+	options_t o;
+	win_option_mask_t winopt_mask[NUM_WINTYPES] = {{0}};
+	bool shadow_enabled = false, fading_enable = false, hasneg = false;
+	char *config_file = parse_config(&o, ps->config_file, &shadow_enabled,
+	                                 &fading_enable, &hasneg, winopt_mask);
+	if (IS_ERR(config_file)) {
+		log_error("Failed to read the changed config file, keeping the current "
+		          "configuration.");
+		options_destroy(&o);
+		return;
+	}
+	free(config_file);
+	if (!get_cfg(&o, ps->argc, ps->argv, shadow_enabled, fading_enable, hasneg,
+	             winopt_mask)) {
+		log_error("The changed config file is invalid, keeping the current "
+		          "configuration.");
+		options_destroy(&o);
+		return;
+	}
+
+	if (options_need_reset(&ps->o, &o)) {
+		log_info("The changed options need a reset");
+		options_destroy(&o);
+		reset_enable(ps->loop, NULL, 0);
+		return;
+	}
+
+	// Keep the conditions that didn't change, they are already postprocessed
+	bool conditions_changed = false;
+#define KEEP_CONDITIONS(name)                                                            \
+	do {                                                                             \
+		if (c2_list_equal(ps->o.name, o.name)) {                                 \
+			c2_lptr_t *tmp = ps->o.name;                                     \
+			ps->o.name = o.name;                                             \
+			o.name = tmp;                                                    \
+		} else {                                                                 \
+			conditions_changed = true;                                       \
+		}                                                                        \
+	} while (0)
+	KEEP_CONDITIONS(unredir_if_possible_blacklist);
+	KEEP_CONDITIONS(paint_blacklist);
+	KEEP_CONDITIONS(shadow_blacklist);
+	KEEP_CONDITIONS(shadow_clip_list);
+	KEEP_CONDITIONS(fade_blacklist);
+	KEEP_CONDITIONS(blur_background_blacklist);
+	KEEP_CONDITIONS(invert_color_list);
+	KEEP_CONDITIONS(opacity_rules);
+	KEEP_CONDITIONS(rounded_corners_blacklist);
+	KEEP_CONDITIONS(focus_blacklist);
+#undef KEEP_CONDITIONS
+
+	// These are controlled through D-Bus
+	o.redirected_force = ps->o.redirected_force;
+	o.stoppaint_force = ps->o.stoppaint_force;
+
+	bool blur_changed = !blur_options_equal(&ps->o, &o);
+	bool shadow_radius_changed = ps->o.shadow_radius != o.shadow_radius;
+	bool shadow_size_changed = shadow_radius_changed ||
+	                           ps->o.shadow_offset_x != o.shadow_offset_x ||
+	                           ps->o.shadow_offset_y != o.shadow_offset_y;
+	bool shadow_changed = shadow_size_changed || ps->o.shadow_red != o.shadow_red ||
+	                      ps->o.shadow_green != o.shadow_green ||
+	                      ps->o.shadow_blue != o.shadow_blue ||
+	                      ps->o.shadow_opacity != o.shadow_opacity;
+	bool factors_changed = conditions_changed || window_factors_differ(&ps->o, &o);
+	bool shadow_exclude_changed =
+	    !str_equal(ps->o.shadow_exclude_reg_str, o.shadow_exclude_reg_str);
+	bool trace_changed = !str_equal(ps->o.trace_file, o.trace_file);
+
+	options_t old = ps->o;
+	ps->o = o;
+	options_destroy(&old);
+	log_info("Applying the changed config file");
+
+	if (conditions_changed) {
+		// Condition ids are assigned over all the lists, so they have to be
+		// assigned again. The lists that were kept still point into the old
+		// state.
+		reset_condition_lists(ps);
+		c2_state_free(ps->c2_state);
+		ps->c2_state = NULL;
+		postprocess_condition_lists(ps);
+	}
+	if (shadow_exclude_changed) {
+		rebuild_shadow_exclude_reg(ps);
+	}
+	if (shadow_radius_changed) {
+		free_conv(ps->gaussian_map);
+		ps->gaussian_map =
+		    gaussian_kernel_autodetect_deviation(ps->o.shadow_radius);
+		sum_kernel_preprocess(ps->gaussian_map);
+	}
+	if (ps->backend_data) {
+		if (shadow_changed && ps->shadow_template) {
+			ps->backend_data->ops->release_image(ps->backend_data,
+			                                     ps->shadow_template);
+			ps->shadow_template = NULL;
+		}
+		if (blur_changed) {
+			if (ps->backend_blur_context) {
+				ps->backend_data->ops->destroy_blur_context(
+				    ps->backend_data, ps->backend_blur_context);
+				ps->backend_blur_context = NULL;
+			}
+			if (!initialize_blur(ps)) {
+				log_error("Failed to prepare for background blur "
+				          "with the new options, resetting");
+				reset_enable(ps->loop, NULL, 0);
+				return;
+			}
+		}
+	}
+	// Otherwise the blur context and the shadows are created with the new options
+	// when the screen is redirected
+
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		if (w->state == WSTATE_DESTROYING) {
+			continue;
+		}
+		if (conditions_changed) {
+			c2_window_state_clear(&w->c2_state);
+		}
+		if (shadow_size_changed) {
+			w->shadow_dx = ps->o.shadow_offset_x;
+			w->shadow_dy = ps->o.shadow_offset_y;
+			w->shadow_width = w->widthb + ps->o.shadow_radius * 2;
+			w->shadow_height = w->heightb + ps->o.shadow_radius * 2;
+		}
+		if (shadow_changed) {
+			win_set_flags(w, WIN_FLAGS_SHADOW_STALE);
+		}
+		if (blur_changed && ps->backend_data) {
+			win_release_blur_cache(ps->backend_data, w);
+		}
+		if (factors_changed) {
+			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
+		}
+	}
+	set_frame_timing(ps, ps->o.frame_timing);
+	if (trace_changed) {
+		set_trace_file(ps, ps->o.trace_file);
+	}
+	ps->pending_updates = true;
+	force_repaint(ps);
+}
+
 static void config_file_change_cb(void *_ps) {
 	auto ps = (struct session *)_ps;
-	reset_enable(ps->loop, NULL, 0);
+	reload_config(ps);
 }
 
 /**
@@ -1677,7 +2665,8 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 #endif
 	    .redirected = false,
 	    .alpha_picts = NULL,
-	    .fade_time = 0L,
+	    .corner_masks = NULL,
+	    .fade_time = 0,
 	    .ignore_head = NULL,
 	    .ignore_tail = NULL,
 	    .quit = false,
@@ -1689,11 +2678,13 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	    .windows = NULL,
 	    .active_win = NULL,
 	    .active_leader = XCB_NONE,
+	    .leader_groups = NULL,
 
 	    .black_picture = XCB_NONE,
 	    .cshadow_picture = XCB_NONE,
 	    .white_picture = XCB_NONE,
 	    .gaussian_map = NULL,
+	    .shadow_template = NULL,
 
 	    .refresh_rate = 0,
 	    .refresh_intv = 0UL,
@@ -1725,6 +2716,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 
 	    .atoms_wintypes = {0},
 	    .track_atom_lst = NULL,
+	    .c2_state = NULL,
 
 #ifdef CONFIG_DBUS
 	    .dbus_data = NULL,
@@ -1741,9 +2733,11 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	// Allocate a session and copy default values into it
 	session_t *ps = cmalloc(session_t);
 	*ps = s_def;
+	ps->init_time = get_time_timespec();
 	list_init_head(&ps->window_stack);
 	ps->loop = EV_DEFAULT;
 	pixman_region32_init(&ps->screen_reg);
+	pixman_region32_init(&ps->root_cache_valid);
 
 	ps->ignore_tail = &ps->ignore_head;
 
@@ -1768,12 +2762,12 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 
 	// Start listening to events on root earlier to catch all possible
 	// root geometry changes
-	auto e = xcb_request_check(
+	auto e = X_REPLY(xcb_request_check(
 	    ps->c, xcb_change_window_attributes_checked(
 	               ps->c, ps->root, XCB_CW_EVENT_MASK,
 	               (const uint32_t[]){XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
 	                                  XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY |
-	                                  XCB_EVENT_MASK_PROPERTY_CHANGE}));
+	                                  XCB_EVENT_MASK_PROPERTY_CHANGE})));
 	if (e) {
 		log_error_x_error(e, "Failed to setup root window event mask");
 	}
@@ -1788,6 +2782,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	xcb_prefetch_extension_data(ps->c, &xcb_present_id);
 	xcb_prefetch_extension_data(ps->c, &xcb_sync_id);
 	xcb_prefetch_extension_data(ps->c, &xcb_glx_id);
+	xcb_prefetch_extension_data(ps->c, &xcb_shm_id);
 
 	ext_info = xcb_get_extension_data(ps->c, &xcb_render_id);
 	if (!ext_info || !ext_info->present) {
@@ -1807,11 +2802,12 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	ps->composite_error = ext_info->first_error;
 
 	{
-		xcb_composite_query_version_reply_t *reply = xcb_composite_query_version_reply(
-		    ps->c,
-		    xcb_composite_query_version(ps->c, XCB_COMPOSITE_MAJOR_VERSION,
-		                                XCB_COMPOSITE_MINOR_VERSION),
-		    NULL);
+		xcb_composite_query_version_reply_t *reply =
+		    X_REPLY(xcb_composite_query_version_reply(
+		        ps->c,
+		        xcb_composite_query_version(ps->c, XCB_COMPOSITE_MAJOR_VERSION,
+		                                    XCB_COMPOSITE_MINOR_VERSION),
+		        NULL));
 
 		if (!reply || (reply->major_version == 0 && reply->minor_version < 2)) {
 			log_fatal("Your X server doesn't have Composite >= 0.2 support, "
@@ -1876,6 +2872,15 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 
 	if (ps->o.logpath) {
 		auto l = file_logger_new(ps->o.logpath);
+		if (l && ps->o.log_async) {
+			auto async_logger = async_logger_new(l);
+			if (async_logger) {
+				l = async_logger;
+			} else {
+				log_warn("Failed to start the log writing thread, writing "
+				         "to the log file directly");
+			}
+		}
 		if (l) {
 			log_info("Switching to log file: %s", ps->o.logpath);
 			if (stderr_logger) {
@@ -1890,6 +2895,14 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 		}
 	}
 
+	if (ps->o.frame_timing) {
+		ps->frame_timing = frame_timing_new();
+	}
+	if (ps->o.trace_file) {
+		// Carry on without tracing if the file can't be opened
+		set_trace_file(ps, ps->o.trace_file);
+	}
+
 	if (strstr(argv[0], "compton")) {
 		log_warn("This compositor has been renamed to \"picom\", the \"compton\" "
 		         "binary will not be installed in the future.");
@@ -1916,19 +2929,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 #undef SET_WM_TYPE_ATOM
 
 	// Get needed atoms for c2 condition lists
-	if (!(c2_list_postprocess(ps, ps->o.unredir_if_possible_blacklist) &&
-	      c2_list_postprocess(ps, ps->o.paint_blacklist) &&
-	      c2_list_postprocess(ps, ps->o.shadow_blacklist) &&
-	      c2_list_postprocess(ps, ps->o.shadow_clip_list) &&
-	      c2_list_postprocess(ps, ps->o.fade_blacklist) &&
-	      c2_list_postprocess(ps, ps->o.blur_background_blacklist) &&
-	      c2_list_postprocess(ps, ps->o.invert_color_list) &&
-	      c2_list_postprocess(ps, ps->o.opacity_rules) &&
-	      c2_list_postprocess(ps, ps->o.rounded_corners_blacklist) &&
-	      c2_list_postprocess(ps, ps->o.focus_blacklist))) {
-		log_error("Post-processing of conditionals failed, some of your rules "
-		          "might not work");
-	}
+	postprocess_condition_lists(ps);
 
 	ps->gaussian_map = gaussian_kernel_autodetect_deviation(ps->o.shadow_radius);
 	sum_kernel_preprocess(ps->gaussian_map);
@@ -1952,13 +2953,14 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 
 	ext_info = xcb_get_extension_data(ps->c, &xcb_present_id);
 	if (ext_info && ext_info->present) {
-		auto r = xcb_present_query_version_reply(
+		auto r = X_REPLY(xcb_present_query_version_reply(
 		    ps->c,
 		    xcb_present_query_version(ps->c, XCB_PRESENT_MAJOR_VERSION,
 		                              XCB_PRESENT_MINOR_VERSION),
-		    NULL);
+		    NULL));
 		if (r) {
 			ps->present_exists = true;
+			ps->present_opcode = ext_info->major_opcode;
 			free(r);
 		}
 	}
@@ -1968,11 +2970,12 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	if (ext_info && ext_info->present) {
 		ps->xsync_error = ext_info->first_error;
 		ps->xsync_event = ext_info->first_event;
+		ps->xsync_opcode = ext_info->major_opcode;
 		// Need X Sync 3.1 for fences
-		auto r = xcb_sync_initialize_reply(
+		auto r = X_REPLY(xcb_sync_initialize_reply(
 		    ps->c,
 		    xcb_sync_initialize(ps->c, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION),
-		    NULL);
+		    NULL));
 		if (r && (r->major_version > 3 ||
 		          (r->major_version == 3 && r->minor_version >= 1))) {
 			ps->xsync_exists = true;
@@ -1980,20 +2983,15 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 		}
 	}
 
-	ps->sync_fence = XCB_NONE;
 	if (ps->xsync_exists) {
-		ps->sync_fence = x_new_id(ps->c);
-		e = xcb_request_check(
-		    ps->c, xcb_sync_create_fence(ps->c, ps->root, ps->sync_fence, 0));
-		if (e) {
+		if (!x_fence_ring_init(ps->c, ps->root, &ps->sync_fences)) {
 			if (ps->o.xrender_sync_fence) {
-				log_error_x_error(e, "Failed to create a XSync fence. "
-				                     "xrender-sync-fence will be "
-				                     "disabled");
+				log_error("Failed to create XSync fences, "
+				          "xrender-sync-fence will be disabled");
 				ps->o.xrender_sync_fence = false;
 			}
-			ps->sync_fence = XCB_NONE;
-			free(e);
+			// Without fences, there's nothing we use X Sync for
+			ps->xsync_exists = false;
 		}
 	} else if (ps->o.xrender_sync_fence) {
 		log_error("XSync extension not found. No XSync fence sync is "
@@ -2086,9 +3084,13 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	}
 
 	ps->file_watch_handle = file_watch_init(ps->loop);
+	ps->workqueue = workqueue_new(ps->loop, workqueue_default_nthreads());
 	if (ps->file_watch_handle && config_file) {
 		file_watch_add(ps->file_watch_handle, config_file, config_file_change_cb, ps);
+		ps->config_file = strdup(config_file);
 	}
+	ps->argc = argc;
+	ps->argv = argv;
 
 	free(config_file_to_free);
 
@@ -2108,15 +3110,34 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 		}
 	}
 
+	// Monitor screen changes to keep track of the monitors, CRTC changes are needed
+	// too, since changing the mode of a monitor doesn't always change the screen
+	if (ps->randr_exists) {
+		xcb_randr_select_input(ps->c, ps->root,
+		                       XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+		                           XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE);
+	}
+	update_monitors(ps);
+
 	// Initialize software optimization
 	if (ps->o.sw_opti)
 		ps->o.sw_opti = swopti_init(ps);
 
-	// Monitor screen changes if vsync_sw is enabled and we are using
-	// an auto-detected refresh rate, or when Xinerama features are enabled
-	if (ps->randr_exists &&
-	    ((ps->o.sw_opti && !ps->o.refresh_rate) || ps->o.xinerama_shadow_crop))
-		xcb_randr_select_input(ps->c, ps->root, XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE);
+	// Frame pacing needs the vblank timestamps from the Present extension. swopti
+	// does its own scheduling, and benchmark mode renders non-stop. The DRM vsync
+	// method starts frames from its own vblank events.
+	frame_pacing_init(&ps->pacing);
+	ps->use_frame_pacing = ps->o.frame_pacing && ps->present_exists &&
+	                       !ps->o.sw_opti && !ps->o.benchmark &&
+	                       !vsync_drm_scheduling(ps);
+	if (ps->use_frame_pacing) {
+		ps->present_eid = x_new_id(ps->c);
+		xcb_present_select_input(ps->c, ps->present_eid,
+		                         session_get_target_window(ps),
+		                         XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+	} else if (ps->o.frame_pacing && !ps->present_exists) {
+		log_info("No Present extension, frames will not be paced.");
+	}
 
 	cxinerama_upd_scrs(ps);
 
@@ -2137,6 +3158,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	ev_io_init(&ps->xiow, x_event_callback, ConnectionNumber(ps->dpy), EV_READ);
 	ev_io_start(ps->loop, &ps->xiow);
 	ev_init(&ps->unredir_timer, tmout_unredir_callback);
+	ev_init(&ps->redir_timer, tmout_redir_callback);
 	if (ps->o.sw_opti)
 		ev_idle_init(&ps->draw_idle, delayed_draw_callback);
 	else
@@ -2144,11 +3166,16 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 
 	ev_init(&ps->fade_timer, fade_timer_callback);
 	ev_init(&ps->delayed_draw_timer, delayed_draw_timer_callback);
+	ev_init(&ps->unfocused_damage_timer, unfocused_damage_timer_callback);
+	ev_init(&ps->frame_pacing_timer, frame_pacing_timer_callback);
 
 	// Set up SIGUSR1 signal handler to reset program
 	ev_signal_init(&ps->usr1_signal, reset_enable, SIGUSR1);
 	ev_signal_init(&ps->int_signal, exit_enable, SIGINT);
+	// SIGUSR2 dumps where the round trips to the X server came from
+	ev_signal_init(&ps->usr2_signal, dump_round_trips, SIGUSR2);
 	ev_signal_start(ps->loop, &ps->usr1_signal);
+	ev_signal_start(ps->loop, &ps->usr2_signal);
 	ev_signal_start(ps->loop, &ps->int_signal);
 
 	// xcb can read multiple events from the socket when a request with reply is
@@ -2185,7 +3212,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 #endif
 	}
 
-	e = xcb_request_check(ps->c, xcb_grab_server_checked(ps->c));
+	e = X_REPLY(xcb_request_check(ps->c, xcb_grab_server_checked(ps->c)));
 	if (e) {
 		log_fatal_x_error(e, "Failed to grab X server");
 		free(e);
@@ -2201,9 +3228,9 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	x_discard_events(ps->c);
 
 	xcb_query_tree_reply_t *query_tree_reply =
-	    xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, ps->root), NULL);
+	    X_REPLY(xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, ps->root), NULL));
 
-	e = xcb_request_check(ps->c, xcb_ungrab_server(ps->c));
+	e = X_REPLY(xcb_request_check(ps->c, xcb_ungrab_server(ps->c)));
 	if (e) {
 		log_fatal_x_error(e, "Failed to ungrab server");
 		free(e);
@@ -2257,6 +3284,19 @@ static void session_destroy(session_t *ps) {
 		unredirect(ps);
 	}
 
+	if (ps->nevents_received) {
+		log_info("X events: %" PRIu64 " received, %" PRIu64 " handled after "
+		         "coalescing.",
+		         ps->nevents_received, ps->nevents_handled);
+	}
+
+	if (ps->pacing.nframes) {
+		log_info("Frame pacing: %" PRIu64 " of %" PRIu64 " frames missed their "
+		         "vblank, vblanks were predicted %" PRIu64 " us off on average.",
+		         ps->pacing.nmissed, ps->pacing.nframes,
+		         frame_pacing_average_error(&ps->pacing));
+	}
+
 #ifdef CONFIG_OPENGL
 	free(ps->argb_fbconfig);
 	ps->argb_fbconfig = NULL;
@@ -2292,18 +3332,20 @@ static void session_destroy(session_t *ps) {
 		free(w);
 	}
 	list_init_head(&ps->window_stack);
+	// Windows leave their groups when they are freed
+	assert(ps->leader_groups == NULL);
 
-	// Free blacklists
-	free_wincondlst(&ps->o.shadow_blacklist);
-	free_wincondlst(&ps->o.shadow_clip_list);
-	free_wincondlst(&ps->o.fade_blacklist);
-	free_wincondlst(&ps->o.focus_blacklist);
-	free_wincondlst(&ps->o.invert_color_list);
-	free_wincondlst(&ps->o.blur_background_blacklist);
-	free_wincondlst(&ps->o.opacity_rules);
-	free_wincondlst(&ps->o.paint_blacklist);
-	free_wincondlst(&ps->o.unredir_if_possible_blacklist);
-	free_wincondlst(&ps->o.rounded_corners_blacklist);
+	// Windows are gone, so the jobs left won't touch them
+	if (ps->workqueue) {
+		workqueue_destroy(ps->loop, ps->workqueue);
+		ps->workqueue = NULL;
+	}
+
+	set_trace_file(ps, NULL);
+
+	// Free blacklists, strings and blur kernels
+	options_destroy(&ps->o);
+	free(ps->config_file);
 
 	// Free tracked atom list
 	{
@@ -2315,6 +3357,8 @@ static void session_destroy(session_t *ps) {
 
 		ps->track_atom_lst = NULL;
 	}
+	c2_state_free(ps->c2_state);
+	ps->c2_state = NULL;
 
 	// Free ignore linked list
 	{
@@ -2343,16 +3387,13 @@ static void session_destroy(session_t *ps) {
 	free_paint(ps, &ps->tgt_buffer);
 
 	pixman_region32_fini(&ps->screen_reg);
+	pixman_region32_fini(&ps->root_cache_valid);
 	free(ps->expose_rects);
 
-	free(ps->o.write_pid_path);
-	free(ps->o.logpath);
-	for (int i = 0; i < ps->o.blur_kernel_count; ++i) {
-		free(ps->o.blur_kerns[i]);
-	}
-	free(ps->o.blur_kerns);
-	free(ps->o.glx_fshader_win_str);
 	free_xinerama_info(ps);
+	free(ps->monitors);
+	frame_timing_free(ps->frame_timing);
+	ps->frame_timing = NULL;
 
 #ifdef CONFIG_VSYNC_DRM
 	// Close file opened for DRM VSync
@@ -2362,16 +3403,20 @@ static void session_destroy(session_t *ps) {
 	}
 #endif
 
+	// Selecting no events frees the event context
+	if (ps->present_eid) {
+		xcb_present_select_input(ps->c, ps->present_eid,
+		                         session_get_target_window(ps), 0);
+		ps->present_eid = XCB_NONE;
+	}
+
 	// Release overlay window
 	if (ps->overlay) {
 		xcb_composite_release_overlay_window(ps->c, ps->overlay);
 		ps->overlay = XCB_NONE;
 	}
 
-	if (ps->sync_fence != XCB_NONE) {
-		xcb_sync_destroy_fence(ps->c, ps->sync_fence);
-		ps->sync_fence = XCB_NONE;
-	}
+	x_fence_ring_deinit(ps->c, &ps->sync_fences);
 
 	// Free reg_win
 	if (ps->reg_win != XCB_NONE) {
@@ -2384,6 +3429,19 @@ static void session_destroy(session_t *ps) {
 		ps->debug_window = XCB_NONE;
 	}
 
+	discard_pending_damage_fetches(ps);
+	free(ps->pending_damage_fetches);
+	ps->pending_damage_fetches = NULL;
+	ps->pending_damage_fetches_capacity = 0;
+	free(ps->event_batch);
+	ps->event_batch = NULL;
+	ps->event_batch_capacity = 0;
+	arena_deinit(&tls_scratch);
+	free(ps->paint_list);
+	ps->paint_list = NULL;
+	ps->npaint_list = 0;
+	ps->paint_list_capacity = 0;
+
 	if (ps->damaged_region != XCB_NONE) {
 		xcb_xfixes_destroy_region(ps->c, ps->damaged_region);
 		ps->damaged_region = XCB_NONE;
@@ -2408,6 +3466,7 @@ static void session_destroy(session_t *ps) {
 	ev_io_stop(ps->loop, &ps->xiow);
 	free_conv(ps->gaussian_map);
 	destroy_atoms(ps->atoms);
+	x_free_visual_caches();
 
 #ifdef DEBUG_XRC
 	// Report about resource leakage
@@ -2418,10 +3477,15 @@ static void session_destroy(session_t *ps) {
 
 	// Stop libev event handlers
 	ev_timer_stop(ps->loop, &ps->unredir_timer);
+	ev_timer_stop(ps->loop, &ps->redir_timer);
 	ev_timer_stop(ps->loop, &ps->fade_timer);
+	ev_timer_stop(ps->loop, &ps->delayed_draw_timer);
+	ev_timer_stop(ps->loop, &ps->unfocused_damage_timer);
+	ev_timer_stop(ps->loop, &ps->frame_pacing_timer);
 	ev_idle_stop(ps->loop, &ps->draw_idle);
 	ev_prepare_stop(ps->loop, &ps->event_check);
 	ev_signal_stop(ps->loop, &ps->usr1_signal);
+	ev_signal_stop(ps->loop, &ps->usr2_signal);
 	ev_signal_stop(ps->loop, &ps->int_signal);
 }
 
@@ -2462,6 +3526,12 @@ int main(int argc, char **argv) {
 		}
 	}
 
+#ifdef MICRO_BENCHMARK
+	if (argc >= 2 && strcmp(argv[1], "--microbench") == 0) {
+		return microbench_run(argc >= 3 ? argv[2] : NULL);
+	}
+#endif
+
 	int exit_code;
 	char *config_file = NULL;
 	bool all_xerrors = false, need_fork = false;
@@ -35,6 +35,10 @@ enum root_flags {
 // TODO(yshui) move static inline functions that are only used in picom.c, into picom.c
 
 void add_damage(session_t *ps, const region_t *damage);
+/// Add damage caused by the content of `w` changing. Unlike `add_damage`, this isn't
+/// counted as changing what's behind `w` and the windows below it.
+void add_damage_from_content(session_t *ps, struct managed_win *w,
+                             const region_t *damage);
 
 uint32_t determine_evmask(session_t *ps, xcb_window_t wid, win_evmode_t mode);
 
@@ -43,11 +47,21 @@ void circulate_win(session_t *ps, xcb_circulate_notify_event_t *ce);
 void update_refresh_rate(session_t *ps);
 
 void root_damaged(session_t *ps);
+/// The wallpaper property of the root window was set
+void root_back_pixmap_changed(session_t *ps);
+/// The content of the wallpaper pixmap changed, reported by root_pixmap_damage
+void root_pixmap_content_changed(session_t *ps);
 
 void cxinerama_upd_scrs(session_t *ps);
 
 void queue_redraw(session_t *ps);
 
+void queue_redraw_for_damage(session_t *ps, struct managed_win *w);
+
+/// Handle a vblank reported by the Present extension, `msc` is the vblank counter and
+/// `ust` its timestamp.
+void handle_vblank(session_t *ps, uint64_t msc, uint64_t ust);
+
 void discard_ignore(session_t *ps, unsigned long sequence);
 
 void set_root_flags(session_t *ps, uint64_t flags);
@@ -106,7 +120,8 @@ free_win_res_glx(session_t *ps attr_unused, struct managed_win *w attr_unused) {
  * Dump an drawable's info.
  */
 static inline void dump_drawable(session_t *ps, xcb_drawable_t drawable) {
-	auto r = xcb_get_geometry_reply(ps->c, xcb_get_geometry(ps->c, drawable), NULL);
+	auto r = X_REPLY(
+	    xcb_get_geometry_reply(ps->c, xcb_get_geometry(ps->c, drawable), NULL));
 	if (!r) {
 		log_trace("Drawable %#010x: Failed", drawable);
 		return;
@@ -1,11 +1,14 @@
 // SPDX-License-Identifier: MPL-2.0
 // Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
 #pragma once
+#include <limits.h>
 #include <pixman.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <xcb/xcb.h>
 
+#include "arena.h"
 #include "log.h"
 #include "utils.h"
 
@@ -39,9 +42,9 @@ static inline rect_t from_x_rect(const xcb_rectangle_t *rect) {
 }
 
 /// Convert an array of xcb rectangles to our rectangle type
-/// Returning an array that needs to be freed
+/// Returning an array allocated from tls_scratch
 static inline rect_t *from_x_rects(int nrects, const xcb_rectangle_t *rects) {
-	rect_t *ret = ccalloc(nrects, rect_t);
+	rect_t *ret = arena_new(&tls_scratch, rect_t, nrects);
 	for (int i = 0; i < nrects; i++) {
 		ret[i] = from_x_rect(rects + i);
 	}
@@ -66,7 +69,8 @@ static inline void _resize_region(const region_t *region, region_t *output, int
 	int nrects;
 	int nnewrects = 0;
 	const rect_t *rects = pixman_region32_rectangles((region_t *)region, &nrects);
-	auto newrects = ccalloc(nrects, rect_t);
+	auto mark = arena_mark(&tls_scratch);
+	auto newrects = arena_new(&tls_scratch, rect_t, nrects);
 	for (int i = 0; i < nrects; i++) {
 		int x1 = rects[i].x1 - dx;
 		int y1 = rects[i].y1 - dy;
@@ -85,7 +89,7 @@ static inline void _resize_region(const region_t *region, region_t *output, int
 	pixman_region32_fini(output);
 	pixman_region32_init_rects(output, newrects, nnewrects);
 
-	free(newrects);
+	arena_rewind(&tls_scratch, mark);
 }
 
 static inline region_t resize_region(const region_t *region, int dx, int dy) {
@@ -98,3 +102,109 @@ static inline region_t resize_region(const region_t *region, int dx, int dy) {
 static inline void resize_region_in_place(region_t *region, int dx, int dy) {
 	return _resize_region(region, region, dx, dy);
 }
+
+static inline long rect_area(const rect_t *r) {
+	return (long)(r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static inline rect_t rect_union(const rect_t *a, const rect_t *b) {
+	return (rect_t){
+	    .x1 = min2(a->x1, b->x1),
+	    .y1 = min2(a->y1, b->y1),
+	    .x2 = max2(a->x2, b->x2),
+	    .y2 = max2(a->y2, b->y2),
+	};
+}
+
+static inline long region_area(const region_t *region) {
+	int nrects;
+	const rect_t *rects = pixman_region32_rectangles((region_t *)region, &nrects);
+	long area = 0;
+	for (int i = 0; i < nrects; i++) {
+		area += rect_area(&rects[i]);
+	}
+	return area;
+}
+
+/// Merge the rectangles of a region into fewer, bigger ones, see region_simplify
+static inline void _region_merge_rects(region_t *region, int max_rects, long max_waste) {
+	int nrects;
+	const rect_t *rects = pixman_region32_rectangles(region, &nrects);
+	auto mark = arena_mark(&tls_scratch);
+	auto merged = arena_new(&tls_scratch, rect_t, nrects);
+	// How much of each merged rectangle is actually covered by the region
+	auto covered = arena_new(&tls_scratch, long, nrects);
+
+	// Rectangles are sorted by bands from top to bottom, then from left to right,
+	// those next to each other in the list are usually close on screen too.
+	int n = 0;
+	for (int i = 0; i < nrects; i++) {
+		if (n > 0) {
+			auto u = rect_union(&merged[n - 1], &rects[i]);
+			long area = rect_area(&rects[i]);
+			long waste = rect_area(&u) - covered[n - 1] - area;
+			if (waste <= max_waste) {
+				merged[n - 1] = u;
+				covered[n - 1] += area;
+				continue;
+			}
+		}
+		merged[n] = rects[i];
+		covered[n++] = rect_area(&rects[i]);
+	}
+
+	// Still too many, do the cheapest merges until there are few enough
+	while (max_rects > 0 && n > max_rects) {
+		int best = 0;
+		long best_waste = LONG_MAX;
+		for (int i = 0; i + 1 < n; i++) {
+			auto u = rect_union(&merged[i], &merged[i + 1]);
+			long waste = rect_area(&u) - covered[i] - covered[i + 1];
+			if (waste < best_waste) {
+				best = i;
+				best_waste = waste;
+			}
+		}
+		merged[best] = rect_union(&merged[best], &merged[best + 1]);
+		covered[best] += covered[best + 1];
+		n--;
+		memmove(&merged[best + 1], &merged[best + 2],
+		        sizeof(rect_t) * (size_t)(n - best - 1));
+		memmove(&covered[best + 1], &covered[best + 2],
+		        sizeof(long) * (size_t)(n - best - 1));
+	}
+
+	pixman_region32_fini(region);
+	pixman_region32_init_rects(region, merged, n);
+	arena_rewind(&tls_scratch, mark);
+}
+
+/**
+ * Simplify a region, trading some extra area for fewer rectangles. Neighbouring
+ * rectangles are merged into their bounding box if that adds no more than `max_waste`
+ * pixels, then the cheapest merges are done until there are at most `max_rects`
+ * rectangles. `max_rects` of 0 means no limit.
+ *
+ * @return number of pixels added to the region
+ */
+static inline long region_simplify(region_t *region, int max_rects, long max_waste) {
+	int nrects = pixman_region32_n_rects(region);
+	if (nrects <= 1 || (max_waste <= 0 && (max_rects <= 0 || nrects <= max_rects))) {
+		return 0;
+	}
+
+	long area_before = region_area(region);
+	_region_merge_rects(region, max_rects, max_waste);
+	if (max_rects > 0 && pixman_region32_n_rects(region) > max_rects) {
+		// Overlapping merged rectangles are split up into bands again, which can
+		// give more rectangles than were merged. Try once more, then give up and
+		// just use the extents.
+		_region_merge_rects(region, max_rects, max_waste);
+		if (pixman_region32_n_rects(region) > max_rects) {
+			rect_t extents = *pixman_region32_extents(region);
+			pixman_region32_fini(region);
+			pixman_region32_init_rects(region, &extents, 1);
+		}
+	}
+	return region_area(region) - area_before;
+}
@@ -11,6 +11,7 @@
 
 #include "common.h"
 #include "options.h"
+#include "picom.h"
 
 #ifdef CONFIG_OPENGL
 #include "backend/gl/glx.h"
@@ -28,9 +29,11 @@
 #include "log.h"
 #include "region.h"
 #include "types.h"
+#include "uthash_extra.h"
 #include "utils.h"
 #include "vsync.h"
 #include "win.h"
+#include "workqueue.h"
 #include "x.h"
 
 #include "backend/backend.h"
@@ -215,30 +218,87 @@ make_circle(int cx, int cy, int radius, uint32_t max_ntraps, xcb_render_trapezoi
 	return n;
 }
 
-uint32_t make_rectangle(int x, int y, int wid, int hei, xcb_render_trapezoid_t traps[]) {
-	traps[0].top = y * 65536;
-	traps[0].left.p1.y = y * 65536;
-	traps[0].left.p1.x = x * 65536;
-	traps[0].left.p2.y = (y + hei) * 65536;
-	traps[0].left.p2.x = x * 65536;
-	traps[0].bottom = (y + hei) * 65536;
-	traps[0].right.p1.x = (x + wid) * 65536;
-	traps[0].right.p1.y = y * 65536;
-	traps[0].right.p2.x = (x + wid) * 65536;
-	traps[0].right.p2.y = (y + hei) * 65536;
-	return 1;
-}
+/// A solid circle, used as the mask of the corners of rounded windows
+struct corner_mask {
+	int radius;
+	/// 2 * radius pixels wide and tall
+	xcb_render_picture_t circle;
+	UT_hash_handle hh;
+};
+
+/// Get the circle of radius `cr`. The circles are drawn once and shared by all the
+/// windows with the same corner radius, instead of being drawn with trapezoids in every
+/// frame.
+static xcb_render_picture_t corner_mask_get(session_t *ps, int cr) {
+	struct corner_mask *m = NULL;
+	HASH_FIND_INT(ps->corner_masks, &cr, m);
+	if (m) {
+		return m->circle;
+	}
 
-uint32_t make_rounded_window_shape(xcb_render_trapezoid_t traps[], uint32_t max_ntraps,
-                                   int cr, int wid, int hei) {
+	auto circle = x_create_picture_with_standard(ps->c, ps->root, 2 * cr, 2 * cr,
+	                                             XCB_PICT_STANDARD_ARGB_32, 0, 0);
+	xcb_render_color_t trans = {.red = 0, .blue = 0, .green = 0, .alpha = 0};
+	const xcb_rectangle_t rect = {.x = 0,
+	                              .y = 0,
+	                              .width = to_u16_checked(2 * cr),
+	                              .height = to_u16_checked(2 * cr)};
+	xcb_render_fill_rectangles(ps->c, XCB_RENDER_PICT_OP_SRC, circle, trans, 1,
+	                           &rect);
+
+	uint32_t max_ntraps = to_u32_checked(cr);
+	xcb_render_trapezoid_t traps[max_ntraps];
 	uint32_t n = make_circle(cr, cr, cr, max_ntraps, traps);
-	n += make_circle(wid - cr, cr, cr, max_ntraps, traps + n);
-	n += make_circle(wid - cr, hei - cr, cr, max_ntraps, traps + n);
-	n += make_circle(cr, hei - cr, cr, max_ntraps, traps + n);
-	n += make_rectangle(0, cr, wid, hei - 2 * cr, traps + n);
-	n += make_rectangle(cr, 0, wid - 2 * cr, cr, traps + n);
-	n += make_rectangle(cr, hei - cr, wid - 2 * cr, cr, traps + n);
-	return n;
+	xcb_render_trapezoids(ps->c, XCB_RENDER_PICT_OP_OVER, ps->alpha_picts[MAX_ALPHA],
+	                      circle,
+	                      x_get_pictfmt_for_standard(ps->c, XCB_PICT_STANDARD_A_8),
+	                      0, 0, n, traps);
+
+	m = ccalloc(1, struct corner_mask);
+	m->radius = cr;
+	m->circle = circle;
+	HASH_ADD_INT(ps->corner_masks, radius, m);
+	return circle;
+}
+
+/**
+ * Create the mask of a `wid` x `hei` window with rounded corners of radius `cr`, its
+ * alpha comes from the 1x1 repeating picture `alpha_pict`.
+ *
+ * The part between the corners is filled directly, and the corners are copied from the
+ * cached circle of the same radius.
+ *
+ * @return the mask, to be freed by the caller
+ */
+static xcb_render_picture_t make_rounded_window_mask(session_t *ps, int cr, int wid,
+                                                     int hei,
+                                                     xcb_render_picture_t alpha_pict) {
+	cr = min2(cr, min2(wid / 2, hei / 2));
+	auto mask = x_create_picture_with_standard(ps->c, ps->root, wid, hei,
+	                                           XCB_PICT_STANDARD_ARGB_32, 0, 0);
+	xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, alpha_pict, XCB_NONE, mask, 0,
+	                     0, 0, 0, 0, to_i16_checked(cr), to_u16_checked(wid),
+	                     to_u16_checked(hei - 2 * cr));
+	xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, alpha_pict, XCB_NONE, mask, 0,
+	                     0, 0, 0, to_i16_checked(cr), 0, to_u16_checked(wid - 2 * cr),
+	                     to_u16_checked(hei));
+	if (cr <= 0) {
+		return mask;
+	}
+
+	auto circle = corner_mask_get(ps, cr);
+	// Top left, top right, bottom left, bottom right quarters of the circle
+	const int corners[4][2] = {{0, 0}, {1, 0}, {0, 1}, {1, 1}};
+	for (int i = 0; i < 4; i++) {
+		const int cx = corners[i][0], cy = corners[i][1];
+		xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, circle, alpha_pict,
+		                     mask, to_i16_checked(cx * cr),
+		                     to_i16_checked(cy * cr), 0, 0,
+		                     to_i16_checked(cx * (wid - cr)),
+		                     to_i16_checked(cy * (hei - cr)), to_u16_checked(cr),
+		                     to_u16_checked(cr));
+	}
+	return mask;
 }
 
 void render(session_t *ps, int x, int y, int dx, int dy, int wid, int hei, int fullwid,
@@ -252,29 +312,8 @@ void render(session_t *ps, int x, int y, int dx, int dy, int wid, int hei, int f
 		xcb_render_picture_t alpha_pict = ps->alpha_picts[alpha_step];
 		if (alpha_step != 0) {
 			if (cr) {
-				xcb_render_picture_t p_tmp = x_create_picture_with_standard(
-				    ps->c, ps->root, fullwid, fullhei,
-				    XCB_PICT_STANDARD_ARGB_32, 0, 0);
-				xcb_render_color_t trans = {
-				    .red = 0, .blue = 0, .green = 0, .alpha = 0};
-				const xcb_rectangle_t rect = {
-				    .x = 0,
-				    .y = 0,
-				    .width = to_u16_checked(fullwid),
-				    .height = to_u16_checked(fullhei)};
-				xcb_render_fill_rectangles(ps->c, XCB_RENDER_PICT_OP_SRC,
-				                           p_tmp, trans, 1, &rect);
-
-				uint32_t max_ntraps = to_u32_checked(cr);
-				xcb_render_trapezoid_t traps[4 * max_ntraps + 3];
-
-				uint32_t n = make_rounded_window_shape(
-				    traps, max_ntraps, cr, fullwid, fullhei);
-
-				xcb_render_trapezoids(
-				    ps->c, XCB_RENDER_PICT_OP_OVER, alpha_pict, p_tmp,
-				    x_get_pictfmt_for_standard(ps->c, XCB_PICT_STANDARD_A_8),
-				    0, 0, n, traps);
+				xcb_render_picture_t p_tmp = make_rounded_window_mask(
+				    ps, cr, fullwid, fullhei, alpha_pict);
 
 				xcb_render_composite(
 				    ps->c, XCB_RENDER_PICT_OP_OVER, pict, p_tmp,
@@ -544,8 +583,8 @@ void paint_one(session_t *ps, struct managed_win *w, const region_t *reg_paint)
 		free_picture(ps->c, &pict);
 
 	// Dimming the window if needed
-	if (w->dim) {
-		double dim_opacity = ps->o.inactive_dim;
+	if (w->dim_level > 0) {
+		double dim_opacity = w->dim_level;
 		if (!ps->o.inactive_dim_fixed)
 			dim_opacity *= w->opacity;
 
@@ -583,8 +622,6 @@ void paint_one(session_t *ps, struct managed_win *w, const region_t *reg_paint)
 	}
 }
 
-extern const char *background_props_str[];
-
 static bool get_root_tile(session_t *ps) {
 	/*
 	if (ps->o.paint_on_overlay) {
@@ -595,7 +632,8 @@ static bool get_root_tile(session_t *ps) {
 	ps->root_tile_fill = false;
 
 	bool fill = false;
-	xcb_pixmap_t pixmap = x_get_root_back_pixmap(ps->c, ps->root, ps->atoms);
+	// Fetched by root_damaged when the wallpaper property changed
+	xcb_pixmap_t pixmap = ps->root_pixmap;
 
 	// Make sure the pixmap we got is valid
 	if (pixmap && !x_validate_pixmap(ps->c, pixmap))
@@ -657,24 +695,15 @@ static void paint_root(session_t *ps, const region_t *reg_paint) {
 }
 
 /**
- * Generate shadow <code>Picture</code> for a window.
+ * Upload a rendered shadow image, and make it the shadow <code>Picture</code> of a
+ * window.
  */
-static bool win_build_shadow(session_t *ps, struct managed_win *w, double opacity) {
-	const int width = w->widthb;
-	const int height = w->heightb;
-	// log_trace("(): building shadow for %s %d %d", w->name, width, height);
-
-	xcb_image_t *shadow_image = NULL;
+static bool
+win_upload_shadow(session_t *ps, struct managed_win *w, xcb_image_t *shadow_image) {
 	xcb_pixmap_t shadow_pixmap = XCB_NONE, shadow_pixmap_argb = XCB_NONE;
 	xcb_render_picture_t shadow_picture = XCB_NONE, shadow_picture_argb = XCB_NONE;
 	xcb_gcontext_t gc = XCB_NONE;
 
-	shadow_image = make_shadow(ps->c, ps->gaussian_map, opacity, width, height);
-	if (!shadow_image) {
-		log_error("failed to make shadow");
-		return XCB_NONE;
-	}
-
 	shadow_pixmap =
 	    x_create_pixmap(ps->c, 8, ps->root, shadow_image->width, shadow_image->height);
 	shadow_pixmap_argb =
@@ -695,7 +724,10 @@ static bool win_build_shadow(session_t *ps, struct managed_win *w, double opacit
 	gc = x_new_id(ps->c);
 	xcb_create_gc(ps->c, gc, shadow_pixmap, 0, NULL);
 
-	xcb_image_put(ps->c, shadow_pixmap, gc, shadow_image, 0, 0, 0);
+	if (!x_put_image(ps->c, shadow_pixmap, gc, shadow_image, 0, 0)) {
+		log_error("failed to upload shadow image");
+		goto shadow_picture_err;
+	}
 	xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, ps->cshadow_picture,
 	                     shadow_picture, shadow_picture_argb, 0, 0, 0, 0, 0, 0,
 	                     shadow_image->width, shadow_image->height);
@@ -706,15 +738,12 @@ static bool win_build_shadow(session_t *ps, struct managed_win *w, double opacit
 	w->shadow_paint.pict = shadow_picture_argb;
 
 	xcb_free_gc(ps->c, gc);
-	xcb_image_destroy(shadow_image);
 	xcb_free_pixmap(ps->c, shadow_pixmap);
 	xcb_render_free_picture(ps->c, shadow_picture);
 
 	return true;
 
 shadow_picture_err:
-	if (shadow_image)
-		xcb_image_destroy(shadow_image);
 	if (shadow_pixmap)
 		xcb_free_pixmap(ps->c, shadow_pixmap);
 	if (shadow_pixmap_argb)
@@ -729,6 +758,90 @@ shadow_picture_err:
 	return false;
 }
 
+/// A shadow being rendered on a worker thread
+struct shadow_job {
+	session_t *ps;
+	/// The window the shadow is for. NULL if the window is gone, or its shadow has
+	/// been discarded since the job was queued.
+	struct managed_win *w;
+	/// A copy of the shadow kernel, the session's can be replaced while the job runs
+	conv *kernel;
+	xcb_image_t *image;
+	int width, height;
+};
+
+static void shadow_job_run(void *data) {
+	struct shadow_job *job = data;
+	fill_shadow_image(job->image, job->kernel, 1, job->width, job->height);
+}
+
+static void shadow_job_done(void *data) {
+	struct shadow_job *job = data;
+	auto w = job->w;
+	if (w) {
+		assert(w->shadow_job == job);
+		assert(!w->shadow_paint.pixmap);
+		w->shadow_job = NULL;
+		if (win_upload_shadow(job->ps, w, job->image)) {
+			// The frames since the job was queued were painted without the
+			// shadow
+			add_damage_from_win(job->ps, w);
+			queue_redraw(job->ps);
+		} else {
+			log_error("build shadow failed");
+		}
+	}
+	xcb_image_destroy(job->image);
+	free_conv(job->kernel);
+	free(job);
+}
+
+/**
+ * Generate shadow <code>Picture</code> for a window.
+ *
+ * The shadow is rendered on a worker thread if there is one, the window is painted
+ * without shadow until it is done.
+ */
+static void win_build_shadow(session_t *ps, struct managed_win *w) {
+	assert(!w->shadow_job);
+	// log_trace("(): building shadow for %s %d %d", w->name, w->widthb,
+	// w->heightb);
+	auto shadow_image =
+	    make_shadow_image(ps->c, ps->gaussian_map, w->widthb, w->heightb);
+	if (!shadow_image) {
+		log_error("failed to make shadow");
+		return;
+	}
+
+	if (!ps->workqueue) {
+		fill_shadow_image(shadow_image, ps->gaussian_map, 1, w->widthb, w->heightb);
+		if (!win_upload_shadow(ps, w, shadow_image)) {
+			log_error("build shadow failed");
+		}
+		xcb_image_destroy(shadow_image);
+		return;
+	}
+
+	auto job = ccalloc(1, struct shadow_job);
+	job->ps = ps;
+	job->w = w;
+	job->kernel = conv_dup(ps->gaussian_map);
+	job->image = shadow_image;
+	job->width = w->widthb;
+	job->height = w->heightb;
+	w->shadow_job = job;
+	workqueue_submit(ps->workqueue, shadow_job_run, shadow_job_done, job);
+}
+
+void win_discard_shadow(session_t *ps, struct managed_win *w) {
+	if (w->shadow_job) {
+		// The job still owns its image, it will be freed when the job is done
+		w->shadow_job->w = NULL;
+		w->shadow_job = NULL;
+	}
+	free_paint(ps, &w->shadow_paint);
+}
+
 /**
  * Paint the shadow of a window.
  */
@@ -747,29 +860,9 @@ win_paint_shadow(session_t *ps, struct managed_win *w, region_t *reg_paint) {
 	    (w->corner_radius > 0) && (!ps->o.wintype_option[w->window_type].full_shadow);
 	if (should_clip) {
 		if (ps->o.backend == BKEND_XRENDER || ps->o.backend == BKEND_XR_GLX_HYBRID) {
-			uint32_t max_ntraps = to_u32_checked(w->corner_radius);
-			xcb_render_trapezoid_t traps[4 * max_ntraps + 3];
-			uint32_t n = make_rounded_window_shape(
-			    traps, max_ntraps, w->corner_radius, w->widthb, w->heightb);
-
-			td = x_create_picture_with_standard(
-			    ps->c, ps->root, w->widthb, w->heightb,
-			    XCB_PICT_STANDARD_ARGB_32, 0, 0);
-			xcb_render_color_t trans = {
-			    .red = 0, .blue = 0, .green = 0, .alpha = 0};
-			const xcb_rectangle_t rect = {.x = 0,
-			                              .y = 0,
-			                              .width = to_u16_checked(w->widthb),
-			                              .height = to_u16_checked(w->heightb)};
-			xcb_render_fill_rectangles(ps->c, XCB_RENDER_PICT_OP_SRC, td,
-			                           trans, 1, &rect);
-
-			auto solid = solid_picture(ps->c, ps->root, false, 1, 0, 0, 0);
-			xcb_render_trapezoids(
-			    ps->c, XCB_RENDER_PICT_OP_OVER, solid, td,
-			    x_get_pictfmt_for_standard(ps->c, XCB_PICT_STANDARD_A_8), 0,
-			    0, n, traps);
-			xcb_render_free_picture(ps->c, solid);
+			td = make_rounded_window_mask(ps, w->corner_radius, w->widthb,
+			                              w->heightb,
+			                              ps->alpha_picts[MAX_ALPHA]);
 		} else {
 			// Not implemented
 		}
@@ -884,7 +977,8 @@ win_blur_background(session_t *ps, struct managed_win *w, xcb_render_picture_t t
 	case BKEND_XRENDER:
 	case BKEND_XR_GLX_HYBRID: {
 		// Normalize blur kernels
-		for (int i = 0; i < ps->o.blur_kernel_count; i++) {
+		for (int i = 0;
+		     ps->o.blur_method == BLUR_METHOD_KERNEL && i < ps->o.blur_kernel_count; i++) {
 			// Note: `x * 65536` converts double `x` to a X fixed point
 			// representation. `x / 65536` is the other way.
 			auto kern_src = ps->o.blur_kerns[i];
@@ -904,29 +998,8 @@ win_blur_background(session_t *ps, struct managed_win *w, xcb_render_picture_t t
 
 		xcb_render_picture_t td = XCB_NONE;
 		if (cr) {
-			uint32_t max_ntraps = to_u32_checked(cr);
-			xcb_render_trapezoid_t traps[4 * max_ntraps + 3];
-			uint32_t n =
-			    make_rounded_window_shape(traps, max_ntraps, cr, wid, hei);
-
-			td = x_create_picture_with_standard(
-			    ps->c, ps->root, wid, hei, XCB_PICT_STANDARD_ARGB_32, 0, 0);
-			xcb_render_color_t trans = {
-			    .red = 0, .blue = 0, .green = 0, .alpha = 0};
-			const xcb_rectangle_t rect = {.x = 0,
-			                              .y = 0,
-			                              .width = to_u16_checked(wid),
-			                              .height = to_u16_checked(hei)};
-			xcb_render_fill_rectangles(ps->c, XCB_RENDER_PICT_OP_SRC, td,
-			                           trans, 1, &rect);
-
-			auto solid = solid_picture(ps->c, ps->root, false, 1, 0, 0, 0);
-
-			xcb_render_trapezoids(
-			    ps->c, XCB_RENDER_PICT_OP_OVER, solid, td,
-			    x_get_pictfmt_for_standard(ps->c, XCB_PICT_STANDARD_A_8), 0,
-			    0, n, traps);
-			xcb_render_free_picture(ps->c, solid);
+			td = make_rounded_window_mask(ps, cr, wid, hei,
+			                              ps->alpha_picts[MAX_ALPHA]);
 		}
 
 		// Minimize the region we try to blur, if the window itself is not
@@ -941,10 +1014,20 @@ win_blur_background(session_t *ps, struct managed_win *w, xcb_render_picture_t t
 			pixman_region32_fini(&reg_noframe);
 		}
 
-		// Translate global coordinates to local ones
-		pixman_region32_translate(&reg_blur, -x, -y);
-		xr_blur_dst(ps, tgt_buffer, x, y, wid, hei, ps->blur_kerns_cache,
-		            ps->o.blur_kernel_count, &reg_blur, td);
+		if (ps->o.blur_method == BLUR_METHOD_DUAL_KAWASE) {
+			const pixman_box32_t extent = {x, y, x + wid, y + hei};
+			pixman_region32_intersect(&reg_blur, &reg_blur, (region_t *)reg_paint);
+			x_kawase_blur(ps->c, &ps->blur_kawase, ps->root, ps->vis, tgt_buffer,
+			              &extent, &reg_blur,
+			              td ? td : ps->alpha_picts[MAX_ALPHA]);
+			// x_kawase_blur changed the clip of the target
+			set_tgt_clip(ps, (region_t *)reg_paint);
+		} else {
+			// Translate global coordinates to local ones
+			pixman_region32_translate(&reg_blur, -x, -y);
+			xr_blur_dst(ps, tgt_buffer, x, y, wid, hei, ps->blur_kerns_cache,
+			            ps->o.blur_kernel_count, &reg_blur, td);
+		}
 		if (td) {
 			xcb_render_free_picture(ps->c, td);
 		}
@@ -968,14 +1051,13 @@ win_blur_background(session_t *ps, struct managed_win *w, xcb_render_picture_t t
 /// region = ??
 /// region_real = the damage region
 void paint_all(session_t *ps, struct managed_win *t, bool ignore_damage) {
-	if (ps->o.xrender_sync_fence || (ps->drivers & DRIVER_NVIDIA)) {
-		if (ps->xsync_exists && !x_fence_sync(ps->c, ps->sync_fence)) {
-			log_error("x_fence_sync failed, xrender-sync-fence will be "
-			          "disabled from now on.");
-			xcb_sync_destroy_fence(ps->c, ps->sync_fence);
-			ps->sync_fence = XCB_NONE;
-			ps->o.xrender_sync_fence = false;
-			ps->xsync_exists = false;
+	if ((ps->o.xrender_sync_fence || (ps->drivers & DRIVER_NVIDIA)) &&
+	    ps->xsync_exists) {
+		x_fence_ring_trigger(ps->c, &ps->sync_fences);
+		x_fence_ring_await(ps->c, &ps->sync_fences);
+		if (bkend_use_glx(ps)) {
+			// OpenGL doesn't render through X, so the CPU has to wait
+			x_sync(ps->c);
 		}
 	}
 
@@ -1031,6 +1113,7 @@ void paint_all(session_t *ps, struct managed_win *t, bool ignore_damage) {
 #ifdef CONFIG_OPENGL
 	if (bkend_use_glx(ps)) {
 		ps->psglx->z = 0.0;
+		glx_paint_begin(ps);
 	}
 #endif
 
@@ -1063,13 +1146,13 @@ void paint_all(session_t *ps, struct managed_win *t, bool ignore_damage) {
 		region_t bshape_no_corners =
 		    win_get_bounding_shape_global_without_corners_by_val(w);
 		region_t bshape_corners = win_get_bounding_shape_global_by_val(w);
-		// Painting shadow
-		if (w->shadow) {
-			// Lazy shadow building
-			if (!w->shadow_paint.pixmap)
-				if (!win_build_shadow(ps, w, 1))
-					log_error("build shadow failed");
+		// Lazy shadow building
+		if (w->shadow && !w->shadow_paint.pixmap && !w->shadow_job) {
+			win_build_shadow(ps, w);
+		}
 
+		// Painting shadow, unless it's still being built
+		if (w->shadow && w->shadow_paint.pixmap) {
 			// Shadow doesn't need to be painted underneath the body
 			// of the windows above. Because no one can see it
 			pixman_region32_subtract(&reg_tmp, &region, w->reg_ignore);
@@ -1143,7 +1226,9 @@ void paint_all(session_t *ps, struct managed_win *t, bool ignore_damage) {
 			set_tgt_clip(ps, &reg_tmp);
 
 #ifdef CONFIG_OPENGL
-			// If rounded corners backup the region first
+			// If rounded corners backup the region first. This is a copy even
+			// when the frame is rendered offscreen: the corners are restored
+			// after the window is painted over the frame.
 			if (w->corner_radius > 0 && ps->o.backend == BKEND_GLX) {
 				const int16_t x = w->g.x;
 				const int16_t y = w->g.y;
@@ -1268,7 +1353,10 @@ void paint_all(session_t *ps, struct managed_win *t, bool ignore_damage) {
 		glx_render(ps, ps->tgt_buffer.ptex, 0, 0, 0, 0, ps->root_width,
 		           ps->root_height, 0, 1.0, false, false, &region, NULL);
 		fallthrough();
-	case BKEND_GLX: glXSwapBuffers(ps->dpy, get_tgt_window(ps)); break;
+	case BKEND_GLX:
+		glx_paint_end(ps, &region);
+		glXSwapBuffers(ps->dpy, get_tgt_window(ps));
+		break;
 #endif
 	default: assert(0);
 	}
@@ -1302,8 +1390,8 @@ void paint_all(session_t *ps, struct managed_win *t, bool ignore_damage) {
  */
 static bool xr_init_blur(session_t *ps) {
 	// Query filters
-	xcb_render_query_filters_reply_t *pf = xcb_render_query_filters_reply(
-	    ps->c, xcb_render_query_filters(ps->c, get_tgt_window(ps)), NULL);
+	xcb_render_query_filters_reply_t *pf = X_REPLY(xcb_render_query_filters_reply(
+	    ps->c, xcb_render_query_filters(ps->c, get_tgt_window(ps)), NULL));
 	if (pf) {
 		xcb_str_iterator_t iter = xcb_render_query_filters_filters_iterator(pf);
 		for (; iter.rem; xcb_str_next(&iter)) {
@@ -1385,9 +1473,18 @@ bool init_render(session_t *ps) {
 	}
 
 	// Blur filter
-	if (ps->o.blur_method && ps->o.blur_method != BLUR_METHOD_KERNEL) {
-		log_warn("Old backends only support blur method \"kernel\". Your blur "
-		         "setting will not be applied");
+	if (ps->o.blur_method == BLUR_METHOD_DUAL_KAWASE && ps->o.backend != BKEND_GLX) {
+		struct dual_kawase_blur_args args = {
+		    .size = ps->o.blur_radius,
+		    .strength = ps->o.blur_strength,
+		};
+		struct dual_kawase_params *params = generate_dual_kawase_params(&args);
+		x_kawase_blur_init(&ps->blur_kawase, params->iterations, params->offset);
+		free(params);
+	} else if (ps->o.blur_method && ps->o.blur_method != BLUR_METHOD_KERNEL) {
+		log_warn("Old backends only support blur method \"kernel\", and "
+		         "\"dual_kawase\" with xrender. Your blur setting will not be "
+		         "applied");
 		ps->o.blur_method = BLUR_METHOD_NONE;
 	}
 
@@ -1464,12 +1561,20 @@ void free_root_tile(session_t *ps) {
 }
 
 void deinit_render(session_t *ps) {
+	vsync_deinit(ps);
+
 	// Free alpha_picts
 	for (int i = 0; i <= MAX_ALPHA; ++i)
 		free_picture(ps->c, &ps->alpha_picts[i]);
 	free(ps->alpha_picts);
 	ps->alpha_picts = NULL;
 
+	HASH_ITER2(ps->corner_masks, m) {
+		HASH_DEL(ps->corner_masks, m);
+		free_picture(ps->c, &m->circle);
+		free(m);
+	}
+
 	// Free cshadow_picture and black_picture
 	if (ps->cshadow_picture == ps->black_picture)
 		ps->cshadow_picture = XCB_NONE;
@@ -1489,7 +1594,9 @@ void deinit_render(session_t *ps) {
 	}
 #endif
 
-	if (ps->o.blur_method != BLUR_METHOD_NONE) {
+	if (ps->o.blur_method == BLUR_METHOD_DUAL_KAWASE) {
+		x_kawase_blur_deinit(ps->c, &ps->blur_kawase);
+	} else if (ps->o.blur_method != BLUR_METHOD_NONE) {
 		for (int i = 0; i < ps->o.blur_kernel_count; i++) {
 			free(ps->blur_kerns_cache[i]);
 		}
@@ -42,6 +42,8 @@ void paint_all(session_t *ps, struct managed_win *const t, bool ignore_damage);
 void free_picture(xcb_connection_t *c, xcb_render_picture_t *p);
 
 void free_paint(session_t *ps, paint_t *ppaint);
+/// Free the shadow of a window, and cancel the shadow being built for it, if any
+void win_discard_shadow(session_t *ps, struct managed_win *w);
 void free_root_tile(session_t *ps);
 
 bool init_render(session_t *ps);
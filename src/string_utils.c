@@ -6,6 +6,7 @@
 #include <test.h>
 
 #include "compiler.h"
+#include "microbench.h"
 #include "string_utils.h"
 #include "utils.h"
 
@@ -80,6 +81,25 @@ TEST_CASE(mstrextend) {
 	free(str1);
 }
 
+MICROBENCH(mstrjoin) {
+	MICROBENCH_LOOP() {
+		char *str = mstrjoin("/home/user/.config", "/picom/picom.conf");
+		microbench_keep(str);
+		free(str);
+	}
+}
+
+MICROBENCH(mstrextend) {
+	MICROBENCH_LOOP() {
+		// Like building a condition string out of its parts
+		char *str = strdup("class_g");
+		mstrextend(&str, " = ");
+		mstrextend(&str, "'Firefox'");
+		microbench_keep(str);
+		free(str);
+	}
+}
+
 #pragma GCC diagnostic pop
 
 /// Parse a floating point number of form (+|-)?[0-9]*(\.[0-9]*)
@@ -127,3 +147,10 @@ TEST_CASE(strtod_simple) {
 	TEST_EQUAL(result, 0.5);
 	TEST_EQUAL(*end, '\0');
 }
+
+MICROBENCH(strtod_simple) {
+	const char *end;
+	MICROBENCH_LOOP() {
+		microbench_keep(strtod_simple("-1234.5678", &end));
+	}
+}
@@ -2,7 +2,9 @@
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 #pragma once
 #include <ctype.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "compiler.h"
 
@@ -50,5 +52,13 @@ static inline char *skip_space_mut(char *src) {
 	return src;
 }
 
+/// Compare two strings, either of which can be NULL
+static inline bool str_equal(const char *a, const char *b) {
+	if (!a || !b) {
+		return a == b;
+	}
+	return strcmp(a, b) == 0;
+}
+
 #define skip_space(x)                                                                    \
 	_Generic((x), char * : skip_space_mut, const char * : skip_space_const)(x)
@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <test.h>
+
+#include "compiler.h"
+#include "log.h"
+#include "trace.h"
+#include "utils.h"
+
+/// Longest log message recorded, after escaping
+#define TRACE_MESSAGE_MAX 160
+
+struct trace {
+	char *map;
+	size_t size;
+	/// Length of the array opening, and the metadata, before the first slot
+	size_t header_len;
+	/// The slot the next event goes into
+	unsigned next;
+	int pid;
+};
+
+struct trace *trace_new(const char *path) {
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("Failed to open trace file %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	char header[128];
+	int pid = getpid();
+	int header_len = snprintf(header, sizeof(header),
+	                          "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+	                          "\"args\":{\"name\":\"picom\"}},\n",
+	                          pid);
+	assert(header_len > 0 && (size_t)header_len < sizeof(header));
+
+	size_t size = (size_t)header_len + (size_t)TRACE_SLOTS * TRACE_SLOT_SIZE;
+	void *map = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0) {
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	int err = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_error("Failed to map trace file %s: %s", path, strerror(err));
+		unlink(path);
+		return NULL;
+	}
+
+	auto t = ccalloc(1, struct trace);
+	t->map = map;
+	t->size = size;
+	t->header_len = (size_t)header_len;
+	t->pid = pid;
+
+	// Empty slots are all whitespaces, so they can sit between events
+	memcpy(t->map, header, t->header_len);
+	memset(t->map + t->header_len, ' ', size - t->header_len);
+	for (unsigned i = 1; i <= TRACE_SLOTS; i++) {
+		t->map[t->header_len + i * TRACE_SLOT_SIZE - 1] = '\n';
+	}
+	log_info("Writing trace to %s", path);
+	return t;
+}
+
+void trace_free(struct trace *t) {
+	if (!t) {
+		return;
+	}
+	munmap(t->map, t->size);
+	free(t);
+}
+
+uint64_t trace_now(const struct trace *t) {
+	if (!t) {
+		return 0;
+	}
+	struct timespec tm = {0, 0};
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return (uint64_t)tm.tv_sec * 1000000ULL + (uint64_t)tm.tv_nsec / 1000;
+}
+
+/// Write one event into the next slot, followed by a comma
+static attr_printf(2, 3) void trace_write(struct trace *t, const char *fmt, ...) {
+	char *slot = t->map + t->header_len + (size_t)t->next * TRACE_SLOT_SIZE;
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(slot, TRACE_SLOT_SIZE - 1, fmt, args);
+	va_end(args);
+
+	if (len < 0 || len > TRACE_SLOT_SIZE - 2) {
+		// Doesn't fit, leave an empty slot behind
+		memset(slot, ' ', TRACE_SLOT_SIZE - 1);
+		return;
+	}
+	memset(slot + len, ' ', (size_t)(TRACE_SLOT_SIZE - 2 - len));
+	slot[TRACE_SLOT_SIZE - 2] = ',';
+	t->next = (t->next + 1) % TRACE_SLOTS;
+}
+
+void trace_span(struct trace *t, const char *name, uint64_t start, uint32_t window) {
+	if (!t) {
+		return;
+	}
+	uint64_t end = trace_now(t);
+	if (window) {
+		trace_write(t,
+		            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRIu64
+		            ",\"dur\":%" PRIu64
+		            ",\"pid\":%d,\"tid\":%d,\"args\":{\"window\":\"%#010x\"}}",
+		            name, start, end - start, t->pid, t->pid, window);
+	} else {
+		trace_write(t,
+		            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRIu64
+		            ",\"dur\":%" PRIu64 ",\"pid\":%d,\"tid\":%d}",
+		            name, start, end - start, t->pid, t->pid);
+	}
+}
+
+void trace_instant(struct trace *t, const char *name, uint32_t window) {
+	if (!t) {
+		return;
+	}
+	uint64_t now = trace_now(t);
+	if (window) {
+		trace_write(t,
+		            "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64
+		            ",\"pid\":%d,\"tid\":%d,\"args\":{\"window\":\"%#010x\"}}",
+		            name, now, t->pid, t->pid, window);
+	} else {
+		trace_write(t,
+		            "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64
+		            ",\"pid\":%d,\"tid\":%d}",
+		            name, now, t->pid, t->pid);
+	}
+}
+
+/// Escape `str` as a JSON string into `buf`, stopping before `cap` bytes. A multibyte
+/// UTF-8 sequence is never cut in half.
+///
+/// @return length of the escaped string, `buf` is not NUL terminated
+static size_t json_escape(char *buf, size_t cap, const char *str, size_t len) {
+	size_t out = 0;
+	size_t i = 0;
+	for (; i < len; i++) {
+		char c = str[i];
+		char esc[2] = {c, 0};
+		size_t elen = 1;
+		if (c == '"' || c == '\\') {
+			esc[0] = '\\';
+			esc[1] = c;
+			elen = 2;
+		} else if (c == '\n') {
+			esc[0] = '\\';
+			esc[1] = 'n';
+			elen = 2;
+		} else if ((unsigned char)c < 0x20) {
+			esc[0] = ' ';
+		}
+		if (out + elen > cap) {
+			break;
+		}
+		memcpy(buf + out, esc, elen);
+		out += elen;
+	}
+	if (i < len && ((unsigned char)str[i] & 0xc0) == 0x80) {
+		// Truncated in the middle of a multibyte character, drop the part of it
+		// that has been copied
+		while (out > 0 && ((unsigned char)buf[out - 1] & 0xc0) == 0x80) {
+			out--;
+		}
+		if (out > 0 && ((unsigned char)buf[out - 1] & 0xc0) == 0xc0) {
+			out--;
+		}
+	}
+	return out;
+}
+
+void trace_message(struct trace *t, const char *str, size_t len) {
+	if (!t) {
+		return;
+	}
+	while (len > 0 && str[len - 1] == '\n') {
+		len--;
+	}
+	char msg[TRACE_MESSAGE_MAX];
+	size_t msg_len = json_escape(msg, sizeof(msg), str, len);
+	trace_write(t,
+	            "{\"name\":\"log\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64
+	            ",\"pid\":%d,\"tid\":%d,\"args\":{\"message\":\"%.*s\"}}",
+	            trace_now(t), t->pid, t->pid, (int)msg_len, msg);
+}
+
+TEST_CASE(json_escape) {
+	char buf[8];
+	size_t len = json_escape(buf, sizeof(buf), "a\"b\n", 4);
+	TEST_EQUAL(len, 6);
+	TEST_TRUE(memcmp(buf, "a\\\"b\\n", 6) == 0);
+
+	// The escape sequence doesn't fit
+	len = json_escape(buf, sizeof(buf), "abcdefg\\", 8);
+	TEST_EQUAL(len, 7);
+
+	// Neither does the whole character
+	len = json_escape(buf, 7, "abcdef\xc3\xa9", 8);
+	TEST_EQUAL(len, 6);
+	len = json_escape(buf, sizeof(buf), "abcde\xc3\xa9", 7);
+	TEST_EQUAL(len, 7);
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Number of events kept in a trace file, the oldest ones are overwritten after that
+#define TRACE_SLOTS 65536
+/// Size of each event in the trace file, longer events are dropped
+#define TRACE_SLOT_SIZE 256
+
+/// A trace of what the compositor is doing, written into a memory mapped file in the
+/// Chrome trace event format, so it can be opened with chrome://tracing or Perfetto's
+/// UI and lined up against traces of the clients and the X server.
+///
+/// The file has a fixed size: it's a JSON array of TRACE_SLOTS fixed size slots, each
+/// holding one event padded with whitespaces, used as a ring buffer. The file is a
+/// valid trace at all times, recording an event is one snprintf into the mapping.
+/// Timestamps are CLOCK_MONOTONIC, in microseconds.
+struct trace;
+
+/// Create the trace file `path`, truncating it if it exists
+///
+/// @return the trace, NULL if the file could not be created
+struct trace *trace_new(const char *path);
+void trace_free(struct trace *t);
+
+/// Current time in microseconds, to be passed to trace_span. 0 if `t` is NULL, so tracing
+/// costs nothing when it's disabled.
+uint64_t trace_now(const struct trace *t);
+
+/// Record an event `name` that started at `start` and ended now. `window` is the window
+/// the event is about, or 0. Does nothing if `t` is NULL.
+void trace_span(struct trace *t, const char *name, uint64_t start, uint32_t window);
+/// Record an instant event `name`. Does nothing if `t` is NULL.
+void trace_instant(struct trace *t, const char *name, uint32_t window);
+/// Record a log message as an instant event, the message is truncated if it doesn't
+/// fit in a slot
+void trace_message(struct trace *t, const char *str, size_t len);
@@ -18,6 +18,9 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+#include <xcb/dri3.h>
+#include <xf86drm.h>
 #endif
 
 #include "config.h"
@@ -47,23 +50,127 @@ static int vsync_drm_wait(session_t *ps) {
 	return ret;
 }
 
+/// Open the primary node of the GPU that drives the X screen. DRI3 tells us which GPU
+/// that is, but it hands out render nodes, which can't wait for vblanks.
+static int vsync_drm_open_device(session_t *ps) {
+	int fd = -1;
+	auto ext = xcb_get_extension_data(ps->c, &xcb_dri3_id);
+	if (ext && ext->present) {
+		auto r = X_REPLY(
+		    xcb_dri3_open_reply(ps->c, xcb_dri3_open(ps->c, ps->root, 0), NULL));
+		if (r) {
+			int dri3_fd = -1;
+			if (r->nfd == 1) {
+				dri3_fd = xcb_dri3_open_reply_fds(ps->c, r)[0];
+			}
+			free(r);
+			char *path =
+			    dri3_fd >= 0 ? drmGetPrimaryDeviceNameFromFd(dri3_fd) : NULL;
+			if (path) {
+				fd = open(path, O_RDWR | O_CLOEXEC);
+				if (fd >= 0) {
+					log_info("Using DRM device %s", path);
+				}
+				free(path);
+			}
+			if (dri3_fd >= 0) {
+				close(dri3_fd);
+			}
+		}
+	}
+	if (fd < 0) {
+		log_info("Can't find the DRM device of the X screen, using card0");
+		fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
+	}
+	return fd;
+}
+
+static void
+vsync_drm_vblank_handler(int fd attr_unused, unsigned int sequence attr_unused,
+                         unsigned int tv_sec attr_unused, unsigned int tv_usec attr_unused,
+                         void *data) {
+	session_t *ps = data;
+	ps->drm_vblank_pending = false;
+	if (ps->redraw_needed) {
+		// Render right after the vblank, so the frame is shown at the next one
+		ev_idle_start(ps->loop, &ps->draw_idle);
+	}
+}
+
+static void vsync_drm_io_callback(EV_P attr_unused, ev_io *w, int revents attr_unused) {
+	// The session is passed to the handler as the signal of the vblank request
+	drmEventContext ctx = {
+	    .version = 2,
+	    .vblank_handler = vsync_drm_vblank_handler,
+	};
+	if (drmHandleEvent(w->fd, &ctx) != 0) {
+		log_error("Failed to read DRM events");
+	}
+}
+
+bool vsync_drm_scheduling(session_t *ps) {
+	return ev_is_active(&ps->drm_io);
+}
+
+void vsync_drm_request_vblank(session_t *ps) {
+	if (ps->drm_vblank_pending) {
+		return;
+	}
+	drm_wait_vblank_t vbl = {
+	    .request.type = _DRM_VBLANK_RELATIVE | _DRM_VBLANK_EVENT,
+	    .request.sequence = 1,
+	    .request.signal = (unsigned long)ps,
+	};
+	int ret;
+	do {
+		ret = ioctl(ps->drm_fd, DRM_IOCTL_WAIT_VBLANK, &vbl);
+	} while (ret && errno == EINTR);
+	if (ret) {
+		// Don't leave the screen stale, render without waiting
+		log_error_errno("Failed to request a vblank event");
+		ev_idle_start(ps->loop, &ps->draw_idle);
+		return;
+	}
+	ps->drm_vblank_pending = true;
+}
+
 /**
  * Initialize DRM VSync.
  *
  * @return true for success, false otherwise
  */
 static bool vsync_drm_init(session_t *ps) {
-	// Should we always open card0?
-	if (ps->drm_fd < 0 && (ps->drm_fd = open("/dev/dri/card0", O_RDWR)) < 0) {
+	if (ps->drm_fd < 0 && (ps->drm_fd = vsync_drm_open_device(ps)) < 0) {
 		log_error("Failed to open device.");
 		return false;
 	}
 
-	if (vsync_drm_wait(ps))
+	// Check vblank waiting works, without actually waiting
+	drm_wait_vblank_t vbl = {
+	    .request.type = _DRM_VBLANK_RELATIVE,
+	    .request.sequence = 0,
+	};
+	if (ioctl(ps->drm_fd, DRM_IOCTL_WAIT_VBLANK, &vbl)) {
+		log_error("VBlank ioctl did not work, unimplemented in this drmver?");
 		return false;
+	}
 
+	// Frames are started from vblank events, instead of blocking until the vblank
+	// before presenting. swopti and benchmark mode do their own scheduling, so they
+	// keep blocking.
+	if (!ps->o.sw_opti && !ps->o.benchmark) {
+		ev_io_init(&ps->drm_io, vsync_drm_io_callback, ps->drm_fd, EV_READ);
+		ev_io_start(ps->loop, &ps->drm_io);
+	}
 	return true;
 }
+
+void vsync_deinit(session_t *ps) {
+	if (ev_is_active(&ps->drm_io)) {
+		ev_io_stop(ps->loop, &ps->drm_io);
+	}
+	ps->drm_vblank_pending = false;
+}
 #endif
 
 #ifdef CONFIG_OPENGL
@@ -194,7 +301,7 @@ bool vsync_init(session_t *ps) {
 #ifdef CONFIG_VSYNC_DRM
 	if (vsync_drm_init(ps)) {
 		log_info("Using the drm vsync method");
-		ps->vsync_wait = vsync_drm_wait;
+		ps->vsync_wait = vsync_drm_scheduling(ps) ? NULL : vsync_drm_wait;
 		return true;
 	}
 #endif
@@ -202,3 +309,15 @@ bool vsync_init(session_t *ps) {
 	log_error("No supported vsync method found for this backend");
 	return false;
 }
+
+#ifndef CONFIG_VSYNC_DRM
+bool vsync_drm_scheduling(session_t *ps attr_unused) {
+	return false;
+}
+
+void vsync_drm_request_vblank(session_t *ps attr_unused) {
+}
+
+void vsync_deinit(session_t *ps attr_unused) {
+}
+#endif
@@ -5,3 +5,11 @@
 typedef struct session session_t;
 
 bool vsync_init(session_t *ps);
+void vsync_deinit(session_t *ps);
+
+/// Whether frames are started from DRM vblank events, instead of being rendered right
+/// away and waiting for the vblank before presenting
+bool vsync_drm_scheduling(session_t *ps);
+/// Ask for an event at the next vblank, a frame is rendered when it arrives if a redraw
+/// is still needed by then
+void vsync_drm_request_vblank(session_t *ps);
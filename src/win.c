@@ -78,6 +78,8 @@ static void win_update_prop_shadow(session_t *ps, struct managed_win *w);
  * Update leader of a window.
  */
 static void win_update_leader(session_t *ps, struct managed_win *w);
+static bool win_fetch_bounding_shape(session_t *ps, struct managed_win *w);
+static void win_rebuild_bounding_shape(session_t *ps, struct managed_win *w);
 
 /// Generate a "no corners" region function, from a function that returns the
 /// region via a region_t pointer argument. Corners of the window will be removed from
@@ -100,17 +102,86 @@ static void win_update_leader(session_t *ps, struct managed_win *w);
 		return ret;                                                              \
 	}
 
+/// Windows whose cache_leader is `leader`, so a window group can be found without going
+/// through all the windows
+struct leader_group {
+	xcb_window_t leader;
+	/// Members of the group, linked by managed_win::leader_group_neighbour
+	struct list_node members;
+	UT_hash_handle hh;
+};
+
 /**
- * Clear leader cache of all windows.
+ * Set the leader cache of a window, and move it to the group of the new leader.
+ *
+ * Destroying windows are not put into any group, they are not in `ps->windows` either.
  */
-static inline void clear_cache_win_leaders(session_t *ps) {
-	win_stack_foreach_managed(w, &ps->window_stack) {
-		w->cache_leader = XCB_NONE;
+static void
+win_set_cache_leader(session_t *ps, struct managed_win *w, xcb_window_t leader) {
+	if (w->leader_group) {
+		auto group = w->leader_group;
+		list_remove(&w->leader_group_neighbour);
+		w->leader_group = NULL;
+		if (list_is_empty(&group->members)) {
+			HASH_DEL(ps->leader_groups, group);
+			free(group);
+		}
+	}
+
+	w->cache_leader = leader;
+	if (!leader || w->state == WSTATE_DESTROYING) {
+		return;
 	}
+
+	struct leader_group *group = NULL;
+	HASH_FIND_INT(ps->leader_groups, &leader, group);
+	if (!group) {
+		group = ccalloc(1, struct leader_group);
+		group->leader = leader;
+		list_init_head(&group->members);
+		HASH_ADD_INT(ps->leader_groups, leader, group);
+	}
+	list_insert_before(&group->members, &w->leader_group_neighbour);
+	w->leader_group = group;
 }
 
 static xcb_window_t win_get_leader_raw(session_t *ps, struct managed_win *w, int recursions);
 
+/**
+ * Clear leader cache of all windows in the group of `leader`, and compute them again.
+ *
+ * The leader of a window is found by following the leader chain through other windows,
+ * so all windows whose chain goes through a window are in the same group as that
+ * window. When a window gets a new leader, only its group has to be invalidated.
+ */
+static void clear_cache_win_leaders(session_t *ps, xcb_window_t leader) {
+	struct leader_group *group = NULL;
+	HASH_FIND_INT(ps->leader_groups, &leader, group);
+	if (!group) {
+		return;
+	}
+
+	// All of the members have to be cleared before any of them is computed again,
+	// otherwise the chain could go through a stale cache
+	size_t nmembers = 0;
+	list_foreach(struct managed_win, w, &group->members, leader_group_neighbour) {
+		nmembers++;
+	}
+	auto members = ccalloc(nmembers, struct managed_win *);
+	nmembers = 0;
+	list_foreach(struct managed_win, w, &group->members, leader_group_neighbour) {
+		members[nmembers++] = w;
+	}
+	// `group` is freed when the last member leaves
+	for (size_t i = 0; i < nmembers; i++) {
+		win_set_cache_leader(ps, members[i], XCB_NONE);
+	}
+	for (size_t i = 0; i < nmembers; i++) {
+		win_get_leader_raw(ps, members[i], 0);
+	}
+	free(members);
+}
+
 /**
  * Get the leader of a window.
  *
@@ -169,15 +240,13 @@ static inline void group_on_factor_change(session_t *ps, xcb_window_t leader) {
 		return;
 	}
 
-	HASH_ITER2(ps->windows, w) {
-		assert(!w->destroyed);
-		if (!w->managed) {
-			continue;
-		}
-		auto mw = (struct managed_win *)w;
-		if (win_get_leader(ps, mw) == leader) {
-			win_on_factor_change(ps, mw);
-		}
+	struct leader_group *group = NULL;
+	HASH_FIND_INT(ps->leader_groups, &leader, group);
+	if (!group) {
+		return;
+	}
+	list_foreach(struct managed_win, w, &group->members, leader_group_neighbour) {
+		win_on_factor_change(ps, w);
 	}
 }
 
@@ -200,13 +269,13 @@ static inline bool group_is_focused(session_t *ps, xcb_window_t leader) {
 		return false;
 	}
 
-	HASH_ITER2(ps->windows, w) {
-		assert(!w->destroyed);
-		if (!w->managed) {
-			continue;
-		}
-		auto mw = (struct managed_win *)w;
-		if (win_get_leader(ps, mw) == leader && win_is_focused_raw(ps, mw)) {
+	struct leader_group *group = NULL;
+	HASH_FIND_INT(ps->leader_groups, &leader, group);
+	if (!group) {
+		return false;
+	}
+	list_foreach(struct managed_win, w, &group->members, leader_group_neighbour) {
+		if (win_is_focused_raw(ps, w)) {
 			return true;
 		}
 	}
@@ -317,8 +386,8 @@ static inline void win_release_shadow(backend_t *base, struct managed_win *w) {
 static inline bool win_bind_pixmap(struct backend_base *b, struct managed_win *w) {
 	assert(!w->win_image);
 	auto pixmap = x_new_id(b->c);
-	auto e = xcb_request_check(
-	    b->c, xcb_composite_name_window_pixmap_checked(b->c, w->base.id, pixmap));
+	auto e = X_REPLY(xcb_request_check(
+	    b->c, xcb_composite_name_window_pixmap_checked(b->c, w->base.id, pixmap)));
 	if (e) {
 		log_error("Failed to get named pixmap for window %#010x(%s)", w->base.id,
 		          w->name);
@@ -338,12 +407,67 @@ static inline bool win_bind_pixmap(struct backend_base *b, struct managed_win *w
 	return true;
 }
 
+int shadow_template_slice_count(int length, int band) {
+	int middle = max2(length - band - SHADOW_TEMPLATE_MIDDLE, 0);
+	return 2 + (middle + SHADOW_TEMPLATE_MIDDLE - 1) / SHADOW_TEMPLATE_MIDDLE;
+}
+
+struct shadow_slice shadow_template_slice(int length, int band, int i) {
+	// The template is the shadow of a window of size band + SHADOW_TEMPLATE_MIDDLE.
+	// Along each axis of a shadow, the first and the last `band` pixels are
+	// gradients, and everything in between is the same, as long as the window is
+	// at least `band` in size. So we can use the start of the template for the
+	// start of the shadow, the end of the template for the end of the shadow, and
+	// slices of the template's middle part for the rest.
+	if (i == 0) {
+		return (struct shadow_slice){
+		    .start = 0,
+		    .end = min2(band + SHADOW_TEMPLATE_MIDDLE, length),
+		    .offset = 0,
+		};
+	}
+	if (i == shadow_template_slice_count(length, band) - 1) {
+		return (struct shadow_slice){
+		    .start = length,
+		    .end = length + band,
+		    .offset = length - band - SHADOW_TEMPLATE_MIDDLE,
+		};
+	}
+	int start = band + SHADOW_TEMPLATE_MIDDLE * i;
+	return (struct shadow_slice){
+	    .start = start,
+	    .end = min2(start + SHADOW_TEMPLATE_MIDDLE, length),
+	    .offset = start - band,
+	};
+}
+
 bool win_bind_shadow(struct backend_base *b, struct managed_win *w, struct color c,
-                     struct conv *kernel) {
+                     struct conv *kernel, void **shadow_template) {
 	assert(!w->shadow_image);
 	assert(w->shadow);
-	w->shadow_image = b->ops->render_shadow(b, w->widthb, w->heightb, kernel, c.red,
-	                                        c.green, c.blue, c.alpha);
+
+	// Shadows only depend on the window size, the kernel, and the color. Windows
+	// that are at least as big as the gradient share the same template, instead
+	// of having their own image the size of the window.
+	int band = kernel->w - 1;
+	w->shadow_from_template = w->widthb >= band && w->heightb >= band;
+	if (w->shadow_from_template && !*shadow_template) {
+		int size = band + SHADOW_TEMPLATE_MIDDLE;
+		*shadow_template = b->ops->render_shadow(b, size, size, kernel, c.red,
+		                                         c.green, c.blue, c.alpha);
+		if (!*shadow_template) {
+			log_warn("Failed to create the shadow template, falling back to "
+			         "per-window shadows");
+			w->shadow_from_template = false;
+		}
+	}
+
+	if (w->shadow_from_template) {
+		w->shadow_image = b->ops->clone_image(b, *shadow_template, NULL);
+	} else {
+		w->shadow_image = b->ops->render_shadow(b, w->widthb, w->heightb, kernel,
+		                                        c.red, c.green, c.blue, c.alpha);
+	}
 	if (!w->shadow_image) {
 		log_error("Failed to bind shadow image, shadow will be disabled for "
 		          "%#010x (%s)",
@@ -373,13 +497,191 @@ void win_release_images(struct backend_base *backend, struct managed_win *w) {
 		assert(!win_check_flags_all(w, WIN_FLAGS_SHADOW_STALE));
 		win_release_shadow(backend, w);
 	}
+
+	win_release_blur_cache(backend, w);
+}
+
+void win_release_hidden_images(struct backend_base *backend, struct managed_win *w) {
+	assert(w->state == WSTATE_MAPPED && !w->to_paint);
+	if (!win_check_flags_any(w, WIN_FLAGS_PIXMAP_NONE | WIN_FLAGS_PIXMAP_STALE)) {
+		win_release_pixmap(backend, w);
+	}
+	// The shadow is kept, it's often shared with other windows, and cheap to keep
+	// otherwise
+	win_release_blur_cache(backend, w);
+}
+
+void win_release_blur_cache(struct backend_base *backend, struct managed_win *w) {
+	if (w->blur_cache.image) {
+		backend->ops->release_image(backend, w->blur_cache.image);
+		w->blur_cache.image = NULL;
+	}
+	pixman_region32_clear(&w->blur_cache.valid);
 }
 
 /// Returns true if the `prop` property is stale, as well as clears the stale flag.
 static bool win_fetch_and_unset_property_stale(struct managed_win *w, xcb_atom_t prop);
+/// Returns true if the `prop` property is stale, without clearing the stale flag.
+static bool win_is_property_stale(const struct managed_win *w, xcb_atom_t prop);
 /// Returns true if any of the properties are stale, as well as clear all the stale flags.
 static void win_clear_all_properties_stale(struct managed_win *w);
 
+/// Send a property request for `w`, unless there is already one for the same property.
+static void win_request_prop(session_t *ps, struct managed_win *w, xcb_window_t wid,
+                             xcb_atom_t atom, uint32_t length, xcb_atom_t rtype) {
+	if (!wid || w->nprop_requests == WIN_MAX_PROP_REQUESTS) {
+		return;
+	}
+	for (int i = 0; i < w->nprop_requests; i++) {
+		if (w->prop_requests[i].wid == wid && w->prop_requests[i].atom == atom) {
+			return;
+		}
+	}
+	w->prop_requests[w->nprop_requests++] = (struct win_prop_request){
+	    .cookie = xcb_get_property(ps->c, 0, wid, atom, rtype, 0, length),
+	    .wid = wid,
+	    .atom = atom,
+	};
+}
+
+/// Find a prefetched request for property `atom` of window `wid`. If found, the request
+/// is removed from `w`, and its cookie is stored in `cookie`.
+static bool win_take_prop_request(struct managed_win *w, xcb_window_t wid,
+                                  xcb_atom_t atom, xcb_get_property_cookie_t *cookie) {
+	for (int i = 0; i < w->nprop_requests; i++) {
+		if (w->prop_requests[i].wid == wid && w->prop_requests[i].atom == atom) {
+			*cookie = w->prop_requests[i].cookie;
+			w->prop_requests[i] = w->prop_requests[--w->nprop_requests];
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Discard all the property requests of `w` that haven't been consumed
+static void win_discard_prop_requests(session_t *ps, struct managed_win *w) {
+	for (int i = 0; i < w->nprop_requests; i++) {
+		xcb_discard_reply(ps->c, w->prop_requests[i].cookie.sequence);
+	}
+	w->nprop_requests = 0;
+}
+
+/// Same as x_get_prop, but use the prefetched reply if there is one. `length` and
+/// `rtype` must match what was used by win_prefetch_properties.
+static winprop_t win_get_prop(session_t *ps, struct managed_win *w, xcb_window_t wid,
+                              xcb_atom_t atom, int length, xcb_atom_t rtype,
+                              int rformat) {
+	xcb_get_property_cookie_t cookie;
+	if (win_take_prop_request(w, wid, atom, &cookie)) {
+		return x_get_prop_reply(ps->c, cookie, rtype, rformat);
+	}
+	return x_get_prop(ps->c, wid, atom, length, rtype, rformat);
+}
+
+/// Same as wid_get_prop_window, but use the prefetched reply if there is one.
+static xcb_window_t win_get_prop_window(session_t *ps, struct managed_win *w,
+                                        xcb_window_t wid, xcb_atom_t aprop) {
+	xcb_window_t p = XCB_NONE;
+	winprop_t prop = win_get_prop(ps, w, wid, aprop, 1L, XCB_ATOM_WINDOW, 32);
+	if (prop.nitems) {
+		p = (xcb_window_t)*prop.p32;
+	}
+	free_winprop(&prop);
+	return p;
+}
+
+/// Same as wid_get_text_prop, but use the prefetched reply if there is one.
+static bool win_get_text_prop(session_t *ps, struct managed_win *w, xcb_window_t wid,
+                              xcb_atom_t prop, char ***pstrlst, int *pnstr) {
+	xcb_get_property_cookie_t cookie;
+	if (win_take_prop_request(w, wid, prop, &cookie)) {
+		return wid_get_text_prop_reply(ps, wid, prop, cookie, pstrlst, pnstr);
+	}
+	return wid_get_text_prop(ps, wid, prop, pstrlst, pnstr);
+}
+
+/// Send the bounding shape requests for `w`, unless they have been sent already
+static void win_request_shape(session_t *ps, struct managed_win *w) {
+	if (!ps->shape_exists || w->shape_request.pending) {
+		return;
+	}
+	w->shape_request = (struct win_shape_request){
+	    .extents = xcb_shape_query_extents(ps->c, w->base.id),
+	    .rectangles =
+	        xcb_shape_get_rectangles(ps->c, w->base.id, XCB_SHAPE_SK_BOUNDING),
+	    .pending = true,
+	};
+}
+
+void win_discard_shape_request(session_t *ps, struct managed_win *w) {
+	if (!w->shape_request.pending) {
+		return;
+	}
+	xcb_discard_reply(ps->c, w->shape_request.extents.sequence);
+	xcb_discard_reply(ps->c, w->shape_request.rectangles.sequence);
+	w->shape_request.pending = false;
+}
+
+void win_prefetch_properties(session_t *ps, struct managed_win *w) {
+	if (!win_is_real_visible(w) && !win_check_flags_all(w, WIN_FLAGS_MAPPED)) {
+		// Properties of invisible windows are not updated until they are mapped
+		return;
+	}
+	if (win_check_flags_any(w, WIN_FLAGS_SIZE_STALE | WIN_FLAGS_SHAPE_STALE)) {
+		win_request_shape(ps, w);
+	}
+	if (!win_check_flags_all(w, WIN_FLAGS_PROPERTY_STALE)) {
+		return;
+	}
+
+	auto a = ps->atoms;
+	auto client = w->client_win;
+	if (win_is_property_stale(w, a->a_NET_WM_WINDOW_TYPE)) {
+		win_request_prop(ps, w, client, a->a_NET_WM_WINDOW_TYPE, 32,
+		                 XCB_ATOM_ATOM);
+	}
+	if (win_is_property_stale(w, a->a_NET_WM_WINDOW_OPACITY)) {
+		win_request_prop(ps, w, w->base.id, a->a_NET_WM_WINDOW_OPACITY, 1,
+		                 XCB_ATOM_CARDINAL);
+		win_request_prop(ps, w, client, a->a_NET_WM_WINDOW_OPACITY, 1,
+		                 XCB_ATOM_CARDINAL);
+	}
+	if (win_is_property_stale(w, a->a_NET_FRAME_EXTENTS)) {
+		win_request_prop(ps, w, client, a->a_NET_FRAME_EXTENTS, 4,
+		                 XCB_ATOM_CARDINAL);
+	}
+	if (win_is_property_stale(w, a->aWM_NAME) ||
+	    win_is_property_stale(w, a->a_NET_WM_NAME)) {
+		win_request_prop(ps, w, client, a->a_NET_WM_NAME,
+		                 X_TEXT_PROP_REQUEST_LENGTH, XCB_GET_PROPERTY_TYPE_ANY);
+		win_request_prop(ps, w, client, a->aWM_NAME, X_TEXT_PROP_REQUEST_LENGTH,
+		                 XCB_GET_PROPERTY_TYPE_ANY);
+	}
+	if (win_is_property_stale(w, a->aWM_CLASS)) {
+		win_request_prop(ps, w, client, a->aWM_CLASS, X_TEXT_PROP_REQUEST_LENGTH,
+		                 XCB_GET_PROPERTY_TYPE_ANY);
+	}
+	if (win_is_property_stale(w, a->aWM_WINDOW_ROLE)) {
+		win_request_prop(ps, w, client, a->aWM_WINDOW_ROLE,
+		                 X_TEXT_PROP_REQUEST_LENGTH, XCB_GET_PROPERTY_TYPE_ANY);
+	}
+	if (win_is_property_stale(w, a->a_COMPTON_SHADOW)) {
+		win_request_prop(ps, w, w->base.id, a->a_COMPTON_SHADOW, 1,
+		                 XCB_ATOM_CARDINAL);
+	}
+	if (win_is_property_stale(w, a->aWM_CLIENT_LEADER) ||
+	    win_is_property_stale(w, a->aWM_TRANSIENT_FOR)) {
+		if (ps->o.detect_transient) {
+			win_request_prop(ps, w, client, a->aWM_TRANSIENT_FOR, 1,
+			                 XCB_ATOM_WINDOW);
+		}
+		if (ps->o.detect_client_leader) {
+			win_request_prop(ps, w, client, a->aWM_CLIENT_LEADER, 1,
+			                 XCB_ATOM_WINDOW);
+		}
+	}
+}
+
 /// Fetch new window properties from the X server, and run appropriate updates. Might set
 /// WIN_FLAGS_FACTOR_CHANGED
 static void win_update_properties(session_t *ps, struct managed_win *w) {
@@ -402,18 +704,24 @@ static void win_update_properties(session_t *ps, struct managed_win *w) {
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->aWM_NAME) ||
 	    win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_WM_NAME)) {
 		if (win_update_name(ps, w) == 1) {
+			c2_window_state_mark_dirty(ps, &w->c2_state, w->client_win,
+			                           ps->atoms->a_NET_WM_NAME);
 			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
 		}
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->aWM_CLASS)) {
 		if (win_update_class(ps, w)) {
+			c2_window_state_mark_dirty(ps, &w->c2_state, w->client_win,
+			                           ps->atoms->aWM_CLASS);
 			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
 		}
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->aWM_WINDOW_ROLE)) {
 		if (win_update_role(ps, w) == 1) {
+			c2_window_state_mark_dirty(ps, &w->c2_state, w->client_win,
+			                           ps->atoms->aWM_WINDOW_ROLE);
 			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
 		}
 	}
@@ -428,6 +736,7 @@ static void win_update_properties(session_t *ps, struct managed_win *w) {
 	}
 
 	win_clear_all_properties_stale(w);
+	win_discard_prop_requests(ps, w);
 }
 
 /// Handle non-image flags. This phase might set IMAGES_STALE flags
@@ -477,7 +786,7 @@ void win_process_update_flags(session_t *ps, struct managed_win *w) {
 			win_on_win_size_change(ps, w);
 			win_update_bounding_shape(ps, w);
 			damaged = true;
-			win_clear_flags(w, WIN_FLAGS_SIZE_STALE);
+			win_clear_flags(w, WIN_FLAGS_SIZE_STALE | WIN_FLAGS_SHAPE_STALE);
 		}
 
 		if (win_check_flags_all(w, WIN_FLAGS_POSITION_STALE)) {
@@ -488,6 +797,20 @@ void win_process_update_flags(session_t *ps, struct managed_win *w) {
 		win_update_screen(ps->xinerama_nscrs, ps->xinerama_scr_regs, w);
 	}
 
+	if (win_check_flags_all(w, WIN_FLAGS_SHAPE_STALE)) {
+		// Shaped windows can send a lot of ShapeNotify without changing their
+		// shape, only damage the window if the shape is really different.
+		if (win_fetch_bounding_shape(ps, w)) {
+			if (was_visible) {
+				add_damage_from_win(ps, w);
+			}
+			win_invalidate_reg_ignore(ps, w);
+			win_rebuild_bounding_shape(ps, w);
+			damaged = true;
+		}
+		win_clear_flags(w, WIN_FLAGS_SHAPE_STALE);
+	}
+
 	if (win_check_flags_all(w, WIN_FLAGS_PROPERTY_STALE)) {
 		win_update_properties(ps, w);
 		win_clear_flags(w, WIN_FLAGS_PROPERTY_STALE);
@@ -547,7 +870,7 @@ void win_process_image_flags(session_t *ps, struct managed_win *w) {
 				                               .green = ps->o.shadow_green,
 				                               .blue = ps->o.shadow_blue,
 				                               .alpha = ps->o.shadow_opacity},
-				                ps->gaussian_map);
+				                ps->gaussian_map, &ps->shadow_template);
 			}
 		}
 
@@ -606,11 +929,13 @@ int win_update_name(session_t *ps, struct managed_win *w) {
 		return 0;
 	}
 
-	if (!(wid_get_text_prop(ps, w->client_win, ps->atoms->a_NET_WM_NAME, &strlst, &nstr))) {
+	if (!win_get_text_prop(ps, w, w->client_win, ps->atoms->a_NET_WM_NAME, &strlst,
+	                       &nstr)) {
 		log_debug("(%#010x): _NET_WM_NAME unset, falling back to WM_NAME.",
 		          w->client_win);
 
-		if (!wid_get_text_prop(ps, w->client_win, ps->atoms->aWM_NAME, &strlst, &nstr)) {
+		if (!win_get_text_prop(ps, w, w->client_win, ps->atoms->aWM_NAME, &strlst,
+		                       &nstr)) {
 			log_debug("Unsetting window name for %#010x", w->client_win);
 			free(w->name);
 			w->name = NULL;
@@ -637,7 +962,8 @@ static int win_update_role(session_t *ps, struct managed_win *w) {
 	char **strlst = NULL;
 	int nstr = 0;
 
-	if (!wid_get_text_prop(ps, w->client_win, ps->atoms->aWM_WINDOW_ROLE, &strlst, &nstr)) {
+	if (!win_get_text_prop(ps, w, w->client_win, ps->atoms->aWM_WINDOW_ROLE, &strlst,
+	                       &nstr)) {
 		return -1;
 	}
 
@@ -656,28 +982,10 @@ static int win_update_role(session_t *ps, struct managed_win *w) {
 	return ret;
 }
 
-/**
- * Check if a window is bounding-shaped.
- */
-static inline bool win_bounding_shaped(const session_t *ps, xcb_window_t wid) {
-	if (ps->shape_exists) {
-		xcb_shape_query_extents_reply_t *reply;
-		Bool bounding_shaped;
-
-		reply = xcb_shape_query_extents_reply(
-		    ps->c, xcb_shape_query_extents(ps->c, wid), NULL);
-		bounding_shaped = reply && reply->bounding_shaped;
-		free(reply);
-
-		return bounding_shaped;
-	}
-
-	return false;
-}
-
-static wintype_t wid_get_prop_wintype(session_t *ps, xcb_window_t wid) {
-	winprop_t prop =
-	    x_get_prop(ps->c, wid, ps->atoms->a_NET_WM_WINDOW_TYPE, 32L, XCB_ATOM_ATOM, 32);
+static wintype_t
+wid_get_prop_wintype(session_t *ps, struct managed_win *w, xcb_window_t wid) {
+	winprop_t prop = win_get_prop(ps, w, wid, ps->atoms->a_NET_WM_WINDOW_TYPE, 32L,
+	                              XCB_ATOM_ATOM, 32);
 
 	for (unsigned i = 0; i < prop.nitems; ++i) {
 		for (wintype_t j = 1; j < NUM_WINTYPES; ++j) {
@@ -693,13 +1001,13 @@ static wintype_t wid_get_prop_wintype(session_t *ps, xcb_window_t wid) {
 	return WINTYPE_UNKNOWN;
 }
 
-static bool
-wid_get_opacity_prop(session_t *ps, xcb_window_t wid, opacity_t def, opacity_t *out) {
+static bool wid_get_opacity_prop(session_t *ps, struct managed_win *w, xcb_window_t wid,
+                                 opacity_t def, opacity_t *out) {
 	bool ret = false;
 	*out = def;
 
-	winprop_t prop = x_get_prop(ps->c, wid, ps->atoms->a_NET_WM_WINDOW_OPACITY, 1L,
-	                            XCB_ATOM_CARDINAL, 32);
+	winprop_t prop = win_get_prop(ps, w, wid, ps->atoms->a_NET_WM_WINDOW_OPACITY, 1L,
+	                              XCB_ATOM_CARDINAL, 32);
 
 	if (prop.nitems) {
 		*out = *prop.c32;
@@ -803,6 +1111,16 @@ double win_calc_opacity_target(session_t *ps, const struct managed_win *w) {
 	return opacity;
 }
 
+bool win_should_blur_background(session_t *ps, const struct managed_win *w) {
+	/* TODO(yshui) since the backend might change the content of the window
+	 * (e.g. with shaders), we should consult the backend whether the window
+	 * is transparent or not. for now we will just rely on the force_win_blend
+	 * option */
+	return w->blur_background &&
+	       (ps->o.force_win_blend || w->mode == WMODE_TRANS ||
+	        (ps->o.blur_background_frame && w->mode == WMODE_FRAME_TRANS));
+}
+
 /**
  * Determine whether a window is to be dimmed.
  */
@@ -847,8 +1165,8 @@ bool win_should_fade(session_t *ps, const struct managed_win *w) {
  * The property must be set on the outermost window, usually the WM frame.
  */
 void win_update_prop_shadow_raw(session_t *ps, struct managed_win *w) {
-	winprop_t prop = x_get_prop(ps->c, w->base.id, ps->atoms->a_COMPTON_SHADOW, 1,
-	                            XCB_ATOM_CARDINAL, 32);
+	winprop_t prop = win_get_prop(ps, w, w->base.id, ps->atoms->a_COMPTON_SHADOW, 1,
+	                              XCB_ATOM_CARDINAL, 32);
 
 	if (!prop.nitems) {
 		w->prop_shadow = -1;
@@ -1149,7 +1467,7 @@ void win_on_factor_change(session_t *ps, struct managed_win *w) {
 
 	win_update_opacity_target(ps, w);
 
-	w->reg_ignore_valid = false;
+	win_invalidate_reg_ignore(ps, w);
 }
 
 /**
@@ -1170,7 +1488,7 @@ void win_on_win_size_change(session_t *ps, struct managed_win *w) {
 	// Invalidate the shadow we built
 	win_set_flags(w, WIN_FLAGS_IMAGES_STALE);
 	ps->pending_updates = true;
-	free_paint(ps, &w->shadow_paint);
+	win_discard_shadow(ps, w);
 }
 
 /**
@@ -1180,7 +1498,7 @@ void win_update_wintype(session_t *ps, struct managed_win *w) {
 	const wintype_t wtype_old = w->window_type;
 
 	// Detect window type here
-	w->window_type = wid_get_prop_wintype(ps, w->client_win);
+	w->window_type = wid_get_prop_wintype(ps, w, w->client_win);
 
 	// Conform to EWMH standard, if _NET_WM_WINDOW_TYPE is not present, take
 	// override-redirect windows or windows without WM_TRANSIENT_FOR as
@@ -1207,6 +1525,7 @@ void win_update_wintype(session_t *ps, struct managed_win *w) {
  */
 void win_mark_client(session_t *ps, struct managed_win *w, xcb_window_t client) {
 	w->client_win = client;
+	c2_window_state_clear(&w->c2_state);
 
 	// If the window isn't mapped yet, stop here, as the function will be
 	// called in map_win()
@@ -1214,10 +1533,10 @@ void win_mark_client(session_t *ps, struct managed_win *w, xcb_window_t client)
 		return;
 	}
 
-	auto e = xcb_request_check(
-	    ps->c, xcb_change_window_attributes(
-	               ps->c, client, XCB_CW_EVENT_MASK,
-	               (const uint32_t[]){determine_evmask(ps, client, WIN_EVMODE_CLIENT)}));
+	uint32_t evmask = determine_evmask(ps, client, WIN_EVMODE_CLIENT);
+	auto e = X_REPLY(xcb_request_check(
+	    ps->c, xcb_change_window_attributes(ps->c, client, XCB_CW_EVENT_MASK,
+	                                        (const uint32_t[]){evmask})));
 	if (e) {
 		log_error("Failed to change event mask of window %#010x", client);
 		free(e);
@@ -1241,8 +1560,8 @@ void win_mark_client(session_t *ps, struct managed_win *w, xcb_window_t client)
 	// Update everything related to conditions
 	win_on_factor_change(ps, w);
 
-	auto r = xcb_get_window_attributes_reply(
-	    ps->c, xcb_get_window_attributes(ps->c, w->client_win), &e);
+	auto r = X_REPLY(xcb_get_window_attributes_reply(
+	    ps->c, xcb_get_window_attributes(ps->c, w->client_win), &e));
 	if (!r) {
 		log_error_x_error(e, "Failed to get client window attributes");
 		return;
@@ -1264,6 +1583,7 @@ void win_unmark_client(session_t *ps, struct managed_win *w) {
 	          w->base.id, w->name);
 
 	w->client_win = XCB_NONE;
+	c2_window_state_clear(&w->c2_state);
 
 	// Recheck event mask
 	xcb_change_window_attributes(
@@ -1272,31 +1592,65 @@ void win_unmark_client(session_t *ps, struct managed_win *w) {
 }
 
 /**
- * Look for the client window of a particular window.
+ * Look for the client window of a particular window, the window with WM_STATE closest to
+ * it in the window tree.
+ *
+ * The tree is searched breadth-first, and the requests for a whole level of it are sent
+ * at once, so this costs a round trip per level, instead of two per window searched.
  */
 static xcb_window_t find_client_win(session_t *ps, xcb_window_t w) {
-	if (wid_has_prop(ps, w, ps->atoms->aWM_STATE)) {
-		return w;
-	}
-
-	xcb_query_tree_reply_t *reply =
-	    xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, w), NULL);
-	if (!reply) {
-		return 0;
-	}
+	auto level = ccalloc(1, xcb_window_t);
+	level[0] = w;
+	int nlevel = 1;
+	xcb_window_t ret = XCB_NONE;
+
+	while (nlevel > 0) {
+		auto props = ccalloc(nlevel, xcb_get_property_cookie_t);
+		auto trees = ccalloc(nlevel, xcb_query_tree_cookie_t);
+		for (int i = 0; i < nlevel; i++) {
+			props[i] =
+			    xcb_get_property(ps->c, 0, level[i], ps->atoms->aWM_STATE,
+			                     XCB_GET_PROPERTY_TYPE_ANY, 0, 0);
+			trees[i] = xcb_query_tree(ps->c, level[i]);
+		}
 
-	xcb_window_t *children = xcb_query_tree_children(reply);
-	int nchildren = xcb_query_tree_children_length(reply);
-	int i;
-	xcb_window_t ret = 0;
+		for (int i = 0; i < nlevel; i++) {
+			if (ret) {
+				xcb_discard_reply(ps->c, props[i].sequence);
+				continue;
+			}
+			auto r = X_REPLY(xcb_get_property_reply(ps->c, props[i], NULL));
+			if (r && r->type != XCB_NONE) {
+				ret = level[i];
+			}
+			free(r);
+		}
 
-	for (i = 0; i < nchildren; ++i) {
-		if ((ret = find_client_win(ps, children[i]))) {
-			break;
+		xcb_window_t *next = NULL;
+		int nnext = 0;
+		for (int i = 0; i < nlevel; i++) {
+			if (ret) {
+				xcb_discard_reply(ps->c, trees[i].sequence);
+				continue;
+			}
+			auto r = X_REPLY(xcb_query_tree_reply(ps->c, trees[i], NULL));
+			int nchildren = r ? xcb_query_tree_children_length(r) : 0;
+			if (nchildren > 0) {
+				next = crealloc(next, nnext + nchildren);
+				memcpy(next + nnext, xcb_query_tree_children(r),
+				       sizeof(xcb_window_t) * (size_t)nchildren);
+				nnext += nchildren;
+			}
+			free(r);
 		}
-	}
 
-	free(reply);
+		free(props);
+		free(trees);
+		free(level);
+		level = next;
+		nlevel = nnext;
+	}
+	free(level);
 
 	return ret;
 }
@@ -1348,11 +1702,14 @@ void free_win_res(session_t *ps, struct managed_win *w) {
 	// assert(w->win_data == NULL);
 	free_win_res_glx(ps, w);
 	free_paint(ps, &w->paint);
-	free_paint(ps, &w->shadow_paint);
+	win_discard_shadow(ps, w);
 	// Above should be done during unmapping
 	// Except when we are called by session_destroy
 
+	win_set_cache_leader(ps, w, XCB_NONE);
 	pixman_region32_fini(&w->bounding_shape);
+	pixman_region32_fini(&w->blur_cache.valid);
+	pixman_region32_fini(&w->content_damage);
 	// BadDamage may be thrown if the window is destroyed
 	set_ignore_cookie(ps, xcb_damage_destroy(ps->c, w->damage));
 	rc_region_unref(&w->reg_ignore);
@@ -1364,6 +1721,56 @@ void free_win_res(session_t *ps, struct managed_win *w) {
 	free(w->stale_props);
 	w->stale_props = NULL;
 	w->stale_props_capacity = 0;
+	win_discard_prop_requests(ps, w);
+	win_discard_shape_request(ps, w);
+	free(w->shape_rects);
+	w->shape_rects = NULL;
+	c2_window_state_destroy(&w->c2_state);
+}
+
+/// Distance between the stack labels when they are evenly spaced. Leaves room for 31
+/// windows to be inserted between two windows before anything has to be relabelled.
+#define STACK_LABEL_GAP ((uint64_t)1 << 32)
+
+/// Give all the windows in the stack evenly spaced labels. O(n), but only needed once
+/// there is no room between two labels.
+static void win_stack_relabel(session_t *ps) {
+	uint64_t nwindows = 0;
+	list_foreach(struct win, w, &ps->window_stack, stack_neighbour) {
+		nwindows++;
+	}
+	uint64_t label = nwindows * STACK_LABEL_GAP;
+	list_foreach(struct win, w, &ps->window_stack, stack_neighbour) {
+		w->stack_label = label;
+		label -= STACK_LABEL_GAP;
+	}
+	log_debug("Relabelled the window stack, %" PRIu64 " windows", nwindows);
+	// The label the topmost invalidated window had means nothing now
+	ps->reg_ignore_dirty_label = UINT64_MAX;
+}
+
+/// Give window `w` a label that fits between its neighbours, after it has been inserted
+/// into or moved in the stack. Amortized O(1).
+static void win_stack_update_label(session_t *ps, struct win *w) {
+	// The window above has a larger label, the one below a smaller one
+	uint64_t above = UINT64_MAX, below = 0;
+	if (w->stack_neighbour.prev != &ps->window_stack) {
+		above = list_entry(w->stack_neighbour.prev, struct win, stack_neighbour)
+		            ->stack_label;
+	}
+	if (!list_node_is_last(&ps->window_stack, &w->stack_neighbour)) {
+		below = list_next_entry(w, stack_neighbour)->stack_label;
+	}
+
+	if (above == UINT64_MAX && UINT64_MAX - below > STACK_LABEL_GAP) {
+		// New top of the stack, keep it evenly spaced so following windows
+		// restacked to the top don't run out of room
+		w->stack_label = below + STACK_LABEL_GAP;
+	} else if (above - below >= 2) {
+		w->stack_label = below + (above - below) / 2;
+	} else {
+		win_stack_relabel(ps);
+	}
 }
 
 /// Insert a new window after list_node `prev`
@@ -1376,6 +1783,7 @@ static struct win *add_win(session_t *ps, xcb_window_t id, struct list_node *pre
 
 	auto new_w = cmalloc(struct win);
 	list_insert_after(prev, &new_w->stack_neighbour);
+	win_stack_update_label(ps, new_w);
 	new_w->id = id;
 	new_w->managed = false;
 	new_w->is_new = true;
@@ -1411,18 +1819,36 @@ struct win *add_win_above(session_t *ps, xcb_window_t id, xcb_window_t below) {
 	}
 }
 
+/// Send the window attribute and geometry requests fill_win_with_requests needs
+struct fill_win_request fill_win_send_requests(session_t *ps, const struct win *w) {
+	return (struct fill_win_request){
+	    .attributes = xcb_get_window_attributes(ps->c, w->id),
+	    .geometry = xcb_get_geometry(ps->c, w->id),
+	};
+}
+
+struct win *fill_win(session_t *ps, struct win *w) {
+	return fill_win_with_requests(ps, w, fill_win_send_requests(ps, w));
+}
+
 /// Query the Xorg for information about window `win`
 /// `win` pointer might become invalid after this function returns
 /// Returns the pointer to the window, might be different from `w`
-struct win *fill_win(session_t *ps, struct win *w) {
+struct win *
+fill_win_with_requests(session_t *ps, struct win *w, struct fill_win_request req) {
 	static const struct managed_win win_def = {
 	    // No need to initialize. (or, you can think that
 	    // they are initialized right here).
 	    // The following ones are updated during paint or paint preprocess
 	    .shadow_opacity = 0.0,
 	    .to_paint = false,
+	    .occluded = false,
+	    .occluded_since = 0,
+	    .last_painted = 0,
 	    .frame_opacity = 1.0,
 	    .dim = false,
+	    .dim_level = 0,
+	    .dim_animation = {0},
 	    .invert_color = false,
 	    .blur_background = false,
 	    .reg_ignore = NULL,
@@ -1436,6 +1862,8 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	                                           // change
 	    .stale_props = NULL,
 	    .stale_props_capacity = 0,
+	    .nprop_requests = 0,
+	    .c2_state = {0},
 
 	    // Runtime variables, updated by dbus
 	    .fade_force = UNSET,
@@ -1460,6 +1888,10 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	    // is mapped
 	    .win_image = NULL,
 	    .shadow_image = NULL,
+	    .shadow_from_template = false,
+	    .blur_cache = {.image = NULL},
+	    .content_damage = {0},
+	    .content_changed = false,
 	    .prev_trans = NULL,
 	    .shadow = false,
 	    .clip_shadow_above = false,
@@ -1474,12 +1906,15 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	    .focused = false,
 	    .opacity = 0,
 	    .opacity_target = 0,
+	    .opacity_animation = {0},
 	    .has_opacity_prop = false,
 	    .opacity_prop = OPAQUE,
 	    .opacity_is_set = false,
 	    .opacity_set = 1,
 	    .frame_extents = MARGIN_INIT,        // in win_mark_client
 	    .bounding_shaped = false,
+	    .shape_rects = NULL,
+	    .nshape_rects = -1,
 	    .bounding_shape = {0},
 	    .rounded_corners = false,
 	    .paint_excluded = false,
@@ -1506,6 +1941,8 @@ struct win *fill_win(session_t *ps, struct win *w) {
 
 	// Reject overlay window and already added windows
 	if (w->id == ps->overlay) {
+		xcb_discard_reply(ps->c, req.attributes.sequence);
+		xcb_discard_reply(ps->c, req.geometry.sequence);
 		return w;
 	}
 
@@ -1513,13 +1950,14 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	if (duplicated_win) {
 		log_debug("Window %#010x (recorded name: %s) added multiple times", w->id,
 		          duplicated_win->name);
+		xcb_discard_reply(ps->c, req.attributes.sequence);
+		xcb_discard_reply(ps->c, req.geometry.sequence);
 		return &duplicated_win->base;
 	}
 
 	log_debug("Managing window %#010x", w->id);
-	xcb_get_window_attributes_cookie_t acookie = xcb_get_window_attributes(ps->c, w->id);
 	xcb_get_window_attributes_reply_t *a =
-	    xcb_get_window_attributes_reply(ps->c, acookie, NULL);
+	    X_REPLY(xcb_get_window_attributes_reply(ps->c, req.attributes, NULL));
 	if (!a || a->map_state == XCB_MAP_STATE_UNVIEWABLE) {
 		// Failed to get window attributes or geometry probably means
 		// the window is gone already. Unviewable means the window is
@@ -1527,6 +1965,7 @@ struct win *fill_win(session_t *ps, struct win *w) {
 		// BTW, we don't care about Input Only windows, except for stacking
 		// proposes, so we need to keep track of them still.
 		free(a);
+		xcb_discard_reply(ps->c, req.geometry.sequence);
 		return w;
 	}
 
@@ -1534,6 +1973,7 @@ struct win *fill_win(session_t *ps, struct win *w) {
 		// No need to manage this window, but we still keep it on the window stack
 		w->managed = false;
 		free(a);
+		xcb_discard_reply(ps->c, req.geometry.sequence);
 		return w;
 	}
 
@@ -1549,11 +1989,13 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	new->base.managed = true;
 	new->a = *a;
 	pixman_region32_init(&new->bounding_shape);
+	pixman_region32_init(&new->blur_cache.valid);
+	pixman_region32_init(&new->content_damage);
 
 	free(a);
 
 	xcb_generic_error_t *e;
-	auto g = xcb_get_geometry_reply(ps->c, xcb_get_geometry(ps->c, w->id), &e);
+	auto g = X_REPLY(xcb_get_geometry_reply(ps->c, req.geometry, &e));
 	if (!g) {
 		log_error_x_error(e, "Failed to get geometry of window %#010x", w->id);
 		free(e);
@@ -1571,16 +2013,14 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	free(g);
 
 	// Create Damage for window (if not Input Only)
+	//
+	// Not checked, so we don't wait for a round trip for every new window. We
+	// already know the window existed when the geometry request was handled. If it
+	// got destroyed since then, we will receive a DestroyNotify for it, and the
+	// damage object will be cleaned up along with the window.
 	new->damage = x_new_id(ps->c);
-	e = xcb_request_check(
-	    ps->c, xcb_damage_create_checked(ps->c, new->damage, w->id,
-	                                     XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY));
-	if (e) {
-		log_error_x_error(e, "Failed to create damage");
-		free(e);
-		free(new);
-		return w;
-	}
+	set_ignore_cookie(ps, xcb_damage_create(ps->c, new->damage, w->id,
+	                                        XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY));
 
 	// Set window event mask
 	xcb_change_window_attributes(
@@ -1596,6 +2036,8 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	new->client_pictfmt = NULL;
 
 	list_replace(&w->stack_neighbour, &new->base.stack_neighbour);
+	new->base.stack_label = w->stack_label;
+	win_invalidate_reg_ignore(ps, new);
 	struct win *replaced = NULL;
 	HASH_REPLACE_INT(ps->windows, id, &new->base, replaced);
 	assert(replaced == w);
@@ -1635,8 +2077,14 @@ static inline void win_set_leader(session_t *ps, struct managed_win *w, xcb_wind
 		w->leader = nleader;
 
 		// Forcefully do this to deal with the case when a child window
-		// gets mapped before parent, or when the window is a waypoint
-		clear_cache_win_leaders(ps);
+		// gets mapped before parent, or when the window is a waypoint. Windows
+		// whose leader is our client window, but which didn't find us when their
+		// cache was built, are in the group of our client window.
+		win_set_cache_leader(ps, w, XCB_NONE);
+		clear_cache_win_leaders(ps, cache_leader_old);
+		if (w->client_win != cache_leader_old) {
+			clear_cache_win_leaders(ps, w->client_win);
+		}
 
 		// Update the old and new window group and active_leader if the window
 		// could affect their state.
@@ -1661,19 +2109,21 @@ void win_update_leader(session_t *ps, struct managed_win *w) {
 
 	// Read the leader properties
 	if (ps->o.detect_transient && !leader) {
-		leader =
-		    wid_get_prop_window(ps->c, w->client_win, ps->atoms->aWM_TRANSIENT_FOR);
+		leader = win_get_prop_window(ps, w, w->client_win,
+		                             ps->atoms->aWM_TRANSIENT_FOR);
 	}
 
 	if (ps->o.detect_client_leader && !leader) {
-		leader =
-		    wid_get_prop_window(ps->c, w->client_win, ps->atoms->aWM_CLIENT_LEADER);
+		leader = win_get_prop_window(ps, w, w->client_win,
+		                             ps->atoms->aWM_CLIENT_LEADER);
 	}
 
 	win_set_leader(ps, w, leader);
 
+	// Build the cache now, so the window can be found in its group
+	xcb_window_t cache_leader = win_get_leader(ps, w);
 	log_trace("(%#010x): client %#010x, leader %#010x, cache %#010x", w->base.id,
-	          w->client_win, w->leader, win_get_leader(ps, w));
+	          w->client_win, w->leader, cache_leader);
 }
 
 /**
@@ -1683,8 +2133,7 @@ static xcb_window_t win_get_leader_raw(session_t *ps, struct managed_win *w, int
 	// Rebuild the cache if needed
 	if (!w->cache_leader && (w->client_win || w->leader)) {
 		// Leader defaults to client window
-		if (!(w->cache_leader = w->leader))
-			w->cache_leader = w->client_win;
+		win_set_cache_leader(ps, w, w->leader ? w->leader : w->client_win);
 
 		// If the leader of this window isn't itself, look for its ancestors
 		if (w->cache_leader && w->cache_leader != w->client_win) {
@@ -1694,7 +2143,8 @@ static xcb_window_t win_get_leader_raw(session_t *ps, struct managed_win *w, int
 				if (recursions > WIN_GET_LEADER_MAX_RECURSION)
 					return XCB_NONE;
 
-				w->cache_leader = win_get_leader_raw(ps, wp, recursions + 1);
+				win_set_cache_leader(
+				    ps, w, win_get_leader_raw(ps, wp, recursions + 1));
 			}
 		}
 	}
@@ -1721,7 +2171,8 @@ bool win_update_class(session_t *ps, struct managed_win *w) {
 	w->class_general = NULL;
 
 	// Retrieve the property string list
-	if (!wid_get_text_prop(ps, w->client_win, ps->atoms->aWM_CLASS, &strlst, &nstr)) {
+	if (!win_get_text_prop(ps, w, w->client_win, ps->atoms->aWM_CLASS, &strlst,
+	                       &nstr)) {
 		return false;
 	}
 
@@ -1825,47 +2276,82 @@ void win_extents(const struct managed_win *w, region_t *res) {
 gen_by_val(win_extents);
 
 /**
- * Update the out-dated bounding shape of a window.
+ * Fetch the bounding shape of a window from the X server, using the replies of the
+ * requests sent by win_prefetch_properties if there are any.
  *
- * Mark the window shape as updated
+ * @return whether the shape is different from the one we had
  */
-void win_update_bounding_shape(session_t *ps, struct managed_win *w) {
-	if (ps->shape_exists) {
-		w->bounding_shaped = win_bounding_shaped(ps, w->base.id);
+static bool win_fetch_bounding_shape(session_t *ps, struct managed_win *w) {
+	if (!ps->shape_exists) {
+		return false;
 	}
 
-	// We don't handle property updates of non-visible windows until they are mapped.
-	assert(w->state != WSTATE_UNMAPPED && w->state != WSTATE_DESTROYING &&
-	       w->state != WSTATE_UNMAPPING);
-
-	pixman_region32_clear(&w->bounding_shape);
-	// Start with the window rectangular region
-	win_get_region_local(w, &w->bounding_shape);
+	win_request_shape(ps, w);
+	w->shape_request.pending = false;
+	auto extents = X_REPLY(
+	    xcb_shape_query_extents_reply(ps->c, w->shape_request.extents, NULL));
+	bool bounding_shaped = extents && extents->bounding_shaped;
+	free(extents);
 
-	// Only request for a bounding region if the window is shaped
-	// (while loop is used to avoid goto, not an actual loop)
-	while (w->bounding_shaped) {
+	// Only need the rectangles if the window is shaped
+	xcb_shape_get_rectangles_reply_t *r = NULL;
+	if (bounding_shaped) {
 		/*
 		 * if window doesn't exist anymore,  this will generate an error
 		 * as well as not generate a region.
 		 */
+		r = X_REPLY(xcb_shape_get_rectangles_reply(
+		    ps->c, w->shape_request.rectangles, NULL));
+	} else {
+		xcb_discard_reply(ps->c, w->shape_request.rectangles.sequence);
+	}
+
+	int nrects = -1;
+	xcb_rectangle_t *rects = NULL;
+	if (r) {
+		nrects = xcb_shape_get_rectangles_rectangles_length(r);
+		rects = xcb_shape_get_rectangles_rectangles(r);
+	}
+
+	size_t size = nrects > 0 ? (size_t)nrects * sizeof(*rects) : 0;
+	bool changed = bounding_shaped != w->bounding_shaped ||
+	               nrects != w->nshape_rects ||
+	               (size && memcmp(rects, w->shape_rects, size) != 0);
+	if (changed) {
+		free(w->shape_rects);
+		w->shape_rects = NULL;
+		if (size) {
+			w->shape_rects = ccalloc(nrects, xcb_rectangle_t);
+			memcpy(w->shape_rects, rects, size);
+		}
+		w->nshape_rects = nrects;
+		w->bounding_shaped = bounding_shaped;
+	}
+	free(r);
+	return changed;
+}
 
-		xcb_shape_get_rectangles_reply_t *r = xcb_shape_get_rectangles_reply(
-		    ps->c,
-		    xcb_shape_get_rectangles(ps->c, w->base.id, XCB_SHAPE_SK_BOUNDING), NULL);
+/**
+ * Build the bounding shape region of a window from its size, and the rectangles
+ * fetched by win_fetch_bounding_shape.
+ */
+static void win_rebuild_bounding_shape(session_t *ps, struct managed_win *w) {
+	// We don't handle property updates of non-visible windows until they are mapped.
+	assert(w->state != WSTATE_UNMAPPED && w->state != WSTATE_DESTROYING &&
+	       w->state != WSTATE_UNMAPPING);
 
-		if (!r) {
-			break;
-		}
+	pixman_region32_clear(&w->bounding_shape);
+	// Start with the window rectangular region
+	win_get_region_local(w, &w->bounding_shape);
 
-		xcb_rectangle_t *xrects = xcb_shape_get_rectangles_rectangles(r);
-		int nrects = xcb_shape_get_rectangles_rectangles_length(r);
-		rect_t *rects = from_x_rects(nrects, xrects);
-		free(r);
+	// Only use the bounding region if the window is shaped
+	if (w->bounding_shaped && w->nshape_rects >= 0) {
+		auto mark = arena_mark(&tls_scratch);
+		rect_t *rects = from_x_rects(w->nshape_rects, w->shape_rects);
 
 		region_t br;
-		pixman_region32_init_rects(&br, rects, nrects);
-		free(rects);
+		pixman_region32_init_rects(&br, rects, w->nshape_rects);
+		arena_rewind(&tls_scratch, mark);
 
 		// Add border width because we are using a different origin.
 		// X thinks the top left of the inner window is the origin
@@ -1880,7 +2366,6 @@ void win_update_bounding_shape(session_t *ps, struct managed_win *w) {
 		// rectangle
 		pixman_region32_intersect(&w->bounding_shape, &w->bounding_shape, &br);
 		pixman_region32_fini(&br);
-		break;
 	}
 
 	if (w->bounding_shaped && ps->o.detect_rounded_corners) {
@@ -1893,17 +2378,29 @@ void win_update_bounding_shape(session_t *ps, struct managed_win *w) {
 	ps->pending_updates = true;
 
 	free_paint(ps, &w->paint);
-	free_paint(ps, &w->shadow_paint);
+	win_discard_shadow(ps, w);
 
 	win_on_factor_change(ps, w);
 }
 
+/**
+ * Update the out-dated bounding shape of a window.
+ *
+ * Mark the window shape as updated
+ */
+void win_update_bounding_shape(session_t *ps, struct managed_win *w) {
+	// The region depends on the size of the window as well, so it's always rebuilt
+	win_fetch_bounding_shape(ps, w);
+	win_rebuild_bounding_shape(ps, w);
+}
+
 /**
  * Reread opacity property of a window.
  */
 void win_update_opacity_prop(session_t *ps, struct managed_win *w) {
 	// get frame opacity first
-	w->has_opacity_prop = wid_get_opacity_prop(ps, w->base.id, OPAQUE, &w->opacity_prop);
+	w->has_opacity_prop =
+	    wid_get_opacity_prop(ps, w, w->base.id, OPAQUE, &w->opacity_prop);
 
 	if (w->has_opacity_prop) {
 		// opacity found
@@ -1917,15 +2414,15 @@ void win_update_opacity_prop(session_t *ps, struct managed_win *w) {
 
 	// get client opacity
 	w->has_opacity_prop =
-	    wid_get_opacity_prop(ps, w->client_win, OPAQUE, &w->opacity_prop);
+	    wid_get_opacity_prop(ps, w, w->client_win, OPAQUE, &w->opacity_prop);
 }
 
 /**
  * Retrieve frame extents from a window.
  */
 void win_update_frame_extents(session_t *ps, struct managed_win *w, xcb_window_t client) {
-	winprop_t prop = x_get_prop(ps->c, client, ps->atoms->a_NET_FRAME_EXTENTS, 4L,
-	                            XCB_ATOM_CARDINAL, 32);
+	winprop_t prop = win_get_prop(ps, w, client, ps->atoms->a_NET_FRAME_EXTENTS, 4L,
+	                              XCB_ATOM_CARDINAL, 32);
 
 	if (prop.nitems == 4) {
 		int extents[4];
@@ -1952,7 +2449,7 @@ void win_update_frame_extents(session_t *ps, struct managed_win *w, xcb_window_t
 		// If frame_opacity != 1, then frame of this window
 		// is not included in reg_ignore of underneath windows
 		if (ps->o.frame_opacity == 1 && changed) {
-			w->reg_ignore_valid = false;
+			win_invalidate_reg_ignore(ps, w);
 		}
 	}
 
@@ -1963,15 +2460,16 @@ void win_update_frame_extents(session_t *ps, struct managed_win *w, xcb_window_t
 }
 
 bool win_is_region_ignore_valid(session_t *ps, const struct managed_win *w) {
-	win_stack_foreach_managed(i, &ps->window_stack) {
-		if (i == w) {
-			break;
-		}
-		if (!i->reg_ignore_valid) {
-			return false;
-		}
-	}
-	return true;
+	// Nothing above the topmost invalidated window has changed. The topmost
+	// invalidated window could have moved since, or been destroyed, then this is
+	// just conservative.
+	return w->base.stack_label >= ps->reg_ignore_dirty_label;
+}
+
+void win_invalidate_reg_ignore(session_t *ps, struct managed_win *w) {
+	w->reg_ignore_valid = false;
+	ps->reg_ignore_dirty_label =
+	    max2(ps->reg_ignore_dirty_label, w->base.stack_label);
 }
 
 /**
@@ -1998,8 +2496,9 @@ void win_ev_stop(session_t *ps, const struct win *w) {
 /// Finish the unmapping of a window (e.g. after fading has finished).
 /// Doesn't free `w`
 static void unmap_win_finish(session_t *ps, struct managed_win *w) {
-	w->reg_ignore_valid = false;
+	win_invalidate_reg_ignore(ps, w);
 	w->state = WSTATE_UNMAPPED;
+	w->occluded = false;
 
 	// We are in unmap_win, this window definitely was viewable
 	if (ps->backend_data) {
@@ -2014,7 +2513,7 @@ static void unmap_win_finish(session_t *ps, struct managed_win *w) {
 	}
 
 	free_paint(ps, &w->paint);
-	free_paint(ps, &w->shadow_paint);
+	win_discard_shadow(ps, w);
 
 	// Try again at binding images when the window is mapped next time
 	win_clear_flags(w, WIN_FLAGS_IMAGE_ERROR);
@@ -2055,7 +2554,7 @@ static void destroy_win_finish(session_t *ps, struct win *w) {
 		 * when w is destroyed. */
 		if (next_w) {
 			rc_region_unref(&next_w->reg_ignore);
-			next_w->reg_ignore_valid = false;
+			win_invalidate_reg_ignore(ps, next_w);
 		}
 
 		if (mw == ps->active_win) {
@@ -2096,22 +2595,23 @@ static inline void restack_win(session_t *ps, struct win *w, struct list_node *n
 	}
 
 	if (mw) {
-		// This invalidates all reg_ignore below the new stack position of `w`
-		mw->reg_ignore_valid = false;
-		rc_region_unref(&mw->reg_ignore);
-
 		// This invalidates all reg_ignore below the old stack position of `w`
 		auto next_w = win_stack_find_next_managed(ps, &w->stack_neighbour);
 		if (next_w) {
-			next_w->reg_ignore_valid = false;
+			win_invalidate_reg_ignore(ps, next_w);
 			rc_region_unref(&next_w->reg_ignore);
 		}
 	}
 
 	list_move_before(&w->stack_neighbour, next);
+	win_stack_update_label(ps, w);
 
-	// add damage for this window
 	if (mw) {
+		// This invalidates all reg_ignore below the new stack position of `w`
+		win_invalidate_reg_ignore(ps, mw);
+		rc_region_unref(&mw->reg_ignore);
+
+		// add damage for this window
 		add_damage_from_win(ps, mw);
 	}
 
@@ -2216,13 +2716,17 @@ bool destroy_win_start(session_t *ps, struct win *w) {
 		// Clear some flags about stale window information. Because now the window
 		// is destroyed, we can't update them anyway.
 		win_clear_flags(mw, WIN_FLAGS_SIZE_STALE | WIN_FLAGS_POSITION_STALE |
-		                        WIN_FLAGS_PROPERTY_STALE |
+		                        WIN_FLAGS_PROPERTY_STALE | WIN_FLAGS_SHAPE_STALE |
 		                        WIN_FLAGS_FACTOR_CHANGED | WIN_FLAGS_CLIENT_STALE);
 
 		// Update state flags of a managed window
 		mw->state = WSTATE_DESTROYING;
 		mw->a.map_state = XCB_MAP_STATE_UNMAPPED;
 		mw->in_openclose = true;
+
+		// Take the window out of its group, like it's taken out of
+		// `ps->windows`, the cached leader is kept
+		win_set_cache_leader(ps, mw, mw->cache_leader);
 	}
 
 	// don't need win_ev_stop because the window is gone anyway
@@ -2247,6 +2751,7 @@ void unmap_win_start(session_t *ps, struct managed_win *w) {
 	assert(w->a._class != XCB_WINDOW_CLASS_INPUT_ONLY);
 
 	log_debug("Unmapping %#010x \"%s\"", w->base.id, w->name);
+	trace_instant(ps->trace, "unmap", w->base.id);
 
 	if (unlikely(w->state == WSTATE_DESTROYING)) {
 		log_warn("Trying to undestroy a window?");
@@ -2370,6 +2875,10 @@ void map_win_start(session_t *ps, struct managed_win *w) {
 	}
 
 	log_debug("Mapping (%#010x \"%s\")", w->base.id, w->name);
+	trace_instant(ps->trace, "map", w->base.id);
+
+	// We might have missed property changes while the window was unmapped
+	c2_window_state_clear(&w->c2_state);
 
 	assert(w->state != WSTATE_DESTROYING);
 	if (w->state != WSTATE_UNMAPPED && w->state != WSTATE_UNMAPPING) {
@@ -2564,7 +3073,8 @@ struct managed_win *find_managed_window_or_parent(session_t *ps, xcb_window_t wi
 		// xcb_query_tree probably fails if you run picom when X is somehow
 		// initializing (like add it in .xinitrc). In this case
 		// just leave it alone.
-		auto reply = xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, wid), NULL);
+		auto reply = X_REPLY(
+		    xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, wid), NULL));
 		if (reply == NULL) {
 			break;
 		}
@@ -2596,7 +3106,7 @@ static inline bool
 win_is_fullscreen_xcb(xcb_connection_t *c, const struct atom *a, const xcb_window_t w) {
 	xcb_get_property_cookie_t prop =
 	    xcb_get_property(c, 0, w, a->a_NET_WM_STATE, XCB_ATOM_ATOM, 0, 12);
-	xcb_get_property_reply_t *reply = xcb_get_property_reply(c, prop, NULL);
+	xcb_get_property_reply_t *reply = X_REPLY(xcb_get_property_reply(c, prop, NULL));
 	if (!reply) {
 		return false;
 	}
@@ -2666,6 +3176,16 @@ void win_set_properties_stale(struct managed_win *w, const xcb_atom_t *props, in
 		w->stale_props[props[i] / bits_per_element] |=
 		    1UL << (props[i] % bits_per_element);
 	}
+
+	// Replies to requests sent before might contain the old values, invalidate
+	// them so they are requested again.
+	for (int i = 0; i < w->nprop_requests; i++) {
+		for (int j = 0; j < nprops; j++) {
+			if (w->prop_requests[i].atom == props[j]) {
+				w->prop_requests[i].wid = XCB_NONE;
+			}
+		}
+	}
 	win_set_flags(w, WIN_FLAGS_PROPERTY_STALE);
 }
 
@@ -2674,6 +3194,15 @@ static void win_clear_all_properties_stale(struct managed_win *w) {
 	win_clear_flags(w, WIN_FLAGS_PROPERTY_STALE);
 }
 
+static bool win_is_property_stale(const struct managed_win *w, xcb_atom_t prop) {
+	const auto bits_per_element = sizeof(*w->stale_props) * 8;
+	if (prop >= w->stale_props_capacity * bits_per_element) {
+		return false;
+	}
+	const auto mask = 1UL << (prop % bits_per_element);
+	return w->stale_props[prop / bits_per_element] & mask;
+}
+
 static bool win_fetch_and_unset_property_stale(struct managed_win *w, xcb_atom_t prop) {
 	const auto bits_per_element = sizeof(*w->stale_props) * 8;
 	if (prop >= w->stale_props_capacity * bits_per_element) {
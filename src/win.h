@@ -14,6 +14,7 @@
 #include <GL/gl.h>
 #endif
 
+#include "animation.h"
 #include "c2.h"
 #include "compiler.h"
 #include "list.h"
@@ -25,6 +26,8 @@
 #include "x.h"
 
 struct backend_base;
+struct leader_group;
+struct shadow_job;
 typedef struct session session_t;
 typedef struct _glx_texture glx_texture_t;
 
@@ -62,6 +65,26 @@ struct window_stack_entry {
 	xcb_window_t id;
 };
 
+/// Data of a window that is going to be painted, which every frame needs.
+/// paint_preprocess puts these in an array, in painting order (bottom to top), so
+/// walking the painted windows goes through contiguous memory and only touches the big
+/// `struct managed_win` for what isn't here. Only valid until the frame is painted.
+struct win_paint_entry {
+	struct managed_win *w;
+	/// Position and size of the window, including the border
+	int x, y, widthb, heightb;
+	double opacity;
+	winmode_t mode;
+	/// Whether the background of the window is blurred
+	bool blur_background;
+	/// Whether the window has a shadow
+	bool shadow;
+	/// Borrowed from `w`
+	rc_region_t *reg_ignore;
+	void *win_image;
+	void *shadow_image;
+};
+
 /**
  * About coordinate systems
  *
@@ -80,6 +103,10 @@ struct win {
 	struct list_node stack_neighbour;
 	/// ID of the top-level frame window.
 	xcb_window_t id;
+	/// Position of the window in `window_stack`, windows higher in the stack have
+	/// larger labels. Only the order of the labels means anything, they are kept up
+	/// to date when the stack changes, see win_stack_update_label.
+	uint64_t stack_label;
 	/// Whether the window is destroyed from Xorg's perspective
 	bool destroyed : 1;
 	/// True if we just received CreateNotify, and haven't queried X for any info
@@ -90,6 +117,32 @@ struct win {
 	bool managed : 1;
 };
 
+/// A property request sent ahead of time by win_prefetch_properties
+struct win_prop_request {
+	xcb_get_property_cookie_t cookie;
+	/// The window the property is requested from, XCB_NONE if the request has been
+	/// invalidated
+	xcb_window_t wid;
+	xcb_atom_t atom;
+};
+
+/// Bounding shape requests sent ahead of time by win_prefetch_properties
+struct win_shape_request {
+	xcb_shape_query_extents_cookie_t extents;
+	xcb_shape_get_rectangles_cookie_t rectangles;
+	/// Whether the requests have been sent and their replies are not collected yet
+	bool pending;
+};
+
+/// Requests sent ahead of time for a new window, see fill_win_send_requests
+struct fill_win_request {
+	xcb_get_window_attributes_cookie_t attributes;
+	xcb_get_geometry_cookie_t geometry;
+};
+
+/// Maximum number of properties win_prefetch_properties might request for a window
+#define WIN_MAX_PROP_REQUESTS 12
+
 struct win_geometry {
 	int16_t x;
 	int16_t y;
@@ -98,12 +151,34 @@ struct win_geometry {
 	uint16_t border_width;
 };
 
+/// Blurred background of a window, copied out of the rendering buffer
+struct win_blur_cache {
+	/// The image, NULL if there is no cache
+	void *image;
+	/// Where the image is on screen, and its size
+	int x, y, width, height;
+	/// The part of the image that is up to date, in global coordinates
+	region_t valid;
+};
+
 struct managed_win {
 	struct win base;
 	/// backend data attached to this window. Only available when
 	/// `state` is not UNMAPPED
 	void *win_image;
 	void *shadow_image;
+	/// Whether `shadow_image` is a copy of the shared shadow template, see
+	/// `win_bind_shadow`
+	bool shadow_from_template;
+	/// Blurred background of the window, kept to be reused in later frames
+	struct win_blur_cache blur_cache;
+	/// Damage caused by the content of this window changing since the last paint, in
+	/// global coordinates. See `session_t::background_damage`.
+	region_t content_damage;
+	/// Whether the window received any damage since the backend was last told its
+	/// content changed. Unlike `content_damage`, this isn't clipped to what's
+	/// visible, it's set even for damage that isn't painted.
+	bool content_changed;
 	/// Pointer to the next higher window to paint.
 	struct managed_win *prev_trans;
 	/// Number of windows above this window
@@ -140,10 +215,23 @@ struct managed_win {
 	uint64_t *stale_props;
 	/// number of uint64_ts that has been allocated for stale_props
 	uint64_t stale_props_capacity;
+	/// Property requests whose replies haven't been consumed yet
+	struct win_prop_request prop_requests[WIN_MAX_PROP_REQUESTS];
+	/// Number of entries in prop_requests
+	int nprop_requests;
+	/// Properties cached for window rule matching
+	struct c2_window_state c2_state;
 
 	/// Bounding shape of the window. In local coordinates.
 	/// See above about coordinate systems.
 	region_t bounding_shape;
+	/// Rectangles of the bounding shape as the X server last sent them, used to tell
+	/// whether the shape has actually changed. -1 rectangles if the window isn't
+	/// shaped, or they couldn't be fetched.
+	xcb_rectangle_t *shape_rects;
+	int nshape_rects;
+	/// Bounding shape request whose replies haven't been consumed yet
+	struct win_shape_request shape_request;
 	/// Window flags. Definitions above.
 	uint64_t flags;
 	/// The region of screen that will be obscured when windows above is painted,
@@ -164,6 +252,13 @@ struct managed_win {
 	bool rounded_corners;
 	/// Whether this window is to be painted.
 	bool to_paint;
+	/// Whether the window was completely covered by the opaque windows above it the
+	/// last time the paint list was built. Damage of occluded windows is ignored.
+	bool occluded;
+	/// When the window became occluded
+	uint64_t occluded_since;
+	/// When the window was last put in the paint list
+	uint64_t last_painted;
 	/// Whether the window is painting excluded.
 	bool paint_excluded;
 	/// Whether the window is unredirect-if-possible excluded.
@@ -184,6 +279,11 @@ struct managed_win {
 	xcb_window_t leader;
 	/// Cached topmost window ID of the window.
 	xcb_window_t cache_leader;
+	/// The group of windows with the same cache_leader, NULL if cache_leader is not
+	/// set, or the window is being destroyed.
+	struct leader_group *leader_group;
+	/// Neighbours of this window in `leader_group`
+	struct list_node leader_group_neighbour;
 
 	// Focus-related members
 	/// Whether the window is to be considered focused.
@@ -208,6 +308,8 @@ struct managed_win {
 	double opacity_target;
 	/// Previous window opacity.
 	double opacity_target_old;
+	/// Animation of `opacity` towards `opacity_target`.
+	struct animation opacity_animation;
 	/// true if window (or client window, for broken window managers
 	/// not transferring client window's _NET_WM_OPACITY value) has opacity prop
 	bool has_opacity_prop;
@@ -251,6 +353,8 @@ struct managed_win {
 	int shadow_height;
 	/// Picture to render shadow. Affected by window size.
 	paint_t shadow_paint;
+	/// The shadow being rendered on a worker thread, see win_build_shadow.
+	struct shadow_job *shadow_job;
 	/// The value of _COMPTON_SHADOW attribute of the window. Below 0 for
 	/// none.
 	long prop_shadow;
@@ -260,6 +364,11 @@ struct managed_win {
 	// Dim-related members
 	/// Whether the window is to be dimmed.
 	bool dim;
+	/// How much the window is currently dimmed. Animated towards inactive_dim when
+	/// `dim` is set, or 0 otherwise.
+	double dim_level;
+	/// Animation of `dim_level`.
+	struct animation dim_animation;
 
 	/// Whether to invert window color.
 	bool invert_color;
@@ -281,10 +390,36 @@ struct managed_win {
 /// Process pending updates/images flags on a window. Has to be called in X critical
 /// section
 void win_process_update_flags(session_t *ps, struct managed_win *w);
+/// Send requests for all the stale properties of a window, without waiting for the
+/// replies. The replies are used the next time win_process_update_flags is called.
+void win_prefetch_properties(session_t *ps, struct managed_win *w);
 void win_process_image_flags(session_t *ps, struct managed_win *w);
-/// Bind a shadow to the window, with color `c` and shadow kernel `kernel`
+/// Bind a shadow to the window, with color `c` and shadow kernel `kernel`. If the
+/// window is big enough, the shadow is shared with other windows through
+/// `*shadow_template`, which is created if it is NULL.
 bool win_bind_shadow(struct backend_base *b, struct managed_win *w, struct color c,
-                     struct conv *kernel);
+                     struct conv *kernel, void **shadow_template);
+
+/// Size of the constant middle part of the shadow template. Shadows bigger than that
+/// are composed from multiple slices of the template.
+#define SHADOW_TEMPLATE_MIDDLE 512
+
+/// A part along one axis of a shadow composed from the shadow template
+struct shadow_slice {
+	/// Where the slice starts and ends, relative to the shadow
+	int start, end;
+	/// Where the template should be put so its content matches the slice
+	int offset;
+};
+
+/// Split one axis of a shadow into slices that can be drawn from the shadow template.
+///
+/// @param length size of the window along this axis
+/// @param band   width of the gradient at each end of the shadow
+/// @param i      index of the slice, must be less than what
+///               `shadow_template_slice_count` returns
+struct shadow_slice shadow_template_slice(int length, int band, int i);
+int shadow_template_slice_count(int length, int band);
 
 /// Start the unmap of a window. We cannot unmap immediately since we might need to fade
 /// the window out.
@@ -301,6 +436,12 @@ bool must_use destroy_win_start(session_t *ps, struct win *w);
 /// Release images bound with a window, set the *_NONE flags on the window. Only to be
 /// used when de-initializing the backend outside of win.c
 void win_release_images(struct backend_base *base, struct managed_win *w);
+/// Drop the blurred background kept for `w`
+void win_release_blur_cache(struct backend_base *base, struct managed_win *w);
+/// Release the images of a mapped window that isn't being painted, because it has been
+/// hidden behind other windows for a while, or to stay within the image memory budget.
+/// The pixmap is bound again once the window is painted.
+void win_release_hidden_images(struct backend_base *base, struct managed_win *w);
 winmode_t attr_pure win_calc_mode(const struct managed_win *w);
 void win_set_shadow_force(session_t *ps, struct managed_win *w, switch_t val);
 void win_set_fade_force(struct managed_win *w, switch_t val);
@@ -334,12 +475,17 @@ void win_recheck_client(session_t *ps, struct managed_win *w);
  */
 double attr_pure win_calc_opacity_target(session_t *ps, const struct managed_win *w);
 bool attr_pure win_should_dim(session_t *ps, const struct managed_win *w);
+/// Whether the background of a window will be blurred
+bool attr_pure win_should_blur_background(session_t *ps, const struct managed_win *w);
 void win_update_screen(int nscreens, region_t *screens, struct managed_win *w);
 /**
  * Retrieve the bounding shape of a window.
  */
 // XXX was win_border_size
 void win_update_bounding_shape(session_t *ps, struct managed_win *w);
+/// Discard the bounding shape requests of a window that haven't been consumed, because
+/// the shape changed after they were sent
+void win_discard_shape_request(session_t *ps, struct managed_win *w);
 /**
  * Check if a window has BYPASS_COMPOSITOR property set
  */
@@ -380,6 +526,12 @@ struct win *add_win_top(session_t *ps, xcb_window_t id);
 /// Query the Xorg for information about window `win`
 /// `win` pointer might become invalid after this function returns
 struct win *fill_win(session_t *ps, struct win *win);
+/// Send the requests needed by fill_win, without waiting for the replies
+struct fill_win_request fill_win_send_requests(session_t *ps, const struct win *w);
+/// Same as fill_win, but uses the requests sent by fill_win_send_requests. The replies
+/// are always consumed, even if the window turns out not to be managed.
+struct win *
+fill_win_with_requests(session_t *ps, struct win *win, struct fill_win_request req);
 /// Move window `w` to be right above `below`
 void restack_above(session_t *ps, struct win *w, xcb_window_t below);
 /// Move window `w` to the bottom of the stack
@@ -433,6 +585,10 @@ bool attr_pure win_has_alpha(const struct managed_win *w);
 /// check if reg_ignore_valid is true for all windows above us
 bool attr_pure win_is_region_ignore_valid(session_t *ps, const struct managed_win *w);
 
+/// Clear reg_ignore_valid of a window, so reg_ignore of windows beneath it will be
+/// recalculated
+void win_invalidate_reg_ignore(session_t *ps, struct managed_win *w);
+
 /// Whether a given window is mapped on the X server side
 bool win_is_mapped_in_x(const struct managed_win *w);
 
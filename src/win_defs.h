@@ -87,13 +87,14 @@ enum win_flags {
 	WIN_FLAGS_MAPPED = 64,
 	/// this window has properties which needs to be updated
 	WIN_FLAGS_PROPERTY_STALE = 128,
-	// TODO(yshui) _maybe_ split SIZE_STALE into SIZE_STALE and SHAPE_STALE
-	/// this window has an unhandled size/shape change
+	/// this window has an unhandled size change, its shape is updated as well
 	WIN_FLAGS_SIZE_STALE = 256,
 	/// this window has an unhandled position (i.e. x and y) change
 	WIN_FLAGS_POSITION_STALE = 512,
 	/// need better name for this, is set when some aspects of the window changed
 	WIN_FLAGS_FACTOR_CHANGED = 1024,
+	/// this window has an unhandled bounding shape change
+	WIN_FLAGS_SHAPE_STALE = 2048,
 };
 
 static const uint64_t WIN_FLAGS_IMAGES_STALE =
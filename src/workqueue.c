@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <ev.h>
+
+#include "compiler.h"
+#include "list.h"
+#include "log.h"
+#include "utils.h"
+#include "workqueue.h"
+
+/// Most workers we would start, the jobs are small, more threads won't help
+#define WORKQUEUE_MAX_THREADS 4
+
+struct work {
+	struct list_node siblings;
+	work_run_cb_t run;
+	work_done_cb_t done;
+	void *data;
+};
+
+struct workqueue {
+	/// Signalled by the workers when jobs are done
+	ev_async done_signal;
+	struct ev_loop *loop;
+
+	pthread_mutex_t lock;
+	/// Signalled when a job is queued, or the workers should quit
+	pthread_cond_t cond;
+	/// Jobs waiting for a worker, protected by `lock`
+	struct list_node pending;
+	/// Jobs that have run, waiting for their completion callbacks, protected by `lock`
+	struct list_node finished;
+	bool quit;
+
+	int nthreads;
+	pthread_t threads[];
+};
+
+static void *workqueue_worker(void *arg) {
+	struct workqueue *wq = arg;
+	pthread_mutex_lock(&wq->lock);
+	while (true) {
+		while (!wq->quit && list_is_empty(&wq->pending)) {
+			pthread_cond_wait(&wq->cond, &wq->lock);
+		}
+		if (wq->quit) {
+			break;
+		}
+		auto work = list_entry(wq->pending.next, struct work, siblings);
+		list_remove(&work->siblings);
+		pthread_mutex_unlock(&wq->lock);
+
+		work->run(work->data);
+
+		pthread_mutex_lock(&wq->lock);
+		list_insert_before(&wq->finished, &work->siblings);
+		ev_async_send(wq->loop, &wq->done_signal);
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return NULL;
+}
+
+/// Call the completion callbacks of all the jobs in `list`, and free them
+static void workqueue_complete(struct list_node *list) {
+	list_foreach_safe(struct work, work, list, siblings) {
+		list_remove(&work->siblings);
+		work->done(work->data);
+		free(work);
+	}
+}
+
+static void workqueue_done_cb(EV_P attr_unused, ev_async *w, int revents attr_unused) {
+	auto wq = (struct workqueue *)w;
+	struct list_node finished;
+	list_init_head(&finished);
+
+	// Take the finished jobs out, so the callbacks run without the lock
+	pthread_mutex_lock(&wq->lock);
+	if (!list_is_empty(&wq->finished)) {
+		list_replace(&wq->finished, &finished);
+		list_init_head(&wq->finished);
+	}
+	pthread_mutex_unlock(&wq->lock);
+
+	workqueue_complete(&finished);
+}
+
+int workqueue_default_nthreads(void) {
+	// Leave a core for the main thread
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus <= 1) {
+		return 1;
+	}
+	return (int)min2(ncpus - 1, WORKQUEUE_MAX_THREADS);
+}
+
+struct workqueue *workqueue_new(EV_P_ int nthreads) {
+	assert(nthreads > 0);
+	struct workqueue *wq =
+	    cvalloc(sizeof(struct workqueue) + sizeof(pthread_t) * (size_t)nthreads);
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->cond, NULL);
+	list_init_head(&wq->pending);
+	list_init_head(&wq->finished);
+	wq->quit = false;
+	wq->nthreads = 0;
+	wq->loop = EV_A;
+
+	ev_async_init(&wq->done_signal, workqueue_done_cb);
+	ev_async_start(EV_A_ & wq->done_signal);
+
+	for (int i = 0; i < nthreads; i++) {
+		if (pthread_create(&wq->threads[i], NULL, workqueue_worker, wq) != 0) {
+			log_warn("Failed to start worker thread %d", i);
+			break;
+		}
+		wq->nthreads++;
+	}
+	if (wq->nthreads == 0) {
+		log_error("Failed to start any worker thread");
+		workqueue_destroy(EV_A_ wq);
+		return NULL;
+	}
+	log_debug("Started %d worker threads", wq->nthreads);
+	return wq;
+}
+
+void workqueue_submit(struct workqueue *wq, work_run_cb_t run, work_done_cb_t done,
+                      void *data) {
+	auto work = ccalloc(1, struct work);
+	work->run = run;
+	work->done = done;
+	work->data = data;
+
+	pthread_mutex_lock(&wq->lock);
+	list_insert_before(&wq->pending, &work->siblings);
+	pthread_cond_signal(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+void workqueue_destroy(EV_P_ struct workqueue *wq) {
+	pthread_mutex_lock(&wq->lock);
+	wq->quit = true;
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+	for (int i = 0; i < wq->nthreads; i++) {
+		pthread_join(wq->threads[i], NULL);
+	}
+	ev_async_stop(EV_A_ & wq->done_signal);
+
+	// No one else is using the queue now
+	workqueue_complete(&wq->finished);
+	workqueue_complete(&wq->pending);
+
+	pthread_cond_destroy(&wq->cond);
+	pthread_mutex_destroy(&wq->lock);
+	free(wq);
+}
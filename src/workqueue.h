@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+#include <ev.h>
+
+/// A small pool of worker threads, for CPU heavy work that doesn't need X or the
+/// session, like rendering shadows. Jobs are run on the workers, then their completion
+/// callbacks are called in the libev loop, on the thread that owns the queue.
+///
+/// Jobs must not log, or touch anything the main thread might be using, the main thread
+/// should only look at a job's data again in its completion callback.
+struct workqueue;
+
+/// Runs on a worker thread
+typedef void (*work_run_cb_t)(void *data);
+/// Runs on the main thread, after `work_run_cb_t` returned. `data` is owned by the
+/// callback from here on.
+typedef void (*work_done_cb_t)(void *data);
+
+struct workqueue *workqueue_new(EV_P_ int nthreads);
+/// Queue a job. `done` is always called eventually, even if the queue is destroyed
+/// before `run` gets to run.
+void workqueue_submit(struct workqueue *, work_run_cb_t run, work_done_cb_t done,
+                      void *data);
+/// Stop the workers, and call the completion callbacks of all remaining jobs, whether
+/// they have run or not.
+void workqueue_destroy(EV_P_ struct workqueue *);
+
+/// Number of worker threads to use on this machine
+int workqueue_default_nthreads(void);
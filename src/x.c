@@ -1,8 +1,14 @@
 // SPDX-License-Identifier: MPL-2.0
 // Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#include <inttypes.h>
 #include <stdalign.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
 
 #include <X11/Xutil.h>
 #include <pixman.h>
@@ -10,6 +16,7 @@
 #include <xcb/damage.h>
 #include <xcb/glx.h>
 #include <xcb/render.h>
+#include <xcb/shm.h>
 #include <xcb/sync.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_renderutil.h>
@@ -44,11 +51,14 @@
  */
 winprop_t x_get_prop_with_offset(xcb_connection_t *c, xcb_window_t w, xcb_atom_t atom,
                                  int offset, int length, xcb_atom_t rtype, int rformat) {
-	xcb_get_property_reply_t *r = xcb_get_property_reply(
-	    c,
-	    xcb_get_property(c, 0, w, atom, rtype, to_u32_checked(offset),
-	                     to_u32_checked(length)),
-	    NULL);
+	auto cookie = xcb_get_property(c, 0, w, atom, rtype, to_u32_checked(offset),
+	                               to_u32_checked(length));
+	return x_get_prop_reply(c, cookie, rtype, rformat);
+}
+
+winprop_t x_get_prop_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie,
+                           xcb_atom_t rtype, int rformat) {
+	xcb_get_property_reply_t *r = X_REPLY(xcb_get_property_reply(c, cookie, NULL));
 
 	if (r && xcb_get_property_value_length(r) &&
 	    (rtype == XCB_GET_PROPERTY_TYPE_ANY || r->type == rtype) &&
@@ -72,8 +82,8 @@ winprop_t x_get_prop_with_offset(xcb_connection_t *c, xcb_window_t w, xcb_atom_t
 /// Get the type, format and size in bytes of a window's specific attribute.
 winprop_info_t x_get_prop_info(xcb_connection_t *c, xcb_window_t w, xcb_atom_t atom) {
 	xcb_generic_error_t *e = NULL;
-	auto r = xcb_get_property_reply(
-	    c, xcb_get_property(c, 0, w, atom, XCB_ATOM_ANY, 0, 0), &e);
+	auto r = X_REPLY(xcb_get_property_reply(
+	    c, xcb_get_property(c, 0, w, atom, XCB_ATOM_ANY, 0, 0), &e));
 	if (!r) {
 		log_debug_x_error(e, "Failed to get property info for window %#010x", w);
 		free(e);
@@ -108,17 +118,9 @@ xcb_window_t wid_get_prop_window(xcb_connection_t *c, xcb_window_t wid, xcb_atom
 	return p;
 }
 
-/**
- * Get the value of a text property of a window.
- */
-bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char ***pstrlst,
-                       int *pnstr) {
-	assert(ps->server_grabbed);
-	auto prop_info = x_get_prop_info(ps->c, wid, prop);
-	auto type = prop_info.type;
-	auto format = prop_info.format;
-	auto length = prop_info.length;
-
+/// Check the type and format of a text property
+static bool x_check_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop,
+                              xcb_atom_t type, uint8_t format) {
 	if (type == XCB_ATOM_NONE) {
 		return false;
 	}
@@ -135,19 +137,13 @@ bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char **
 		         prop, wid, format);
 		return false;
 	}
+	return true;
+}
 
-	xcb_generic_error_t *e = NULL;
-	auto word_count = (length + 4 - 1) / 4;
-	auto r = xcb_get_property_reply(
-	    ps->c, xcb_get_property(ps->c, 0, wid, prop, type, 0, word_count), &e);
-	if (!r) {
-		log_debug_x_error(e, "Failed to get window property for %#010x", wid);
-		free(e);
-		return false;
-	}
-
-	assert(length == (uint32_t)xcb_get_property_value_length(r));
-
+/// Split the value of a text property into a list of strings.
+static bool
+x_text_prop_to_strlst(const xcb_get_property_reply_t *r, char ***pstrlst, int *pnstr) {
+	auto length = (uint32_t)xcb_get_property_value_length(r);
 	void *data = xcb_get_property_value(r);
 	unsigned int nstr = 0;
 	uint32_t current_offset = 0;
@@ -164,7 +160,6 @@ bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char **
 		strlst[0] = "";
 		*pnstr = 1;
 		*pstrlst = strlst;
-		free(r);
 		return true;
 	}
 
@@ -189,10 +184,76 @@ bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char **
 
 	*pnstr = to_int_checked(nstr);
 	*pstrlst = ret;
-	free(r);
 	return true;
 }
 
+/**
+ * Get the value of a text property of a window.
+ */
+bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char ***pstrlst,
+                       int *pnstr) {
+	assert(ps->server_grabbed);
+	auto prop_info = x_get_prop_info(ps->c, wid, prop);
+	auto type = prop_info.type;
+	auto format = prop_info.format;
+	auto length = prop_info.length;
+
+	if (!x_check_text_prop(ps, wid, prop, type, format)) {
+		return false;
+	}
+
+	xcb_generic_error_t *e = NULL;
+	auto word_count = (length + 4 - 1) / 4;
+	auto r = X_REPLY(xcb_get_property_reply(
+	    ps->c, xcb_get_property(ps->c, 0, wid, prop, type, 0, word_count), &e));
+	if (!r) {
+		log_debug_x_error(e, "Failed to get window property for %#010x", wid);
+		free(e);
+		return false;
+	}
+
+	assert(length == (uint32_t)xcb_get_property_value_length(r));
+	bool ret = x_text_prop_to_strlst(r, pstrlst, pnstr);
+	free(r);
+	return ret;
+}
+
+bool wid_get_text_prop_reply(session_t *ps, xcb_window_t wid, xcb_atom_t prop,
+                             xcb_get_property_cookie_t cookie, char ***pstrlst,
+                             int *pnstr) {
+	xcb_generic_error_t *e = NULL;
+	auto r = X_REPLY(xcb_get_property_reply(ps->c, cookie, &e));
+	if (!r) {
+		log_debug_x_error(e, "Failed to get window property for %#010x", wid);
+		free(e);
+		return false;
+	}
+
+	if (!x_check_text_prop(ps, wid, prop, r->type, r->format)) {
+		free(r);
+		return false;
+	}
+
+	if (r->bytes_after) {
+		// The property is longer than what we asked for, fall back to fetching
+		// it synchronously.
+		free(r);
+		return wid_get_text_prop(ps, wid, prop, pstrlst, pnstr);
+	}
+	bool ret = x_text_prop_to_strlst(r, pstrlst, pnstr);
+	free(r);
+	return ret;
+}
+
+bool wid_get_text_prop_from_reply(session_t *ps, xcb_window_t wid, xcb_atom_t prop,
+                                  const xcb_get_property_reply_t *r, char ***pstrlst,
+                                  int *pnstr) {
+	if (!x_check_text_prop(ps, wid, prop, r->type, r->format)) {
+		return false;
+	}
+	return x_text_prop_to_strlst(r, pstrlst, pnstr);
+}
+
 // A cache of pict formats. We assume they don't change during the lifetime
 // of this program
 static thread_local xcb_render_query_pict_formats_reply_t *g_pictfmts = NULL;
@@ -203,23 +264,39 @@ static inline void x_get_server_pictfmts(xcb_connection_t *c) {
 	}
 	xcb_generic_error_t *e = NULL;
 	// Get window picture format
-	g_pictfmts =
-	    xcb_render_query_pict_formats_reply(c, xcb_render_query_pict_formats(c), &e);
+	g_pictfmts = X_REPLY(
+	    xcb_render_query_pict_formats_reply(c, xcb_render_query_pict_formats(c), &e));
 	if (e || !g_pictfmts) {
 		log_fatal("failed to get pict formats\n");
 		abort();
 	}
 }
 
+// Visuals are looked up every time a window is mapped, remember what we found instead of
+// searching through the server's lists again. Like the pict formats, we assume these
+// don't change.
+static thread_local struct icache *g_visual_pictfmts = NULL;
+static thread_local struct icache *g_visual_depths = NULL;
+
 const xcb_render_pictforminfo_t *
 x_get_pictform_for_visual(xcb_connection_t *c, xcb_visualid_t visual) {
 	x_get_server_pictfmts(c);
+	if (!g_visual_pictfmts) {
+		g_visual_pictfmts = new_icache();
+	}
+	uint64_t cached;
+	if (visual != XCB_NONE && icache_get(g_visual_pictfmts, visual, &cached)) {
+		return (const xcb_render_pictforminfo_t *)(uintptr_t)cached;
+	}
 
 	xcb_render_pictvisual_t *pv = xcb_render_util_find_visual_format(g_pictfmts, visual);
 	for (xcb_render_pictforminfo_iterator_t i =
 	         xcb_render_query_pict_formats_formats_iterator(g_pictfmts);
 	     i.rem; xcb_render_pictforminfo_next(&i)) {
 		if (i.data->id == pv->format) {
+			if (visual != XCB_NONE) {
+				icache_set(g_visual_pictfmts, visual, (uintptr_t)i.data);
+			}
 			return i.data;
 		}
 	}
@@ -261,6 +338,14 @@ x_get_pictfmt_for_standard(xcb_connection_t *c, xcb_pict_standard_t std) {
 }
 
 int x_get_visual_depth(xcb_connection_t *c, xcb_visualid_t visual) {
+	if (!g_visual_depths) {
+		g_visual_depths = new_icache();
+	}
+	uint64_t cached;
+	if (visual != XCB_NONE && icache_get(g_visual_depths, visual, &cached)) {
+		return (int)cached;
+	}
+
 	auto setup = xcb_get_setup(c);
 	for (auto screen = xcb_setup_roots_iterator(setup); screen.rem;
 	     xcb_screen_next(&screen)) {
@@ -270,6 +355,10 @@ int x_get_visual_depth(xcb_connection_t *c, xcb_visualid_t visual) {
 			const xcb_visualtype_t *visuals = xcb_depth_visuals(depth.data);
 			for (int i = 0; i < len; i++) {
 				if (visual == visuals[i].visual_id) {
+					if (visual != XCB_NONE) {
+						icache_set(g_visual_depths, visual,
+						           depth.data->depth);
+					}
 					return depth.data->depth;
 				}
 			}
@@ -278,6 +367,20 @@ int x_get_visual_depth(xcb_connection_t *c, xcb_visualid_t visual) {
 	return -1;
 }
 
+void x_free_visual_caches(void) {
+	if (g_visual_pictfmts) {
+		icache_free(g_visual_pictfmts, NULL, NULL);
+		g_visual_pictfmts = NULL;
+	}
+	if (g_visual_depths) {
+		icache_free(g_visual_depths, NULL, NULL);
+		g_visual_depths = NULL;
+	}
+	// The cached pict formats point into this reply
+	free(g_pictfmts);
+	g_pictfmts = NULL;
+}
+
 xcb_render_picture_t
 x_create_picture_with_pictfmt_and_pixmap(xcb_connection_t *c,
                                          const xcb_render_pictforminfo_t *pictfmt,
@@ -293,9 +396,9 @@ x_create_picture_with_pictfmt_and_pixmap(xcb_connection_t *c,
 	}
 
 	xcb_render_picture_t tmp_picture = x_new_id(c);
-	xcb_generic_error_t *e =
-	    xcb_request_check(c, xcb_render_create_picture_checked(
-	                             c, tmp_picture, pixmap, pictfmt->id, valuemask, buf));
+	xcb_generic_error_t *e = X_REPLY(xcb_request_check(
+	    c, xcb_render_create_picture_checked(c, tmp_picture, pixmap, pictfmt->id,
+	                                         valuemask, buf)));
 	free(buf);
 	if (e) {
 		log_error_x_error(e, "failed to create picture");
@@ -365,16 +468,22 @@ x_create_picture_with_visual(xcb_connection_t *c, xcb_drawable_t d, int w, int h
 }
 
 bool x_fetch_region(xcb_connection_t *c, xcb_xfixes_region_t r, pixman_region32_t *res) {
+	return x_fetch_region_reply(c, xcb_xfixes_fetch_region(c, r), res);
+}
+
+bool x_fetch_region_reply(xcb_connection_t *c, xcb_xfixes_fetch_region_cookie_t cookie,
+                          pixman_region32_t *res) {
 	xcb_generic_error_t *e = NULL;
 	xcb_xfixes_fetch_region_reply_t *xr =
-	    xcb_xfixes_fetch_region_reply(c, xcb_xfixes_fetch_region(c, r), &e);
+	    X_REPLY(xcb_xfixes_fetch_region_reply(c, cookie, &e));
 	if (!xr) {
 		log_error_x_error(e, "Failed to fetch rectangles");
 		return false;
 	}
 
 	int nrect = xcb_xfixes_fetch_region_rectangles_length(xr);
-	auto b = ccalloc(nrect, pixman_box32_t);
+	auto mark = arena_mark(&tls_scratch);
+	auto b = arena_new(&tls_scratch, pixman_box32_t, nrect);
 	xcb_rectangle_t *xrect = xcb_xfixes_fetch_region_rectangles(xr);
 	for (int i = 0; i < nrect; i++) {
 		b[i] = (pixman_box32_t){.x1 = xrect[i].x,
@@ -383,18 +492,16 @@ bool x_fetch_region(xcb_connection_t *c, xcb_xfixes_region_t r, pixman_region32_
 		                        .y2 = xrect[i].y + xrect[i].height};
 	}
 	bool ret = pixman_region32_init_rects(res, b, nrect);
-	free(b);
+	arena_rewind(&tls_scratch, mark);
 	free(xr);
 	return ret;
 }
 
-void x_set_picture_clip_region(xcb_connection_t *c, xcb_render_picture_t pict,
-                               int16_t clip_x_origin, int16_t clip_y_origin,
-                               const region_t *reg) {
-	int nrects;
-	const rect_t *rects = pixman_region32_rectangles((region_t *)reg, &nrects);
-	auto xrects = ccalloc(nrects, xcb_rectangle_t);
-	for (int i = 0; i < nrects; i++) {
+/// Convert a region to X rectangles. The returned array is allocated from tls_scratch.
+static xcb_rectangle_t *x_rectangles_from_region(const region_t *reg, int *nrects) {
+	const rect_t *rects = pixman_region32_rectangles((region_t *)reg, nrects);
+	auto xrects = arena_new(&tls_scratch, xcb_rectangle_t, *nrects);
+	for (int i = 0; i < *nrects; i++) {
 		xrects[i] = (xcb_rectangle_t){
 		    .x = to_i16_checked(rects[i].x1),
 		    .y = to_i16_checked(rects[i].y1),
@@ -402,21 +509,39 @@ void x_set_picture_clip_region(xcb_connection_t *c, xcb_render_picture_t pict,
 		    .height = to_u16_checked(rects[i].y2 - rects[i].y1),
 		};
 	}
+	return xrects;
+}
 
-	xcb_generic_error_t *e = xcb_request_check(
+void x_set_region(xcb_connection_t *c, xcb_xfixes_region_t dst, const region_t *reg) {
+	int nrects;
+	auto mark = arena_mark(&tls_scratch);
+	auto xrects = x_rectangles_from_region(reg, &nrects);
+	xcb_xfixes_set_region(c, dst, to_u32_checked(nrects), xrects);
+	arena_rewind(&tls_scratch, mark);
+}
+
+void x_set_picture_clip_region(xcb_connection_t *c, xcb_render_picture_t pict,
+                               int16_t clip_x_origin, int16_t clip_y_origin,
+                               const region_t *reg) {
+	int nrects;
+	auto mark = arena_mark(&tls_scratch);
+	auto xrects = x_rectangles_from_region(reg, &nrects);
+
+	xcb_generic_error_t *e = X_REPLY(xcb_request_check(
 	    c, xcb_render_set_picture_clip_rectangles_checked(
-	           c, pict, clip_x_origin, clip_y_origin, to_u32_checked(nrects), xrects));
+	           c, pict, clip_x_origin, clip_y_origin, to_u32_checked(nrects),
+	           xrects)));
 	if (e) {
 		log_error_x_error(e, "Failed to set clip region");
 		free(e);
 	}
-	free(xrects);
+	arena_rewind(&tls_scratch, mark);
 }
 
 void x_clear_picture_clip_region(xcb_connection_t *c, xcb_render_picture_t pict) {
 	xcb_render_change_picture_value_list_t v = {.clipmask = XCB_NONE};
-	xcb_generic_error_t *e = xcb_request_check(
-	    c, xcb_render_change_picture(c, pict, XCB_RENDER_CP_CLIP_MASK, &v));
+	xcb_generic_error_t *e = X_REPLY(xcb_request_check(
+	    c, xcb_render_change_picture(c, pict, XCB_RENDER_CP_CLIP_MASK, &v)));
 	if (e) {
 		log_error_x_error(e, "failed to clear clip region");
 		free(e);
@@ -552,7 +677,7 @@ xcb_pixmap_t x_create_pixmap(xcb_connection_t *c, uint8_t depth, xcb_drawable_t
 	xcb_pixmap_t pix = x_new_id(c);
 	xcb_void_cookie_t cookie = xcb_create_pixmap_checked(
 	    c, depth, pix, drawable, to_u16_checked(width), to_u16_checked(height));
-	xcb_generic_error_t *err = xcb_request_check(c, cookie);
+	xcb_generic_error_t *err = X_REPLY(xcb_request_check(c, cookie));
 	if (err == NULL) {
 		return pix;
 	}
@@ -562,6 +687,104 @@ xcb_pixmap_t x_create_pixmap(xcb_connection_t *c, uint8_t depth, xcb_drawable_t
 	return XCB_NONE;
 }
 
+// Whether uploading images with MIT-SHM didn't work before, so we stop trying
+static thread_local bool g_shm_unusable = false;
+
+/// Whether the X server runs on this machine, so it could map our shared memory
+static bool x_is_local(xcb_connection_t *c) {
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if (getsockname(xcb_get_file_descriptor(c), (struct sockaddr *)&addr, &len) < 0) {
+		return false;
+	}
+	return addr.ss_family == AF_UNIX;
+}
+
+/// Upload an image through a MIT-SHM segment, so the image data doesn't have to go
+/// through the X connection. Returns false if nothing was uploaded.
+static bool x_shm_put_image(xcb_connection_t *c, xcb_drawable_t drawable,
+                            xcb_gcontext_t gc, const xcb_image_t *image, int16_t dst_x,
+                            int16_t dst_y) {
+	if (g_shm_unusable) {
+		return false;
+	}
+	auto ext = xcb_get_extension_data(c, &xcb_shm_id);
+	if (!ext || !ext->present || !x_is_local(c)) {
+		log_debug("MIT-SHM is not usable, images are sent over the X connection");
+		g_shm_unusable = true;
+		return false;
+	}
+
+	int shmid = shmget(IPC_PRIVATE, image->size, IPC_CREAT | 0600);
+	if (shmid < 0) {
+		log_debug("Failed to create a shared memory segment of %u bytes",
+		          image->size);
+		return false;
+	}
+	void *data = shmat(shmid, NULL, 0);
+	if (data == (void *)-1) {
+		shmctl(shmid, IPC_RMID, NULL);
+		return false;
+	}
+	memcpy(data, image->data, image->size);
+
+	xcb_shm_seg_t seg = x_new_id(c);
+	auto e = X_REPLY(
+	    xcb_request_check(c, xcb_shm_attach_checked(c, seg, (uint32_t)shmid, true)));
+	// Once the X server has attached the segment, it is only freed after the
+	// server detaches it too.
+	shmctl(shmid, IPC_RMID, NULL);
+	if (e) {
+		log_debug("The X server can't attach our shared memory, images are sent "
+		          "over the X connection");
+		free(e);
+		shmdt(data);
+		g_shm_unusable = true;
+		return false;
+	}
+
+	xcb_shm_put_image(c, drawable, gc, image->width, image->height, 0, 0,
+	                  image->width, image->height, dst_x, dst_y, image->depth,
+	                  (uint8_t)image->format, 0, seg, 0);
+	xcb_shm_detach(c, seg);
+	shmdt(data);
+	return true;
+}
+
+bool x_put_image(xcb_connection_t *c, xcb_drawable_t drawable, xcb_gcontext_t gc,
+                 const xcb_image_t *image, int16_t dst_x, int16_t dst_y) {
+	if (x_shm_put_image(c, drawable, gc, image, dst_x, dst_y)) {
+		return true;
+	}
+
+	// We need to make room for protocol metadata in the request. The metadata should
+	// be 24 bytes plus padding, let's be generous and give it 1kb
+	auto maximum_image_size = xcb_get_maximum_request_length(c) * 4 - 1024;
+	auto maximum_row =
+	    to_u16_checked(clamp(maximum_image_size / image->stride, 0, UINT16_MAX));
+	if (maximum_row <= 0) {
+		log_error("X server request size limit is too restrictive, or the image "
+		          "is too wide for us to send a single row of it. Image size: "
+		          "%dx%d",
+		          image->width, image->height);
+		return false;
+	}
+
+	for (uint32_t row = 0; row < image->height; row += maximum_row) {
+		auto batch_height = maximum_row;
+		if (batch_height > image->height - row) {
+			batch_height = to_u16_checked(image->height - row);
+		}
+
+		uint32_t offset = row * image->stride / sizeof(*image->data);
+		xcb_put_image(c, (uint8_t)image->format, drawable, gc, image->width,
+		              batch_height, dst_x, to_i16_checked(dst_y + (int)row), 0,
+		              image->depth, image->stride * batch_height,
+		              image->data + offset);
+	}
+	return true;
+}
+
 /**
  * Validate a pixmap.
  *
@@ -573,7 +796,7 @@ bool x_validate_pixmap(xcb_connection_t *c, xcb_pixmap_t pixmap) {
 		return false;
 	}
 
-	auto r = xcb_get_geometry_reply(c, xcb_get_geometry(c, pixmap), NULL);
+	auto r = X_REPLY(xcb_get_geometry_reply(c, xcb_get_geometry(c, pixmap), NULL));
 	if (!r) {
 		return false;
 	}
@@ -582,22 +805,21 @@ bool x_validate_pixmap(xcb_connection_t *c, xcb_pixmap_t pixmap) {
 	free(r);
 	return ret;
 }
-/// Names of root window properties that could point to a pixmap of
-/// background.
-static const char *background_props_str[] = {
-    "_XROOTPMAP_ID",
-    "_XSETROOT_ID",
-    0,
-};
+/// Get the root window properties that could point to a pixmap of background.
+static inline void x_background_props(const struct atom *atoms, xcb_atom_t props[2]) {
+	props[0] = atoms->a_XROOTPMAP_ID;
+	props[1] = atoms->a_XSETROOT_ID;
+}
 
 xcb_pixmap_t
 x_get_root_back_pixmap(xcb_connection_t *c, xcb_window_t root, struct atom *atoms) {
 	xcb_pixmap_t pixmap = XCB_NONE;
+	xcb_atom_t props[2];
+	x_background_props(atoms, props);
 
 	// Get the values of background attributes
-	for (int p = 0; background_props_str[p]; p++) {
-		xcb_atom_t prop_atom = get_atom(atoms, background_props_str[p]);
-		winprop_t prop = x_get_prop(c, root, prop_atom, 1, XCB_ATOM_PIXMAP, 32);
+	for (size_t p = 0; p < ARR_SIZE(props); p++) {
+		winprop_t prop = x_get_prop(c, root, props[p], 1, XCB_ATOM_PIXMAP, 32);
 		if (prop.nitems) {
 			pixmap = (xcb_pixmap_t)*prop.p32;
 			free_winprop(&prop);
@@ -610,9 +832,10 @@ x_get_root_back_pixmap(xcb_connection_t *c, xcb_window_t root, struct atom *atom
 }
 
 bool x_is_root_back_pixmap_atom(struct atom *atoms, xcb_atom_t atom) {
-	for (int p = 0; background_props_str[p]; p++) {
-		xcb_atom_t prop_atom = get_atom(atoms, background_props_str[p]);
-		if (prop_atom == atom) {
+	xcb_atom_t props[2];
+	x_background_props(atoms, props);
+	for (size_t p = 0; p < ARR_SIZE(props); p++) {
+		if (props[p] == atom) {
 			return true;
 		}
 	}
@@ -623,38 +846,63 @@ bool x_is_root_back_pixmap_atom(struct atom *atoms, xcb_atom_t atom) {
  * Synchronizes a X Render drawable to ensure all pending painting requests
  * are completed.
  */
-bool x_fence_sync(xcb_connection_t *c, xcb_sync_fence_t f) {
-	// TODO(richardgv): If everybody just follows the rules stated in X Sync
-	// prototype, we need only one fence per screen, but let's stay a bit
-	// cautious right now
-
-	auto e = xcb_request_check(c, xcb_sync_trigger_fence_checked(c, f));
-	if (e) {
-		log_error_x_error(e, "Failed to trigger the fence");
-		goto err;
+bool x_fence_ring_init(xcb_connection_t *c, xcb_drawable_t drawable,
+                       struct x_fence_ring *ring) {
+	*ring = (struct x_fence_ring){.curr = X_FENCE_RING_SIZE - 1};
+	xcb_void_cookie_t cookies[X_FENCE_RING_SIZE];
+	for (int i = 0; i < X_FENCE_RING_SIZE; i++) {
+		ring->fences[i] = x_new_id(c);
+		cookies[i] = xcb_sync_create_fence_checked(c, drawable, ring->fences[i], 0);
 	}
-
-	e = xcb_request_check(c, xcb_sync_await_fence_checked(c, 1, &f));
-	if (e) {
-		log_error_x_error(e, "Failed to await on a fence");
-		goto err;
+	// Only the first request check is a round trip
+	bool ret = true;
+	for (int i = 0; i < X_FENCE_RING_SIZE; i++) {
+		auto e = X_REPLY(xcb_request_check(c, cookies[i]));
+		if (e) {
+			log_error_x_error(e, "Failed to create a XSync fence");
+			ring->fences[i] = XCB_NONE;
+			free(e);
+			ret = false;
+		}
 	}
+	if (!ret) {
+		x_fence_ring_deinit(c, ring);
+	}
+	return ret;
+}
 
-	e = xcb_request_check(c, xcb_sync_reset_fence_checked(c, f));
-	if (e) {
-		log_error_x_error(e, "Failed to reset the fence");
-		goto err;
+void x_fence_ring_deinit(xcb_connection_t *c, struct x_fence_ring *ring) {
+	for (int i = 0; i < X_FENCE_RING_SIZE; i++) {
+		if (ring->fences[i] != XCB_NONE) {
+			xcb_sync_destroy_fence(c, ring->fences[i]);
+			ring->fences[i] = XCB_NONE;
+		}
 	}
-	return true;
+}
 
-err:
-	free(e);
-	return false;
+xcb_sync_fence_t x_fence_ring_trigger(xcb_connection_t *c, struct x_fence_ring *ring) {
+	int i = (ring->curr + 1) % X_FENCE_RING_SIZE;
+	auto f = ring->fences[i];
+	if (ring->triggered[i]) {
+		// Resetting a fence that isn't triggered yet is an error. It's been
+		// several frames, so waiting for it shouldn't hold anything up.
+		if (!ring->awaited[i]) {
+			xcb_sync_await_fence(c, 1, &f);
+		}
+		xcb_sync_reset_fence(c, f);
+	}
+	xcb_sync_trigger_fence(c, f);
+	ring->triggered[i] = true;
+	ring->awaited[i] = false;
+	ring->curr = i;
+	return f;
 }
 
-// xcb-render specific macros
-#define XFIXED_TO_DOUBLE(value) (((double)(value)) / 65536)
-#define DOUBLE_TO_XFIXED(value) ((xcb_render_fixed_t)(((double)(value)) * 65536))
+void x_fence_ring_await(xcb_connection_t *c, struct x_fence_ring *ring) {
+	assert(ring->triggered[ring->curr]);
+	xcb_sync_await_fence(c, 1, &ring->fences[ring->curr]);
+	ring->awaited[ring->curr] = true;
+}
 
 /**
  * Convert a struct conv to a X picture convolution filter, normalizing the kernel
@@ -704,6 +952,176 @@ void x_create_convolution_kernel(const conv *kernel, double center,
 	    DOUBLE_TO_XFIXED(center * factor);
 }
 
+void x_kawase_blur_init(struct x_kawase_blur *kb, int iterations, double offset) {
+	kb->iterations = iterations;
+	kb->offset = offset;
+	for (int i = 0; i < 256; i++) {
+		kb->weights[i] = XCB_NONE;
+	}
+}
+
+void x_kawase_blur_deinit(xcb_connection_t *c, struct x_kawase_blur *kb) {
+	for (int i = 0; i < 256; i++) {
+		if (kb->weights[i] != XCB_NONE) {
+			xcb_render_free_picture(c, kb->weights[i]);
+			kb->weights[i] = XCB_NONE;
+		}
+	}
+}
+
+/// A sample of the image, at (dx, dy) from where the bilinear scaling would sample,
+/// weighted by weight / 255
+struct x_kawase_tap {
+	double dx, dy;
+	uint8_t weight;
+};
+
+// The weights of each pass add up to exactly 255, so repeated passes don't drift
+// brighter or darker
+static const struct x_kawase_tap x_kawase_down_taps[] = {
+    {0, 0, 127},       {-0.5, -0.5, 32}, {0.5, 0.5, 32},
+    {0.5, -0.5, 32},   {-0.5, 0.5, 32},
+};
+static const struct x_kawase_tap x_kawase_up_taps[] = {
+    {-1, 0, 21},       {1, 0, 21},      {0, 1, 21},      {0, -1, 22},
+    {-0.5, 0.5, 42},   {0.5, 0.5, 43},  {0.5, -0.5, 42}, {-0.5, -0.5, 43},
+};
+
+static xcb_render_picture_t
+x_kawase_weight(xcb_connection_t *c, struct x_kawase_blur *kb, xcb_drawable_t root,
+                uint8_t weight) {
+	if (kb->weights[weight] == XCB_NONE) {
+		xcb_pixmap_t pixmap = x_create_pixmap(c, 8, root, 1, 1);
+		if (!pixmap) {
+			return XCB_NONE;
+		}
+		const xcb_render_create_picture_value_list_t pa = {.repeat = 1};
+		kb->weights[weight] = x_create_picture_with_standard_and_pixmap(
+		    c, XCB_PICT_STANDARD_A_8, pixmap, XCB_RENDER_CP_REPEAT, &pa);
+		xcb_free_pixmap(c, pixmap);
+		if (kb->weights[weight] == XCB_NONE) {
+			return XCB_NONE;
+		}
+		// k * 0x101 is exactly k in 8 bits
+		xcb_render_fill_rectangles(
+		    c, XCB_RENDER_PICT_OP_SRC, kb->weights[weight],
+		    (xcb_render_color_t){.alpha = (uint16_t)(weight * 0x101)}, 1,
+		    (xcb_rectangle_t[]){{.x = 0, .y = 0, .width = 1, .height = 1}});
+	}
+	return kb->weights[weight];
+}
+
+/// Render one pass of the blur: sample `src` at `scale` times the coordinates in
+/// `dst`, offset by (x, y), at each of the taps, and add them up into `dst`
+static bool x_kawase_pass(xcb_connection_t *c, struct x_kawase_blur *kb,
+                          xcb_drawable_t root, xcb_render_picture_t src, double scale,
+                          double x, double y, const struct x_kawase_tap *taps,
+                          size_t ntaps, xcb_render_picture_t dst, uint16_t width,
+                          uint16_t height) {
+	static const char *filter = "bilinear";
+	xcb_render_set_picture_filter(c, src, to_u16_checked(strlen(filter)), filter, 0,
+	                              NULL);
+	for (size_t i = 0; i < ntaps; i++) {
+		auto weight = x_kawase_weight(c, kb, root, taps[i].weight);
+		if (weight == XCB_NONE) {
+			return false;
+		}
+		// Picture transforms map coordinates in the destination to the source
+		const xcb_render_transform_t transform = {
+		    DOUBLE_TO_XFIXED(scale),
+		    0,
+		    DOUBLE_TO_XFIXED(x + taps[i].dx * kb->offset),
+		    0,
+		    DOUBLE_TO_XFIXED(scale),
+		    DOUBLE_TO_XFIXED(y + taps[i].dy * kb->offset),
+		    0,
+		    0,
+		    DOUBLE_TO_XFIXED(1),
+		};
+		xcb_render_set_picture_transform(c, src, transform);
+		xcb_render_composite(c, i == 0 ? XCB_RENDER_PICT_OP_SRC : XCB_RENDER_PICT_OP_ADD,
+		                     src, weight, dst, 0, 0, 0, 0, 0, 0, width, height);
+	}
+	return true;
+}
+
+bool x_kawase_blur(xcb_connection_t *c, struct x_kawase_blur *kb, xcb_drawable_t root,
+                   xcb_visualid_t visual, xcb_render_picture_t pict,
+                   const pixman_box32_t *extent, const region_t *reg_write,
+                   xcb_render_picture_t mask) {
+	static const char *filter0 = "Nearest";
+	const xcb_render_transform_t identity = {
+	    DOUBLE_TO_XFIXED(1), 0, 0, 0, DOUBLE_TO_XFIXED(1), 0, 0, 0,
+	    DOUBLE_TO_XFIXED(1),
+	};
+	const int n = kb->iterations;
+	assert(n > 0);
+
+	// levels[0] is the blurred image at full size, levels[i] is halved i times
+	int width[n + 1], height[n + 1];
+	xcb_render_picture_t levels[n + 1];
+	width[0] = extent->x2 - extent->x1;
+	height[0] = extent->y2 - extent->y1;
+	const uint32_t pic_attrs_mask = XCB_RENDER_CP_REPEAT;
+	const xcb_render_create_picture_value_list_t pic_attrs = {
+	    .repeat = XCB_RENDER_REPEAT_PAD};
+	bool ret = true;
+	for (int i = 0; i <= n; i++) {
+		if (i > 0) {
+			width[i] = max2((width[i - 1] + 1) / 2, 1);
+			height[i] = max2((height[i - 1] + 1) / 2, 1);
+		}
+		levels[i] = x_create_picture_with_visual(c, root, width[i], height[i], visual,
+		                                         pic_attrs_mask, &pic_attrs);
+		if (!levels[i]) {
+			log_error("Failed to build intermediate Picture.");
+			ret = false;
+		}
+	}
+	if (!ret) {
+		goto out;
+	}
+
+	// Scale down, level by level. The first pass reads from `pict` directly.
+	region_t reg_extent;
+	pixman_region32_init_rects(&reg_extent, extent, 1);
+	x_set_picture_clip_region(c, pict, 0, 0, &reg_extent);
+	pixman_region32_fini(&reg_extent);
+	for (int i = 1; i <= n && ret; i++) {
+		auto src = i == 1 ? pict : levels[i - 1];
+		double x = i == 1 ? extent->x1 : 0, y = i == 1 ? extent->y1 : 0;
+		ret = x_kawase_pass(c, kb, root, src, 2, x, y, x_kawase_down_taps,
+		                    ARR_SIZE(x_kawase_down_taps), levels[i],
+		                    to_u16_checked(width[i]), to_u16_checked(height[i]));
+	}
+	xcb_render_set_picture_filter(c, pict, to_u16_checked(strlen(filter0)), filter0,
+	                              0, NULL);
+	xcb_render_set_picture_transform(c, pict, identity);
+
+	// Then back up
+	for (int i = n; i > 0 && ret; i--) {
+		ret = x_kawase_pass(c, kb, root, levels[i], 0.5, 0, 0, x_kawase_up_taps,
+		                    ARR_SIZE(x_kawase_up_taps), levels[i - 1],
+		                    to_u16_checked(width[i - 1]),
+		                    to_u16_checked(height[i - 1]));
+	}
+	if (ret) {
+		x_set_picture_clip_region(c, pict, 0, 0, reg_write);
+		xcb_render_composite(c, XCB_RENDER_PICT_OP_OVER, levels[0], mask, pict, 0,
+		                     0, 0, 0, to_i16_checked(extent->x1),
+		                     to_i16_checked(extent->y1), to_u16_checked(width[0]),
+		                     to_u16_checked(height[0]));
+	}
+
+out:
+	for (int i = 0; i <= n; i++) {
+		if (levels[i]) {
+			xcb_render_free_picture(c, levels[i]);
+		}
+	}
+	return ret;
+}
+
 /// Generate a search criteria for fbconfig from a X visual.
 /// Returns {-1, -1, -1, -1, -1, 0} on failure
 struct xvisual_info x_get_visual_info(xcb_connection_t *c, xcb_visualid_t visual) {
@@ -746,3 +1164,148 @@ xcb_screen_t *x_screen_of_display(xcb_connection_t *c, int screen) {
 
 	return NULL;
 }
+
+/// Refresh rate of a RandR mode, 0 if unknown
+static double x_mode_refresh_rate(const xcb_randr_mode_info_t *mode) {
+	double vtotal = mode->vtotal;
+	if (mode->mode_flags & XCB_RANDR_MODE_FLAG_DOUBLE_SCAN) {
+		vtotal *= 2;
+	}
+	if (mode->mode_flags & XCB_RANDR_MODE_FLAG_INTERLACE) {
+		vtotal /= 2;
+	}
+	if (!mode->htotal || vtotal <= 0) {
+		return 0;
+	}
+	return mode->dot_clock / (mode->htotal * vtotal);
+}
+
+struct x_monitor *x_get_monitors(xcb_connection_t *c, xcb_window_t root, int *count) {
+	*count = 0;
+	auto res = X_REPLY(xcb_randr_get_screen_resources_current_reply(
+	    c, xcb_randr_get_screen_resources_current(c, root), NULL));
+	if (!res) {
+		return NULL;
+	}
+
+	int ncrtcs = xcb_randr_get_screen_resources_current_crtcs_length(res);
+	const xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(res);
+	int nmodes = xcb_randr_get_screen_resources_current_modes_length(res);
+	const xcb_randr_mode_info_t *modes =
+	    xcb_randr_get_screen_resources_current_modes(res);
+
+	// Send all the requests first, then collect the replies
+	auto cookies = ccalloc(ncrtcs, xcb_randr_get_crtc_info_cookie_t);
+	for (int i = 0; i < ncrtcs; i++) {
+		cookies[i] = xcb_randr_get_crtc_info(c, crtcs[i], res->config_timestamp);
+	}
+
+	auto monitors = ccalloc(ncrtcs, struct x_monitor);
+	for (int i = 0; i < ncrtcs; i++) {
+		auto r = X_REPLY(xcb_randr_get_crtc_info_reply(c, cookies[i], NULL));
+		if (!r) {
+			continue;
+		}
+		// Disabled CRTCs don't have a mode
+		if (r->mode != XCB_NONE && r->width && r->height) {
+			auto m = &monitors[(*count)++];
+			m->crtc = crtcs[i];
+			m->rect = (rect_t){.x1 = r->x,
+			                   .y1 = r->y,
+			                   .x2 = r->x + r->width,
+			                   .y2 = r->y + r->height};
+			for (int j = 0; j < nmodes; j++) {
+				if (modes[j].id == r->mode) {
+					m->refresh_rate = x_mode_refresh_rate(&modes[j]);
+					break;
+				}
+			}
+			log_debug("Monitor %d: CRTC %#x, %dx%d+%d+%d, %.2f Hz",
+			          *count - 1, m->crtc, r->width, r->height, r->x, r->y,
+			          m->refresh_rate);
+		}
+		free(r);
+	}
+	free(cookies);
+	free(res);
+
+	if (*count == 0) {
+		free(monitors);
+		return NULL;
+	}
+	return monitors;
+}
+
+static struct {
+	struct x_reply_site *sites;
+	uint64_t count;
+	bool in_frame;
+} x_round_trips;
+
+void x_reply_account(struct x_reply_site *site, uint64_t start) {
+	uint64_t elapsed = x_reply_clock() - start;
+	if (!site->registered) {
+		site->registered = true;
+		site->next = x_round_trips.sites;
+		x_round_trips.sites = site;
+	}
+	site->count++;
+	site->total_ns += elapsed;
+	site->max_ns = max2(site->max_ns, elapsed);
+	x_round_trips.count++;
+	if (x_round_trips.in_frame) {
+		if (!site->frame_count) {
+			log_debug("Round trip to the X server while rendering a "
+			          "frame, in %s:%d",
+			          site->func, site->line);
+		}
+		site->frame_count++;
+	}
+}
+
+uint64_t x_round_trip_count(void) {
+	return x_round_trips.count;
+}
+
+void x_round_trips_set_in_frame(bool in_frame) {
+	x_round_trips.in_frame = in_frame;
+}
+
+static int x_reply_site_cmp(const void *a, const void *b) {
+	const struct x_reply_site *x = *(struct x_reply_site *const *)a;
+	const struct x_reply_site *y = *(struct x_reply_site *const *)b;
+	return (x->total_ns < y->total_ns) - (x->total_ns > y->total_ns);
+}
+
+char *x_round_trips_report(int max_sites) {
+	size_t nsites = 0;
+	for (auto site = x_round_trips.sites; site; site = site->next) {
+		nsites++;
+	}
+	auto sites = ccalloc(nsites, struct x_reply_site *);
+	nsites = 0;
+	for (auto site = x_round_trips.sites; site; site = site->next) {
+		sites[nsites++] = site;
+	}
+	qsort(sites, nsites, sizeof(*sites), x_reply_site_cmp);
+
+	char *ret = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&ret, &len);
+	if (!f) {
+		free(sites);
+		return NULL;
+	}
+	fprintf(f, "%" PRIu64 " round trips to the X server\n", x_round_trips.count);
+	for (size_t i = 0; i < nsites && i < (size_t)max_sites; i++) {
+		fprintf(f,
+		        "%s:%d: %" PRIu64 " round trips, %" PRIu64 " while rendering, "
+		        "%.3f ms in total, %.3f ms at most\n",
+		        sites[i]->func, sites[i]->line, sites[i]->count,
+		        sites[i]->frame_count, (double)sites[i]->total_ns / 1e6,
+		        (double)sites[i]->max_ns / 1e6);
+	}
+	fclose(f);
+	free(sites);
+	return ret;
+}
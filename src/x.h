@@ -4,9 +4,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
+#include <xcb/randr.h>
 #include <xcb/render.h>
 #include <xcb/sync.h>
 #include <xcb/xcb.h>
+#include <xcb/xcb_image.h>
 #include <xcb/xcb_renderutil.h>
 #include <xcb/xfixes.h>
 
@@ -18,6 +21,10 @@
 typedef struct session session_t;
 struct atom;
 
+// xcb-render specific macros
+#define XFIXED_TO_DOUBLE(value) (((double)(value)) / 65536)
+#define DOUBLE_TO_XFIXED(value) ((xcb_render_fixed_t)(((double)(value)) * 65536))
+
 /// Structure representing Window property value.
 typedef struct winprop {
 	union {
@@ -55,10 +62,45 @@ struct xvisual_info {
 	xcb_visualid_t visual;
 };
 
+/// Round trips made at one place in the code, see X_REPLY
+struct x_reply_site {
+	const char *func;
+	int line;
+	bool registered;
+	/// Number of round trips, and how many of them were made while rendering a frame
+	uint64_t count, frame_count;
+	/// Total and longest time spent waiting for the replies, in nanoseconds
+	uint64_t total_ns, max_ns;
+	struct x_reply_site *next;
+};
+
+static inline uint64_t x_reply_clock(void) {
+	struct timespec tm = {0, 0};
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return (uint64_t)tm.tv_sec * 1000000000ULL + (uint64_t)tm.tv_nsec;
+}
+
+void x_reply_account(struct x_reply_site *site, uint64_t start);
+
+/// Wait for a reply from the X server, e.g. `X_REPLY(xcb_foo_reply(c, cookie, &e))`,
+/// and account for the round trip to the place it's made at. Every blocking wait for a
+/// reply should go through this, so the round trips show up in
+/// x_round_trips_report.
+#define X_REPLY(expr)                                                                    \
+	({                                                                               \
+		static struct x_reply_site __site = {                                    \
+		    .func = __func__, .line = __LINE__};                                 \
+		uint64_t __start = x_reply_clock();                                      \
+		__auto_type __reply = (expr);                                            \
+		x_reply_account(&__site, __start);                                       \
+		__reply;                                                                 \
+	})
+
 #define XCB_AWAIT_VOID(func, c, ...)                                                     \
 	({                                                                               \
 		bool __success = true;                                                   \
-		__auto_type __e = xcb_request_check(c, func##_checked(c, __VA_ARGS__));  \
+		__auto_type __e =                                                        \
+		    X_REPLY(xcb_request_check(c, func##_checked(c, __VA_ARGS__)));       \
 		if (__e) {                                                               \
 			x_print_error(__e->sequence, __e->major_code, __e->minor_code,   \
 			              __e->error_code);                                  \
@@ -71,7 +113,7 @@ struct xvisual_info {
 #define XCB_AWAIT(func, c, ...)                                                          \
 	({                                                                               \
 		xcb_generic_error_t *__e = NULL;                                         \
-		__auto_type __r = func##_reply(c, func(c, __VA_ARGS__), &__e);           \
+		__auto_type __r = X_REPLY(func##_reply(c, func(c, __VA_ARGS__), &__e));  \
 		if (__e) {                                                               \
 			x_print_error(__e->sequence, __e->major_code, __e->minor_code,   \
 			              __e->error_code);                                  \
@@ -107,7 +149,7 @@ static inline uint32_t x_new_id(xcb_connection_t *c) {
  * libX11
  */
 static inline void x_sync(xcb_connection_t *c) {
-	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), NULL));
+	free(X_REPLY(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), NULL)));
 }
 
 /**
@@ -136,6 +178,15 @@ static inline winprop_t x_get_prop(xcb_connection_t *c, xcb_window_t wid, xcb_at
 	return x_get_prop_with_offset(c, wid, atom, 0L, length, rtype, rformat);
 }
 
+/**
+ * Collect the reply of a previously sent xcb_get_property request. Same as
+ * x_get_prop_with_offset, except the request is not sent by this function.
+ *
+ * @param rtype, rformat the type and format which were requested
+ */
+winprop_t x_get_prop_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie,
+                           xcb_atom_t rtype, int rformat);
+
 /// Get the type, format and size in bytes of a window's specific attribute.
 winprop_info_t x_get_prop_info(xcb_connection_t *c, xcb_window_t w, xcb_atom_t atom);
 
@@ -165,9 +216,28 @@ xcb_window_t wid_get_prop_window(xcb_connection_t *c, xcb_window_t wid, xcb_atom
 bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char ***pstrlst,
                        int *pnstr);
 
+/// Number of 32-bit words to request for a prefetched text property. Properties longer
+/// than this are fetched again by wid_get_text_prop_reply.
+#define X_TEXT_PROP_REQUEST_LENGTH 256
+
+/// Same as wid_get_text_prop, but using the reply of a request sent earlier for at
+/// most X_TEXT_PROP_REQUEST_LENGTH words.
+bool wid_get_text_prop_reply(session_t *ps, xcb_window_t wid, xcb_atom_t prop,
+                             xcb_get_property_cookie_t cookie, char ***pstrlst,
+                             int *pnstr);
+
+/// Same as wid_get_text_prop, but decodes an already received reply, which must cover
+/// the whole property. `r` is not freed.
+bool wid_get_text_prop_from_reply(session_t *ps, xcb_window_t wid, xcb_atom_t prop,
+                                  const xcb_get_property_reply_t *r, char ***pstrlst,
+                                  int *pnstr);
+
 const xcb_render_pictforminfo_t *
 x_get_pictform_for_visual(xcb_connection_t *, xcb_visualid_t);
 int x_get_visual_depth(xcb_connection_t *, xcb_visualid_t);
+/// Free the pict formats and visual information cached for the current connection. The
+/// next session could be connected to a different server.
+void x_free_visual_caches(void);
 
 xcb_render_picture_t
 x_create_picture_with_pictfmt_and_pixmap(xcb_connection_t *,
@@ -212,6 +282,14 @@ x_create_picture_with_visual(xcb_connection_t *, xcb_drawable_t, int w, int h,
 /// Fetch a X region and store it in a pixman region
 bool x_fetch_region(xcb_connection_t *, xcb_xfixes_region_t r, region_t *res);
 
+/// Set the content of an X Fixes region to `reg`.
+void x_set_region(xcb_connection_t *, xcb_xfixes_region_t dst, const region_t *reg);
+
+/// Collect the reply of a previously sent xcb_xfixes_fetch_region request, and store it
+/// in a pixman region
+bool x_fetch_region_reply(xcb_connection_t *, xcb_xfixes_fetch_region_cookie_t cookie,
+                          region_t *res);
+
 void x_set_picture_clip_region(xcb_connection_t *, xcb_render_picture_t, int16_t clip_x_origin,
                                int16_t clip_y_origin, const region_t *);
 
@@ -235,6 +313,11 @@ xcb_pixmap_t x_create_pixmap(xcb_connection_t *, uint8_t depth, xcb_drawable_t d
 
 bool x_validate_pixmap(xcb_connection_t *, xcb_pixmap_t pxmap);
 
+/// Upload a client side image into a drawable. MIT-SHM is used if the X server is on the
+/// same machine, otherwise the image is split into as many PutImage requests as needed.
+bool x_put_image(xcb_connection_t *c, xcb_drawable_t drawable, xcb_gcontext_t gc,
+                 const xcb_image_t *image, int16_t dst_x, int16_t dst_y);
+
 /**
  * Free a <code>winprop_t</code>.
  *
@@ -257,7 +340,32 @@ x_get_root_back_pixmap(xcb_connection_t *c, xcb_window_t root, struct atom *atom
 /// root window background pixmap
 bool x_is_root_back_pixmap_atom(struct atom *atoms, xcb_atom_t atom);
 
-bool x_fence_sync(xcb_connection_t *, xcb_sync_fence_t);
+#define X_FENCE_RING_SIZE 4
+
+/// X Sync fences used in turn, to make rendering wait for the X rendering requested
+/// before it, without round trips. A fence is only reset when its turn comes again,
+/// frames later, when it has long been triggered.
+struct x_fence_ring {
+	xcb_sync_fence_t fences[X_FENCE_RING_SIZE];
+	/// Whether each fence has been triggered since it was last reset
+	bool triggered[X_FENCE_RING_SIZE];
+	/// Whether the X server has been asked to wait for each triggered fence
+	bool awaited[X_FENCE_RING_SIZE];
+	/// The fence triggered last
+	int curr;
+};
+
+/// Create the fences, on the screen of `drawable`
+bool x_fence_ring_init(xcb_connection_t *, xcb_drawable_t drawable, struct x_fence_ring *);
+void x_fence_ring_deinit(xcb_connection_t *, struct x_fence_ring *);
+/// Trigger the next fence in the ring, it becomes triggered once the X rendering
+/// requested so far is done. Errors are reported to the event loop's error handler.
+///
+/// @return the triggered fence
+xcb_sync_fence_t x_fence_ring_trigger(xcb_connection_t *, struct x_fence_ring *);
+/// Make the X server hold the requests sent after this, until the fence triggered
+/// last is triggered
+void x_fence_ring_await(xcb_connection_t *, struct x_fence_ring *);
 
 struct x_convolution_kernel {
 	int size;
@@ -279,6 +387,32 @@ struct x_convolution_kernel {
 void attr_nonnull(1, 3) x_create_convolution_kernel(const conv *kernel, double center,
                                                     struct x_convolution_kernel **ret);
 
+/// Dual kawase blur made of nothing but composites with bilinear scaling transforms,
+/// which X servers accelerate, unlike convolution filters, which most of them run on
+/// the CPU.
+struct x_kawase_blur {
+	/// Number of times the image is halved, then doubled back
+	int iterations;
+	/// Distance of the samples, in pixels of the image being sampled
+	double offset;
+	/// 1x1 alpha pictures of value i/255, to weight the samples, created on demand
+	xcb_render_picture_t weights[256];
+};
+
+void x_kawase_blur_init(struct x_kawase_blur *, int iterations, double offset);
+void x_kawase_blur_deinit(xcb_connection_t *, struct x_kawase_blur *);
+
+/// Blur the `extent` of `pict`, and composite the blurred image back with OVER, through
+/// `mask`, whose origin is at the top left of `extent`. Intermediate images are created
+/// with `visual`, which should be the visual of `pict`.
+///
+/// The clip region of `pict` is set to `extent` to read from it, then to `reg_write` to
+/// write the result, it's not restored. The transform and filter of `pict` are reset.
+bool x_kawase_blur(xcb_connection_t *, struct x_kawase_blur *, xcb_drawable_t root,
+                   xcb_visualid_t visual, xcb_render_picture_t pict,
+                   const pixman_box32_t *extent, const region_t *reg_write,
+                   xcb_render_picture_t mask);
+
 /// Generate a search criteria for fbconfig from a X visual.
 /// Returns {-1, -1, -1, -1, -1, -1} on failure
 struct xvisual_info x_get_visual_info(xcb_connection_t *c, xcb_visualid_t visual);
@@ -290,4 +424,28 @@ x_get_pictfmt_for_standard(xcb_connection_t *c, xcb_pict_standard_t std);
 
 xcb_screen_t *x_screen_of_display(xcb_connection_t *c, int screen);
 
+/// A monitor, i.e. an active RandR CRTC
+struct x_monitor {
+	xcb_randr_crtc_t crtc;
+	/// The part of the screen shown on the monitor
+	rect_t rect;
+	/// Refresh rate in Hz, 0 if unknown
+	double refresh_rate;
+};
+
+/// Get the monitors showing the screen of `root`. Returns NULL and sets `*count` to 0
+/// if they can't be queried.
+struct x_monitor *x_get_monitors(xcb_connection_t *c, xcb_window_t root, int *count);
+
+/// Total number of round trips made so far
+uint64_t x_round_trip_count(void);
+/// Mark whether a frame is being rendered. Round trips made while rendering are counted
+/// separately, since they directly delay the frames.
+void x_round_trips_set_in_frame(bool in_frame);
+/// Describe the places making the most round trips, sorted by how long they waited
+/// for the replies in total. At most `max_sites` places are listed.
+///
+/// @return the description, one place per line, to be freed by the caller
+char *x_round_trips_report(int max_sites);
+
 uint32_t attr_deprecated xcb_generate_id(xcb_connection_t *c);
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# Usage: bench.py <picom pid> <scene>
+#
+# Run a scene against a running picom, and report how many frames it rendered, the CPU
+# time it took per frame, and the X round trips it made per frame.
+
+import os
+import re
+import subprocess
+import sys
+import time
+
+import xcffib
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "testcases"))
+from scenes import SCENES
+
+DURATION = 5
+
+def dbus_service():
+    display = re.sub("[^a-zA-Z0-9]", "_", os.environ["DISPLAY"])
+    return "com.github.chjj.compton." + display
+
+def opts_get(name):
+    """Get a numeric option of picom over D-Bus, None if it doesn't have the option"""
+    cmd = ["dbus-send", "--print-reply=literal", "--dest=" + dbus_service(),
+           "/com/github/chjj/compton", "com.github.chjj.compton.opts_get", "string:" + name]
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    if out.returncode != 0:
+        return None
+    return int(out.stdout.split()[-1])
+
+def cpu_time(pid):
+    """User and system CPU time used by a process, in seconds"""
+    with open("/proc/%d/stat" % pid) as f:
+        # The process name might contain spaces, fields are counted from after it
+        fields = f.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+def snapshot(pid):
+    return opts_get("frame_count"), cpu_time(pid), opts_get("round_trips")
+
+pid = int(sys.argv[1])
+scene_name = sys.argv[2]
+
+# Wait for picom to come up
+for _ in range(100):
+    if opts_get("frame_count") is not None:
+        break
+    time.sleep(0.1)
+else:
+    sys.exit("picom doesn't respond over D-Bus")
+
+conn = xcffib.connect()
+scene = SCENES[scene_name](conn)
+scene.setup()
+conn.flush()
+time.sleep(1)
+
+frames0, cpu0, round_trips0 = snapshot(pid)
+start = time.monotonic()
+i = 0
+while time.monotonic() - start < DURATION:
+    scene.step(i)
+    i += 1
+    if i % 10 == 0:
+        # Don't let the requests pile up faster than the server handles them
+        conn.core.GetInputFocus().reply()
+        time.sleep(0.001)
+conn.core.GetInputFocus().reply()
+elapsed = time.monotonic() - start
+frames1, cpu1, round_trips1 = snapshot(pid)
+
+frames = frames1 - frames0
+if frames <= 0:
+    sys.exit("No frames were rendered")
+print("scene: %s" % scene_name)
+print("steps: %d" % i)
+print("frames: %d" % frames)
+print("frames/s: %.1f" % (frames / elapsed))
+print("CPU time per frame: %.1f us" % ((cpu1 - cpu0) * 1e6 / frames))
+if round_trips0 is not None:
+    print("X round trips per frame: %.2f" % ((round_trips1 - round_trips0) / frames))
@@ -0,0 +1,93 @@
+# Scripted scenes for the benchmarks. Each scene creates its windows in setup(), then
+# step() is called repeatedly to keep the compositor busy.
+
+import xcffib.xproto as xproto
+from common import set_window_name, set_window_class, to_atom
+
+class Scene:
+    nwindows = 20
+
+    def __init__(self, conn):
+        self.conn = conn
+        setup = conn.get_setup()
+        self.root = setup.roots[0].root
+        self.visual = setup.roots[0].root_visual
+        self.depth = setup.roots[0].root_depth
+        self.windows = []
+
+    def create_window(self, i, mapped=True):
+        wid = self.conn.generate_id()
+        x, y = (i * 37) % 1600, (i * 53) % 800
+        self.conn.core.CreateWindowChecked(self.depth, wid, self.root, x, y, 300, 250, 0,
+                xproto.WindowClass.InputOutput, self.visual, xproto.CW.BackPixel,
+                [0x00ff00 * (i % 3) + 0x3f * i]).check()
+        if mapped:
+            self.conn.core.MapWindowChecked(wid).check()
+        self.windows.append(wid)
+        return wid
+
+    def setup(self):
+        for i in range(self.nwindows):
+            self.create_window(i)
+
+    def step(self, i):
+        pass
+
+class Map(Scene):
+    """Windows mapping and unmapping"""
+    nwindows = 50
+
+    def step(self, i):
+        wid = self.windows[i % self.nwindows]
+        self.conn.core.UnmapWindow(wid)
+        self.conn.core.MapWindow(wid)
+
+class Stacking(Scene):
+    """Overlapping windows raised one after another"""
+    nwindows = 50
+
+    def step(self, i):
+        wid = self.windows[i % self.nwindows]
+        self.conn.core.ConfigureWindow(wid, xproto.ConfigWindow.StackMode,
+                [xproto.StackMode.Above])
+
+class Damage(Scene):
+    """Windows redrawing their contents as fast as they can"""
+
+    def step(self, i):
+        self.conn.core.ClearArea(False, self.windows[i % self.nwindows], 0, 0, 0, 0)
+
+class Fade(Scene):
+    """Windows changing their opacity, with fading enabled"""
+
+    def setup(self):
+        super().setup()
+        self.opacity_atom = to_atom(self.conn, "_NET_WM_WINDOW_OPACITY")
+
+    def step(self, i):
+        wid = self.windows[i % self.nwindows]
+        opacity = 0xffffffff if (i // self.nwindows) % 2 else 0x7fffffff
+        self.conn.core.ChangeProperty(xproto.PropMode.Replace, wid, self.opacity_atom,
+                xproto.Atom.CARDINAL, 32, 1, [opacity])
+
+class Rules(Scene):
+    """Many windows renamed over and over, so the window rules are matched again"""
+    nwindows = 100
+
+    def setup(self):
+        for i in range(self.nwindows):
+            wid = self.create_window(i)
+            set_window_name(self.conn, wid, "Window %d" % i)
+            set_window_class(self.conn, wid, "bench%d" % (i % 10))
+
+    def step(self, i):
+        wid = self.windows[i % self.nwindows]
+        set_window_name(self.conn, wid, "Window %d" % i)
+
+SCENES = {
+    "map": Map,
+    "stacking": Stacking,
+    "damage": Damage,
+    "fade": Fade,
+    "rules": Rules,
+}
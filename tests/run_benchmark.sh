@@ -0,0 +1,28 @@
+#!/bin/sh
+# Usage: run_benchmark.sh <picom> <backend> <config> <scene>
+set -e
+if [ -z $DISPLAY ]; then
+	exec xvfb-run -s "+extension composite +extension GLX -screen 0 1920x1080x24" -a $0 "$@"
+fi
+if [ -z $DBUS_SESSION_BUS_ADDRESS ]; then
+	eval `dbus-launch --sh-syntax`
+	trap 'kill $DBUS_SESSION_BUS_PID' EXIT
+fi
+
+exe=$(realpath $1)
+config=$(realpath $3)
+cd $(dirname $0)
+
+echo "Running benchmark $4 with the $2 backend"
+
+($exe --dbus --experimental-backends --backend $2 --no-frame-pacing --log-level=warn \
+	--log-file=$PWD/bench-log --config=$config) &
+main_pid=$!
+ret=0
+./benchmarks/bench.py $main_pid $4 || ret=$?
+
+kill -INT $main_pid || true
+wait $main_pid || ret=$?
+cat bench-log
+rm bench-log
+exit $ret